@@ -7,23 +7,40 @@ SRCS = \
 	application/imageio.cpp \
 	application/camera_roam.cpp \
 	application/scene_loader.cpp \
+	application/network.cpp \
 	math/math.cpp \
 	math/color.cpp \
 	math/vector.cpp \
 	math/quaternion.cpp \
 	math/matrix.cpp \
 	math/camera.cpp \
+	math/camera_path.cpp \
 	scene/material.cpp \
 	scene/mesh.cpp \
 	scene/scene.cpp \
 	scene/sphere.cpp \
 	scene/triangle.cpp \
 	scene/model.cpp \
+	scene/bvh.cpp \
+	scene/compressed_bvh.cpp \
+	scene/wide_bvh.cpp \
+	scene/visibility_cache.cpp \
+	scene/scene_hash.cpp \
+	scene/snapshot.cpp \
+	scene/triangle_group.cpp \
+	scene/asset_cache.cpp \
 	tinyxml/tinyxml.cpp \
 	tinyxml/tinyxmlerror.cpp \
 	tinyxml/tinyxmlparser.cpp \
 	raytracer/main.cpp \
-	raytracer/raytracer.cpp
+	raytracer/raytracer.cpp \
+	raytracer/checkpoint.cpp \
+	raytracer/distributed.cpp \
+	raytracer/background.cpp \
+	raytracer/gbuffer.cpp \
+	raytracer/server.cpp \
+	raytracer/render_pool.cpp \
+	raytracer/batch.cpp
 
 TARGET = raytracer
 
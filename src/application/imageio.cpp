@@ -31,6 +31,7 @@
 #include <iostream>
 #include "/usr/X11/include/png.h"
 #include <cassert>
+#include <cmath>
 
 namespace _462 {
 
@@ -198,6 +199,161 @@ static bool _save_image_RGBA_png(const char *fileName, unsigned char *buffer,
     return true;
 }
 
+// A growing malloc'd buffer that png data is written to in memory.
+struct _PngMemory
+{
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+};
+
+static void _write_png_memory(png_structp png_ptr, png_bytep data, png_size_t len)
+{
+    _PngMemory *mem = (_PngMemory *) png_get_io_ptr(png_ptr);
+    if (mem->size + len > mem->capacity) {
+        size_t capacity = mem->capacity * 2;
+        if (capacity < mem->size + len)
+            capacity = mem->size + len;
+        unsigned char *grown = (unsigned char *) realloc(mem->data, capacity);
+        if (!grown)
+            png_error(png_ptr, "out of memory");
+        mem->data = grown;
+        mem->capacity = capacity;
+    }
+    memcpy(mem->data + mem->size, data, len);
+    mem->size += len;
+}
+
+static void _flush_png_memory(png_structp)
+{
+}
+
+static unsigned char* _encode_image_RGBA_png(const unsigned char *buffer,
+  int width, int height, size_t *size)
+{
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0,
+      0);
+    if (!png_ptr)
+        return 0;
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        png_destroy_write_struct(&png_ptr, (png_infopp) 0);
+        return 0;
+    }
+
+    // a quarter of the raw size is a fair first guess for rendered images
+    _PngMemory mem;
+    mem.capacity = width * height + 1024;
+    mem.size = 0;
+    mem.data = (unsigned char *) malloc(mem.capacity);
+    if (!mem.data) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        return 0;
+    }
+    png_bytep *row_pointers = new png_bytep[height];
+
+    // do the setjmp thingy
+    if (setjmp(png_ptr->jmpbuf)) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        delete [] row_pointers;
+        free(mem.data);
+        return 0;
+    }
+
+    png_set_write_fn(png_ptr, &mem, _write_png_memory, _flush_png_memory);
+
+    png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+      PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+
+    for (int y = 0 ; y < height ; y++)
+        row_pointers[y] = (png_byte *) (buffer + (height - 1 - y) * width * 4);
+    png_write_image(png_ptr, row_pointers);
+    png_write_end(png_ptr, info_ptr);
+
+    delete [] row_pointers;
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    *size = mem.size;
+    return mem.data;
+}
+
+// ***** floating point related internal functions ***** //
+
+// Converts a linear color to the shared exponent RGBE encoding used by
+// Radiance files.
+static void _float_to_rgbe(unsigned char rgbe[4], float r, float g, float b)
+{
+    float v = r;
+    if (g > v) v = g;
+    if (b > v) v = b;
+
+    if (v < 1e-32f) {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+    } else {
+        int e;
+        float m = (float) (frexp(v, &e) * 256.0 / v);
+        rgbe[0] = (unsigned char) (r > 0.0f ? r * m : 0.0f);
+        rgbe[1] = (unsigned char) (g > 0.0f ? g * m : 0.0f);
+        rgbe[2] = (unsigned char) (b > 0.0f ? b * m : 0.0f);
+        rgbe[3] = (unsigned char) (e + 128);
+    }
+}
+
+static bool _save_image_RGB_hdr(const char *fileName, const float *buffer,
+  int width, int height, float scale)
+{
+    FILE *fp = fopen(fileName, "wb");
+    if (!fp)
+        return false;
+
+    fprintf(fp, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n",
+      height, width);
+
+    // radiance scanlines go top to bottom, flat (non-RLE) encoding
+    unsigned char *scanline = new unsigned char[width * 4];
+    bool ok = true;
+    for (int y = height - 1; y >= 0 && ok; y--) {
+        const float *row = buffer + y * width * 3;
+        for (int x = 0; x < width; x++) {
+            _float_to_rgbe(scanline + 4 * x, row[3 * x] * scale,
+              row[3 * x + 1] * scale, row[3 * x + 2] * scale);
+        }
+        ok = fwrite(scanline, 4, width, fp) == (size_t) width;
+    }
+
+    delete [] scanline;
+    fclose(fp);
+    return ok;
+}
+
+static bool _save_image_RGB_pfm(const char *fileName, const float *buffer,
+  int width, int height, float scale)
+{
+    FILE *fp = fopen(fileName, "wb");
+    if (!fp)
+        return false;
+
+    // a negative scale in the header marks the data as little endian
+    const unsigned int one = 1;
+    bool little_endian = *(const unsigned char *) &one == 1;
+    fprintf(fp, "PF\n%d %d\n%s\n", width, height,
+      little_endian ? "-1.0" : "1.0");
+
+    // pfm scanlines go bottom to top, same as our buffers
+    float *scanline = new float[width * 3];
+    bool ok = true;
+    for (int y = 0; y < height && ok; y++) {
+        const float *row = buffer + y * width * 3;
+        for (int i = 0; i < width * 3; i++)
+            scanline[i] = row[i] * scale;
+        ok = fwrite(scanline, sizeof(float) * 3, width, fp) == (size_t) width;
+    }
+
+    delete [] scanline;
+    fclose(fp);
+    return ok;
+}
+
 // ***** external functions ***** //
 
 // Sets the width and height to the appropriate values and mallocs
@@ -225,6 +381,30 @@ bool imageio_save_image( const char *fileName, unsigned char *buffer,
         return false;
 }
 
+// Saves a linear floating point RGB image, scaling every value by scale.
+// The format is chosen by the extension, either .hdr or .pfm.
+bool imageio_save_hdr_image( const char *fileName, const float *buffer,
+                             int width, int height, float scale )
+{
+    if (_ends_with(fileName, ".hdr"))
+        return _save_image_RGB_hdr(fileName, buffer, width, height, scale);
+    else if (_ends_with(fileName, ".pfm"))
+        return _save_image_RGB_pfm(fileName, buffer, width, height, scale);
+    else
+        return false;
+}
+
+unsigned char* imageio_encode_png( const unsigned char *buffer, int width,
+                                   int height, size_t *size )
+{
+    return _encode_image_RGBA_png(buffer, width, height, size);
+}
+
+bool imageio_is_hdr_filename( const char *fileName )
+{
+    return _ends_with(fileName, ".hdr") || _ends_with(fileName, ".pfm");
+}
+
 // Wraps the general functionality of saving an image and writes the current
 // frame buffer to a specified file name.  Also returns true on succces,
 // false otherwise.
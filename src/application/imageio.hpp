@@ -43,6 +43,25 @@ unsigned char* imageio_load_image( const char* filename, int *width, int *height
 // The image format is RGBA.
 bool imageio_save_image( const char* filename, unsigned char* buffer, int width, int height );
 
+// Encodes image given by buffer, RGBA with the bottom row first as for
+// imageio_save_image, as a PNG file in memory. Sets size to its length in
+// bytes and returns a malloc'd buffer to be freed with free(), or 0 on error.
+unsigned char* imageio_encode_png( const unsigned char* buffer, int width,
+                                   int height, size_t* size );
+
+// Saves a linear floating point image, 3 floats (RGB) per pixel in row-major
+// order with the bottom row first, to the given file name. Every value is
+// multiplied by scale before writing, so accumulated sums can be written
+// without a separate normalization pass. The format is chosen from the
+// extension: Radiance RGBE (.hdr) or portable float map (.pfm).
+// Returns true on success, false otherwise.
+bool imageio_save_hdr_image( const char* filename, const float* buffer,
+                             int width, int height, float scale );
+
+// Returns true if the file name has an extension handled by
+// imageio_save_hdr_image rather than imageio_save_image.
+bool imageio_is_hdr_filename( const char* filename );
+
 // Writes the current opengl frame buffer to a specified file name.
 // Returns true on succces, false otherwise.
 bool imageio_save_screenshot( const char* filename, int width, int height );
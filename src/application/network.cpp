@@ -0,0 +1,321 @@
+/**
+ * @file network.cpp
+ * @brief Blocking stream sockets over TCP or unix domain sockets.
+ */
+
+#include "application/network.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#endif
+
+namespace _462 {
+
+static const char UNIX_PREFIX[] = "unix:";
+
+#ifndef _WIN32
+
+// splits "host:port" into its parts, returns false if malformed
+static bool split_address( const char* address, std::string* host, std::string* port )
+{
+    const char* colon = strrchr( address, ':' );
+    if ( !colon || colon[1] == '\0' ) {
+        std::cout << "Invalid address '" << address << "', expected host:port or unix:path.\n";
+        return false;
+    }
+    host->assign( address, colon - address );
+    port->assign( colon + 1 );
+    return true;
+}
+
+static bool is_unix_address( const char* address )
+{
+    return strncmp( address, UNIX_PREFIX, sizeof UNIX_PREFIX - 1 ) == 0;
+}
+
+// fills in a unix socket address for "unix:path"
+static bool make_unix_address( const char* address, sockaddr_un* addr )
+{
+    const char* path = address + sizeof UNIX_PREFIX - 1;
+    if ( strlen( path ) >= sizeof addr->sun_path ) {
+        std::cout << "Socket path '" << path << "' is too long.\n";
+        return false;
+    }
+    memset( addr, 0, sizeof *addr );
+    addr->sun_family = AF_UNIX;
+    strcpy( addr->sun_path, path );
+    return true;
+}
+
+// looks up a TCP address, returns a list to be freed with freeaddrinfo
+static addrinfo* resolve( const char* address, bool passive )
+{
+    std::string host, port;
+    if ( !split_address( address, &host, &port ) )
+        return 0;
+
+    addrinfo hints;
+    memset( &hints, 0, sizeof hints );
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    addrinfo* result = 0;
+    int rv = getaddrinfo( host.empty() ? 0 : host.c_str(), port.c_str(), &hints, &result );
+    if ( rv != 0 ) {
+        std::cout << "Cannot resolve '" << address << "': " << gai_strerror( rv ) << "\n";
+        return 0;
+    }
+    return result;
+}
+
+int net_listen( const char* address )
+{
+    // a closed peer should show up as an error, not kill the process
+    signal( SIGPIPE, SIG_IGN );
+
+    int sock = -1;
+
+    if ( is_unix_address( address ) ) {
+        sockaddr_un addr;
+        if ( !make_unix_address( address, &addr ) )
+            return -1;
+        // remove a stale socket left by a previous run
+        unlink( addr.sun_path );
+        sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if ( sock != -1 && bind( sock, (sockaddr*) &addr, sizeof addr ) != 0 ) {
+            close( sock );
+            sock = -1;
+        }
+    } else {
+        addrinfo* info = resolve( address, true );
+        if ( !info )
+            return -1;
+        sock = socket( info->ai_family, info->ai_socktype, info->ai_protocol );
+        int yes = 1;
+        if ( sock != -1 ) {
+            setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes );
+            if ( bind( sock, info->ai_addr, info->ai_addrlen ) != 0 ) {
+                close( sock );
+                sock = -1;
+            }
+        }
+        freeaddrinfo( info );
+    }
+
+    if ( sock == -1 || listen( sock, 64 ) != 0 ) {
+        std::cout << "Cannot listen on '" << address << "': " << strerror( errno ) << "\n";
+        if ( sock != -1 )
+            close( sock );
+        return -1;
+    }
+
+    return sock;
+}
+
+bool net_local_address( int sock, char* address, size_t len )
+{
+    sockaddr_storage storage;
+    socklen_t size = sizeof storage;
+    if ( getsockname( sock, (sockaddr*) &storage, &size ) != 0 )
+        return false;
+
+    if ( storage.ss_family == AF_UNIX ) {
+        const sockaddr_un* addr = (const sockaddr_un*) &storage;
+        snprintf( address, len, "%s%s", UNIX_PREFIX, addr->sun_path );
+    } else {
+        const sockaddr_in* addr = (const sockaddr_in*) &storage;
+        // a wildcard address is reachable through the loopback interface
+        const char* host = addr->sin_addr.s_addr == htonl( INADDR_ANY )
+            ? "127.0.0.1" : inet_ntoa( addr->sin_addr );
+        snprintf( address, len, "%s:%d", host, (int) ntohs( addr->sin_port ) );
+    }
+    return true;
+}
+
+int net_connect( const char* address )
+{
+    signal( SIGPIPE, SIG_IGN );
+
+    int sock = -1;
+
+    if ( is_unix_address( address ) ) {
+        sockaddr_un addr;
+        if ( !make_unix_address( address, &addr ) )
+            return -1;
+        sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if ( sock != -1 && connect( sock, (sockaddr*) &addr, sizeof addr ) != 0 ) {
+            close( sock );
+            sock = -1;
+        }
+    } else {
+        addrinfo* info = resolve( address, false );
+        if ( !info )
+            return -1;
+        sock = socket( info->ai_family, info->ai_socktype, info->ai_protocol );
+        if ( sock != -1 && connect( sock, info->ai_addr, info->ai_addrlen ) != 0 ) {
+            close( sock );
+            sock = -1;
+        }
+        freeaddrinfo( info );
+        // requests and replies are small, don't wait to coalesce them
+        int yes = 1;
+        if ( sock != -1 )
+            setsockopt( sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes );
+    }
+
+    if ( sock == -1 ) {
+        std::cout << "Cannot connect to '" << address << "': " << strerror( errno ) << "\n";
+    }
+    return sock;
+}
+
+int net_accept( int sock )
+{
+    int conn = accept( sock, 0, 0 );
+    if ( conn != -1 ) {
+        // TCP_NODELAY fails harmlessly on unix sockets
+        int yes = 1;
+        setsockopt( conn, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes );
+    }
+    return conn;
+}
+
+bool net_send( int sock, const void* data, size_t len )
+{
+    const char* ptr = (const char*) data;
+    while ( len > 0 ) {
+        ssize_t n = send( sock, ptr, len, 0 );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return false;
+        ptr += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool net_recv( int sock, void* data, size_t len )
+{
+    char* ptr = (char*) data;
+    while ( len > 0 ) {
+        ssize_t n = recv( sock, ptr, len, 0 );
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return false;
+        ptr += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool net_wait( const int* socks, bool* ready, size_t num, int timeout_ms )
+{
+    fd_set set;
+    FD_ZERO( &set );
+    int max_fd = -1;
+    for ( size_t i = 0; i < num; ++i ) {
+        FD_SET( socks[i], &set );
+        max_fd = std::max( max_fd, socks[i] );
+    }
+
+    timeval timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = ( timeout_ms % 1000 ) * 1000;
+
+    int rv = select( max_fd + 1, &set, 0, 0, &timeout );
+    if ( rv < 0 && errno != EINTR )
+        return false;
+
+    for ( size_t i = 0; i < num; ++i ) {
+        ready[i] = rv > 0 && FD_ISSET( socks[i], &set );
+    }
+    return true;
+}
+
+void net_close( int sock )
+{
+    if ( sock != -1 )
+        close( sock );
+}
+
+#else /* _WIN32 */
+
+int net_listen( const char* address )
+{
+    std::cout << "Sockets are not supported on this platform.\n";
+    return -1;
+}
+
+bool net_local_address( int sock, char* address, size_t len ) { return false; }
+
+int net_connect( const char* address )
+{
+    std::cout << "Sockets are not supported on this platform.\n";
+    return -1;
+}
+
+int net_accept( int sock ) { return -1; }
+bool net_send( int sock, const void* data, size_t len ) { return false; }
+bool net_recv( int sock, void* data, size_t len ) { return false; }
+bool net_wait( const int* socks, bool* ready, size_t num, int timeout_ms ) { return false; }
+void net_close( int sock ) { }
+
+#endif /* _WIN32 */
+
+bool net_send_int( int sock, int val )
+{
+    unsigned char bytes[4];
+    unsigned int u = val;
+    bytes[0] = ( u >> 24 ) & 0xff;
+    bytes[1] = ( u >> 16 ) & 0xff;
+    bytes[2] = ( u >> 8 ) & 0xff;
+    bytes[3] = u & 0xff;
+    return net_send( sock, bytes, sizeof bytes );
+}
+
+bool net_recv_int( int sock, int* val )
+{
+    unsigned char bytes[4];
+    if ( !net_recv( sock, bytes, sizeof bytes ) )
+        return false;
+    *val = (int) ( ( (unsigned int) bytes[0] << 24 ) | ( (unsigned int) bytes[1] << 16 )
+                 | ( (unsigned int) bytes[2] << 8 ) | (unsigned int) bytes[3] );
+    return true;
+}
+
+bool net_send_float( int sock, float val )
+{
+    int bits;
+    memcpy( &bits, &val, sizeof bits );
+    return net_send_int( sock, bits );
+}
+
+bool net_recv_float( int sock, float* val )
+{
+    int bits;
+    if ( !net_recv_int( sock, &bits ) )
+        return false;
+    memcpy( val, &bits, sizeof *val );
+    return true;
+}
+
+} /* _462 */
@@ -0,0 +1,53 @@
+/**
+ * @file network.hpp
+ * @brief Blocking stream sockets over TCP or unix domain sockets.
+ *
+ * Addresses are strings of the form "host:port" for TCP or "unix:path" for
+ * unix domain sockets. Sockets are plain file descriptors, -1 on error.
+ * Only implemented on POSIX systems; elsewhere every function fails.
+ */
+
+#ifndef _462_APPLICATION_NETWORK_HPP_
+#define _462_APPLICATION_NETWORK_HPP_
+
+#include <cstdlib>
+
+namespace _462 {
+
+// Opens a socket listening on the given address. A TCP port of 0 picks any
+// free port. Prints a message to stdout and returns -1 on error.
+int net_listen( const char* address );
+
+// Puts the address a listening socket can be reached at into address, up
+// to len characters, e.g. to pass a picked port on to other processes.
+bool net_local_address( int sock, char* address, size_t len );
+
+// Connects to the given address. Prints a message to stdout and returns
+// -1 on error.
+int net_connect( const char* address );
+
+// Accepts a connection on a listening socket, returns -1 on error.
+int net_accept( int sock );
+
+// Sends/receives exactly len bytes, returns false on error or if the
+// other end closes the connection first.
+bool net_send( int sock, const void* data, size_t len );
+bool net_recv( int sock, void* data, size_t len );
+
+// Sends/receives a 32-bit integer in network byte order.
+bool net_send_int( int sock, int val );
+bool net_recv_int( int sock, int* val );
+
+// Sends/receives a 32-bit float as its bit pattern, like an integer.
+bool net_send_float( int sock, float val );
+bool net_recv_float( int sock, float* val );
+
+// Waits up to timeout_ms milliseconds for any of the sockets to become
+// readable and sets ready[i] accordingly. Returns false on error.
+bool net_wait( const int* socks, bool* ready, size_t num, int timeout_ms );
+
+void net_close( int sock );
+
+} /* _462 */
+
+#endif /* _462_APPLICATION_NETWORK_HPP_ */
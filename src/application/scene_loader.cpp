@@ -15,6 +15,10 @@
 
 #include <iostream>
 #include <map>
+#include <list>
+#include <vector>
+#include <string>
+#include <cstdio>
 #include <cstring>
 #include <exception>
 
@@ -59,7 +63,12 @@ static const char STR_NAME[] = "name";
 static const char STR_FILENAME[] = "filename";
 static const char STR_BACKGROUND[] = "background_color";
 static const char STR_AMLIGHT[] = "ambient_light";
+static const char STR_LCUTOFF[] = "light_cutoff";
+static const char STR_LSAMPLES[] = "light_samples";
 static const char STR_CAMERA[] = "camera";
+static const char STR_CAMPATH[] = "camera_path";
+static const char STR_KEYFRAME[] = "keyframe";
+static const char STR_TIME[] = "time";
 static const char STR_PLIGHT[] = "point_light";
 static const char STR_MATERIAL[] = "material";
 static const char STR_SPHERE[] = "sphere";
@@ -67,9 +76,37 @@ static const char STR_TRIANGLE[] = "triangle";
 static const char STR_MODEL[] = "model";
 static const char STR_MESH[] = "mesh";
 
+// files at least this big are streamed rather than loaded as a document
+static const long STREAMING_MIN_SIZE = 1 << 20;
+
+/**
+ * A document of one element of a streamed scene file, which knows where in
+ * the file the element started so errors give the file's rows and columns.
+ */
+class SceneChunk : public TiXmlDocument
+{
+public:
+
+    SceneChunk() : row( 0 ), col( 0 ) { }
+
+    // the file's row and column of the chunk's row r and column c
+    int file_row( int r ) const { return row + r; }
+    int file_col( int r, int c ) const { return r == 1 ? col + c : c; }
+
+    // zero-based row and column of the element's '<' in the file
+    int row, col;
+};
+
 static void print_error_header( const TiXmlElement* base )
 {
-    std::cout << "ERROR, " << base->Row() << ":" << base->Column() << "; "
+    int row = base->Row();
+    int col = base->Column();
+    const SceneChunk* chunk = dynamic_cast< const SceneChunk* >( base->GetDocument() );
+    if ( chunk ) {
+        col = chunk->file_col( row, col );
+        row = chunk->file_row( row );
+    }
+    std::cout << "ERROR, " << row << ":" << col << "; "
         << "in " << base->Value() << ", ";
 }
 
@@ -196,6 +233,32 @@ static void parse_camera( const TiXmlElement* elem, Camera* camera )
     camera->orientation = normalize( ori );
 }
 
+static void parse_camera_path( const TiXmlElement* elem, const Camera& camera, CameraPath* path )
+{
+    const TiXmlElement* child = elem->FirstChildElement( STR_KEYFRAME );
+    while ( child ) {
+        CameraPath::Keyframe keyframe;
+        Quaternion ori;
+
+        // fov defaults to that of the camera
+        keyframe.fov = camera.fov;
+        parse_attrib_double( child, true, STR_TIME, &keyframe.time );
+        parse_elem( child, true,  STR_POSITION,  &keyframe.position );
+        parse_elem( child, true,  STR_ORIENT,    &ori );
+        parse_elem( child, false, STR_FOV,       &keyframe.fov );
+        keyframe.orientation = normalize( ori );
+
+        path->add_keyframe( keyframe );
+        child = child->NextSiblingElement( STR_KEYFRAME );
+    }
+
+    if ( path->empty() ) {
+        print_error_header( elem );
+        std::cout << "no '" << STR_KEYFRAME << "' defined.\n";
+        throw std::exception();
+    }
+}
+
 static void parse_point_light( const TiXmlElement* elem, PointLight* light )
 {
     parse_elem( elem, false, STR_ACON,      &light->attenuation.constant );
@@ -206,7 +269,7 @@ static void parse_point_light( const TiXmlElement* elem, PointLight* light )
 }
 
 template< typename T >
-static void parse_lookup_data( const std::map< const char*, T, StrCompare > tmap, const TiXmlElement* elem, const char* name, T* val )
+static void parse_lookup_data( const std::map< const char*, T, StrCompare >& tmap, const TiXmlElement* elem, const char* name, T* val )
 {
     typename std::map< const char*, T, StrCompare >::const_iterator iter;
     const char* att;
@@ -323,7 +386,7 @@ static void check_mem( void* ptr )
     }
 }
 
-bool load_scene( Scene* scene, const char* filename )
+static bool load_scene_document( Scene* scene, const char* filename )
 {
     TiXmlDocument doc( filename );
     const TiXmlElement* root = 0;
@@ -358,12 +421,23 @@ bool load_scene( Scene* scene, const char* filename )
         // parse the camera
         elem = get_unique_child( root, true, STR_CAMERA );
         parse_camera( elem, &scene->camera );
+        // parse the camera path, if any
+        elem = get_unique_child( root, false, STR_CAMPATH );
+        if ( elem ) {
+            parse_camera_path( elem, scene->camera, &scene->camera_path );
+        }
         // parse background color
         parse_elem( root, true,  STR_BACKGROUND, &scene->background_color );
         // parse refractive index
         parse_elem( root, true,  STR_REFRACT, &scene->refractive_index );
         // parse ambient light
         parse_elem( root, false, STR_AMLIGHT, &scene->ambient_light );
+        // parse how dim a light may get before it is skipped
+        parse_elem( root, false, STR_LCUTOFF, &scene->light_cutoff );
+        // parse how many lights to sample per surface, if not all of them
+        real_t light_samples = 0.0;
+        parse_elem( root, false, STR_LSAMPLES, &light_samples );
+        scene->light_samples = static_cast< size_t >( std::max( light_samples, 0.0 ) );
 
         // parse the lights
         elem = root->FirstChildElement( STR_PLIGHT );
@@ -377,7 +451,7 @@ bool load_scene( Scene* scene, const char* filename )
         // parse the materials
         elem = root->FirstChildElement( STR_MATERIAL );
         while ( elem ) {
-            Material* mat = new Material();
+            Material* mat = scene->make_material();
             check_mem( mat );
             scene->add_material( mat );
             const char* name = parse_material( elem, mat );
@@ -396,7 +470,7 @@ bool load_scene( Scene* scene, const char* filename )
         // parse the meshes
         elem = root->FirstChildElement( STR_MESH );
         while ( elem ) {
-            Mesh* mesh = new Mesh();
+            Mesh* mesh = scene->make_mesh();
             check_mem( mesh );
             scene->add_mesh( mesh );
             const char* name = parse_mesh( elem, mesh );
@@ -432,7 +506,7 @@ bool load_scene( Scene* scene, const char* filename )
         // spheres
         elem = root->FirstChildElement( STR_SPHERE );
         while ( elem ) {
-            Sphere* geom = new Sphere();
+            Sphere* geom = scene->make_sphere();
             check_mem( geom );
             scene->add_geometry( geom );
             parse_geom_sphere( materials, elem, geom );
@@ -442,7 +516,7 @@ bool load_scene( Scene* scene, const char* filename )
         // triangles
         elem = root->FirstChildElement( STR_TRIANGLE );
         while ( elem ) {
-            Triangle* geom = new Triangle();
+            Triangle* geom = scene->make_triangle();
             check_mem( geom );
             scene->add_geometry( geom );
             parse_geom_triangle( materials, triverts, elem, geom );
@@ -452,7 +526,7 @@ bool load_scene( Scene* scene, const char* filename )
         // models
         elem = root->FirstChildElement( STR_MODEL );
         while ( elem ) {
-            Model* geom = new Model();
+            Model* geom = scene->make_model();
             check_mem( geom );
             scene->add_geometry( geom );
             parse_geom_model( materials, meshes, elem, geom );
@@ -474,5 +548,543 @@ bool load_scene( Scene* scene, const char* filename )
 
 }
 
+/**
+ * Reads a file a buffer at a time, keeping the row and column of the next
+ * character as TinyXML counts them. Line endings are read as '\n', as
+ * TiXmlDocument::LoadFile does.
+ */
+class SceneReader
+{
+public:
+
+    SceneReader( FILE* fp ) : row( 0 ), col( 0 ), fp( fp ), pos( 0 ), len( 0 ) { }
+
+    // the character ahead of the next one by the given count, or EOF
+    int peek( size_t ahead = 0 )
+    {
+        if ( pos + ahead >= len && !fill( ahead + 1 ) )
+            return EOF;
+        int c = (unsigned char) buf[pos + ahead];
+        return c == '\r' ? '\n' : c;
+    }
+
+    // consumes the next character, appending it to text if given
+    int get( std::string* text = 0 )
+    {
+        int c = peek();
+        if ( c == EOF )
+            return EOF;
+        if ( buf[pos++] == '\r' && peek() == '\n' && buf[pos] == '\n' ) {
+            ++pos;
+        }
+        if ( text ) {
+            *text += (char) c;
+        }
+
+        if ( c == '\n' ) {
+            ++row;
+            col = 0;
+        } else if ( c == '\t' ) {
+            col = ( col / TAB_SIZE + 1 ) * TAB_SIZE;
+        } else if ( ( c & 0xc0 ) != 0x80 ) {
+            // the continuation bytes of utf-8 characters take no column
+            ++col;
+        }
+        return c;
+    }
+
+    // whether the next characters are str
+    bool at( const char* str )
+    {
+        for ( size_t i = 0; str[i]; ++i ) {
+            if ( peek( i ) != (unsigned char) str[i] )
+                return false;
+        }
+        return true;
+    }
+
+    // zero-based row and column of the next character
+    int row, col;
+
+private:
+
+    // TiXmlDocument's default
+    static const int TAB_SIZE = 4;
+
+    // moves what is left to the front, and reads until there are needed
+    // characters. returns false if the file ends first.
+    bool fill( size_t needed )
+    {
+        memmove( buf, buf + pos, len - pos );
+        len -= pos;
+        pos = 0;
+        while ( len < needed ) {
+            size_t num = fread( buf + len, 1, sizeof buf - len, fp );
+            if ( num == 0 )
+                return false;
+            len += num;
+        }
+        return true;
+    }
+
+    FILE* fp;
+    char buf[1 << 16];
+    size_t pos, len;
+};
+
+static void print_stream_error( const SceneReader& in, const char* desc )
+{
+    std::cout << "ERROR, " << in.row + 1 << ":" << in.col + 1 << "; "
+        << "parse error: " << desc << "\n";
+}
+
+/**
+ * Copies a tag, comment or other markup starting at '<' into text, if
+ * given, through its closing '>'.
+ * @return 1 for a start tag, -1 for an end tag and 0 for anything else.
+ */
+static int read_markup( SceneReader* in, std::string* text )
+{
+    const char* end = ">";
+    int kind = 0;
+    if ( in->at( "<!--" ) ) {
+        end = "-->";
+    } else if ( in->at( "<![CDATA[" ) ) {
+        end = "]]>";
+    } else if ( in->at( "</" ) ) {
+        kind = -1;
+    } else if ( !in->at( "<!" ) && !in->at( "<?" ) ) {
+        kind = 1;
+    }
+
+    // a '>' in a quoted attribute does not end a tag
+    int quote = 0;
+    int prev = 0;
+    for ( ;; ) {
+        if ( !quote && in->at( end ) )
+            break;
+        int c = in->get( text );
+        if ( c == EOF ) {
+            print_stream_error( *in, "Error reading end tag." );
+            throw std::exception();
+        }
+        if ( kind == 0 || c == quote ) {
+            quote = 0;
+        } else if ( !quote && ( c == '"' || c == '\'' ) ) {
+            quote = c;
+        }
+        prev = c;
+    }
+    for ( size_t i = 0; end[i]; ++i ) {
+        in->get( text );
+    }
+
+    // an empty element tag is a whole element
+    return kind == 1 && prev == '/' ? 0 : kind;
+}
+
+/**
+ * Skips anything before the next tag that is not a comment or declaration.
+ * @return false if the file ends first.
+ */
+static bool skip_to_tag( SceneReader* in )
+{
+    for ( ;; ) {
+        int c = in->peek();
+        if ( c == EOF )
+            return false;
+        if ( c != '<' ) {
+            in->get();
+        } else if ( in->at( "<!" ) || in->at( "<?" ) ) {
+            read_markup( in, 0 );
+        } else {
+            return true;
+        }
+    }
+}
+
+// copies the element starting at the next '<' into text
+static void read_element( SceneReader* in, std::string* text )
+{
+    int depth = 0;
+    do {
+        while ( in->peek() != '<' ) {
+            if ( in->get( text ) == EOF ) {
+                print_stream_error( *in, "Error reading end tag." );
+                throw std::exception();
+            }
+        }
+        depth += read_markup( in, text );
+    } while ( depth > 0 );
+}
+
+// whether elem names something not in tmap yet by the given attribute
+template< typename T >
+static bool is_forward_reference( const std::map< const char*, T, StrCompare >& tmap,
+                                  const TiXmlElement* elem, const char* name )
+{
+    const char* att = elem->Attribute( name );
+    return att && tmap.find( att ) == tmap.end();
+}
+
+// an element that may only appear once, and where in the file it first did
+struct UniqueElement
+{
+    int count;
+    int row, col;
+    UniqueElement() : count( 0 ), row( 0 ), col( 0 ) { }
+};
+
+// counts the chunk's element, reporting a repeat at the first one as
+// get_unique_child does
+static void check_unique( const SceneChunk* chunk, UniqueElement* unique )
+{
+    const TiXmlElement* elem = chunk->RootElement();
+    if ( unique->count++ > 0 ) {
+        std::cout << "ERROR, " << unique->row << ":" << unique->col << "; "
+            << "in " << elem->Value() << ", "
+            << "'" << elem->Value() << "' multiply defined.\n";
+        throw std::exception();
+    }
+    unique->row = chunk->file_row( elem->Row() );
+    unique->col = chunk->file_col( elem->Row(), elem->Column() );
+}
+
+// checks a required element appeared, as get_unique_child checks
+static void check_required( const TiXmlElement* root, const UniqueElement& unique, const char* name )
+{
+    if ( unique.count == 0 ) {
+        print_error_header( root );
+        std::cout << "no '" << name << "' defined.\n";
+        throw std::exception();
+    }
+}
+
+/**
+ * What a streamed scene has read so far. The geometries are made in the
+ * scene as they are read, but only added once all are read, so they are
+ * in the same order as load_scene_document adds them.
+ */
+struct StreamedScene
+{
+    // owns the names in the maps, which outlive the chunks they came from
+    std::list< std::string > names;
+    MaterialMap materials;
+    MeshMap meshes;
+    TriVertMap triverts;
+
+    // the geometries of each kind, in file order
+    std::vector< Sphere* > spheres;
+    std::vector< Triangle* > triangles;
+    std::vector< Model* > models;
+
+    // elements naming something defined further on, parsed once the rest
+    // are, with the geometry each fills in if any
+    typedef std::vector< std::pair< SceneChunk*, Geometry* > > DeferredList;
+    DeferredList deferred;
+
+    // the number of each element that may only appear once
+    UniqueElement cameras, camera_paths, backgrounds, refractive_indices;
+    UniqueElement ambient_lights, light_cutoffs, light_samples;
+    real_t num_light_samples;
+
+    StreamedScene() : num_light_samples( 0.0 ) { }
+
+    ~StreamedScene()
+    {
+        for ( size_t i = 0; i < deferred.size(); ++i ) delete deferred[i].first;
+    }
+
+    const char* keep_name( const char* name )
+    {
+        names.push_back( name );
+        return names.back().c_str();
+    }
+
+    void add_vertex( const TiXmlElement* elem )
+    {
+        Triangle::Vertex v;
+        const char* name = parse_triangle_vertex( materials, elem, &v );
+        assert( name );
+        if ( triverts.find( name ) != triverts.end() ) {
+            print_error_header( elem );
+            std::cout << "Triangle vertex '" << name << "' multiply defined.\n";
+            throw std::exception();
+        }
+        triverts.insert( std::make_pair( keep_name( name ), v ) );
+    }
+
+    // fills in geom, which was made for elem
+    void parse_geometry( const TiXmlElement* elem, Geometry* geom )
+    {
+        const char* name = elem->Value();
+        if ( strcmp( name, STR_SPHERE ) == 0 ) {
+            parse_geom_sphere( materials, elem, static_cast< Sphere* >( geom ) );
+        } else if ( strcmp( name, STR_TRIANGLE ) == 0 ) {
+            parse_geom_triangle( materials, triverts, elem, static_cast< Triangle* >( geom ) );
+        } else {
+            parse_geom_model( materials, meshes, elem, static_cast< Model* >( geom ) );
+        }
+    }
+
+    /**
+     * Parses a top-level element into scene, or defers it if it names
+     * something not yet defined.
+     * @return true if the chunk was deferred, and is now owned by this.
+     */
+    bool parse( Scene* scene, SceneChunk* chunk )
+    {
+        const TiXmlElement* elem = chunk->RootElement();
+        const char* name = elem->Value();
+        Geometry* geom = 0;
+        bool defer = false;
+
+        if ( strcmp( name, STR_CAMERA ) == 0 ) {
+            check_unique( chunk, &cameras );
+            parse_camera( elem, &scene->camera );
+        } else if ( strcmp( name, STR_CAMPATH ) == 0 ) {
+            check_unique( chunk, &camera_paths );
+            // keyframes default to the camera's fov
+            defer = cameras.count == 0;
+            if ( !defer ) {
+                parse_camera_path( elem, scene->camera, &scene->camera_path );
+            }
+        } else if ( strcmp( name, STR_BACKGROUND ) == 0 ) {
+            check_unique( chunk, &backgrounds );
+            parse_elem( elem, &scene->background_color );
+        } else if ( strcmp( name, STR_REFRACT ) == 0 ) {
+            check_unique( chunk, &refractive_indices );
+            parse_elem( elem, &scene->refractive_index );
+        } else if ( strcmp( name, STR_AMLIGHT ) == 0 ) {
+            check_unique( chunk, &ambient_lights );
+            parse_elem( elem, &scene->ambient_light );
+        } else if ( strcmp( name, STR_LCUTOFF ) == 0 ) {
+            check_unique( chunk, &light_cutoffs );
+            parse_elem( elem, &scene->light_cutoff );
+        } else if ( strcmp( name, STR_LSAMPLES ) == 0 ) {
+            check_unique( chunk, &light_samples );
+            parse_elem( elem, &num_light_samples );
+        } else if ( strcmp( name, STR_PLIGHT ) == 0 ) {
+            PointLight pl;
+            parse_point_light( elem, &pl );
+            scene->add_light( pl );
+        } else if ( strcmp( name, STR_MATERIAL ) == 0 ) {
+            Material* mat = scene->make_material();
+            check_mem( mat );
+            scene->add_material( mat );
+            const char* mat_name = parse_material( elem, mat );
+            assert( mat_name );
+            if ( materials.find( mat_name ) != materials.end() ) {
+                print_error_header( elem );
+                std::cout << "Material '" << mat_name << "' multiply defined.\n";
+                throw std::exception();
+            }
+            materials.insert( std::make_pair( keep_name( mat_name ), mat ) );
+        } else if ( strcmp( name, STR_MESH ) == 0 ) {
+            Mesh* mesh = scene->make_mesh();
+            check_mem( mesh );
+            scene->add_mesh( mesh );
+            const char* mesh_name = parse_mesh( elem, mesh );
+            assert( mesh_name );
+            if ( meshes.find( mesh_name ) != meshes.end() ) {
+                print_error_header( elem );
+                std::cout << "Mesh '" << mesh_name << "' multiply defined.\n";
+                throw std::exception();
+            }
+            meshes.insert( std::make_pair( keep_name( mesh_name ), mesh ) );
+        } else if ( strcmp( name, STR_VERTEX ) == 0 ) {
+            defer = is_forward_reference( materials, elem, STR_MATERIAL );
+            if ( !defer ) {
+                add_vertex( elem );
+            }
+        } else if ( strcmp( name, STR_SPHERE ) == 0 ) {
+            Sphere* sphere = scene->make_sphere();
+            check_mem( sphere );
+            spheres.push_back( sphere );
+            geom = sphere;
+            defer = is_forward_reference( materials, elem, STR_MATERIAL );
+        } else if ( strcmp( name, STR_TRIANGLE ) == 0 ) {
+            Triangle* triangle = scene->make_triangle();
+            check_mem( triangle );
+            triangles.push_back( triangle );
+            geom = triangle;
+            const TiXmlElement* child = elem->FirstChildElement( STR_VERTEX );
+            for ( ; child && !defer; child = child->NextSiblingElement( STR_VERTEX ) ) {
+                defer = is_forward_reference( triverts, child, STR_NAME );
+            }
+        } else if ( strcmp( name, STR_MODEL ) == 0 ) {
+            Model* model = scene->make_model();
+            check_mem( model );
+            models.push_back( model );
+            geom = model;
+            defer = is_forward_reference( meshes, elem, STR_MESH )
+                || is_forward_reference( materials, elem, STR_MATERIAL );
+        }
+
+        if ( defer ) {
+            deferred.push_back( std::make_pair( chunk, geom ) );
+            return true;
+        }
+        if ( geom ) {
+            parse_geometry( elem, geom );
+        }
+        return false;
+    }
+
+    // parses the deferred elements, once everything they name is defined
+    void parse_deferred( Scene* scene )
+    {
+        // every vertex is defined before any triangle, as in the document
+        for ( DeferredList::iterator i = deferred.begin(); i != deferred.end(); ++i ) {
+            const TiXmlElement* elem = i->first->RootElement();
+            if ( strcmp( elem->Value(), STR_VERTEX ) == 0 ) {
+                add_vertex( elem );
+            }
+        }
+        for ( DeferredList::iterator i = deferred.begin(); i != deferred.end(); ++i ) {
+            const TiXmlElement* elem = i->first->RootElement();
+            if ( strcmp( elem->Value(), STR_CAMPATH ) == 0 ) {
+                parse_camera_path( elem, scene->camera, &scene->camera_path );
+            } else if ( i->second ) {
+                parse_geometry( elem, i->second );
+            }
+        }
+    }
+
+    // hands the geometries to scene, spheres then triangles then models
+    void add_geometries( Scene* scene )
+    {
+        for ( size_t i = 0; i < spheres.size(); ++i ) {
+            scene->add_geometry( spheres[i] );
+        }
+        for ( size_t i = 0; i < triangles.size(); ++i ) {
+            scene->add_geometry( triangles[i] );
+        }
+        for ( size_t i = 0; i < models.size(); ++i ) {
+            scene->add_geometry( models[i] );
+        }
+    }
+};
+
+// parses text, an element starting at row and col of the file, into chunk
+static void parse_chunk( SceneChunk* chunk, const std::string& text, int row, int col )
+{
+    chunk->Clear();
+    chunk->row = row;
+    chunk->col = col;
+    chunk->Parse( text.c_str(), 0, TIXML_DEFAULT_ENCODING );
+    if ( chunk->Error() ) {
+        std::cout << "ERROR, " << chunk->file_row( chunk->ErrorRow() ) << ":"
+            << chunk->file_col( chunk->ErrorRow(), chunk->ErrorCol() ) << "; "
+            << "parse error: " << chunk->ErrorDesc() << "\n";
+        throw std::exception();
+    }
+    if ( !chunk->RootElement() ) {
+        std::cout << "No root element.\n";
+        throw std::exception();
+    }
+}
+
+bool load_scene_streaming( Scene* scene, const char* filename )
+{
+    FILE* fp = fopen( filename, "rb" );
+    if ( !fp ) {
+        std::cout << "ERROR, 0:0; parse error: Failed to open file\n";
+        return false;
+    }
+
+    assert( scene );
+    scene->reset();
+
+    SceneReader in( fp );
+    SceneChunk root;
+    SceneChunk* chunk = 0;
+    std::string text;
+    bool loaded = false;
+
+    try {
+        StreamedScene state;
+
+        if ( !skip_to_tag( &in ) || in.at( "</" ) ) {
+            std::cout << "No root element.\n";
+            throw std::exception();
+        }
+
+        // parse the root's start tag alone, as an empty element, for errors
+        // about what it is missing
+        int row = in.row;
+        int col = in.col;
+        bool empty = read_markup( &in, &text ) == 0;
+        if ( !empty ) {
+            text.insert( text.size() - 1, "/" );
+        }
+        parse_chunk( &root, text, row, col );
+
+        // parse each child of the root on its own as it is read
+        while ( !empty ) {
+            if ( !skip_to_tag( &in ) ) {
+                print_stream_error( in, "Error reading end tag." );
+                throw std::exception();
+            }
+            if ( in.at( "</" ) ) {
+                read_markup( &in, 0 );
+                break;
+            }
+
+            row = in.row;
+            col = in.col;
+            text.clear();
+            read_element( &in, &text );
+            if ( !chunk ) {
+                chunk = new SceneChunk();
+            }
+            parse_chunk( chunk, text, row, col );
+            if ( state.parse( scene, chunk ) ) {
+                chunk = 0;
+            }
+        }
+
+        const TiXmlElement* elem = root.RootElement();
+        check_required( elem, state.cameras, STR_CAMERA );
+        check_required( elem, state.backgrounds, STR_BACKGROUND );
+        check_required( elem, state.refractive_indices, STR_REFRACT );
+        scene->light_samples = static_cast< size_t >( std::max( state.num_light_samples, 0.0 ) );
+
+        state.parse_deferred( scene );
+        state.add_geometries( scene );
+        loaded = true;
+
+    } catch ( std::bad_alloc const& ) {
+        std::cout << "Out of memory error while loading scene\n.";
+    } catch ( ... ) {
+    }
+
+    delete chunk;
+    fclose( fp );
+    if ( !loaded ) {
+        scene->reset();
+    }
+    return loaded;
+}
+
+bool load_scene( Scene* scene, const char* filename )
+{
+    // a document of a big generated scene takes many times the memory of
+    // the file, so stream those
+    long size = 0;
+    FILE* fp = fopen( filename, "rb" );
+    if ( fp ) {
+        if ( fseek( fp, 0, SEEK_END ) == 0 ) {
+            size = ftell( fp );
+        }
+        fclose( fp );
+    }
+
+    if ( size >= STREAMING_MIN_SIZE ) {
+        return load_scene_streaming( scene, filename );
+    }
+    return load_scene_document( scene, filename );
+}
+
 } /* _462 */
 
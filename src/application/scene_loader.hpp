@@ -20,6 +20,17 @@ class Scene;
  */
 bool load_scene( Scene* scene, const char* filename );
 
+/**
+ * Loads a scene as load_scene does, but reads the file one top-level
+ * element at a time, adding each to the scene as it is read, so the whole
+ * document is never held in memory. Used by load_scene for large files.
+ * Elements may name materials, meshes or vertices defined after them,
+ * though those elements are held until the end of the file.
+ * @return True on success, false on error.
+ * Will clear the scene on error.
+ */
+bool load_scene_streaming( Scene* scene, const char* filename );
+
 } /* _462 */
 
 #endif /* _462_APPLICATOIN_SCENELOADER_HPP_ */
@@ -0,0 +1,106 @@
+/**
+ * @file camera_path.cpp
+ * @brief Camera keyframe track
+ */
+
+#include "math/camera_path.hpp"
+#include "math/camera.hpp"
+
+namespace _462 {
+
+void CameraPath::add_keyframe( const Keyframe& keyframe )
+{
+    KeyframeList::iterator i = keyframes.end();
+    while ( i != keyframes.begin() && ( i - 1 )->time > keyframe.time ) {
+        --i;
+    }
+    keyframes.insert( i, keyframe );
+}
+
+void CameraPath::clear()
+{
+    keyframes.clear();
+}
+
+bool CameraPath::empty() const
+{
+    return keyframes.empty();
+}
+
+size_t CameraPath::num_keyframes() const
+{
+    return keyframes.size();
+}
+
+const CameraPath::Keyframe* CameraPath::get_keyframes() const
+{
+    return keyframes.empty() ? NULL : &keyframes[0];
+}
+
+real_t CameraPath::get_start_time() const
+{
+    assert( !keyframes.empty() );
+    return keyframes.front().time;
+}
+
+real_t CameraPath::get_end_time() const
+{
+    assert( !keyframes.empty() );
+    return keyframes.back().time;
+}
+
+static Vector3 catmull_rom( const Vector3& p0, const Vector3& p1,
+                            const Vector3& p2, const Vector3& p3, real_t t )
+{
+    real_t t2 = t * t;
+    real_t t3 = t2 * t;
+    return 0.5 * ( ( 2.0 * p1 )
+                 + ( p2 - p0 ) * t
+                 + ( 2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3 ) * t2
+                 + ( 3.0 * p1 - p0 - 3.0 * p2 + p3 ) * t3 );
+}
+
+/**
+ * Moves camera along the path. Only the position, orientation and fov are
+ * changed, clipping planes and aspect ratio are left as they are.
+ */
+void CameraPath::evaluate( real_t time, Camera* camera ) const
+{
+    assert( !keyframes.empty() );
+
+    size_t num = keyframes.size();
+
+    if ( time <= keyframes.front().time || num == 1 ) {
+        camera->position = keyframes.front().position;
+        camera->orientation = keyframes.front().orientation;
+        camera->fov = keyframes.front().fov;
+        return;
+    }
+    if ( time >= keyframes.back().time ) {
+        camera->position = keyframes.back().position;
+        camera->orientation = keyframes.back().orientation;
+        camera->fov = keyframes.back().fov;
+        return;
+    }
+
+    // find the segment [i, i + 1] containing time
+    size_t i = 0;
+    while ( keyframes[i + 1].time < time ) {
+        ++i;
+    }
+
+    const Keyframe& k1 = keyframes[i];
+    const Keyframe& k2 = keyframes[i + 1];
+    real_t span = k2.time - k1.time;
+    real_t t = span > 0.0 ? ( time - k1.time ) / span : 1.0;
+
+    // endpoints are repeated to get tangents for the first and last segment
+    const Vector3& p0 = keyframes[i > 0 ? i - 1 : i].position;
+    const Vector3& p3 = keyframes[i + 2 < num ? i + 2 : i + 1].position;
+
+    camera->position = catmull_rom( p0, k1.position, k2.position, p3, t );
+    camera->orientation = slerp( k1.orientation, k2.orientation, t );
+    camera->fov = k1.fov + ( k2.fov - k1.fov ) * t;
+}
+
+} /* _462 */
@@ -0,0 +1,63 @@
+/**
+ * @file camera_path.hpp
+ * @brief Camera keyframe track
+ */
+
+#ifndef _462_MATH_CAMERA_PATH_HPP_
+#define _462_MATH_CAMERA_PATH_HPP_
+
+#include "math/vector.hpp"
+#include "math/quaternion.hpp"
+#include <vector>
+
+namespace _462 {
+
+class Camera;
+
+/**
+ * A sequence of camera keyframes over time. Positions follow a Catmull-Rom
+ * spline through the keyframes, orientations are slerped and the field of
+ * view is linearly interpolated. Times before the first or after the last
+ * keyframe hold that keyframe.
+ */
+class CameraPath
+{
+public:
+
+    struct Keyframe
+    {
+        // time of the keyframe, in seconds
+        real_t time;
+        Vector3 position;
+        // unit quaternion, see Camera::orientation
+        Quaternion orientation;
+        // field of view of the y-axis, in radians
+        real_t fov;
+    };
+
+    // adds a keyframe, keeping keyframes sorted by time
+    void add_keyframe( const Keyframe& keyframe );
+    // removes all keyframes
+    void clear();
+
+    bool empty() const;
+    size_t num_keyframes() const;
+    const Keyframe* get_keyframes() const;
+
+    // time of the first and last keyframe
+    real_t get_start_time() const;
+    real_t get_end_time() const;
+
+    // sets the position, orientation and fov of camera for the given time
+    void evaluate( real_t time, Camera* camera ) const;
+
+private:
+
+    typedef std::vector< Keyframe > KeyframeList;
+
+    KeyframeList keyframes;
+};
+
+} /* _462 */
+
+#endif /* _462_MATH_CAMERA_PATH_HPP_ */
@@ -28,6 +28,25 @@ inline T clamp( T val, T min, T max )
     return std::min( max, std::max( min, val ) );
 }
 
+// returns the smallest real_t greater than x, for positive, normal x
+inline real_t next_up( real_t x )
+{
+    int exponent;
+    frexp( x, &exponent );
+    // real_t has 53 bits of mantissa
+    return x + ldexp( real_t( 1.0 ), exponent - 53 );
+}
+
+// spreads the low 10 bits of x out to every third bit, for morton codes
+inline unsigned int expand_bits( unsigned int x )
+{
+    x = ( x | ( x << 16 ) ) & 0x030000FF;
+    x = ( x | ( x << 8 ) ) & 0x0300F00F;
+    x = ( x | ( x << 4 ) ) & 0x030C30C3;
+    x = ( x | ( x << 2 ) ) & 0x09249249;
+    return x;
+}
+
 
 } /* _462 */
 
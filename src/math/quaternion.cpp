@@ -181,6 +181,35 @@ Quaternion conjugate( const Quaternion& q )
     return Quaternion( q.w, -q.x, -q.y, -q.z );
 }
 
+Quaternion slerp( const Quaternion& a, const Quaternion& b, real_t t )
+{
+    real_t cosine = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+    Quaternion end = b;
+
+    // q and -q are the same rotation, so go the short way around
+    if ( cosine < 0.0 ) {
+        cosine = -cosine;
+        end *= -1.0;
+    }
+
+    real_t sa, sb;
+    if ( cosine > 0.9995 ) {
+        // nearly parallel, plain lerp avoids dividing by a tiny sine
+        sa = 1.0 - t;
+        sb = t;
+    } else {
+        real_t angle = acos( cosine );
+        real_t inv_sine = 1.0 / sin( angle );
+        sa = sin( ( 1.0 - t ) * angle ) * inv_sine;
+        sb = sin( t * angle ) * inv_sine;
+    }
+
+    Quaternion rv( sa * a.w + sb * end.w, sa * a.x + sb * end.x,
+                   sa * a.y + sb * end.y, sa * a.z + sb * end.z );
+    make_unit( rv );
+    return rv;
+}
+
 std::ostream& operator <<( std::ostream& o, const Quaternion& q )
 {
     o << "Quaternion(" << q.w << ", " << q.x << ", " << q.y << ", " << q.z << ")";
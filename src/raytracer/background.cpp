@@ -0,0 +1,358 @@
+/**
+ * @file background.cpp
+ * @brief Raytracing on worker threads while the window stays responsive.
+ */
+
+#include "raytracer/background.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+namespace _462 {
+
+// the reprojection error, in pixels, of a pixel nothing was reprojected to
+#define DISOCCLUDED_ERROR 8.0
+
+// whether the cameras see the same image
+static bool same_view( const Camera& a, const Camera& b )
+{
+    return a.position == b.position && a.orientation == b.orientation && a.fov == b.fov
+        && a.aspect == b.aspect && a.near_clip == b.near_clip;
+}
+
+// orders bands by descending reprojection error
+struct WorseBand
+{
+    const std::vector< real_t >* errors;
+    bool operator()( size_t a, size_t b ) const { return ( *errors )[a] > ( *errors )[b]; }
+};
+
+BackgroundRaytrace::BackgroundRaytrace()
+    : scene( 0 ), width( 0 ), height( 0 ), new_eye( Vector3::Zero ), estimated( false ), traced_revisions(),
+      reusable( false ), quit( false ), generation( 0 ), band_rows( 1 ),
+      next_band( 0 ), reproject_pending( false ), reprojecting( false ),
+      eye( Vector3::Zero ), estimate_pending( false ), num_presented( 0 )
+{
+    mutex = SDL_CreateMutex();
+    wake = SDL_CreateCond();
+}
+
+BackgroundRaytrace::~BackgroundRaytrace()
+{
+    stop();
+    SDL_DestroyCond( wake );
+    SDL_DestroyMutex( mutex );
+}
+
+bool BackgroundRaytrace::initialize( Scene* scene, size_t width, size_t height, size_t num_threads )
+{
+    assert( num_threads > 0 );
+    stop();
+
+    bool resized = scene != this->scene || width != this->width || height != this->height;
+    this->scene = scene;
+    this->width = width;
+    this->height = height;
+
+    try {
+        back.resize( 4 * width * height );
+        hdr_back.resize( 3 * width * height );
+        positions.resize( width * height );
+        hit_back.resize( width * height );
+        new_back.resize( back.size() );
+        new_hdr_back.resize( hdr_back.size() );
+        new_positions.resize( width * height );
+        new_hit_back.resize( width * height );
+        dists.resize( width * height );
+        errors.resize( width * height );
+        workers.resize( num_threads );
+    } catch ( std::bad_alloc const& ) {
+        return false;
+    }
+
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+        workers[i].owner = this;
+        workers[i].thread = 0;
+        workers[i].raytracer.initialize( scene, width, height );
+    }
+
+    view.initialize( scene, width, height );
+
+    // the camera is the only part of the scene the back buffers survive
+    // changes to
+    const Scene::Revisions& revisions = scene->get_revisions();
+    bool kept = !resized && revisions.geometry == traced_revisions.geometry
+        && revisions.materials == traced_revisions.materials && revisions.lights == traced_revisions.lights;
+    traced_revisions = revisions;
+    reusable = kept && !rows_traced.empty()
+        && std::find( rows_traced.begin(), rows_traced.end(), false ) == rows_traced.end();
+    if ( !kept ) {
+        hit_back.assign( width * height, false );
+    }
+
+    band_order.clear();
+    next_band = 0;
+    reproject_pending = false;
+    estimate_pending = false;
+    rows_traced.assign( height, false );
+    rows_presented.assign( height, false );
+    num_presented = 0;
+    return true;
+}
+
+Raytracer* BackgroundRaytrace::get_raytracer( size_t worker )
+{
+    assert( worker < workers.size() );
+    return &workers[worker].raytracer;
+}
+
+size_t BackgroundRaytrace::num_workers() const
+{
+    return workers.size();
+}
+
+bool BackgroundRaytrace::start( const Camera& camera )
+{
+    assert( scene );
+
+    SDL_mutexP( mutex );
+    ++generation;
+    if ( reusable && same_view( camera, this->camera ) ) {
+        // the back buffers are this raytrace, finished
+        band_order.clear();
+        reproject_pending = false;
+        estimate_pending = false;
+        rows_traced.assign( height, true );
+    } else {
+        // no rows are handed out until a worker has reprojected, so the
+        // window's thread never waits on it
+        this->camera = camera;
+        band_order.clear();
+        reproject_pending = true;
+        // in wavefront mode, trace bands that its sorting works over
+        band_rows = workers[0].raytracer.is_wavefront() ? Raytracer::WAVEFRONT_ROWS : 1;
+        estimate_pending = false;
+        rows_traced.assign( height, false );
+    }
+    reusable = false;
+    next_band = 0;
+    rows_presented.assign( height, false );
+    num_presented = 0;
+    quit = false;
+    SDL_CondBroadcast( wake );
+    SDL_mutexV( mutex );
+
+    // workers already running pick up the new camera between rows
+    bool started = false;
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+        if ( !workers[i].thread ) {
+            workers[i].thread = SDL_CreateThread( worker_main, &workers[i] );
+        }
+        started = started || workers[i].thread != 0;
+    }
+    return started;
+}
+
+void BackgroundRaytrace::stop()
+{
+    SDL_mutexP( mutex );
+    quit = true;
+    SDL_CondBroadcast( wake );
+    SDL_mutexV( mutex );
+
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+        if ( workers[i].thread ) {
+            SDL_WaitThread( workers[i].thread, 0 );
+            workers[i].thread = 0;
+        }
+    }
+}
+
+bool BackgroundRaytrace::present( unsigned char* buffer, float* hdr_buffer )
+{
+    SDL_mutexP( mutex );
+    if ( estimate_pending ) {
+        memcpy( buffer, &back[0], back.size() );
+        if ( hdr_buffer ) {
+            memcpy( hdr_buffer, &hdr_back[0], hdr_back.size() * sizeof hdr_buffer[0] );
+        }
+        estimate_pending = false;
+    }
+    for ( size_t row = 0; row < height; ++row ) {
+        if ( !rows_traced[row] || rows_presented[row] )
+            continue;
+        size_t index = row * width;
+        memcpy( &buffer[4 * index], &back[4 * index], 4 * width );
+        if ( hdr_buffer ) {
+            memcpy( &hdr_buffer[3 * index], &hdr_back[3 * index], 3 * width * sizeof hdr_buffer[0] );
+        }
+        rows_presented[row] = true;
+        ++num_presented;
+    }
+    bool done = num_presented == height;
+    SDL_mutexV( mutex );
+    return done;
+}
+
+int BackgroundRaytrace::worker_main( void* data )
+{
+    Worker* worker = static_cast< Worker* >( data );
+    worker->owner->work( worker );
+    return 0;
+}
+
+void BackgroundRaytrace::reproject( const Camera& camera )
+{
+    size_t num_bands = ( height + band_rows - 1 ) / band_rows;
+
+    view.update_camera( camera );
+    new_eye = camera.get_position();
+    // the angle a pixel covers, to measure how far the view of a sample
+    // turned in pixels
+    real_t pixel_angle = camera.get_fov_radians() / height;
+
+    // pixels nothing lands on keep what they had
+    std::copy( back.begin(), back.end(), new_back.begin() );
+    std::copy( hdr_back.begin(), hdr_back.end(), new_hdr_back.begin() );
+    std::fill( new_hit_back.begin(), new_hit_back.end(), false );
+    std::fill( errors.begin(), errors.end(), DISOCCLUDED_ERROR );
+    estimated = false;
+
+    for ( size_t i = 0; i < width * height; ++i ) {
+        if ( !hit_back[i] )
+            continue;
+
+        const Vector3& pos = positions[i];
+        real_t x, y;
+        if ( !view.project( pos, &x, &y ) || x < 0.0 || y < 0.0 || x >= width || y >= height )
+            continue;
+        size_t px = (size_t) x;
+        size_t py = (size_t) y;
+        size_t index = py * width + px;
+
+        // the nearest sample landing on a pixel hides the rest
+        real_t dist = length( pos - new_eye );
+        if ( new_hit_back[index] && dists[index] <= dist )
+            continue;
+
+        Vector3 old_view = normalize( pos - eye );
+        Vector3 new_view = ( pos - new_eye ) / dist;
+        real_t turned = acos( clamp( dot( old_view, new_view ), real_t( -1.0 ), real_t( 1.0 ) ) );
+        real_t dx = x - px - 0.5;
+        real_t dy = y - py - 0.5;
+        errors[index] = sqrt( dx * dx + dy * dy ) + turned / pixel_angle;
+
+        memcpy( &new_back[4 * index], &back[4 * i], 4 );
+        memcpy( &new_hdr_back[3 * index], &hdr_back[3 * i], 3 * sizeof new_hdr_back[0] );
+        new_positions[index] = pos;
+        new_hit_back[index] = true;
+        dists[index] = dist;
+        estimated = true;
+    }
+
+    // trace the worst estimated bands first, top to bottom among equals
+    std::vector< real_t > band_errors( num_bands, 0.0 );
+    for ( size_t i = 0; i < width * height; ++i ) {
+        band_errors[i / width / band_rows] += errors[i];
+    }
+    new_band_order.resize( num_bands );
+    for ( size_t i = 0; i < num_bands; ++i ) {
+        new_band_order[i] = i;
+    }
+    WorseBand worse = { &band_errors };
+    std::stable_sort( new_band_order.begin(), new_band_order.end(), worse );
+}
+
+void BackgroundRaytrace::publish_reprojection()
+{
+    back.swap( new_back );
+    hdr_back.swap( new_hdr_back );
+    positions.swap( new_positions );
+    hit_back.swap( new_hit_back );
+    eye = new_eye;
+    estimate_pending = estimated;
+    band_order.swap( new_band_order );
+    next_band = 0;
+}
+
+void BackgroundRaytrace::work( Worker* worker )
+{
+    Raytracer& raytracer = worker->raytracer;
+    std::vector< Color3 > colors;
+    std::vector< real_t > depths;
+    std::vector< Vector3 > hits;
+
+    SDL_mutexP( mutex );
+    // the raytrace the worker's camera is set up for, none yet
+    unsigned int current = generation - 1;
+    while ( !quit ) {
+        if ( reproject_pending && !reprojecting ) {
+            // nothing writes the back buffers until its bands are handed out
+            reproject_pending = false;
+            reprojecting = true;
+            unsigned int reprojected = generation;
+            Camera new_camera = camera;
+            SDL_mutexV( mutex );
+
+            reproject( new_camera );
+
+            SDL_mutexP( mutex );
+            reprojecting = false;
+            // if the camera moved again, it is reprojected from the old view
+            if ( reprojected == generation ) {
+                publish_reprojection();
+            }
+            SDL_CondBroadcast( wake );
+            continue;
+        }
+        if ( next_band == band_order.size() ) {
+            SDL_CondWait( wake, mutex );
+            continue;
+        }
+
+        size_t row = band_order[next_band++] * band_rows;
+        size_t num_rows = std::min( band_rows, height - row );
+        bool moved = current != generation;
+        Camera row_camera = camera;
+        current = generation;
+        SDL_mutexV( mutex );
+
+        if ( moved ) {
+            raytracer.update_camera( row_camera );
+        }
+        colors.resize( width * num_rows );
+        depths.resize( width * num_rows );
+        raytracer.trace_tile( 0, row, width, num_rows, &colors[0], &depths[0] );
+        hits.resize( width * num_rows );
+        for ( size_t i = 0; i < width * num_rows; ++i ) {
+            if ( depths[i] >= 0.0 ) {
+                Vector3 dir = raytracer.primary_ray( i % width, row + i / width );
+                hits[i] = row_camera.get_position() + dir * depths[i];
+            }
+        }
+
+        SDL_mutexP( mutex );
+        // the camera moved while tracing, so the rows are out of date
+        if ( current != generation )
+            continue;
+
+        for ( size_t i = 0; i < width * num_rows; ++i ) {
+            size_t index = row * width + i;
+            const Color3& color = colors[i];
+            color.to_array( &back[4 * index] );
+            hdr_back[3 * index] = color.r;
+            hdr_back[3 * index + 1] = color.g;
+            hdr_back[3 * index + 2] = color.b;
+            positions[index] = hits[i];
+            hit_back[index] = depths[i] >= 0.0;
+        }
+        for ( size_t i = 0; i < num_rows; ++i ) {
+            rows_traced[row + i] = true;
+        }
+    }
+    SDL_mutexV( mutex );
+}
+
+} /* _462 */
@@ -0,0 +1,163 @@
+/**
+ * @file background.hpp
+ * @brief Raytracing on worker threads while the window stays responsive.
+ */
+
+#ifndef _462_RAYTRACER_BACKGROUND_HPP_
+#define _462_RAYTRACER_BACKGROUND_HPP_
+
+#include "raytracer/raytracer.hpp"
+#include <SDL/SDL_thread.h>
+#include <SDL/SDL_mutex.h>
+#include <vector>
+
+namespace _462 {
+
+/**
+ * Raytraces a scene on worker threads, each with its own Raytracer, into
+ * a back buffer. The window's thread copies the finished rows into the
+ * buffer it displays with present, so it never waits for a row to be
+ * traced and never shows one half written. Moving the camera restarts the
+ * raytrace without waiting for the workers: they pick up the new camera
+ * when they finish their current rows, and throw those rows away.
+ *
+ * The world position each viewing ray hit is kept with its color. When the
+ * camera moves, a worker reprojects those into the new view as an estimate
+ * of the image until it is traced again, and the rows the estimate covers
+ * worst, where surfaces came into view or samples moved furthest from
+ * their pixel, are traced first.
+ */
+class BackgroundRaytrace
+{
+public:
+
+    BackgroundRaytrace();
+    // stops the workers
+    ~BackgroundRaytrace();
+
+    /**
+     * Sets up num_threads workers to raytrace scene at the given size,
+     * stopping any that are running. Like Raytracer::initialize, the
+     * scene's geometries are brought up to date, so this must not be
+     * called while anything else is tracing the scene. If only the camera
+     * changed since the last raytrace of the scene at this size, what it
+     * traced is kept: the next start reprojects it, or if the camera is
+     * the same and the raytrace had finished, just presents it again.
+     * @return false if the buffers could not be allocated.
+     */
+    bool initialize( Scene* scene, size_t width, size_t height, size_t num_threads );
+
+    // the raytracer of a worker, whose options may be set while stopped
+    Raytracer* get_raytracer( size_t worker );
+    size_t num_workers() const;
+
+    /**
+     * Starts the raytrace from camera, starting the workers if they are
+     * not running. If they are, the raytrace in progress is abandoned.
+     * What was traced or estimated so far is reprojected into the new view
+     * by a worker, before any rows are traced.
+     * @return false if no worker thread could be started.
+     */
+    bool start( const Camera& camera );
+
+    // stops the workers once their current rows are done, and waits for them
+    void stop();
+
+    /**
+     * Copies the rows finished since the last call into buffer, and their
+     * linear colors into hdr_buffer if not null. The first call after the
+     * reprojection is done copies its estimate of the whole image, and
+     * pixels it has no estimate for are left until the raytrace replaces
+     * them.
+     * @return true once every row of the current raytrace has been copied.
+     */
+    bool present( unsigned char* buffer, float* hdr_buffer );
+
+private:
+
+    struct Worker
+    {
+        BackgroundRaytrace* owner;
+        Raytracer raytracer;
+        SDL_Thread* thread;
+    };
+
+    static int worker_main( void* data );
+    // traces rows for worker until told to quit
+    void work( Worker* worker );
+    // reprojects the back buffers into the view of camera into the
+    // reprojection buffers, and orders the bands by how poorly they are
+    // estimated into new_band_order. reads the back buffers without the
+    // mutex, so only while no rows are handed out.
+    void reproject( const Camera& camera );
+    // swaps the reprojection into the back buffers and hands out its bands
+    void publish_reprojection();
+
+    typedef std::vector< Worker > WorkerList;
+
+    Scene* scene;
+    size_t width, height;
+    WorkerList workers;
+    // set up for the camera of the current raytrace, to project with
+    Raytracer view;
+    // what the worker reprojecting fills in without the mutex, kept to
+    // not allocate them on every camera move
+    std::vector< unsigned char > new_back;
+    std::vector< float > new_hdr_back;
+    std::vector< Vector3 > new_positions;
+    std::vector< bool > new_hit_back;
+    std::vector< real_t > dists;
+    std::vector< real_t > errors;
+    std::vector< size_t > new_band_order;
+    Vector3 new_eye;
+    bool estimated;
+    // the scene's revisions when the back buffers were traced
+    Scene::Revisions traced_revisions;
+    // whether the finished raytrace in the back buffers can be presented
+    // again by a start from the same camera
+    bool reusable;
+
+    // guards everything below, and the rows of the back buffers marked
+    // as traced
+    SDL_mutex* mutex;
+    // signalled when there are rows to trace or the workers should quit
+    SDL_cond* wake;
+    bool quit;
+    // the camera of the current raytrace, and a count of the raytraces
+    // started so workers can tell their rows are out of date
+    Camera camera;
+    unsigned int generation;
+    // rows traced at once, and the order the bands of them are traced in
+    size_t band_rows;
+    std::vector< size_t > band_order;
+    // index into band_order of the next band for a worker to trace
+    size_t next_band;
+    // whether the current raytrace still has to be reprojected, and
+    // whether a worker is reprojecting one
+    bool reproject_pending;
+    bool reprojecting;
+    // the finished rows, 4 bytes and 3 floats per pixel, and the estimate
+    // of the rest
+    std::vector< unsigned char > back;
+    std::vector< float > hdr_back;
+    // the world position seen through each pixel, if hit_back is set
+    std::vector< Vector3 > positions;
+    std::vector< bool > hit_back;
+    // the eye positions were last reprojected to
+    Vector3 eye;
+    // whether present has yet to copy the estimate
+    bool estimate_pending;
+    // which rows of the current raytrace are finished, and which of those
+    // present has copied
+    std::vector< bool > rows_traced;
+    std::vector< bool > rows_presented;
+    size_t num_presented;
+
+    // no meaningful assignment/copy
+    BackgroundRaytrace( const BackgroundRaytrace& );
+    BackgroundRaytrace& operator=( const BackgroundRaytrace& );
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_BACKGROUND_HPP_ */
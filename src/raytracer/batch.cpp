@@ -0,0 +1,300 @@
+/**
+ * @file batch.cpp
+ * @brief Rendering a manifest of jobs in one process.
+ */
+
+#include "raytracer/batch.hpp"
+#include "raytracer/render_pool.hpp"
+#include "application/imageio.hpp"
+#include "application/scene_loader.hpp"
+#include "scene/scene.hpp"
+#include "scene/snapshot.hpp"
+#include "scene/asset_cache.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <new>
+
+namespace _462 {
+
+// jobs kept in flight per thread, enough that the threads stay busy
+// while the next scene loads
+static const size_t JOBS_PER_THREAD = 2;
+
+/**
+ * A line of the manifest. Once its pixels are traced, the thread that
+ * finished it saves them and lets them go.
+ */
+class BatchJob : public RenderJob
+{
+public:
+
+    BatchJob() : scene_index( 0 ), line( 0 ), saved( false ) { }
+
+    std::string output_filename;
+    // into the list of scene files
+    size_t scene_index;
+    // of the manifest, for messages
+    int line;
+    bool saved;
+
+    virtual void finish()
+    {
+        saved = imageio_save_image( output_filename.c_str(), &pixels[0], crop_width, crop_height );
+        std::vector< unsigned char >().swap( pixels );
+    }
+};
+
+typedef std::vector< BatchJob* > JobList;
+typedef std::vector< std::string > FilenameList;
+
+// orders jobs by the scene they render, then by their line
+struct SceneOrder
+{
+    bool operator()( const BatchJob* a, const BatchJob* b ) const
+    {
+        return a->scene_index != b->scene_index ? a->scene_index < b->scene_index : a->line < b->line;
+    }
+};
+
+struct LoadedScene
+{
+    Scene* scene;
+    // jobs of the scene not yet finished
+    size_t remaining;
+    bool failed;
+};
+
+typedef std::vector< LoadedScene > SceneList;
+
+static bool ends_with( const std::string& s, const char* suffix )
+{
+    size_t len = strlen( suffix );
+    return s.size() >= len && s.compare( s.size() - len, len, suffix ) == 0;
+}
+
+// reads the jobs of the manifest, with the scene files they use in the
+// order they first appear. returns false on a malformed line.
+static bool read_manifest( const char* filename, JobList* jobs, FilenameList* scene_filenames )
+{
+    std::ifstream file( filename );
+    if ( !file ) {
+        std::cout << "Cannot open manifest '" << filename << "'.\n";
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while ( getline( file, line ) ) {
+        ++line_number;
+        std::stringstream stream( line );
+        std::string scene_filename;
+        if ( !( stream >> scene_filename ) || scene_filename[0] == '#' )
+            continue;
+
+        BatchJob* job = new BatchJob;
+        job->line = line_number;
+        job->samples = 1;
+        jobs->push_back( job );
+
+        // samples are optional, but must be a whole number with nothing
+        // after them
+        bool valid = !( stream >> job->width >> job->height >> job->output_filename ).fail();
+        std::string token, extra;
+        if ( valid && stream >> token ) {
+            std::stringstream samples( token );
+            valid = !( samples >> job->samples ).fail() && !( samples >> extra ) && !( stream >> extra );
+        }
+        if ( !valid || job->width < 1 || job->width > RenderJob::MAX_SIZE || job->height < 1
+             || job->height > RenderJob::MAX_SIZE || job->samples < 1
+             || job->samples > RenderJob::MAX_SAMPLES ) {
+            std::cout << filename << ":" << line_number
+                      << ": expected scene_file width height output_file [samples].\n";
+            return false;
+        }
+        if ( !ends_with( job->output_filename, ".png" ) ) {
+            std::cout << filename << ":" << line_number << ": output files must be PNG.\n";
+            return false;
+        }
+
+        job->crop_width = job->width;
+        job->crop_height = job->height;
+        FilenameList::iterator iter = std::find( scene_filenames->begin(), scene_filenames->end(),
+                                                 scene_filename );
+        job->scene_index = iter - scene_filenames->begin();
+        if ( iter == scene_filenames->end() ) {
+            scene_filenames->push_back( scene_filename );
+        }
+    }
+    return true;
+}
+
+// loads a scene file or snapshot with its assets and brings it up to date
+static Scene* load_batch_scene( const BatchParams& params, const std::string& filename,
+                                AssetCache* cache )
+{
+    Scene* scene = new Scene;
+    bool from_snapshot = SceneSnapshot::is_snapshot( filename.c_str() );
+    bool loaded;
+    try {
+        if ( from_snapshot ) {
+            // a snapshot comes with its textures, meshes and binary hierarchies
+            loaded = SceneSnapshot::load( scene, filename.c_str() );
+            scene->bvh_build_mode = params.bvh_build_mode;
+            scene->bvh_layout = params.bvh_layout;
+            Mesh* const* meshes = scene->get_meshes();
+            for ( size_t i = 0; loaded && i < scene->num_meshes(); ++i ) {
+                meshes[i]->set_bvh_layout( scene->bvh_layout );
+            }
+        } else {
+            loaded = load_scene( scene, filename.c_str() );
+            scene->bvh_build_mode = params.bvh_build_mode;
+            scene->bvh_layout = params.bvh_layout;
+            // the cache copies the meshes it can bake
+            scene->bake_transforms = params.bake_transforms;
+            // rendered without what is missing, as a raytrace with -r is
+            if ( loaded && !cache->load( scene ) ) {
+                std::cout << "Error loading a texture or mesh of scene " << filename
+                          << ", rendering without it.\n";
+            }
+            if ( loaded ) {
+                scene->merge_triangles();
+            }
+        }
+    } catch ( std::bad_alloc const& ) {
+        std::cout << "Out of memory error while loading scene.\n";
+        loaded = false;
+    }
+
+    if ( !loaded ) {
+        std::cout << "Error loading scene " << filename << ".\n";
+        delete scene;
+        return 0;
+    }
+
+    // only bakes and updates the scene, the pool traces it
+    scene->bake_transforms = params.bake_transforms;
+    Raytracer raytracer;
+    raytracer.initialize( scene, 1, 1 );
+    return scene;
+}
+
+// waits for the oldest job in flight and reports it, freeing its scene
+// once all the scene's jobs are done. returns whether it was saved.
+static bool finish_job( RenderPool* pool, std::deque< BatchJob* >* in_flight, SceneList* scenes,
+                        size_t num_done, size_t num_jobs )
+{
+    BatchJob* job = in_flight->front();
+    in_flight->pop_front();
+    pool->wait( job );
+
+    if ( job->saved ) {
+        std::cout << "Rendered '" << job->output_filename << "' (" << num_done + 1 << " of "
+                  << num_jobs << ").\n";
+    } else {
+        std::cout << "Error saving '" << job->output_filename << "'.\n";
+    }
+
+    LoadedScene& loaded = ( *scenes )[job->scene_index];
+    if ( --loaded.remaining == 0 ) {
+        delete loaded.scene;
+        loaded.scene = 0;
+    }
+    return job->saved;
+}
+
+bool batch_render( const BatchParams& params )
+{
+    JobList jobs;
+    FilenameList scene_filenames;
+    bool ok = read_manifest( params.manifest_filename, &jobs, &scene_filenames );
+    if ( ok && jobs.empty() ) {
+        std::cout << "No jobs in manifest '" << params.manifest_filename << "'.\n";
+        ok = false;
+    }
+    if ( !ok ) {
+        for ( size_t i = 0; i < jobs.size(); ++i ) {
+            delete jobs[i];
+        }
+        return false;
+    }
+
+    std::stable_sort( jobs.begin(), jobs.end(), SceneOrder() );
+
+    SceneList scenes( scene_filenames.size() );
+    for ( size_t i = 0; i < scenes.size(); ++i ) {
+        scenes[i].scene = 0;
+        scenes[i].remaining = 0;
+        scenes[i].failed = false;
+    }
+    for ( size_t i = 0; i < jobs.size(); ++i ) {
+        ++scenes[jobs[i]->scene_index].remaining;
+    }
+
+    // destroyed after the pool, as its threads may still read the scenes
+    AssetCache cache;
+    RenderPool pool;
+    size_t num_threads = pool.start( params.num_threads, params.wavefront );
+    if ( num_threads == 0 ) {
+        std::cout << "Cannot start the batch's threads.\n";
+        for ( size_t i = 0; i < jobs.size(); ++i ) {
+            delete jobs[i];
+        }
+        return false;
+    }
+    std::cout << "Rendering " << jobs.size() << " jobs of " << scenes.size() << " scenes with "
+              << num_threads << " threads.\n";
+
+    std::deque< BatchJob* > in_flight;
+    size_t max_in_flight = JOBS_PER_THREAD * num_threads;
+    size_t num_done = 0;
+    size_t num_saved = 0;
+
+    for ( size_t i = 0; i < jobs.size(); ++i ) {
+        BatchJob* job = jobs[i];
+        LoadedScene& loaded = scenes[job->scene_index];
+
+        // load each scene at its first job, while the threads trace the
+        // jobs of the one before
+        if ( !loaded.scene && !loaded.failed ) {
+            loaded.scene = load_batch_scene( params, scene_filenames[job->scene_index], &cache );
+            loaded.failed = !loaded.scene;
+        }
+        if ( loaded.failed ) {
+            std::cout << "Skipping '" << job->output_filename << "', its scene failed to load.\n";
+            ++num_done;
+            continue;
+        }
+
+        while ( in_flight.size() >= max_in_flight ) {
+            num_saved += finish_job( &pool, &in_flight, &scenes, num_done++, jobs.size() );
+        }
+
+        job->scene = loaded.scene;
+        job->camera = loaded.scene->camera;
+        job->camera.aspect = real_t( job->width ) / real_t( job->height );
+        pool.submit( job );
+        in_flight.push_back( job );
+    }
+    while ( !in_flight.empty() ) {
+        num_saved += finish_job( &pool, &in_flight, &scenes, num_done++, jobs.size() );
+    }
+    pool.stop();
+
+    std::cout << "Rendered " << num_saved << " of " << jobs.size() << " jobs. Loaded "
+              << cache.num_loaded() << " texture and mesh files, and shared them "
+              << cache.num_shared() << " times.\n";
+
+    for ( size_t i = 0; i < jobs.size(); ++i ) {
+        delete jobs[i];
+    }
+    return num_saved == jobs.size();
+}
+
+} /* _462 */
@@ -0,0 +1,47 @@
+/**
+ * @file batch.hpp
+ * @brief Rendering a manifest of jobs in one process.
+ *
+ * A manifest lists images to render, each a scene file, a size and an
+ * output file. They are rendered by one pool of threads, loading each
+ * scene once for all its jobs and each texture and mesh file once for
+ * all the scenes using it, and the next scene loads while the threads
+ * trace the last one's images.
+ */
+
+#ifndef _462_RAYTRACER_BATCH_HPP_
+#define _462_RAYTRACER_BATCH_HPP_
+
+#include "scene/mesh.hpp"
+#include <cstdlib>
+
+namespace _462 {
+
+struct BatchParams
+{
+    // the manifest, one job per line as
+    //   scene_file width height output_file [samples]
+    // with blank lines and lines starting with # skipped
+    const char* manifest_filename;
+    // the number of threads tracing, shared by every job
+    int num_threads;
+    // how the scenes' and meshes' hierarchies are built and stored
+    Bvh::BuildMode bvh_build_mode;
+    Mesh::BvhLayout bvh_layout;
+    // whether to trace a bounce at a time
+    bool wavefront;
+    // whether to bake static geometries' transforms into their vertices
+    bool bake_transforms;
+};
+
+/**
+ * Renders every job of the manifest to its PNG output file. Jobs are
+ * grouped by scene file, in the order each scene first appears. A scene
+ * that fails to load fails its jobs, and the rest still render.
+ * @return true if every job was rendered and saved.
+ */
+bool batch_render( const BatchParams& params );
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_BATCH_HPP_ */
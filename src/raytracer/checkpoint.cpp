@@ -0,0 +1,172 @@
+/**
+ * @file checkpoint.cpp
+ * @brief Saving and restoring partially complete raytraces.
+ *
+ * File layout, all integers are native endian:
+ *   magic "RTCK", version
+ *   width, height, length of the scene filename, the scene filename
+ *   one byte per row, nonzero if the row is complete
+ *   for each complete row, bottom to top:
+ *     4 * width bytes of RGBA
+ *     a flag byte, followed by 3 * width floats of RGB if nonzero
+ */
+
+#include "raytracer/checkpoint.hpp"
+#include "raytracer/raytracer.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace _462 {
+
+static const char MAGIC[4] = { 'R', 'T', 'C', 'K' };
+static const int VERSION = 1;
+
+static bool write_int( FILE* fp, int val )
+{
+    return fwrite( &val, sizeof val, 1, fp ) == 1;
+}
+
+static bool read_int( FILE* fp, int* val )
+{
+    return fread( val, sizeof *val, 1, fp ) == 1;
+}
+
+bool checkpoint_save( const char* filename, const CheckpointParams& params,
+                      const Raytracer& raytracer,
+                      const unsigned char* buffer, const float* hdr_buffer )
+{
+    std::string tmpname = std::string( filename ) + ".tmp";
+    FILE* fp = fopen( tmpname.c_str(), "wb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    int width = params.width;
+    int height = params.height;
+    int name_len = strlen( params.scene_filename );
+
+    bool ok = fwrite( MAGIC, sizeof MAGIC, 1, fp ) == 1
+        && write_int( fp, VERSION )
+        && write_int( fp, width )
+        && write_int( fp, height )
+        && write_int( fp, name_len )
+        && fwrite( params.scene_filename, 1, name_len, fp ) == (size_t) name_len;
+
+    std::vector< unsigned char > done( height );
+    for ( int y = 0; y < height; ++y ) {
+        done[y] = raytracer.is_row_done( y );
+    }
+    ok = ok && fwrite( &done[0], 1, height, fp ) == (size_t) height;
+
+    unsigned char has_hdr = hdr_buffer != 0;
+    for ( int y = 0; ok && y < height; ++y ) {
+        if ( !done[y] )
+            continue;
+        ok = fwrite( buffer + 4 * width * y, 4, width, fp ) == (size_t) width
+            && fwrite( &has_hdr, 1, 1, fp ) == 1
+            && ( !has_hdr || fwrite( hdr_buffer + 3 * width * y, 3 * sizeof( float ), width, fp ) == (size_t) width );
+    }
+
+    ok = fclose( fp ) == 0 && ok;
+    if ( !ok ) {
+        remove( tmpname.c_str() );
+        return false;
+    }
+
+#ifdef _WIN32
+    // windows will not rename over an existing file
+    remove( filename );
+#endif
+    return rename( tmpname.c_str(), filename ) == 0;
+}
+
+bool checkpoint_load( const char* filename, const CheckpointParams& params,
+                      Raytracer* raytracer,
+                      unsigned char* buffer, float* hdr_buffer )
+{
+    FILE* fp = fopen( filename, "rb" );
+    if ( !fp ) {
+        std::cout << "No checkpoint '" << filename << "' to resume from.\n";
+        return false;
+    }
+
+    char magic[sizeof MAGIC];
+    int version, width, height, name_len;
+    bool ok = fread( magic, sizeof magic, 1, fp ) == 1
+        && memcmp( magic, MAGIC, sizeof MAGIC ) == 0
+        && read_int( fp, &version ) && version == VERSION
+        && read_int( fp, &width )
+        && read_int( fp, &height )
+        && read_int( fp, &name_len ) && name_len >= 0;
+
+    std::string scene_filename( ok ? name_len : 0, '\0' );
+    ok = ok && ( name_len == 0 || fread( &scene_filename[0], 1, name_len, fp ) == (size_t) name_len );
+
+    if ( !ok ) {
+        std::cout << "Checkpoint '" << filename << "' is not a valid checkpoint.\n";
+        fclose( fp );
+        return false;
+    }
+
+    if ( width != params.width || height != params.height || scene_filename != params.scene_filename ) {
+        std::cout << "Checkpoint '" << filename << "' is for " << scene_filename
+            << " at " << width << "x" << height << ", not resuming.\n";
+        fclose( fp );
+        return false;
+    }
+
+    std::vector< unsigned char > done( height );
+    ok = fread( &done[0], 1, height, fp ) == (size_t) height;
+
+    // read into scratch rows so a truncated file leaves the buffers alone
+    std::vector< unsigned char > rgba( 4 * width );
+    std::vector< float > rgb( 3 * width );
+    size_t num_restored = 0;
+    for ( int y = 0; ok && y < height; ++y ) {
+        if ( !done[y] )
+            continue;
+
+        unsigned char has_hdr;
+        ok = fread( &rgba[0], 4, width, fp ) == (size_t) width
+            && fread( &has_hdr, 1, 1, fp ) == 1
+            && ( !has_hdr || fread( &rgb[0], 3 * sizeof( float ), width, fp ) == (size_t) width );
+        if ( !ok )
+            break;
+
+        // rows saved without float data must be retraced to fill the hdr buffer
+        if ( hdr_buffer && !has_hdr )
+            continue;
+
+        memcpy( buffer + 4 * width * y, &rgba[0], rgba.size() );
+        if ( hdr_buffer ) {
+            memcpy( hdr_buffer + 3 * width * y, &rgb[0], rgb.size() * sizeof( float ) );
+        }
+        raytracer->set_row_done( y );
+        ++num_restored;
+    }
+
+    fclose( fp );
+
+    if ( !ok ) {
+        std::cout << "Checkpoint '" << filename << "' is truncated, resuming the rows read so far.\n";
+    }
+    std::cout << "Restored " << num_restored << " of " << height << " rows from '" << filename << "'.\n";
+    return true;
+}
+
+void checkpoint_gen_name( char* name, size_t len, const char* output )
+{
+    static const char* SUFFIX = ".ckpt";
+
+    assert( len > strlen( SUFFIX ) );
+    strncpy( name, output, len - strlen( SUFFIX ) - 1 );
+    name[len - strlen( SUFFIX ) - 1] = '\0';
+    strcat( name, SUFFIX );
+}
+
+} /* _462 */
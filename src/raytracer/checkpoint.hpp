@@ -0,0 +1,56 @@
+/**
+ * @file checkpoint.hpp
+ * @brief Saving and restoring partially complete raytraces.
+ */
+
+#ifndef _462_RAYTRACER_CHECKPOINT_HPP_
+#define _462_RAYTRACER_CHECKPOINT_HPP_
+
+#include <cstdlib>
+
+namespace _462 {
+
+class Raytracer;
+
+/**
+ * The parameters a checkpoint was rendered with. A checkpoint is only
+ * resumed if these match the current render.
+ */
+struct CheckpointParams
+{
+    // the scene file being rendered. not allocated, points to something static
+    const char* scene_filename;
+    // dimensions of the image
+    int width, height;
+};
+
+/**
+ * Writes the completed rows of the raytrace, their pixels from both buffers,
+ * and the render parameters to filename. The file is written to a temporary
+ * name first and then renamed, so an interrupted save never leaves a
+ * truncated checkpoint behind.
+ * @param hdr_buffer May be null.
+ * @return true on success, false on error.
+ */
+bool checkpoint_save( const char* filename, const CheckpointParams& params,
+                      const Raytracer& raytracer,
+                      const unsigned char* buffer, const float* hdr_buffer );
+
+/**
+ * Reads a checkpoint written by checkpoint_save. If its parameters match,
+ * the saved rows are copied into the buffers and marked as done in the
+ * raytracer, which must already be initialized, so only the missing rows
+ * are traced. Prints a message to stdout if the checkpoint is unusable.
+ * @param hdr_buffer May be null.
+ * @return true if the checkpoint was restored, false otherwise.
+ */
+bool checkpoint_load( const char* filename, const CheckpointParams& params,
+                      Raytracer* raytracer,
+                      unsigned char* buffer, float* hdr_buffer );
+
+// puts the default checkpoint filename for output into name, up to len characters
+void checkpoint_gen_name( char* name, size_t len, const char* output );
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_CHECKPOINT_HPP_ */
@@ -0,0 +1,400 @@
+/**
+ * @file distributed.cpp
+ * @brief Raytracing an image across several processes.
+ *
+ * Protocol, every integer is sent in network byte order:
+ *   worker -> coordinator: magic "RTWK", version
+ *   coordinator -> worker: image width, height
+ *   then repeatedly:
+ *     coordinator -> worker: tile x, y, width, height (width 0 to stop)
+ *     worker -> coordinator: tile x, y, width, height, then row by row
+ *       4 bytes of RGBA per pixel followed by 3 floats of linear RGB
+ *       per pixel, the floats sent as their bit patterns
+ */
+
+#include "raytracer/distributed.hpp"
+#include "raytracer/raytracer.hpp"
+#include "application/network.hpp"
+#include "scene/scene.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace _462 {
+
+static const char MAGIC[4] = { 'R', 'T', 'W', 'K' };
+static const int VERSION = 1;
+
+// how often the coordinator checks on spawned workers
+static const int POLL_INTERVAL = 100;
+
+struct Tile
+{
+    int x, y, width, height;
+};
+
+// bytes per pixel in a tile reply
+static const size_t PIXEL_SIZE = 4 + 3 * sizeof( float );
+
+struct WorkerConnection
+{
+    int sock;
+    // false until the hello message was received
+    bool greeted;
+    // whether a tile is out at this worker
+    bool busy;
+    Tile tile;
+};
+
+typedef std::deque< Tile > TileQueue;
+typedef std::vector< WorkerConnection > WorkerList;
+typedef std::vector< unsigned char > ByteList;
+
+static bool send_tile( int sock, const Tile& tile )
+{
+    return net_send_int( sock, tile.x ) && net_send_int( sock, tile.y )
+        && net_send_int( sock, tile.width ) && net_send_int( sock, tile.height );
+}
+
+static bool recv_tile( int sock, Tile* tile )
+{
+    return net_recv_int( sock, &tile->x ) && net_recv_int( sock, &tile->y )
+        && net_recv_int( sock, &tile->width ) && net_recv_int( sock, &tile->height );
+}
+
+static void put_float( unsigned char* dst, float f )
+{
+    unsigned int bits;
+    memcpy( &bits, &f, sizeof bits );
+    dst[0] = ( bits >> 24 ) & 0xff;
+    dst[1] = ( bits >> 16 ) & 0xff;
+    dst[2] = ( bits >> 8 ) & 0xff;
+    dst[3] = bits & 0xff;
+}
+
+static float get_float( const unsigned char* src )
+{
+    unsigned int bits = ( (unsigned int) src[0] << 24 ) | ( (unsigned int) src[1] << 16 )
+                      | ( (unsigned int) src[2] << 8 ) | (unsigned int) src[3];
+    float f;
+    memcpy( &f, &bits, sizeof f );
+    return f;
+}
+
+// traces a tile into the reply layout
+static void trace_tile( Raytracer* raytracer, const Tile& tile, unsigned char* pixels )
+{
+    std::vector< Color3 > colors( tile.width * tile.height );
+    if ( colors.empty() )
+        return;
+    raytracer->trace_tile( tile.x, tile.y, tile.width, tile.height, &colors[0] );
+    for ( size_t i = 0; i < colors.size(); ++i ) {
+        const Color3& color = colors[i];
+        color.to_array( pixels );
+        put_float( pixels + 4, float( color.r ) );
+        put_float( pixels + 8, float( color.g ) );
+        put_float( pixels + 12, float( color.b ) );
+        pixels += PIXEL_SIZE;
+    }
+}
+
+// copies a traced tile into the output buffers
+static void store_tile( const Tile& tile, const unsigned char* pixels, int width,
+                        unsigned char* buffer, float* hdr_buffer )
+{
+    for ( int y = tile.y; y < tile.y + tile.height; ++y ) {
+        for ( int x = tile.x; x < tile.x + tile.width; ++x ) {
+            size_t index = y * width + x;
+            memcpy( &buffer[4 * index], pixels, 4 );
+            if ( hdr_buffer ) {
+                hdr_buffer[3 * index + 0] = get_float( pixels + 4 );
+                hdr_buffer[3 * index + 1] = get_float( pixels + 8 );
+                hdr_buffer[3 * index + 2] = get_float( pixels + 12 );
+            }
+            pixels += PIXEL_SIZE;
+        }
+    }
+}
+
+// hands the next tile to a worker, returns false if sending failed
+static bool assign_tile( WorkerConnection* worker, TileQueue* pending )
+{
+    if ( pending->empty() )
+        return true;
+
+    worker->tile = pending->front();
+    pending->pop_front();
+    worker->busy = true;
+    return send_tile( worker->sock, worker->tile );
+}
+
+// closes a worker, putting its tile back in the queue
+static void drop_worker( WorkerList* workers, size_t i, TileQueue* pending )
+{
+    WorkerConnection& worker = ( *workers )[i];
+    if ( worker.busy ) {
+        std::cout << "Lost a worker, reassigning tile (" << worker.tile.x << ", " << worker.tile.y << ").\n";
+        pending->push_front( worker.tile );
+    }
+    net_close( worker.sock );
+    workers->erase( workers->begin() + i );
+}
+
+#ifndef _WIN32
+
+static pid_t spawn_worker( const char* program, const char* address, const char* scene_filename )
+{
+    pid_t pid = fork();
+    if ( pid == 0 ) {
+        execlp( program, program, "-w", address, scene_filename, (char*) 0 );
+        std::cout << "Cannot run worker '" << program << "'.\n";
+        _exit( 1 );
+    }
+    return pid;
+}
+
+// returns the number of spawned workers still running, reaping the rest
+static size_t reap_workers( std::vector< pid_t >* children, bool block )
+{
+    for ( size_t i = 0; i < children->size(); ) {
+        if ( waitpid( ( *children )[i], 0, block ? 0 : WNOHANG ) != 0 ) {
+            children->erase( children->begin() + i );
+        } else {
+            ++i;
+        }
+    }
+    return children->size();
+}
+
+#endif /* _WIN32 */
+
+bool distributed_coordinate( const CoordinatorParams& params, Scene* scene,
+                             Raytracer* raytracer, unsigned char* buffer, float* hdr_buffer )
+{
+    static const size_t PRINT_INTERVAL = 64;
+
+    int listener = net_listen( params.address );
+    if ( listener == -1 )
+        return false;
+
+    char address[256];
+    if ( !net_local_address( listener, address, sizeof address ) ) {
+        std::cout << "Cannot determine the coordinator address.\n";
+        net_close( listener );
+        return false;
+    }
+    std::cout << "Coordinating workers on " << address << ".\n";
+
+    // split the image into tiles, bottom row first like a regular raytrace
+    TileQueue pending;
+    for ( int y = 0; y < params.height; y += params.tile_size ) {
+        for ( int x = 0; x < params.width; x += params.tile_size ) {
+            Tile tile;
+            tile.x = x;
+            tile.y = y;
+            tile.width = std::min( params.tile_size, params.width - x );
+            tile.height = std::min( params.tile_size, params.height - y );
+            pending.push_back( tile );
+        }
+    }
+    size_t num_tiles = pending.size();
+    size_t num_done = 0;
+
+#ifndef _WIN32
+    std::vector< pid_t > children;
+    for ( int i = 0; i < params.num_local_workers; ++i ) {
+        pid_t pid = spawn_worker( params.program, address, params.scene_filename );
+        if ( pid > 0 ) {
+            children.push_back( pid );
+        }
+    }
+#endif
+    if ( params.num_local_workers == 0 ) {
+        std::cout << "Waiting for workers to connect.\n";
+    }
+
+    WorkerList workers;
+    ByteList pixels;
+
+    while ( num_done < num_tiles ) {
+
+        std::vector< int > socks( 1, listener );
+        for ( size_t i = 0; i < workers.size(); ++i ) {
+            socks.push_back( workers[i].sock );
+        }
+        bool* ready = new bool[socks.size()];
+        if ( !net_wait( &socks[0], ready, socks.size(), POLL_INTERVAL ) ) {
+            delete [] ready;
+            break;
+        }
+
+        // handle workers in reverse so dropping one keeps the indices valid
+        for ( size_t i = workers.size(); i-- > 0; ) {
+            if ( !ready[i + 1] )
+                continue;
+
+            WorkerConnection& worker = workers[i];
+
+            if ( !worker.greeted ) {
+                char magic[sizeof MAGIC];
+                int version;
+                if ( !net_recv( worker.sock, magic, sizeof magic )
+                     || memcmp( magic, MAGIC, sizeof MAGIC ) != 0
+                     || !net_recv_int( worker.sock, &version ) || version != VERSION
+                     || !net_send_int( worker.sock, params.width )
+                     || !net_send_int( worker.sock, params.height ) ) {
+                    drop_worker( &workers, i, &pending );
+                    continue;
+                }
+                worker.greeted = true;
+                if ( !assign_tile( &worker, &pending ) ) {
+                    drop_worker( &workers, i, &pending );
+                }
+                continue;
+            }
+
+            // anything but a reply to the current tile means the worker is gone
+            Tile tile;
+            if ( !worker.busy || !recv_tile( worker.sock, &tile )
+                 || memcmp( &tile, &worker.tile, sizeof tile ) != 0 ) {
+                drop_worker( &workers, i, &pending );
+                continue;
+            }
+
+            pixels.resize( tile.width * tile.height * PIXEL_SIZE );
+            if ( !net_recv( worker.sock, &pixels[0], pixels.size() ) ) {
+                drop_worker( &workers, i, &pending );
+                continue;
+            }
+
+            store_tile( tile, &pixels[0], params.width, buffer, hdr_buffer );
+            worker.busy = false;
+            if ( num_done++ % PRINT_INTERVAL == 0 ) {
+                printf( "Raytracing (tile %lu of %lu)...\n", num_done, num_tiles );
+            }
+
+            if ( !assign_tile( &worker, &pending ) ) {
+                drop_worker( &workers, i, &pending );
+            }
+        }
+
+        if ( ready[0] ) {
+            int sock = net_accept( listener );
+            if ( sock != -1 ) {
+                WorkerConnection worker;
+                worker.sock = sock;
+                worker.greeted = false;
+                worker.busy = false;
+                workers.push_back( worker );
+            }
+        }
+
+        delete [] ready;
+
+#ifndef _WIN32
+        size_t num_alive = reap_workers( &children, false );
+#else
+        size_t num_alive = 0;
+#endif
+
+        // nobody left to do the work, so finish it here
+        if ( workers.empty() && num_alive == 0 && params.num_local_workers > 0 && !pending.empty() ) {
+            std::cout << "No workers left, raytracing " << pending.size() << " tiles locally.\n";
+            while ( !pending.empty() ) {
+                Tile tile = pending.front();
+                pending.pop_front();
+                pixels.resize( tile.width * tile.height * PIXEL_SIZE );
+                trace_tile( raytracer, tile, &pixels[0] );
+                store_tile( tile, &pixels[0], params.width, buffer, hdr_buffer );
+                num_done++;
+            }
+        }
+    }
+
+    // tell everyone to stop
+    Tile stop = { 0, 0, 0, 0 };
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+        if ( workers[i].greeted )
+            send_tile( workers[i].sock, stop );
+        net_close( workers[i].sock );
+    }
+    net_close( listener );
+#ifndef _WIN32
+    reap_workers( &children, true );
+#endif
+
+    if ( num_done < num_tiles ) {
+        std::cout << "Distributed raytrace failed.\n";
+        return false;
+    }
+
+    printf( "Done raytracing!\n" );
+    return true;
+}
+
+bool distributed_work( const char* address, Scene* scene, Raytracer* raytracer )
+{
+    int sock = net_connect( address );
+    if ( sock == -1 )
+        return false;
+
+    int width, height;
+    if ( !net_send( sock, MAGIC, sizeof MAGIC ) || !net_send_int( sock, VERSION )
+         || !net_recv_int( sock, &width ) || !net_recv_int( sock, &height )
+         || width < 1 || height < 1 ) {
+        std::cout << "Handshake with coordinator failed.\n";
+        net_close( sock );
+        return false;
+    }
+
+    scene->camera.aspect = real_t( width ) / real_t( height );
+    if ( !raytracer->initialize( scene, width, height ) ) {
+        std::cout << "Raytracer initialization failed.\n";
+        net_close( sock );
+        return false;
+    }
+
+    ByteList pixels;
+    bool ok = true;
+    while ( true ) {
+        Tile tile;
+        if ( !recv_tile( sock, &tile ) ) {
+            ok = false;
+            break;
+        }
+        if ( tile.width == 0 )
+            break;
+
+        if ( tile.x < 0 || tile.y < 0 || tile.width < 0 || tile.height < 0
+             || tile.x + tile.width > width || tile.y + tile.height > height ) {
+            std::cout << "Invalid tile from coordinator.\n";
+            ok = false;
+            break;
+        }
+
+        pixels.resize( tile.width * tile.height * PIXEL_SIZE );
+        trace_tile( raytracer, tile, &pixels[0] );
+        if ( !send_tile( sock, tile ) || !net_send( sock, &pixels[0], pixels.size() ) ) {
+            ok = false;
+            break;
+        }
+    }
+
+    if ( !ok ) {
+        std::cout << "Lost connection to coordinator.\n";
+    }
+    net_close( sock );
+    return ok;
+}
+
+} /* _462 */
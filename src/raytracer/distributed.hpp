@@ -0,0 +1,57 @@
+/**
+ * @file distributed.hpp
+ * @brief Raytracing an image across several processes.
+ *
+ * A coordinator splits the image into tiles and hands them out one at a
+ * time to worker processes, which load the same scene and send back the
+ * traced pixels. Workers may be spawned locally or connect from elsewhere.
+ */
+
+#ifndef _462_RAYTRACER_DISTRIBUTED_HPP_
+#define _462_RAYTRACER_DISTRIBUTED_HPP_
+
+#include <cstdlib>
+
+namespace _462 {
+
+class Scene;
+class Raytracer;
+
+struct CoordinatorParams
+{
+    // the program to spawn local workers with, usually argv[0]
+    const char* program;
+    // the scene file the workers should load
+    const char* scene_filename;
+    // address to listen for workers on, see network.hpp
+    const char* address;
+    // the number of worker processes to spawn on this machine
+    int num_local_workers;
+    // dimensions of the image
+    int width, height;
+    // width and height of the tiles handed to workers
+    int tile_size;
+};
+
+/**
+ * Raytraces the image by handing tiles to workers until all are done. A tile
+ * whose worker disconnects or dies is given to another worker. If no worker
+ * is left, and none can still connect, the rest is traced in this process.
+ * @param raytracer Must be initialized for scene at the given size.
+ * @param buffer RGBA output, 4 bytes per pixel.
+ * @param hdr_buffer Linear RGB output, 3 floats per pixel. May be null.
+ * @return true on success, false on error.
+ */
+bool distributed_coordinate( const CoordinatorParams& params, Scene* scene,
+                             Raytracer* raytracer, unsigned char* buffer, float* hdr_buffer );
+
+/**
+ * Connects to the coordinator at address and traces the tiles it sends
+ * until told to stop. The scene and its assets must already be loaded.
+ * @return true if the coordinator ended the session normally.
+ */
+bool distributed_work( const char* address, Scene* scene, Raytracer* raytracer );
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_DISTRIBUTED_HPP_ */
@@ -0,0 +1,352 @@
+/**
+ * @file gbuffer.cpp
+ * @brief What every ray of an image hit, for re-shading it after only
+ *  materials or lights changed.
+ *
+ * File layout, all numbers are native endian:
+ *   magic "RTGB", version
+ *   scene key, width, height
+ *   number of lights, then each light's position when last shaded
+ *   number of nodes, then each node
+ *   number of shadow ray outcomes, then each outcome
+ */
+
+#include "raytracer/gbuffer.hpp"
+#include "raytracer/raytracer.hpp"
+#include "scene/scene_hash.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <exception>
+
+// arbitrary slop factor, as in Geometry::compute_specular
+#define EPSILON .000001
+
+namespace _462 {
+
+static const char MAGIC[4] = { 'R', 'T', 'G', 'B' };
+static const int VERSION = 1;
+
+// what shading needs as it walks the nodes
+struct GBuffer::ShadeContext
+{
+    const Scene* scene;
+    Geometry* const* geometries;
+    ShadowCache* shadow_cache;
+    // the node to shade next
+    size_t next;
+    // whether each light moved since the last shade
+    std::vector< bool > moved;
+    // the outcomes of this shade, replacing the last shade's
+    OutcomeList outcomes;
+};
+
+GBuffer::GBuffer()
+    : key( 0 ), width( 0 ), height( 0 ) { }
+
+unsigned int GBuffer::scene_key( const Scene& scene, size_t width, size_t height )
+{
+    SceneHash hash;
+    hash.add( &width, sizeof width );
+    hash.add( &height, sizeof height );
+
+    const Camera& camera = scene.camera;
+    hash.add( camera.position );
+    hash.add( camera.orientation );
+    hash.add( camera.fov );
+    hash.add( camera.near_clip );
+
+    hash.add_geometries( scene );
+
+    // refraction decides which rays are spawned, the rest of a material
+    // only how what they hit is shaded
+    Material* const* materials = scene.get_materials();
+    size_t num_materials = scene.num_materials();
+    hash.add( &num_materials, sizeof num_materials );
+    for ( size_t i = 0; i < num_materials; ++i ) {
+        hash.add( materials[i]->refractive_index );
+    }
+
+    int bounces = Raytracer::MAX_BOUNCES;
+    hash.add( &bounces, sizeof bounces );
+    return hash.hash;
+}
+
+bool GBuffer::matches( const Scene& scene, size_t width, size_t height ) const
+{
+    return !nodes.empty() && key == scene_key( scene, width, height );
+}
+
+void GBuffer::record( const Scene& scene, const Raytracer& raytracer, size_t width, size_t height )
+{
+    key = scene_key( scene, width, height );
+    this->width = width;
+    this->height = height;
+    nodes.clear();
+    outcomes.clear();
+
+    // nothing is shaded yet, so no light has moved
+    light_positions.clear();
+    for ( size_t i = 0; i < scene.num_lights(); ++i ) {
+        light_positions.push_back( scene.get_lights()[i].position );
+    }
+
+    Geometry* const* geometries = scene.get_geometries();
+    geometry_index.clear();
+    for ( size_t i = 0; i < scene.num_geometries(); ++i ) {
+        geometry_index.push_back( std::make_pair( geometries[i], (unsigned int) i ) );
+    }
+    std::sort( geometry_index.begin(), geometry_index.end() );
+
+    Vector3 eye = scene.camera.get_position();
+    for ( size_t y = 0; y < height; ++y ) {
+        for ( size_t x = 0; x < width; ++x ) {
+            record_ray( scene, eye, eye, raytracer.primary_ray( x, y ), 0 );
+        }
+    }
+
+    geometry_index.clear();
+}
+
+/**
+ * Traces the ray from start, which is origin for viewing rays and just off
+ * it for the others, then the rays spawned where it hit, level bounces
+ * after the viewing ray.
+ */
+void GBuffer::record_ray( const Scene& scene, const Vector3& origin, const Vector3& start,
+                          const Vector3& dir, int level )
+{
+    Node node;
+    node.dir = dir;
+    node.num_children = 0;
+    node.first_outcome = 0;
+    node.num_outcomes = 0;
+
+    real_t t = -1.0;
+    const Geometry* geo = scene.intersect( dir, start, &t );
+    if ( !geo ) {
+        node.position = origin;
+        memset( &node.hit, 0, sizeof node.hit );
+        node.geometry = NO_GEOMETRY;
+        nodes.push_back( node );
+        return;
+    }
+
+    node.position = origin + dir * t;
+    geo->get_hit( &node.hit );
+    node.geometry = std::lower_bound( geometry_index.begin(), geometry_index.end(),
+                                      std::make_pair( geo, 0u ) )->second;
+    size_t index = nodes.size();
+    nodes.push_back( node );
+    if ( level == Raytracer::MAX_BOUNCES )
+        return;
+
+    // spawn before tracing further, which overwrites the hit state
+    SpecularRays rays;
+    geo->specular_rays( geo->normal_of( node.position ), dir, &rays );
+    nodes[index].num_children = rays.num;
+    for ( size_t i = 0; i < rays.num; ++i ) {
+        record_ray( scene, node.position, node.position + EPSILON * rays.dir[i], rays.dir[i], level + 1 );
+    }
+}
+
+void GBuffer::shade( const Scene& scene, unsigned char* buffer, float* hdr_buffer, ShadowCache* shadow_cache )
+{
+    ShadeContext ctx;
+    ctx.scene = &scene;
+    ctx.geometries = scene.get_geometries();
+    ctx.shadow_cache = shadow_cache;
+    ctx.next = 0;
+
+    const PointLight* lights = scene.get_lights();
+    for ( size_t i = 0; i < scene.num_lights(); ++i ) {
+        ctx.moved.push_back( i >= light_positions.size() || lights[i].position != light_positions[i] );
+    }
+    ctx.outcomes.reserve( outcomes.size() );
+
+    for ( size_t i = 0; i < width * height; ++i ) {
+        Color3 color = shade_viewing( ctx );
+        color.to_array( &buffer[4 * i] );
+        if ( hdr_buffer ) {
+            hdr_buffer[3 * i] = color.r;
+            hdr_buffer[3 * i + 1] = color.g;
+            hdr_buffer[3 * i + 2] = color.b;
+        }
+    }
+    assert( ctx.next == nodes.size() );
+
+    outcomes.swap( ctx.outcomes );
+    light_positions.clear();
+    for ( size_t i = 0; i < scene.num_lights(); ++i ) {
+        light_positions.push_back( lights[i].position );
+    }
+}
+
+Color3 GBuffer::shade_viewing( ShadeContext& ctx )
+{
+    Node& node = nodes[ctx.next++];
+    if ( node.geometry == NO_GEOMETRY )
+        return ctx.scene->background_color;
+
+    const Geometry* geo = ctx.geometries[node.geometry];
+    geo->set_hit( node.hit );
+    Color3 specular = geo->get_specular();
+    SpecularRays rays;
+    geo->specular_rays( geo->normal_of( node.position ), node.dir, &rays );
+
+    // refractive surfaces only show their specular color to the camera
+    if ( geo->get_refractive_index() != 0 )
+        return shade_children( ctx, rays, node.num_children, 1 );
+
+    Color3 color = shade_hit( ctx, &node, geo );
+    color += specular * shade_children( ctx, rays, node.num_children, 1 );
+    return color;
+}
+
+Color3 GBuffer::shade_children( ShadeContext& ctx, const SpecularRays& rays, unsigned int num_children, int level )
+{
+    assert( num_children == rays.num );
+    Color3 colors[2];
+    for ( size_t i = 0; i < num_children; ++i ) {
+        colors[i] = shade_child( ctx, rays, level );
+    }
+    return rays.combine( colors );
+}
+
+Color3 GBuffer::shade_child( ShadeContext& ctx, const SpecularRays& rays, int level )
+{
+    Node& node = nodes[ctx.next++];
+    if ( node.geometry == NO_GEOMETRY )
+        return rays.miss( ctx.scene->background_color );
+
+    const Geometry* geo = ctx.geometries[node.geometry];
+    geo->set_hit( node.hit );
+    Color3 color = shade_hit( ctx, &node, geo );
+    if ( level == Raytracer::MAX_BOUNCES )
+        return rays.last_bounce( color );
+
+    // everything from this hit before its children overwrite the hit state
+    Color3 specular = geo->get_specular();
+    SpecularRays spawned;
+    geo->specular_rays( geo->normal_of( node.position ), node.dir, &spawned );
+    Color3 seen = shade_children( ctx, spawned, node.num_children, level + 1 );
+    return rays.bounce( color, specular, seen );
+}
+
+Color3 GBuffer::shade_hit( ShadeContext& ctx, Node* node, const Geometry* geo )
+{
+    ShadowLog log;
+    log.previous = node->num_outcomes > 0 ? &outcomes[node->first_outcome] : 0;
+    log.num_previous = node->num_outcomes;
+    log.moved = &ctx.moved;
+    log.outcomes = &ctx.outcomes;
+
+    size_t first = ctx.outcomes.size();
+    ctx.shadow_cache->log = &log;
+    Color3 color = geo->color_at_pixel( ctx.scene, node->position, ctx.shadow_cache );
+    ctx.shadow_cache->log = 0;
+
+    std::sort( ctx.outcomes.begin() + first, ctx.outcomes.end() );
+    node->first_outcome = first;
+    node->num_outcomes = ctx.outcomes.size() - first;
+    return color;
+}
+
+size_t GBuffer::num_hits() const
+{
+    return nodes.size();
+}
+
+template< typename T >
+static bool write_list( FILE* fp, const std::vector< T >& list )
+{
+    size_t num = list.size();
+    return fwrite( &num, sizeof num, 1, fp ) == 1
+        && ( num == 0 || fwrite( &list[0], sizeof( T ), num, fp ) == num );
+}
+
+template< typename T >
+static bool read_list( FILE* fp, std::vector< T >* list )
+{
+    size_t num;
+    if ( fread( &num, sizeof num, 1, fp ) != 1 )
+        return false;
+    try {
+        list->resize( num );
+    } catch ( std::exception const& ) {
+        return false;
+    }
+    return num == 0 || fread( &( *list )[0], sizeof( T ), num, fp ) == num;
+}
+
+bool GBuffer::save( const char* filename ) const
+{
+    std::string tmpname = std::string( filename ) + ".tmp";
+    FILE* fp = fopen( tmpname.c_str(), "wb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    bool ok = fwrite( MAGIC, sizeof MAGIC, 1, fp ) == 1
+        && fwrite( &VERSION, sizeof VERSION, 1, fp ) == 1
+        && fwrite( &key, sizeof key, 1, fp ) == 1
+        && fwrite( &width, sizeof width, 1, fp ) == 1
+        && fwrite( &height, sizeof height, 1, fp ) == 1
+        && write_list( fp, light_positions )
+        && write_list( fp, nodes )
+        && write_list( fp, outcomes );
+
+    ok = fclose( fp ) == 0 && ok;
+    if ( !ok ) {
+        remove( tmpname.c_str() );
+        return false;
+    }
+
+#ifdef _WIN32
+    // windows will not rename over an existing file
+    remove( filename );
+#endif
+    return rename( tmpname.c_str(), filename ) == 0;
+}
+
+bool GBuffer::load( const char* filename )
+{
+    FILE* fp = fopen( filename, "rb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    // read into scratch lists so a truncated file leaves the buffer alone
+    char magic[sizeof MAGIC];
+    int version;
+    unsigned int new_key;
+    size_t new_width, new_height;
+    std::vector< Vector3 > new_light_positions;
+    NodeList new_nodes;
+    OutcomeList new_outcomes;
+    bool ok = fread( magic, sizeof magic, 1, fp ) == 1
+        && memcmp( magic, MAGIC, sizeof MAGIC ) == 0
+        && fread( &version, sizeof version, 1, fp ) == 1 && version == VERSION
+        && fread( &new_key, sizeof new_key, 1, fp ) == 1
+        && fread( &new_width, sizeof new_width, 1, fp ) == 1
+        && fread( &new_height, sizeof new_height, 1, fp ) == 1
+        && read_list( fp, &new_light_positions )
+        && read_list( fp, &new_nodes )
+        && read_list( fp, &new_outcomes );
+    fclose( fp );
+    if ( !ok )
+        return false;
+
+    key = new_key;
+    width = new_width;
+    height = new_height;
+    light_positions.swap( new_light_positions );
+    nodes.swap( new_nodes );
+    outcomes.swap( new_outcomes );
+    return true;
+}
+
+} /* _462 */
@@ -0,0 +1,121 @@
+/**
+ * @file gbuffer.hpp
+ * @brief What every ray of an image hit, for re-shading it after only
+ *  materials or lights changed.
+ */
+
+#ifndef _462_RAYTRACER_GBUFFER_HPP_
+#define _462_RAYTRACER_GBUFFER_HPP_
+
+#include "scene/scene.hpp"
+#include <vector>
+
+namespace _462 {
+
+class Raytracer;
+
+/**
+ * The tree of viewing, reflected and refracted rays of every pixel, with
+ * where each ray hit, the geometry and its hit state. Which rays are
+ * spawned depends only on the camera, the geometry and the refractive
+ * indices, so the image can be shaded again from the recorded hits with
+ * other material colors and lights without tracing any of them. The
+ * outcome of every shadow ray is kept too, so only the shadow rays to
+ * lights that moved are traced again.
+ */
+class GBuffer
+{
+public:
+
+    GBuffer();
+
+    // whether the hits were recorded for the scene's camera, geometry and
+    // refractive indices as they are now, at this image size
+    bool matches( const Scene& scene, size_t width, size_t height ) const;
+
+    /**
+     * Traces the rays of every pixel, replacing what was recorded.
+     * @param raytracer Must be initialized for scene at the given size.
+     */
+    void record( const Scene& scene, const Raytracer& raytracer, size_t width, size_t height );
+
+    /**
+     * Shades the recorded hits with the scene's current materials and
+     * lights, exactly as Raytracer::trace_pixel would. Shadow rays to lights
+     * that did not move since the last shade are answered from then, and
+     * the rest are traced through shadow_cache.
+     * @param buffer RGBA output, 4 bytes per pixel.
+     * @param hdr_buffer Linear RGB output, 3 floats per pixel. May be null.
+     */
+    void shade( const Scene& scene, unsigned char* buffer, float* hdr_buffer, ShadowCache* shadow_cache );
+
+    // the number of rays recorded
+    size_t num_hits() const;
+
+    /**
+     * Writes the hits and shadow ray outcomes to filename, through a
+     * temporary file so an interrupted save leaves no truncated buffer.
+     * @return true on success, false on error.
+     */
+    bool save( const char* filename ) const;
+
+    /**
+     * Replaces the buffer with the one in filename.
+     * @return true on success, false if it could not be read.
+     */
+    bool load( const char* filename );
+
+private:
+
+    // a ray, in depth first order after the ray that spawned it
+    struct Node
+    {
+        // where the ray hit and its direction
+        Vector3 position;
+        Vector3 dir;
+        HitRecord hit;
+        // index of the geometry hit, or NO_GEOMETRY
+        unsigned int geometry;
+        // the number of rays spawned at the hit, which follow it
+        unsigned int num_children;
+        // the range of outcomes of the shadow rays traced from the hit
+        unsigned int first_outcome;
+        unsigned int num_outcomes;
+    };
+
+    struct ShadeContext;
+
+    void record_ray( const Scene& scene, const Vector3& origin, const Vector3& start,
+                     const Vector3& dir, int level );
+    // the color of the next viewing ray
+    Color3 shade_viewing( ShadeContext& ctx );
+    // the specular color seen through rays, whose nodes come next
+    Color3 shade_children( ShadeContext& ctx, const SpecularRays& rays, unsigned int num_children, int level );
+    // what the next node contributes to the parent that spawned it with rays
+    Color3 shade_child( ShadeContext& ctx, const SpecularRays& rays, int level );
+    // the color at the hit of node, whose hit state must be set
+    Color3 shade_hit( ShadeContext& ctx, Node* node, const Geometry* geo );
+
+    // the key of the scene's camera, geometries and refractive indices
+    static unsigned int scene_key( const Scene& scene, size_t width, size_t height );
+
+    static const unsigned int NO_GEOMETRY = ~0u;
+
+    typedef std::vector< Node > NodeList;
+    typedef std::vector< unsigned int > OutcomeList;
+
+    unsigned int key;
+    size_t width, height;
+    NodeList nodes;
+    // the outcomes of each node's shadow rays from the last shade, see
+    // ShadowLog
+    OutcomeList outcomes;
+    // where the lights were in the last shade
+    std::vector< Vector3 > light_positions;
+    // the index of each geometry, while recording
+    std::vector< std::pair< const Geometry*, unsigned int > > geometry_index;
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_GBUFFER_HPP_ */
@@ -12,10 +12,20 @@
 #include "application/scene_loader.hpp"
 #include "application/opengl.hpp"
 #include "scene/scene.hpp"
+#include "scene/visibility_cache.hpp"
+#include "scene/snapshot.hpp"
+#include "raytracer/gbuffer.hpp"
 #include "raytracer/raytracer.hpp"
+#include "raytracer/background.hpp"
+#include "raytracer/checkpoint.hpp"
+#include "raytracer/distributed.hpp"
+#include "raytracer/server.hpp"
+#include "raytracer/batch.hpp"
 
+#include <SDL/SDL.h>
 #include <iostream>
 #include <cstring>
+#include <cstdio>
 
 namespace _462 {
 
@@ -23,6 +33,11 @@ namespace _462 {
 #define DEFAULT_HEIGHT 600
 
 #define BUFFER_SIZE(w,h) ( (size_t) ( 4 * (w) * (h) ) )
+#define HDR_BUFFER_SIZE(w,h) ( (size_t) ( 3 * (w) * (h) * sizeof( float ) ) )
+
+#define DEFAULT_TILE_SIZE 32
+#define DEFAULT_THREADS 1
+#define DEFAULT_COORDINATOR_ADDRESS "127.0.0.1:0"
 
 #define KEY_RAYTRACE SDLK_r
 #define KEY_SCREENSHOT SDLK_f
@@ -50,6 +65,45 @@ struct Options
     const char* output_filename;
     // window dimensions
     int width, height;
+    // seconds between checkpoints of a raytrace without a window, 0 for none
+    real_t checkpoint_interval;
+    // whether to resume a raytrace without a window from its checkpoint
+    bool resume;
+    // not allocated, the name this program was run with
+    const char* program;
+    // number of local worker processes to distribute a raytrace to
+    int num_workers;
+    // not allocated, address to accept remote workers on, null for none
+    const char* listen_address;
+    // not allocated, coordinator to work for, null if not a worker
+    const char* worker_address;
+    // not allocated, address to serve render requests on, null for none
+    const char* serve_address;
+    // whether the input file is a manifest of jobs to render in one process
+    bool batch;
+    // width and height of the tiles handed to workers
+    int tile_size;
+    // number of frames of the scene's camera path to render, 0 for a still
+    int num_frames;
+    // how to build hierarchies, -1 for lbvh with a window and sah without
+    int bvh_build_mode;
+    // how meshes store their hierarchies
+    Mesh::BvhLayout bvh_layout;
+    // whether to time the raytrace with each hierarchy layout
+    bool benchmark;
+    // whether to trace a bounce at a time in sorted order
+    bool wavefront;
+    // whether to bake static geometries' transforms into their vertices
+    bool bake_transforms;
+    // not allocated, file of baked shadow rays to reuse and add to, null for none
+    const char* visibility_filename;
+    // number of threads raytracing in the background with a window
+    int num_threads;
+    // not allocated, file of recorded hits to re-shade from, null for none
+    const char* gbuffer_filename;
+    // not allocated, file to save the loaded scene to instead of
+    // raytracing, null for none
+    const char* snapshot_filename;
 };
 
 class RaytracerApplication : public Application
@@ -57,8 +111,9 @@ class RaytracerApplication : public Application
 public:
 
     RaytracerApplication( const Options& opt )
-        : options( opt ), buffer( 0 ), buf_width( 0 ), buf_height( 0 ), raytracing( false ) { }
-    virtual ~RaytracerApplication() { free( buffer ); }
+        : options( opt ), buffer( 0 ), hdr_buffer( 0 ), buf_width( 0 ), buf_height( 0 ), raytracing( false ),
+          visibility_rays( 0 ), visibility_baked( 0 ), from_snapshot( false ) { }
+    virtual ~RaytracerApplication() { free( buffer ); free( hdr_buffer ); }
 
     virtual bool initialize();
     virtual void destroy();
@@ -69,13 +124,35 @@ public:
     // flips raytracing, does any necessary initialization
     void toggle_raytracing( int width, int height );
     // writes the current raytrace buffer to the output file
-    void output_image();
-
+    bool output_image();
+    // writes the current raytrace buffer to the given file
+    bool save_image( const char* filename );
+    // raytraces each frame of the camera path to numbered output files
+    bool raytrace_animation();
+    bool raytrace_benchmark();
+    // raytraces to completion, resuming from and periodically saving a checkpoint
+    void raytrace_checkpointed();
+    // raytraces to completion by handing tiles to worker processes
+    bool raytrace_distributed();
+    // re-shades the hits recorded in the g-buffer file if they are still
+    // valid, otherwise records them, and saves the file
+    void raytrace_gbuffer();
+    // loads the visibility cache, or starts baking it if it doesn't match,
+    // and sets it on tracer
+    void start_visibility_cache( Raytracer* tracer );
+    // adds the shadow rays of tracer's finished raytrace to the visibility
+    // cache and saves it
+    void finish_visibility_cache( const Raytracer& tracer );
+
+    // raytraces without a window
     Raytracer raytracer;
 
     // the scene to render
     Scene scene;
 
+    // raytraces with a window, so tracing never holds up a frame
+    BackgroundRaytrace background;
+
     // options
     Options options;
 
@@ -84,6 +161,8 @@ public:
 
     // the image buffer for raytracing
     unsigned char* buffer;
+    // the unclamped linear colors of the raytrace, 3 floats per pixel
+    float* hdr_buffer;
     // width and height of the buffer
     int buf_width, buf_height;
 // true if we are in raytrace mode.
@@ -92,6 +171,15 @@ public:
     bool raytracing;
     // false if there is more raytracing to do
     bool raytrace_finished;
+
+    // baked shadow rays, used if options.visibility_filename is set
+    VisibilityCache visibility_cache;
+    // the raytracer's shadow ray counts when the raytrace started
+    unsigned long visibility_rays, visibility_baked;
+
+    // whether the scene was opened from a snapshot, with its textures and
+    // meshes already loaded
+    bool from_snapshot;
 };
 
 bool RaytracerApplication::initialize()
@@ -107,20 +195,29 @@ bool RaytracerApplication::initialize()
 
         // load all textures
         for ( size_t i = 0; i < scene.num_materials(); ++i ) {
-            if ( !materials[i]->load() || ( load_gl && !materials[i]->create_gl_data() ) ) {
+            if ( ( !from_snapshot && !materials[i]->load() ) || ( load_gl && !materials[i]->create_gl_data() ) ) {
                 std::cout << "Error loading texture, aborting.\n";
                 return false;
             }
         }
 
-        // load all meshes
+        // load all meshes, a snapshot's come with their binary hierarchies
         for ( size_t i = 0; i < scene.num_meshes(); ++i ) {
-            if ( !meshes[i]->load() || ( load_gl && !meshes[i]->create_gl_data() ) ) {
+            if ( from_snapshot ) {
+                meshes[i]->set_bvh_layout( scene.bvh_layout );
+            }
+            if ( ( !from_snapshot && !meshes[i]->load( scene.bvh_build_mode, scene.bvh_layout ) )
+                 || ( load_gl && !meshes[i]->create_gl_data() ) ) {
                 std::cout << "Error loading mesh, aborting.\n";
                 return false;
             }
         }
 
+        // a snapshot's triangles were merged before it was saved
+        if ( !from_snapshot ) {
+            scene.merge_triangles();
+        }
+
     } catch ( std::bad_alloc const& ) {
         std::cout << "Out of memory error while initializing scene\n.";
         return false;
@@ -161,21 +258,35 @@ bool RaytracerApplication::initialize()
 
 void RaytracerApplication::destroy()
 {
-
+    background.stop();
 }
 
 void RaytracerApplication::update( real_t delta_time )
 {
+    camera_control.update( delta_time );
+    const Camera& camera = camera_control.camera;
+
     if ( raytracing ) {
-        // do part of the raytrace
+        // moving the camera restarts the raytrace from the new view, with
+        // the last image reprojected into it
+        if ( camera.position != scene.camera.position || camera.orientation != scene.camera.orientation ) {
+            scene.camera.position = camera.position;
+            scene.camera.orientation = camera.orientation;
+            background.start( scene.camera );
+            raytrace_finished = false;
+        }
+
+        // show the rows the workers have finished
         if ( !raytrace_finished ) {
             assert( buffer );
-            raytrace_finished = raytracer.raytrace( buffer, &delta_time );
+            raytrace_finished = background.present( buffer, hdr_buffer );
+            if ( raytrace_finished ) {
+                printf( "Done raytracing!\n" );
+                finish_visibility_cache( *background.get_raytracer( 0 ) );
+            }
         }
     } else {
-        // copy camera over from camera control (if not raytracing)
-        camera_control.update( delta_time );
-        scene.camera = camera_control.camera;
+        scene.camera = camera;
     }
 }
 
@@ -219,9 +330,7 @@ void RaytracerApplication::handle_event( const SDL_Event& event )
 {
     int width, height;
 
-    if ( !raytracing ) {
-        camera_control.handle_event( this, event );
-    }
+    camera_control.handle_event( this, event );
 
     switch ( event.type )
     {
@@ -253,9 +362,16 @@ void RaytracerApplication::toggle_raytracing( int width, int height )
         // only re-allocate if the dimensions changed
         if ( buf_width != width || buf_height != height ) {
             free( buffer );
+            free( hdr_buffer );
             buffer = (unsigned char*) malloc( BUFFER_SIZE( width, height ) );
-            if ( !buffer ) {
+            hdr_buffer = (float*) malloc( HDR_BUFFER_SIZE( width, height ) );
+            if ( !buffer || !hdr_buffer ) {
                 std::cout << "Unable to allocate buffer.\n";
+                free( buffer );
+                free( hdr_buffer );
+                buffer = 0;
+                hdr_buffer = 0;
+                buf_width = buf_height = 0;
                 return; // leave untoggled since we have no buffer.
             }
             buf_width = width;
@@ -265,19 +381,39 @@ void RaytracerApplication::toggle_raytracing( int width, int height )
         // initialize the raytracer (first make sure camera aspect is correct)
         scene.camera.aspect = real_t( width ) / real_t( height );
 
-        if ( !raytracer.initialize( &scene, width, height ) ) {
-            std::cout << "Raytracer initialization failed.\n";
-            return; // leave untoggled since initialization failed.
+        if ( options.open_window ) {
+            // trace on worker threads, which the window shows as they go
+            if ( !background.initialize( &scene, width, height, options.num_threads ) ) {
+                std::cout << "Raytracer initialization failed.\n";
+                return; // leave untoggled since initialization failed.
+            }
+            for ( size_t i = 0; i < background.num_workers(); ++i ) {
+                background.get_raytracer( i )->set_wavefront( options.wavefront );
+            }
+            start_visibility_cache( background.get_raytracer( 0 ) );
+            if ( !background.start( scene.camera ) ) {
+                std::cout << "Unable to start raytracing threads.\n";
+                return;
+            }
+        } else {
+            raytracer.set_hdr_buffer( hdr_buffer );
+            if ( !raytracer.initialize( &scene, width, height ) ) {
+                std::cout << "Raytracer initialization failed.\n";
+                return; // leave untoggled since initialization failed.
+            }
+            start_visibility_cache( &raytracer );
         }
 
         // reset flag that says we are done
         raytrace_finished = false;
+    } else {
+        background.stop();
     }
 
     raytracing = !raytracing;
 }
 
-void RaytracerApplication::output_image()
+bool RaytracerApplication::output_image()
 {
     static const size_t MAX_LEN = 256;
     const char* filename;
@@ -285,7 +421,7 @@ void RaytracerApplication::output_image()
 
     if ( !buffer ) {
         std::cout << "No image to output.\n";
-        return;
+        return false;
     }
 
     assert( buf_width > 0 && buf_height > 0 );
@@ -298,11 +434,293 @@ void RaytracerApplication::output_image()
         filename = buf;
     }
 
-    if ( imageio_save_image( filename, buffer, buf_width, buf_height ) ) {
+    return save_image( filename );
+}
+
+bool RaytracerApplication::save_image( const char* filename )
+{
+    assert( buffer && buf_width > 0 && buf_height > 0 );
+
+    bool saved;
+    if ( imageio_is_hdr_filename( filename ) ) {
+        // write the average of all accumulated passes without clamping
+        size_t passes = std::max( raytracer.num_passes(), (size_t) 1 );
+        saved = imageio_save_hdr_image( filename, hdr_buffer, buf_width, buf_height, 1.0f / passes );
+    } else {
+        saved = imageio_save_image( filename, buffer, buf_width, buf_height );
+    }
+
+    if ( saved ) {
         std::cout << "Saved raytraced image to '" << filename << "'.\n";
     } else {
         std::cout << "Error saving raytraced image to '" << filename << "'.\n";
     }
+    return saved;
+}
+
+void RaytracerApplication::start_visibility_cache( Raytracer* tracer )
+{
+    const char* filename = options.visibility_filename;
+    if ( !filename )
+        return;
+
+    // keep what earlier raytraces of the same scene baked
+    if ( !visibility_cache.matches( scene ) ) {
+        if ( visibility_cache.load( filename ) && visibility_cache.matches( scene ) ) {
+            std::cout << "Loaded " << visibility_cache.num_entries() << " baked cells from '"
+                      << filename << "'.\n";
+        } else {
+            std::cout << "Baking visibility cache '" << filename << "' for this scene.\n";
+            visibility_cache.reset( scene );
+        }
+    }
+
+    tracer->set_visibility_cache( &visibility_cache );
+    visibility_rays = tracer->get_shadow_cache().rays;
+    visibility_baked = tracer->get_shadow_cache().baked;
+}
+
+void RaytracerApplication::finish_visibility_cache( const Raytracer& tracer )
+{
+    const char* filename = options.visibility_filename;
+    if ( !filename )
+        return;
+
+    unsigned long traced = tracer.get_shadow_cache().rays - visibility_rays;
+    unsigned long baked = tracer.get_shadow_cache().baked - visibility_baked;
+    std::cout << "Visibility cache answered " << baked << " of " << baked + traced << " shadow rays.\n";
+    visibility_rays += traced;
+    visibility_baked += baked;
+
+    visibility_cache.finish_bake();
+    if ( visibility_cache.save( filename ) ) {
+        std::cout << "Saved " << visibility_cache.num_entries() << " baked cells to '" << filename << "'.\n";
+    } else {
+        std::cout << "Error saving visibility cache to '" << filename << "'.\n";
+    }
+}
+
+void RaytracerApplication::raytrace_checkpointed()
+{
+    static const size_t MAX_LEN = 256;
+    char filename[MAX_LEN];
+
+    assert( buffer && options.output_filename );
+    checkpoint_gen_name( filename, MAX_LEN, options.output_filename );
+
+    CheckpointParams params;
+    params.scene_filename = options.input_filename;
+    params.width = buf_width;
+    params.height = buf_height;
+
+    if ( options.resume ) {
+        checkpoint_load( filename, params, &raytracer, buffer, hdr_buffer );
+    }
+
+    // without an interval just finish the rows that are left
+    real_t interval = options.checkpoint_interval;
+    while ( !raytracer.raytrace( buffer, interval > 0 ? &interval : 0 ) ) {
+        if ( checkpoint_save( filename, params, raytracer, buffer, hdr_buffer ) ) {
+            std::cout << "Saved checkpoint to '" << filename << "'.\n";
+        } else {
+            std::cout << "Error saving checkpoint to '" << filename << "'.\n";
+        }
+    }
+}
+
+/**
+ * Inserts a zero-padded frame number before the extension of output,
+ * e.g. "fly.png" becomes "fly0012.png" for frame 12.
+ */
+static void gen_frame_name( char* name, size_t len, const char* output, int frame )
+{
+    char number[16];
+    sprintf( number, "%04d", frame );
+
+    const char* ext = strrchr( output, '.' );
+    const char* slash = strrchr( output, '/' );
+    if ( !ext || ( slash && slash > ext ) ) {
+        ext = output + strlen( output );
+    }
+
+    assert( len > strlen( number ) + strlen( ext ) );
+    size_t base_len = std::min( (size_t) ( ext - output ), len - strlen( number ) - strlen( ext ) - 1 );
+    strncpy( name, output, base_len );
+    name[base_len] = '\0';
+    strcat( name, number );
+    strcat( name, ext );
+}
+
+bool RaytracerApplication::raytrace_animation()
+{
+    static const size_t MAX_LEN = 256;
+    char filename[MAX_LEN];
+
+    assert( buffer && options.output_filename && options.num_frames > 0 );
+
+    const CameraPath& path = scene.camera_path;
+    if ( path.empty() ) {
+        std::cout << "Scene has no camera path to animate.\n";
+        return false;
+    }
+
+    real_t start = path.get_start_time();
+    real_t end = path.get_end_time();
+
+    // meshes, textures and per-geometry data stay loaded, only the camera moves
+    for ( int i = 0; i < options.num_frames; ++i ) {
+        real_t time = options.num_frames > 1
+            ? start + ( end - start ) * i / ( options.num_frames - 1 )
+            : start;
+        path.evaluate( time, &scene.camera );
+        raytracer.update_camera();
+
+        std::cout << "Raytracing frame " << i << " of " << options.num_frames << " (time " << time << ").\n";
+        raytracer.raytrace( buffer, 0 );
+        finish_visibility_cache( raytracer );
+
+        gen_frame_name( filename, MAX_LEN, options.output_filename, i );
+        if ( !save_image( filename ) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool RaytracerApplication::raytrace_benchmark()
+{
+    static const Mesh::BvhLayout layouts[] = { Mesh::BVH_BINARY, Mesh::BVH_COMPRESSED, Mesh::BVH_WIDE };
+    static const char* layout_names[] = { "binary", "compressed", "wide" };
+    static const size_t num_layouts = sizeof layouts / sizeof layouts[0];
+
+    assert( buffer );
+
+    // every layout must give the image of the first
+    size_t size = BUFFER_SIZE( buf_width, buf_height );
+    unsigned char* first = (unsigned char*) malloc( size );
+    if ( !first ) {
+        std::cout << "Unable to allocate buffer.\n";
+        return false;
+    }
+
+    bool same = true;
+    Mesh* const* meshes = scene.get_meshes();
+    TraversalStats order_stats[2];
+    for ( size_t i = 0; i < num_layouts; ++i ) {
+        size_t memory = 0;
+        for ( size_t j = 0; j < scene.num_meshes(); ++j ) {
+            meshes[j]->build_bvh( scene.bvh_build_mode, layouts[i] );
+            memory += meshes[j]->bvh_memory_size();
+        }
+        scene.bvh_layout = layouts[i];
+        scene.update_geometries();
+
+        raytracer.update_camera();
+        ShadowCache shadow_before = raytracer.get_shadow_cache();
+        Uint32 start_time = SDL_GetTicks();
+        raytracer.raytrace( buffer, 0 );
+        Uint32 trace_time = SDL_GetTicks() - start_time;
+        unsigned long shadow_rays = raytracer.get_shadow_cache().rays - shadow_before.rays;
+        unsigned long shadow_blocked = raytracer.get_shadow_cache().blocked - shadow_before.blocked;
+        unsigned long shadow_hits = raytracer.get_shadow_cache().hits - shadow_before.hits;
+
+        // time just finding what the viewing rays hit, without shading
+        TraversalStats stats;
+        size_t num_rays = (size_t) buf_width * buf_height;
+        start_time = SDL_GetTicks();
+        for ( int y = 0; y < buf_height; ++y ) {
+            for ( int x = 0; x < buf_width; ++x ) {
+                real_t t = -1.0;
+                scene.intersect( raytracer.primary_ray( x, y ), scene.camera.get_position(), &t, &stats );
+            }
+        }
+        Uint32 ray_time = std::max( SDL_GetTicks() - start_time, (Uint32) 1 );
+
+        std::cout << "Benchmark " << layout_names[i] << ": mesh hierarchies use "
+                  << memory / 1024 << " KB, raytraced in " << trace_time << " ms.\n"
+                  << "    viewing rays: " << num_rays / ( ray_time * 1000.0 ) << " Mrays/s, "
+                  << (double) stats.nodes / num_rays << " nodes and "
+                  << (double) stats.primitives / num_rays << " primitives per ray.\n"
+                  << "    shadow rays: " << shadow_rays << ", " << shadow_blocked << " blocked, "
+                  << 100.0 * shadow_hits / std::max( shadow_blocked, 1ul )
+                  << "% of those by the last occluder of their light.\n";
+
+        if ( i == 0 ) {
+            memcpy( first, buffer, size );
+        } else if ( memcmp( first, buffer, size ) != 0 ) {
+            std::cout << "Image with the " << layout_names[i] << " layout differs from the "
+                      << layout_names[0] << " one.\n";
+            same = false;
+        }
+
+        // count the node reads of tracing depth first, then a bounce at a time
+        for ( size_t k = 0; k < 2; ++k ) {
+            order_stats[k] = TraversalStats();
+            raytracer.set_wavefront( k == 1 );
+            raytracer.set_stats( &order_stats[k] );
+            raytracer.update_camera();
+            raytracer.raytrace( buffer, 0 );
+            if ( memcmp( first, buffer, size ) != 0 ) {
+                std::cout << "Image traced " << ( k == 1 ? "a bounce at a time" : "depth first" )
+                          << " with the " << layout_names[i] << " layout differs.\n";
+                same = false;
+            }
+        }
+        raytracer.set_stats( 0 );
+        raytracer.set_wavefront( options.wavefront );
+
+        std::cout << "    cache misses of nodes read by viewing, reflected and refracted rays: "
+                  << order_stats[0].cache_misses << " depth first, "
+                  << order_stats[1].cache_misses << " a bounce at a time ("
+                  << 100.0 * ( 1.0 - (double) order_stats[1].cache_misses
+                                     / std::max( order_stats[0].cache_misses, 1ul ) )
+                  << "% fewer).\n";
+    }
+
+    free( first );
+    return same;
+}
+
+void RaytracerApplication::raytrace_gbuffer()
+{
+    const char* filename = options.gbuffer_filename;
+    assert( filename );
+
+    GBuffer gbuffer;
+    if ( gbuffer.load( filename ) && gbuffer.matches( scene, buf_width, buf_height ) ) {
+        std::cout << "Re-shading " << gbuffer.num_hits() << " recorded hits from '" << filename << "'.\n";
+    } else {
+        std::cout << "Recording g-buffer '" << filename << "' for this scene.\n";
+        gbuffer.record( scene, raytracer, buf_width, buf_height );
+    }
+
+    ShadowCache shadow_cache;
+    gbuffer.shade( scene, buffer, hdr_buffer, &shadow_cache );
+    std::cout << "Traced " << shadow_cache.rays << " shadow rays and reused "
+              << shadow_cache.replayed << ".\n";
+
+    if ( gbuffer.save( filename ) ) {
+        std::cout << "Saved " << gbuffer.num_hits() << " recorded hits to '" << filename << "'.\n";
+    } else {
+        std::cout << "Error saving g-buffer to '" << filename << "'.\n";
+    }
+}
+
+bool RaytracerApplication::raytrace_distributed()
+{
+    assert( buffer );
+
+    CoordinatorParams params;
+    params.program = options.program;
+    params.scene_filename = options.input_filename;
+    params.address = options.listen_address ? options.listen_address : DEFAULT_COORDINATOR_ADDRESS;
+    params.num_local_workers = options.num_workers;
+    params.width = buf_width;
+    params.height = buf_height;
+    params.tile_size = options.tile_size;
+
+    return distributed_coordinate( params, &scene, &raytracer, buffer, hdr_buffer );
 }
 
 
@@ -401,7 +819,10 @@ using namespace _462;
  */
 static void print_usage( const char* progname )
 {
-    std::cout << "Usage: " << progname << " [-r] [-d width height] input_scene [output_file]\n"
+    std::cout << "Usage: " << progname << " [-r] [-d width height] [-c seconds] [-R]\n"
+        "\t[-j workers] [-l address] [-w address] [-s address] [-t size] [-a frames]\n"
+        "\t[-T threads] [-m] [-b sah|lbvh] [-L binary|compressed|wide] [-B] [-W] [-F]\n"
+        "\t[-V cache_file] [-G gbuffer_file] [-S snapshot_file] input_scene [output_file]\n"
         "\n" \
         "Options:\n" \
         "\n" \
@@ -411,21 +832,99 @@ static void print_usage( const char* progname )
         "\t-d width height\n" \
         "\t\tThe dimensions of image to raytrace (and window if using\n" \
         "\t\tand opengl context. Defaults to width=800, height=600.\n" \
+        "\t-c seconds\n" \
+        "\t\tWith -r, saves the finished rows to output_file.ckpt every\n" \
+        "\t\tgiven number of seconds. Requires an output file.\n" \
+        "\t-R\n" \
+        "\t\tWith -r, resumes from output_file.ckpt if it exists and only\n" \
+        "\t\traytraces the rows missing from it. Requires an output file.\n" \
+        "\t-j workers\n" \
+        "\t\tRaytraces without a window by splitting the image into tiles\n" \
+        "\t\tand handing them to the given number of worker processes.\n" \
+        "\t-l address\n" \
+        "\t\tRaytraces without a window, accepting workers started with -w\n" \
+        "\t\ton other machines at address, given as host:port or\n" \
+        "\t\tunix:path. May be combined with -j.\n" \
+        "\t-w address\n" \
+        "\t\tRuns as a worker for the coordinator at address, raytracing\n" \
+        "\t\tthe tiles it sends. The scene must be the same on both ends.\n" \
+        "\t-s address\n" \
+        "\t\tKeeps the scene loaded and renders the images clients at\n" \
+        "\t\taddress ask for, each with its own camera, size, crop and\n" \
+        "\t\tsamples, until one asks it to stop. See raytracer/server.cpp.\n" \
+        "\t-t size\n" \
+        "\t\tThe width and height of tiles handed to workers. Defaults to 32.\n" \
+        "\t-T threads\n" \
+        "\t\tWith a window, the number of threads raytracing in the\n" \
+        "\t\tbackground while the window keeps drawing. With -s, the\n" \
+        "\t\tnumber shared by every client's requests, and with -m, by\n" \
+        "\t\tevery job. Defaults to 1.\n" \
+        "\t-m\n" \
+        "\t\tinput_scene is a manifest of jobs, one per line as\n" \
+        "\t\t'scene_file width height output_file [samples]', rendered\n" \
+        "\t\tin one process. Each scene, texture and mesh is loaded once\n" \
+        "\t\tand shared by the jobs using it.\n" \
+        "\t-a frames\n" \
+        "\t\tRaytraces without a window the given number of frames evenly\n" \
+        "\t\tspaced along the scene's camera_path, in one process. Frame\n" \
+        "\t\tnumbers are inserted before the extension of the output file,\n" \
+        "\t\twhich is required.\n" \
+        "\t-b sah|lbvh\n" \
+        "\t\tHow to build the bounding volume hierarchies. sah traces\n" \
+        "\t\tfaster, lbvh builds faster. Defaults to lbvh with a window\n" \
+        "\t\tand sah without one.\n" \
+        "\t-L binary|compressed|wide\n" \
+        "\t\tHow the scene and meshes store their hierarchies. compressed\n" \
+        "\t\tuses about a third the memory of binary, wide tests four\n" \
+        "\t\tboxes at once. Defaults to binary.\n" \
+        "\t-B\n" \
+        "\t\tRaytraces without a window once with each layout, printing\n" \
+        "\t\tthe memory used by the mesh hierarchies and the time taken,\n" \
+        "\t\thow often shadow rays hit their light's last occluder,\n" \
+        "\t\tthen the speed and work of finding what viewing rays hit,\n" \
+        "\t\tand the cache misses of tracing depth first and with -W.\n" \
+        "\t-W\n" \
+        "\t\tTraces bands of rows a bounce at a time, sorting each bounce's\n" \
+        "\t\treflected and refracted rays by where they start and their\n" \
+        "\t\tdirection. The image is the same, but large scenes are read\n" \
+        "\t\tmore coherently.\n" \
+        "\t-F\n" \
+        "\t\tBefore raytracing, moves the vertices of triangles and of models\n" \
+        "\t\twith a mesh of their own into world space, so rays are not\n" \
+        "\t\ttransformed to test them. Models sharing a mesh are not baked.\n" \
+        "\t-V cache_file\n" \
+        "\t\tAnswers shadow rays from the baked results of earlier ones in\n" \
+        "\t\tcache_file, and adds the rays traced to it after each\n" \
+        "\t\traytrace. The cache is rebaked if anything but the camera\n" \
+        "\t\tchanged. Shadow edges may shift by a cell of the cache.\n" \
+        "\t-G gbuffer_file\n" \
+        "\t\tRaytraces without a window, recording what every ray hit to\n" \
+        "\t\tgbuffer_file. Later runs where only material colors and lights\n" \
+        "\t\tchanged shade the recorded hits instead of tracing, and only\n" \
+        "\t\ttrace shadow rays to lights that moved. The image is the same.\n" \
+        "\t-S snapshot_file\n" \
+        "\t\tLoads the scene with its textures and meshes, saves all of it\n" \
+        "\t\twith the hierarchies to snapshot_file and exits. Later runs\n" \
+        "\t\tgiven the snapshot as input_scene open it without loading.\n" \
         "\tinput_scene:\n" \
-        "\t\tThe scene file to load and raytrace.\n" \
+        "\t\tThe scene file, or a snapshot saved with -S, to raytrace.\n" \
         "\toutput_file:\n" \
         "\t\tThe output file in which to write the rendered images.\n" \
         "\t\tIf not specified, default timestamped filenames are used.\n" \
+        "\t\tNames ending in .hdr or .pfm get the unclamped linear image.\n" \
         "\n" \
         "Instructions:\n" \
         "\n" \
         "\tPress 'r' to raytrace the scene. Press 'r' again to go back to\n" \
         "\tgo back to OpenGL rendering. Press 'f' to dump the most recently\n" \
-        "\traytraced image to the output file.\n" \
+        "\traytraced image to the output file. Raytracing again after only\n" \
+        "\tmoving the camera starts from the last raytrace.\n" \
         "\n" \
         "\tUse the mouse and 'w', 'a', 's', 'd', 'q', and 'e' to move the\n" \
         "\tcamera around. The keys translate the camera, and left and right\n" \
-        "\tmouse buttons rotate the camera.\n" \
+        "\tmouse buttons rotate the camera. Moving the camera while\n" \
+        "\traytracing restarts the raytrace from the new view, showing the\n" \
+        "\tprevious image reprojected into it until it is traced again.\n" \
         "\n" \
         "\tIf not using windowed mode (i.e., -r was specified), then output\n" \
         "\timage will be automatically generated and the program will exit.\n" \
@@ -445,40 +944,218 @@ static bool parse_args( Options* opt, int argc, char* argv[] )
         return false;
     }
 
-    if ( strcmp( argv[1], "-r" ) == 0 ) {
-        opt->open_window = false;
-        ++input_index;
-    } else {
-        opt->open_window = true;
-    }
+    opt->open_window = true;
+    opt->width = DEFAULT_WIDTH;
+    opt->height = DEFAULT_HEIGHT;
+    opt->checkpoint_interval = 0;
+    opt->resume = false;
+    opt->program = argv[0];
+    opt->num_workers = 0;
+    opt->listen_address = 0;
+    opt->worker_address = 0;
+    opt->serve_address = 0;
+    opt->batch = false;
+    opt->tile_size = DEFAULT_TILE_SIZE;
+    opt->num_frames = 0;
+    opt->bvh_build_mode = -1;
+    opt->bvh_layout = Mesh::BVH_BINARY;
+    opt->benchmark = false;
+    opt->wavefront = false;
+    opt->bake_transforms = false;
+    opt->visibility_filename = 0;
+    opt->num_threads = DEFAULT_THREADS;
+    opt->gbuffer_filename = 0;
+    opt->snapshot_filename = 0;
+
+    // parse the options preceding the input scene
+    while ( input_index < argc && argv[input_index][0] == '-' ) {
+        const char* arg = argv[input_index];
+
+        if ( strcmp( arg, "-r" ) == 0 ) {
+            opt->open_window = false;
+            ++input_index;
+
+        } else if ( strcmp( arg, "-d" ) == 0 ) {
+            // get window dimensions
+            if ( argc <= input_index + 3 ) {
+                print_usage( argv[0] );
+                return false;
+            }
 
-    if ( argc <= input_index ) {
-        print_usage( argv[0] );
-        return false;
-    }
+            // parse window dimensions
+            opt->width = -1;
+            opt->height = -1;
+            sscanf( argv[input_index + 1], "%d", &opt->width );
+            sscanf( argv[input_index + 2], "%d", &opt->height );
+            // check for valid width/height
+            if ( opt->width < 1 || opt->height < 1 ) {
+                std::cout << "Invalid window dimensions\n";
+                return false;
+            }
+
+            input_index += 3;
+
+        } else if ( strcmp( arg, "-c" ) == 0 ) {
+            if ( argc <= input_index + 2 ) {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            opt->checkpoint_interval = -1;
+            sscanf( argv[input_index + 1], "%lf", &opt->checkpoint_interval );
+            if ( opt->checkpoint_interval <= 0 ) {
+                std::cout << "Invalid checkpoint interval\n";
+                return false;
+            }
+
+            input_index += 2;
+
+        } else if ( strcmp( arg, "-R" ) == 0 ) {
+            opt->resume = true;
+            ++input_index;
+
+        } else if ( strcmp( arg, "-j" ) == 0 || strcmp( arg, "-t" ) == 0 || strcmp( arg, "-a" ) == 0
+                    || strcmp( arg, "-T" ) == 0 ) {
+            if ( argc <= input_index + 2 ) {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            int val = -1;
+            sscanf( argv[input_index + 1], "%d", &val );
+            if ( val < 1 ) {
+                std::cout << "Invalid " << ( arg[1] == 'j' ? "worker count" : arg[1] == 't' ? "tile size"
+                                             : arg[1] == 'T' ? "thread count" : "frame count" ) << "\n";
+                return false;
+            }
+            if ( arg[1] == 'j' ) {
+                opt->num_workers = val;
+                opt->open_window = false;
+            } else if ( arg[1] == 'a' ) {
+                opt->num_frames = val;
+                opt->open_window = false;
+            } else if ( arg[1] == 'T' ) {
+                opt->num_threads = val;
+            } else {
+                opt->tile_size = val;
+            }
 
-    // check if it's a -d, if so then get window dimensions
-    if ( strcmp( argv[input_index], "-d" ) == 0 ) {
-        if ( argc <= input_index + 3 ) {
+            input_index += 2;
+
+        } else if ( strcmp( arg, "-l" ) == 0 || strcmp( arg, "-w" ) == 0 || strcmp( arg, "-s" ) == 0 ) {
+            if ( argc <= input_index + 2 ) {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            if ( arg[1] == 'l' ) {
+                opt->listen_address = argv[input_index + 1];
+            } else if ( arg[1] == 's' ) {
+                opt->serve_address = argv[input_index + 1];
+            } else {
+                opt->worker_address = argv[input_index + 1];
+            }
+            opt->open_window = false;
+
+            input_index += 2;
+
+        } else if ( strcmp( arg, "-b" ) == 0 ) {
+            if ( argc <= input_index + 2 ) {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            const char* mode = argv[input_index + 1];
+            if ( strcmp( mode, "sah" ) == 0 ) {
+                opt->bvh_build_mode = Bvh::BUILD_SAH;
+            } else if ( strcmp( mode, "lbvh" ) == 0 ) {
+                opt->bvh_build_mode = Bvh::BUILD_LBVH;
+            } else {
+                std::cout << "Invalid bvh build mode\n";
+                return false;
+            }
+
+            input_index += 2;
+
+        } else if ( strcmp( arg, "-L" ) == 0 ) {
+            if ( argc <= input_index + 2 ) {
+                print_usage( argv[0] );
+                return false;
+            }
+
+            const char* layout = argv[input_index + 1];
+            if ( strcmp( layout, "binary" ) == 0 ) {
+                opt->bvh_layout = Mesh::BVH_BINARY;
+            } else if ( strcmp( layout, "compressed" ) == 0 ) {
+                opt->bvh_layout = Mesh::BVH_COMPRESSED;
+            } else if ( strcmp( layout, "wide" ) == 0 ) {
+                opt->bvh_layout = Mesh::BVH_WIDE;
+            } else {
+                std::cout << "Invalid bvh layout\n";
+                return false;
+            }
+
+            input_index += 2;
+
+        } else if ( strcmp( arg, "-B" ) == 0 ) {
+            opt->benchmark = true;
+            opt->open_window = false;
+            ++input_index;
+
+        } else if ( strcmp( arg, "-W" ) == 0 ) {
+            opt->wavefront = true;
+            ++input_index;
+
+        } else if ( strcmp( arg, "-m" ) == 0 ) {
+            opt->batch = true;
+            opt->open_window = false;
+            ++input_index;
+
+        } else if ( strcmp( arg, "-F" ) == 0 ) {
+            opt->bake_transforms = true;
+            ++input_index;
+
+        } else if ( strcmp( arg, "-V" ) == 0 ) {
+            if ( argc <= input_index + 2 ) {
+                print_usage( argv[0] );
+                return false;
+            }
+            opt->visibility_filename = argv[input_index + 1];
+            input_index += 2;
+
+        } else if ( strcmp( arg, "-G" ) == 0 ) {
+            if ( argc <= input_index + 2 ) {
+                print_usage( argv[0] );
+                return false;
+            }
+            opt->gbuffer_filename = argv[input_index + 1];
+            opt->open_window = false;
+            input_index += 2;
+
+        } else if ( strcmp( arg, "-S" ) == 0 ) {
+            if ( argc <= input_index + 2 ) {
+                print_usage( argv[0] );
+                return false;
+            }
+            opt->snapshot_filename = argv[input_index + 1];
+            opt->open_window = false;
+            input_index += 2;
+
+        } else {
+            std::cout << "Unknown option '" << arg << "'.\n";
             print_usage( argv[0] );
             return false;
         }
+    }
 
-        // parse window dimensions
-        opt->width = -1;
-        opt->height = -1;
-        sscanf( argv[input_index + 1], "%d", &opt->width );
-        sscanf( argv[input_index + 2], "%d", &opt->height );
-        // check for valid width/height
-        if ( opt->width < 1 || opt->height < 1 ) {
-            std::cout << "Invalid window dimensions\n";
-            return false;
-        }
+    if ( argc <= input_index ) {
+        print_usage( argv[0] );
+        return false;
+    }
 
-        input_index += 3;
-    } else {
-        opt->width = DEFAULT_WIDTH;
-        opt->height = DEFAULT_HEIGHT;
+    // interactive sessions care more about loading fast than tracing fast
+    if ( opt->bvh_build_mode == -1 ) {
+        opt->bvh_build_mode = opt->open_window ? Bvh::BUILD_LBVH : Bvh::BUILD_SAH;
     }
 
     opt->input_filename = argv[input_index];
@@ -494,6 +1171,73 @@ static bool parse_args( Options* opt, int argc, char* argv[] )
         return false;
     }
 
+    // timestamped names differ between runs, so a checkpoint needs a fixed name
+    if ( ( opt->checkpoint_interval > 0 || opt->resume ) && ( opt->open_window || !opt->output_filename ) ) {
+        std::cout << "Checkpoints require -r and an output file.\n";
+        return false;
+    }
+
+    bool coordinating = opt->num_workers > 0 || opt->listen_address;
+    if ( coordinating && ( opt->worker_address || opt->checkpoint_interval > 0 || opt->resume ) ) {
+        std::cout << "Distributed raytracing cannot be combined with -w, -c or -R.\n";
+        return false;
+    }
+    if ( opt->worker_address && ( opt->output_filename || opt->checkpoint_interval > 0 || opt->resume ) ) {
+        std::cout << "Workers send their tiles to the coordinator and take no output file.\n";
+        return false;
+    }
+    if ( opt->benchmark && ( coordinating || opt->worker_address || opt->checkpoint_interval > 0
+                             || opt->resume || opt->num_frames > 0 ) ) {
+        std::cout << "Benchmarks cannot be combined with -j, -l, -w, -c, -R or -a.\n";
+        return false;
+    }
+    if ( opt->visibility_filename && ( coordinating || opt->worker_address || opt->benchmark ) ) {
+        std::cout << "Visibility caches cannot be combined with -j, -l, -w or -B.\n";
+        return false;
+    }
+    // recording into the cache is not safe from several threads
+    if ( opt->visibility_filename && opt->num_threads > 1 ) {
+        std::cout << "Visibility caches are baked by one thread and cannot be combined with -T.\n";
+        return false;
+    }
+    if ( opt->gbuffer_filename && ( coordinating || opt->worker_address || opt->benchmark || opt->num_frames > 0
+                                    || opt->checkpoint_interval > 0 || opt->resume || opt->visibility_filename ) ) {
+        std::cout << "G-buffers cannot be combined with -j, -l, -w, -B, -a, -c, -R or -V.\n";
+        return false;
+    }
+    if ( opt->snapshot_filename && ( coordinating || opt->worker_address || opt->benchmark || opt->num_frames > 0
+                                     || opt->checkpoint_interval > 0 || opt->resume || opt->visibility_filename
+                                     || opt->gbuffer_filename || opt->output_filename ) ) {
+        std::cout << "Snapshots are saved instead of raytracing, so -S takes no output file and cannot be\n"
+            "combined with -j, -l, -w, -B, -a, -c, -R, -V or -G.\n";
+        return false;
+    }
+    if ( opt->serve_address && ( coordinating || opt->worker_address || opt->benchmark || opt->num_frames > 0
+                                 || opt->checkpoint_interval > 0 || opt->resume || opt->visibility_filename
+                                 || opt->gbuffer_filename || opt->snapshot_filename || opt->output_filename ) ) {
+        std::cout << "Servers send their images to clients, so -s takes no output file and cannot be\n"
+            "combined with -j, -l, -w, -B, -a, -c, -R, -V, -G or -S.\n";
+        return false;
+    }
+    if ( opt->batch && ( coordinating || opt->worker_address || opt->serve_address || opt->benchmark
+                         || opt->num_frames > 0 || opt->checkpoint_interval > 0 || opt->resume
+                         || opt->visibility_filename || opt->gbuffer_filename || opt->snapshot_filename
+                         || opt->output_filename ) ) {
+        std::cout << "Manifests name their own output files, so -m takes no output file and cannot be\n"
+            "combined with -j, -l, -w, -s, -B, -a, -c, -R, -V, -G or -S.\n";
+        return false;
+    }
+    if ( opt->num_frames > 0 ) {
+        if ( !opt->output_filename ) {
+            std::cout << "Animations require an output file.\n";
+            return false;
+        }
+        if ( coordinating || opt->worker_address || opt->checkpoint_interval > 0 || opt->resume ) {
+            std::cout << "Animations cannot be combined with -j, -l, -w, -c or -R.\n";
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -511,13 +1255,33 @@ int main( int argc, char* argv[] )
         return 1;
     }
 
+    // every job of a manifest loads its own scene
+    if ( opt.batch ) {
+        BatchParams params;
+        params.manifest_filename = opt.input_filename;
+        params.num_threads = opt.num_threads;
+        params.bvh_build_mode = static_cast< Bvh::BuildMode >( opt.bvh_build_mode );
+        params.bvh_layout = opt.bvh_layout;
+        params.wavefront = opt.wavefront;
+        params.bake_transforms = opt.bake_transforms;
+        return batch_render( params ) ? 0 : 1;
+    }
+
     RaytracerApplication app( opt );
 
-    // load the given scene
-    if ( !load_scene( &app.scene, opt.input_filename ) ) {
+    // load the given scene, or open a snapshot of one
+    app.from_snapshot = SceneSnapshot::is_snapshot( opt.input_filename );
+    if ( app.from_snapshot ? !SceneSnapshot::load( &app.scene, opt.input_filename )
+                           : !load_scene( &app.scene, opt.input_filename ) ) {
         std::cout << "Error loading scene " << opt.input_filename << ". Aborting.\n";
         return 1;
     }
+    app.scene.bvh_build_mode = static_cast< Bvh::BuildMode >( opt.bvh_build_mode );
+    // snapshots keep binary hierarchies, copied to the layout asked for
+    // when they are opened
+    app.scene.bvh_layout = opt.snapshot_filename ? Mesh::BVH_BINARY : opt.bvh_layout;
+    app.raytracer.set_wavefront( opt.wavefront );
+    app.scene.bake_transforms = opt.bake_transforms;
 
     // either launch a window or do a full raytrace without one, depending on the option
     if ( opt.open_window ) {
@@ -529,16 +1293,72 @@ int main( int argc, char* argv[] )
 
     } else {
 
-        app.initialize();
+        bool initialized = app.initialize();
+        if ( opt.snapshot_filename ) {
+            // a snapshot must not be missing a texture or mesh
+            if ( !initialized ) {
+                return 1;
+            }
+            app.scene.update_geometries();
+            if ( !SceneSnapshot::save( app.scene, opt.snapshot_filename ) ) {
+                std::cout << "Error saving snapshot to '" << opt.snapshot_filename << "'.\n";
+                return 1;
+            }
+            std::cout << "Saved snapshot to '" << opt.snapshot_filename << "'.\n";
+            return 0;
+        }
+        if ( opt.worker_address ) {
+            // the coordinator decides the image size
+            return distributed_work( opt.worker_address, &app.scene, &app.raytracer ) ? 0 : 1;
+        }
+        if ( opt.serve_address ) {
+            // clients decide the image sizes
+            ServerParams params;
+            params.address = opt.serve_address;
+            params.num_threads = opt.num_threads;
+            return render_serve( params, &app.scene, &app.raytracer ) ? 0 : 1;
+        }
         app.toggle_raytracing( opt.width, opt.height );
         if ( !app.raytracing ) {
             return 1; // some error occurred
         }
         assert( app.buffer );
-        // raytrace until done
-        app.raytracer.raytrace( app.buffer, 0 );
-        // output result
-        app.output_image();
+        if ( opt.num_frames > 0 ) {
+            if ( !app.raytrace_animation() ) {
+                return 1;
+            }
+        } else if ( opt.benchmark ) {
+            SDL_Init( SDL_INIT_TIMER );
+            // the last layout's image is saved
+            if ( !app.raytrace_benchmark() || !app.output_image() ) {
+                return 1;
+            }
+        } else if ( opt.num_workers > 0 || opt.listen_address ) {
+            if ( !app.raytrace_distributed() || !app.output_image() ) {
+                return 1;
+            }
+        } else if ( opt.checkpoint_interval > 0 || opt.resume ) {
+            // timed raytrace slices need the SDL timer
+            SDL_Init( SDL_INIT_TIMER );
+            app.raytrace_checkpointed();
+            app.finish_visibility_cache( app.raytracer );
+            if ( !app.output_image() ) {
+                return 1;
+            }
+            // the checkpoint is no longer needed once the image is saved
+            char filename[256];
+            checkpoint_gen_name( filename, sizeof filename, opt.output_filename );
+            remove( filename );
+        } else if ( opt.gbuffer_filename ) {
+            app.raytrace_gbuffer();
+            app.output_image();
+        } else {
+            // raytrace until done
+            app.raytracer.raytrace( app.buffer, 0 );
+            app.finish_visibility_cache( app.raytracer );
+            // output result
+            app.output_image();
+        }
         return 0;
 
     }
@@ -14,6 +14,8 @@
 #include "scene/triangle.hpp" 
 #include <SDL/SDL_timer.h>
 #include <iostream>
+#include <cstring>
+#include <algorithm>
 
 #define SPHERE  1.0 
 #define TRIANGLE -1.0 
@@ -25,10 +27,14 @@
 #define GREEN Color3(0,1,0)
 #define BLUE Color3(0,0,1)
 
+// arbitrary slop factor, as in Geometry::compute_specular
+#define EPSILON .000001
+
 namespace _462 {
 
 Raytracer::Raytracer()
-    : scene( 0 ), width( 0 ), height( 0 ) { }
+    : scene( 0 ), width( 0 ), height( 0 ), hdr_buffer( 0 ), passes( 0 ),
+      wavefront( false ), stats( 0 ) { }
 
 Raytracer::~Raytracer() { }
 
@@ -46,7 +52,49 @@ bool Raytracer::initialize( Scene* scene, size_t width, size_t height )
     this->scene = scene;
     this->width = width;
     this->height = height;
-    this->camera = scene->camera; 
+
+    // move static geometries into world space once, if asked
+    if ( scene->bake_transforms ) {
+        scene->bake_static_transforms();
+    }
+
+    // recompute transforms and bounds of whatever moved since last time
+    scene->update_geometries();
+
+    update_camera();
+    return true;
+}	
+
+/**
+ * Points the raytracer at a scene that another raytracer has initialized,
+ * and starts a raytrace of it from camera at the given size. Nothing of
+ * the scene is written, so this is safe while it is being traced.
+ */
+void Raytracer::set_view( Scene* scene, size_t width, size_t height, const Camera& camera )
+{
+    this->scene = scene;
+    this->width = width;
+    this->height = height;
+    update_camera( camera );
+}
+
+/**
+ * Sets up the viewing frame from the scene camera and starts a new raytrace.
+ * Only the camera may have changed since initialize; use this to trace
+ * several frames of the same scene without redoing the per-geometry setup.
+ */
+void Raytracer::update_camera()
+{
+    update_camera( scene->camera );
+}
+
+/**
+ * Sets up the viewing frame from camera and starts a new raytrace. Unlike
+ * the scene's camera, the given one may be owned by another thread.
+ */
+void Raytracer::update_camera( const Camera& camera )
+{
+    this->camera = camera; 
     
     // Compute basis vectors with information from camera 
     Vector3 g = camera.get_direction();
@@ -60,23 +108,18 @@ bool Raytracer::initialize( Scene* scene, size_t width, size_t height )
     fov = camera.get_fov_radians();
     nearClip = camera.get_near_clip();
     current_row = 0;
+    rows_done.assign( height, false );
+    passes = 0;
+    if ( hdr_buffer ) {
+        memset( hdr_buffer, 0, 3 * width * height * sizeof hdr_buffer[0] );
+    }
     
     // compute bounds for the viewing frame 
     top = tan(fov/2.0)*fabs(nearClip); 
     right = ((1.0)*width/height)*top; 
     left = -right;
     bottom = -top; 
-
-    Geometry* const* sceneObjects = scene->get_geometries();
-    for(unsigned int i=0; i<scene->num_geometries(); i++){
-	 Geometry* shape = sceneObjects[i]; 
-	 make_inverse_transformation_matrix(&shape->inv_trans, shape->position, shape->orientation, shape->scale);
-	 Matrix4 trans;
-	 make_transformation_matrix(&trans, shape->position, shape->orientation, shape->scale);
-         make_normal_matrix(&shape->norm_matrix,trans);
-    }
-    return true;
-}	
+}
 
 
 /**
@@ -92,18 +135,13 @@ bool Raytracer::initialize( Scene* scene, size_t width, size_t height )
 
 
 // TODO make NON STATIC trace_pixel function. 
-Color3 Raytracer::trace_pixel( const Scene* scene, size_t x, size_t y, size_t width, size_t height )
+Color3 Raytracer::trace_pixel( const Scene* scene, size_t x, size_t y, size_t width, size_t height, real_t* depth )
 {
     assert( 0 <= x && x < width );
     assert( 0 <= y && y < height );
  
-    // compute s for viewing ray  
-    real_t u_s = left + (right - left)*(x + 0.5)/width; 
-    real_t v_s = bottom + (top - bottom) *(y + 0.5)/height; 
-    Vector3 ray_dir = (u_s*u) + (v_s*v) + (nearClip*w);
     // direction of the viewing ray, normalized for unit length
-    Vector3 dir_norm = normalize(ray_dir); 
-    Geometry* const* sceneObjects = scene->get_geometries();
+    Vector3 dir_norm = primary_ray(x,y); 
     
     // intialize values to be updated 
     // throughout the loop. 
@@ -113,28 +151,224 @@ Color3 Raytracer::trace_pixel( const Scene* scene, size_t x, size_t y, size_t wi
     real_t minTime = UNINITIALIZED; 
 
     Color3 returnColor = RED; 
-    Geometry* geo = sceneObjects[0];  
-    for(unsigned int i=0;i<scene->num_geometries(); i++){
-	Geometry* temp_geo = sceneObjects[i];
-	if(temp_geo->is_intersecting(dir_norm,e,&minTime) != NOINTERSECTION){
-			geo = temp_geo;
-	}
-	
-    } 
+    Geometry* geo = scene->intersect(dir_norm,e,&minTime,stats);
+    if(depth)
+	*depth = minTime;
     if(minTime != UNINITIALIZED){
 	Vector3 surface_pos = e + dir_norm*minTime;
 	Color3 specular = geo->get_specular();
 	Vector3 normal = geo->normal_of(surface_pos);
 	if(geo->get_refractive_index() != 0){
-		return geo->compute_specular(scene,normal,dir_norm,surface_pos,3); 
+		return geo->compute_specular(scene,normal,dir_norm,surface_pos,MAX_BOUNCES,stats,&shadow_cache); 
 	}
-	returnColor = geo->color_at_pixel(scene,surface_pos) + specular*(geo->compute_specular(scene,normal,dir_norm,surface_pos,3));
+	// shade before tracing further, which overwrites the hit state
+	returnColor = geo->color_at_pixel(scene,surface_pos,&shadow_cache);
+	returnColor += specular*(geo->compute_specular(scene,normal,dir_norm,surface_pos,MAX_BOUNCES,stats,&shadow_cache));
 	return returnColor;
     }
     else
 	return scene->background_color; 
 }
 
+Vector3 Raytracer::primary_ray( size_t x, size_t y ) const
+{
+    // compute s for viewing ray  
+    real_t u_s = left + (right - left)*(x + 0.5)/width; 
+    real_t v_s = bottom + (top - bottom) *(y + 0.5)/height; 
+    Vector3 ray_dir = (u_s*u) + (v_s*v) + (nearClip*w);
+    return normalize(ray_dir); 
+}
+
+bool Raytracer::project( const Vector3& point, real_t* x, real_t* y ) const
+{
+    // undo primary_ray: scale the offset from the eye onto the image plane
+    Vector3 offset = point - e;
+    real_t depth = dot( offset, w );
+    if ( depth * nearClip <= 0.0 )
+        return false;
+    real_t scale = nearClip / depth;
+    real_t u_s = dot( offset, u ) * scale;
+    real_t v_s = dot( offset, v ) * scale;
+    *x = ( u_s - left ) / ( right - left ) * width;
+    *y = ( v_s - bottom ) / ( top - bottom ) * height;
+    return true;
+}
+
+void Raytracer::trace_tile( size_t x, size_t y, size_t tile_width, size_t tile_height, Color3* colors,
+                            real_t* depths )
+{
+    if ( wavefront ) {
+        trace_wavefront( x, y, tile_width, tile_height, colors, depths );
+        return;
+    }
+
+    for ( size_t j = y; j < y + tile_height; ++j ) {
+        for ( size_t i = x; i < x + tile_width; ++i ) {
+            *colors++ = trace_pixel( scene, i, j, width, height, depths );
+            if ( depths )
+                ++depths;
+        }
+    }
+}
+
+// a ray of a wavefront, and what it hit
+struct WavefrontRay
+{
+    // the ray is traced from start, which is origin for viewing rays and
+    // just off it for the others
+    Vector3 origin;
+    Vector3 start;
+    Vector3 dir;
+    // index of the ray of the previous bounce that spawned it
+    size_t parent;
+    // what the ray hit, or null
+    const Geometry* geo;
+    // the color and specular color of the hit
+    Color3 color;
+    Color3 specular;
+    // the rays spawned at the hit, the first at first_child of the next
+    // bounce. num is 0 for rays of the last bounce.
+    SpecularRays spawned;
+    size_t first_child;
+    // what the ray contributes to its parent, once its children are done
+    Color3 value;
+};
+
+typedef std::vector< WavefrontRay > WavefrontRayList;
+// orders rays by sort key, then index so the order is repeatable
+typedef std::pair< unsigned int, unsigned int > KeyedRay;
+
+// morton code bits per axis of the grid the ray origins are sorted on
+#define WAVEFRONT_GRID_BITS 9
+
+/**
+ * Sorts a bounce's rays by the octant of their direction, then by the cell
+ * of their origin along a morton curve over the bounce's origins.
+ */
+static void sort_rays( const WavefrontRayList& rays, std::vector< KeyedRay >* order )
+{
+    BoundingBox bounds;
+    for ( size_t i = 0; i < rays.size(); ++i ) {
+        bounds.include( rays[i].origin );
+    }
+    Vector3 extent = bounds.max - bounds.min;
+    real_t cells = 1 << WAVEFRONT_GRID_BITS;
+
+    order->resize( rays.size() );
+    for ( size_t i = 0; i < rays.size(); ++i ) {
+        const WavefrontRay& ray = rays[i];
+        unsigned int key = 0;
+        for ( size_t a = 0; a < 3; ++a ) {
+            real_t f = extent[a] > 0.0 ? ( ray.origin[a] - bounds.min[a] ) / extent[a] : 0.0;
+            unsigned int cell = (unsigned int) clamp( f * cells, real_t( 0.0 ), cells - 1 );
+            key |= expand_bits( cell ) << ( 2 - a );
+        }
+        unsigned int octant = ( ray.dir.x < 0.0 ? 4 : 0 ) | ( ray.dir.y < 0.0 ? 2 : 0 ) | ( ray.dir.z < 0.0 ? 1 : 0 );
+        ( *order )[i] = KeyedRay( octant << ( 3 * WAVEFRONT_GRID_BITS ) | key, i );
+    }
+    std::sort( order->begin(), order->end() );
+}
+
+// the specular color seen at a ray's hit, from what the rays it spawned saw
+static Color3 specular_seen( const WavefrontRayList& children, const WavefrontRay& ray )
+{
+    Color3 colors[2];
+    for ( size_t i = 0; i < ray.spawned.num; ++i ) {
+        colors[i] = children[ray.first_child + i].value;
+    }
+    return ray.spawned.combine( colors );
+}
+
+void Raytracer::trace_wavefront( size_t x, size_t y, size_t tile_width, size_t tile_height, Color3* colors,
+                                 real_t* depths )
+{
+    // rays of each bounce, the viewing rays being bounce 0
+    WavefrontRayList bounces[MAX_BOUNCES + 1];
+    std::vector< KeyedRay > order;
+
+    WavefrontRayList& viewing = bounces[0];
+    viewing.resize( tile_width * tile_height );
+    for ( size_t j = 0; j < tile_height; ++j ) {
+        for ( size_t i = 0; i < tile_width; ++i ) {
+            WavefrontRay& ray = viewing[j * tile_width + i];
+            ray.origin = e;
+            ray.start = e;
+            ray.dir = primary_ray( x + i, y + j );
+        }
+    }
+
+    for ( int bounce = 0; bounce <= MAX_BOUNCES; ++bounce ) {
+        WavefrontRayList& rays = bounces[bounce];
+        // viewing rays are already in order
+        order.clear();
+        if ( bounce > 0 ) {
+            sort_rays( rays, &order );
+        }
+
+        for ( size_t k = 0; k < rays.size(); ++k ) {
+            WavefrontRay& ray = rays[bounce > 0 ? order[k].second : k];
+            ray.spawned.num = 0;
+            real_t t = -1.0;
+            ray.geo = scene->intersect( ray.dir, ray.start, &t, stats );
+            if ( bounce == 0 && depths )
+                depths[k] = ray.geo ? t : -1.0;
+            if ( !ray.geo )
+                continue;
+
+            // shade and spawn before tracing further, which overwrites the
+            // hit state. refractive viewing rays only see their specular.
+            Vector3 surface_pos = ray.origin + ray.dir * t;
+            Vector3 normal = ray.geo->normal_of( surface_pos );
+            if ( bounce > 0 || ray.geo->get_refractive_index() == 0 ) {
+                ray.color = ray.geo->color_at_pixel( scene, surface_pos, &shadow_cache );
+            }
+            if ( bounce == MAX_BOUNCES )
+                continue;
+
+            ray.specular = ray.geo->get_specular();
+            ray.geo->specular_rays( normal, ray.dir, &ray.spawned );
+            WavefrontRayList& children = bounces[bounce + 1];
+            ray.first_child = children.size();
+            for ( size_t i = 0; i < ray.spawned.num; ++i ) {
+                WavefrontRay child;
+                child.origin = surface_pos;
+                child.start = surface_pos + EPSILON * ray.spawned.dir[i];
+                child.dir = ray.spawned.dir[i];
+                child.parent = &ray - &rays[0];
+                children.push_back( child );
+            }
+        }
+    }
+
+    // combine what each ray saw from the last bounce back
+    for ( int bounce = MAX_BOUNCES; bounce > 0; --bounce ) {
+        WavefrontRayList& rays = bounces[bounce];
+        for ( size_t k = 0; k < rays.size(); ++k ) {
+            WavefrontRay& ray = rays[k];
+            const SpecularRays& parent = bounces[bounce - 1][ray.parent].spawned;
+            if ( !ray.geo ) {
+                ray.value = parent.miss( scene->background_color );
+            } else if ( bounce == MAX_BOUNCES ) {
+                ray.value = parent.last_bounce( ray.color );
+            } else {
+                ray.value = parent.bounce( ray.color, ray.specular, specular_seen( bounces[bounce + 1], ray ) );
+            }
+        }
+    }
+
+    for ( size_t k = 0; k < viewing.size(); ++k ) {
+        const WavefrontRay& ray = viewing[k];
+        if ( !ray.geo ) {
+            colors[k] = scene->background_color;
+        } else if ( ray.geo->get_refractive_index() != 0 ) {
+            colors[k] = specular_seen( bounces[1], ray );
+        } else {
+            colors[k] = ray.color;
+            colors[k] += ray.specular * specular_seen( bounces[1], ray );
+        }
+    }
+}
+
 /**
  * Raytraces some portion of the scene. Should raytrace for about
  * max_time duration and then return, even if the raytrace is not copmlete.
@@ -155,7 +389,7 @@ bool Raytracer::raytrace( unsigned char *buffer, real_t* max_time )
 
     // the time in milliseconds that we should stop
     unsigned int end_time = 0;
-    bool is_done;
+    bool is_done = current_row == height;
 
     if ( max_time ) {
         // convert duration to milliseconds
@@ -164,7 +398,7 @@ bool Raytracer::raytrace( unsigned char *buffer, real_t* max_time )
     }
 
     // until time is up, run the raytrace. we render an entire row at once
-    // for simplicity and efficiency.
+    // for simplicity and efficiency, or a band of rows in wavefront mode.
     for ( ; !max_time || end_time > SDL_GetTicks(); ++current_row ) {
 
         if ( current_row % PRINT_INTERVAL == 0 ) {
@@ -177,12 +411,39 @@ bool Raytracer::raytrace( unsigned char *buffer, real_t* max_time )
         if ( is_done )
             break;
 
-        for ( size_t x = 0; x < width; ++x ) {
-            // trace a pixel
-            Color3 color = trace_pixel( scene, x, current_row, width, height );
+        // skip rows that were restored from elsewhere
+        if ( rows_done[current_row] )
+            continue;
+
+        // trace this row and any following ones still to do that fit
+        size_t num_rows = 1;
+        while ( wavefront && num_rows < WAVEFRONT_ROWS && current_row + num_rows < height
+                && !rows_done[current_row + num_rows] ) {
+            ++num_rows;
+        }
+        row_colors.resize( width * num_rows );
+        trace_tile( 0, current_row, width, num_rows, &row_colors[0] );
+
+        for ( size_t i = 0; i < width * num_rows; ++i ) {
+            Color3 color = row_colors[i];
+            size_t index = current_row * width + i;
+            // accumulate the unclamped color and display the running average
+            if ( hdr_buffer ) {
+                float* sum = &hdr_buffer[3 * index];
+                sum[0] += color.r;
+                sum[1] += color.g;
+                sum[2] += color.b;
+                if ( passes > 0 ) {
+                    color = Color3( sum[0], sum[1], sum[2] ) * ( 1.0 / ( passes + 1 ) );
+                }
+            }
             // write the result to the buffer, always use 1.0 as the alpha
-            color.to_array( &buffer[4 * ( current_row * width + x )] );
+            color.to_array( &buffer[4 * index] );
+        }
+        for ( size_t i = 0; i < num_rows; ++i ) {
+            rows_done[current_row + i] = true;
         }
+        current_row += num_rows - 1;
     }
 
     if ( is_done ) {
@@ -192,5 +453,98 @@ bool Raytracer::raytrace( unsigned char *buffer, real_t* max_time )
     return is_done;
 }
 
+/**
+ * Sets the buffer into which each pass accumulates its unclamped linear
+ * colors, or null to disable accumulation. Takes effect on the next call
+ * to initialize, which clears it.
+ * @param hdr_buffer RGB floats, 3 per pixel, in the same order as the
+ *  buffer given to raytrace. Must stay valid while raytracing.
+ */
+void Raytracer::set_hdr_buffer( float* hdr_buffer )
+{
+    this->hdr_buffer = hdr_buffer;
+}
+
+/**
+ * Sets whether tiles are traced a bounce at a time, sorting each bounce's
+ * rays so that those likely to visit the same nodes of the hierarchies
+ * are traced one after another. The image is the same either way.
+ */
+void Raytracer::set_wavefront( bool wavefront )
+{
+    this->wavefront = wavefront;
+}
+
+bool Raytracer::is_wavefront() const
+{
+    return wavefront;
+}
+
+/**
+ * Sets stats to add the work of every viewing, reflected and refracted ray
+ * traced to, or null to stop counting. Shadow rays are not counted.
+ */
+void Raytracer::set_stats( TraversalStats* stats )
+{
+    this->stats = stats;
+}
+
+/**
+ * Returns the cache of each light's last occluder used by this raytracer's
+ * shadow rays, whose counts cover everything traced since it was created.
+ */
+const ShadowCache& Raytracer::get_shadow_cache() const
+{
+    return shadow_cache;
+}
+
+/**
+ * Sets the cache of baked shadow rays. Shadow rays from where it knows the
+ * answer take it from there, and the rest are traced and recorded into it.
+ * The cache must match the scene, and its recorded rays only take effect
+ * once finish_bake is called.
+ */
+void Raytracer::set_visibility_cache( VisibilityCache* visibility )
+{
+    shadow_cache.visibility = visibility;
+}
+
+/**
+ * Starts another raytrace of the same image whose colors are summed into
+ * the hdr buffer. Only valid once the current pass is complete.
+ */
+void Raytracer::next_pass()
+{
+    assert( current_row == height );
+    ++passes;
+    current_row = 0;
+    rows_done.assign( height, false );
+}
+
+/**
+ * Returns the number of passes summed into the hdr buffer. Divide by this
+ * to get the average color.
+ */
+size_t Raytracer::num_passes() const
+{
+    return current_row == height ? passes + 1 : passes;
+}
+
+bool Raytracer::is_row_done( size_t row ) const
+{
+    assert( row < height );
+    return rows_done[row];
+}
+
+/**
+ * Marks a row of the current pass as already traced. Its contents in the
+ * buffers given to raytrace are left untouched by later calls.
+ */
+void Raytracer::set_row_done( size_t row )
+{
+    assert( row < height );
+    rows_done[row] = true;
+}
+
 } /* _462 */
 	
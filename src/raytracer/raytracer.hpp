@@ -14,10 +14,12 @@
 #include "math/color.hpp"
 #include "math/vector.hpp"
 #include "math/camera.hpp"
+#include "scene/scene.hpp"
+#include <vector>
 
 namespace _462 {
 
-class Scene;
+struct TraversalStats;
 
 class Raytracer
 {
@@ -28,11 +30,70 @@ public:
     ~Raytracer();
 
     bool initialize( Scene* scene, size_t width, size_t height ); 
-    Color3 trace_pixel(const Scene* scene, size_t x, size_t y,size_t width, size_t height);
+    // sets the scene and image size from camera like initialize, but
+    // leaves the scene's geometries as they are, so raytracers can share
+    // a scene that is already initialized while others are tracing it
+    void set_view( Scene* scene, size_t width, size_t height, const Camera& camera );
+    // restarts the raytrace from the scene's current camera, keeping the
+    // per-geometry data computed by initialize
+    void update_camera();
+    // as above, from the given camera instead of the scene's
+    void update_camera( const Camera& camera );
+    // depth, if given, is set to how far along the viewing ray it hit, or
+    // -1 if it hit nothing
+    Color3 trace_pixel(const Scene* scene, size_t x, size_t y,size_t width, size_t height, real_t* depth = 0);
+    // the normalized direction of the viewing ray through the pixel, which
+    // starts at the camera position
+    Vector3 primary_ray( size_t x, size_t y ) const;
+    // where the viewing ray through point crosses the image, in pixels with
+    // pixel centers at .5. returns false if point is behind the camera.
+    bool project( const Vector3& point, real_t* x, real_t* y ) const;
     bool raytrace( unsigned char* buffer, real_t* max_time );
+    // traces the tile_width by tile_height pixels whose bottom-left is x, y
+    // into colors, a row at a time from the bottom, and the depths of the
+    // viewing rays into depths if not null, as in trace_pixel
+    void trace_tile( size_t x, size_t y, size_t tile_width, size_t tile_height, Color3* colors,
+                     real_t* depths = 0 );
+
+    // traces tiles a bounce at a time, see trace_wavefront
+    void set_wavefront( bool wavefront );
+    bool is_wavefront() const;
+    // sets optional stats that count the work of tracing viewing,
+    // reflected and refracted rays, or null for none
+    void set_stats( TraversalStats* stats );
+    // the occluders remembered for shadow rays, and how often they hit
+    const ShadowCache& get_shadow_cache() const;
+    // sets an optional cache that answers and records shadow rays, or null
+    void set_visibility_cache( VisibilityCache* visibility );
+
+    // sets an optional linear color buffer that passes accumulate into
+    void set_hdr_buffer( float* hdr_buffer );
+    // restarts the raytrace for another pass accumulated into the hdr buffer
+    void next_pass();
+    // the number of completed passes accumulated into the hdr buffer
+    size_t num_passes() const;
+
+    // true if the row has been traced in the current pass
+    bool is_row_done( size_t row ) const;
+    // marks a row as traced so raytrace skips it, e.g. when resuming
+    void set_row_done( size_t row );
+
+    // bounces of reflected and refracted rays traced after the viewing ray
+    static const int MAX_BOUNCES = 3;
+    // rows traced together in wavefront mode
+    static const size_t WAVEFRONT_ROWS = 16;
 
 private:
 
+    /**
+     * Traces a tile breadth first: all viewing rays, then all the rays
+     * they spawn, sorted so that rays starting near each other in the
+     * same direction are traced together, and so on for each bounce. The
+     * colors are combined afterwards exactly as trace_pixel would have.
+     */
+    void trace_wavefront( size_t x, size_t y, size_t tile_width, size_t tile_height, Color3* colors,
+                          real_t* depths );
+
     // the scene to trace
     Scene* scene;
    
@@ -47,6 +108,21 @@ private:
 
     // the next row to raytrace
     size_t current_row;
+    // which rows of the current pass have been traced
+    std::vector< bool > rows_done;
+
+    // unclamped RGB sums of every pass, 3 floats per pixel. not owned.
+    float* hdr_buffer;
+    // the number of passes summed into hdr_buffer
+    size_t passes;
+
+    bool wavefront;
+    // not owned, may be null
+    TraversalStats* stats;
+    // the last occluder of each light, for the shadow rays traced here
+    ShadowCache shadow_cache;
+    // the colors of the rows traced at once
+    std::vector< Color3 > row_colors;
 };
 
 } /* _462 */
@@ -0,0 +1,172 @@
+/**
+ * @file render_pool.cpp
+ * @brief Threads tracing the images of any number of requests at once.
+ */
+
+#include "raytracer/render_pool.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace _462 {
+
+// traces rows [row, row + num_rows) of job's crop into its pixels,
+// averaging each pixel's samples
+static void trace_band( Raytracer* raytracer, RenderJob* job, int row, int num_rows,
+                        std::vector< Color3 >* colors )
+{
+    size_t s = job->samples;
+    size_t traced_width = job->crop_width * s;
+    colors->resize( traced_width * num_rows * s );
+    raytracer->trace_tile( job->crop_x * s, ( job->crop_y + row ) * s, traced_width, num_rows * s,
+                           &( *colors )[0] );
+
+    real_t scale = 1.0 / ( s * s );
+    for ( int y = 0; y < num_rows; ++y ) {
+        for ( int x = 0; x < job->crop_width; ++x ) {
+            Color3 sum = Color3::Black;
+            for ( size_t j = 0; j < s; ++j ) {
+                const Color3* sample = &( *colors )[( y * s + j ) * traced_width + x * s];
+                for ( size_t i = 0; i < s; ++i ) {
+                    sum += sample[i];
+                }
+            }
+            ( sum * scale ).to_array( &job->pixels[4 * ( ( row + y ) * job->crop_width + x )] );
+        }
+    }
+}
+
+RenderJob::RenderJob()
+    : scene( 0 ), width( 0 ), height( 0 ), crop_x( 0 ), crop_y( 0 ), crop_width( 0 ), crop_height( 0 ),
+      samples( 1 ), band_rows( 1 ), next_row( 0 ), rows_done( 0 ), done( false ) { }
+
+RenderJob::~RenderJob() { }
+
+void RenderJob::finish() { }
+
+RenderPool::RenderPool()
+    : quit( false )
+{
+    mutex = SDL_CreateMutex();
+    wake = SDL_CreateCond();
+    finished = SDL_CreateCond();
+}
+
+RenderPool::~RenderPool()
+{
+    stop();
+    SDL_DestroyCond( finished );
+    SDL_DestroyCond( wake );
+    SDL_DestroyMutex( mutex );
+}
+
+size_t RenderPool::start( size_t num_threads, bool wavefront )
+{
+    assert( threads.empty() );
+    quit = false;
+    threads.resize( num_threads );
+
+    size_t num_started = 0;
+    for ( size_t i = 0; i < threads.size(); ++i ) {
+        threads[i].owner = this;
+        threads[i].raytracer.set_wavefront( wavefront );
+        threads[i].thread = SDL_CreateThread( thread_main, &threads[i] );
+        if ( threads[i].thread ) {
+            ++num_started;
+        }
+    }
+    return num_started;
+}
+
+void RenderPool::stop()
+{
+    SDL_mutexP( mutex );
+    quit = true;
+    SDL_CondBroadcast( wake );
+    SDL_mutexV( mutex );
+
+    for ( size_t i = 0; i < threads.size(); ++i ) {
+        if ( threads[i].thread ) {
+            SDL_WaitThread( threads[i].thread, 0 );
+        }
+    }
+    threads.clear();
+}
+
+void RenderPool::submit( RenderJob* job )
+{
+    assert( job->width >= 1 && job->width <= RenderJob::MAX_SIZE );
+    assert( job->height >= 1 && job->height <= RenderJob::MAX_SIZE );
+    assert( job->samples >= 1 && job->samples <= RenderJob::MAX_SAMPLES );
+
+    // in wavefront mode, about as many traced rows as its sorting works over
+    job->band_rows = std::max( 1, int( Raytracer::WAVEFRONT_ROWS ) / job->samples );
+    job->next_row = 0;
+    job->rows_done = 0;
+    job->done = false;
+    job->pixels.resize( 4 * size_t( job->crop_width ) * job->crop_height );
+
+    SDL_mutexP( mutex );
+    jobs.push_back( job );
+    SDL_CondBroadcast( wake );
+    SDL_mutexV( mutex );
+}
+
+void RenderPool::wait( RenderJob* job )
+{
+    SDL_mutexP( mutex );
+    while ( !job->done ) {
+        SDL_CondWait( finished, mutex );
+    }
+    SDL_mutexV( mutex );
+}
+
+int RenderPool::thread_main( void* data )
+{
+    Thread* thread = static_cast< Thread* >( data );
+    thread->owner->work( thread );
+    return 0;
+}
+
+void RenderPool::work( Thread* thread )
+{
+    std::vector< Color3 > colors;
+
+    SDL_mutexP( mutex );
+    while ( true ) {
+        while ( !quit && jobs.empty() ) {
+            SDL_CondWait( wake, mutex );
+        }
+        if ( jobs.empty() )
+            break;
+
+        // take a band of the oldest job, and send the job to the back of
+        // the queue so jobs in flight together are traced side by side
+        RenderJob* job = jobs.front();
+        jobs.pop_front();
+        int row = job->next_row;
+        int num_rows = std::min( job->band_rows, job->crop_height - row );
+        job->next_row += num_rows;
+        if ( job->next_row < job->crop_height ) {
+            jobs.push_back( job );
+        }
+        SDL_mutexV( mutex );
+
+        // each band sets the view, since the jobs take turns
+        thread->raytracer.set_view( job->scene, job->width * job->samples,
+                                    job->height * job->samples, job->camera );
+        trace_band( &thread->raytracer, job, row, num_rows, &colors );
+
+        SDL_mutexP( mutex );
+        job->rows_done += num_rows;
+        if ( job->rows_done == job->crop_height ) {
+            SDL_mutexV( mutex );
+            job->finish();
+            SDL_mutexP( mutex );
+            job->done = true;
+            SDL_CondBroadcast( finished );
+        }
+    }
+    SDL_mutexV( mutex );
+}
+
+} /* _462 */
@@ -0,0 +1,137 @@
+/**
+ * @file render_pool.hpp
+ * @brief Threads tracing the images of any number of requests at once.
+ */
+
+#ifndef _462_RAYTRACER_RENDER_POOL_HPP_
+#define _462_RAYTRACER_RENDER_POOL_HPP_
+
+#include "raytracer/raytracer.hpp"
+#include <SDL/SDL_thread.h>
+#include <SDL/SDL_mutex.h>
+#include <deque>
+#include <vector>
+
+namespace _462 {
+
+/**
+ * A crop of an image of a scene, for a RenderPool to trace. Threads take
+ * bands of its rows in turn and write them straight into pixels, so
+ * nothing larger than the crop is kept however many samples it has.
+ */
+class RenderJob
+{
+public:
+
+    RenderJob();
+    virtual ~RenderJob();
+
+    // the scene, already initialized by a raytracer so tracing only reads
+    // it, and the camera to trace it from
+    Scene* scene;
+    Camera camera;
+    // the whole image, before samples
+    int width, height;
+    // the part of it to trace, in pixels of the image
+    int crop_x, crop_y, crop_width, crop_height;
+    // samples per pixel along each axis, averaged
+    int samples;
+    // the crop as 4 bytes of RGBA per pixel, bottom row first, sized by submit
+    std::vector< unsigned char > pixels;
+
+    /**
+     * Called on the thread that traced the last band, once pixels is
+     * complete and before wait returns, e.g. to save the image without
+     * holding up the thread that submitted it.
+     */
+    virtual void finish();
+
+    // the largest image width or height, and the most samples per pixel
+    // along each axis, a job may ask for
+    static const int MAX_SIZE = 8192;
+    static const int MAX_SAMPLES = 8;
+
+private:
+
+    friend class RenderPool;
+
+    // crop rows traced at once
+    int band_rows;
+    // the next crop row to hand out, and how many are finished
+    int next_row;
+    int rows_done;
+    // set once finish has returned
+    bool done;
+
+    // no meaningful assignment/copy
+    RenderJob( const RenderJob& );
+    RenderJob& operator=( const RenderJob& );
+};
+
+/**
+ * Threads, each with its own Raytracer, tracing the jobs submitted to
+ * them. Jobs take turns a band at a time, so one submitted while others
+ * are in flight is traced alongside them, and no thread waits for
+ * another's job to finish before starting the next.
+ */
+class RenderPool
+{
+public:
+
+    RenderPool();
+    // stops the threads
+    ~RenderPool();
+
+    /**
+     * Starts num_threads threads, tracing a bounce at a time if wavefront
+     * is set. The pool must not be running.
+     * @return the number of threads started.
+     */
+    size_t start( size_t num_threads, bool wavefront );
+
+    // traces every job submitted, then stops the threads and waits for them
+    void stop();
+
+    // queues job, which must be within the limits of RenderJob and not
+    // change until wait for it returns
+    void submit( RenderJob* job );
+
+    // waits until job has been traced and finished
+    void wait( RenderJob* job );
+
+private:
+
+    struct Thread
+    {
+        RenderPool* owner;
+        Raytracer raytracer;
+        SDL_Thread* thread;
+    };
+
+    static int thread_main( void* data );
+    // traces bands of jobs until told to quit and there are none left
+    void work( Thread* thread );
+
+    typedef std::vector< Thread > ThreadList;
+    typedef std::deque< RenderJob* > JobQueue;
+
+    ThreadList threads;
+
+    // guards everything below, and the bookkeeping of the queued jobs
+    SDL_mutex* mutex;
+    // signalled when jobs are queued or the threads should quit
+    SDL_cond* wake;
+    // broadcast whenever a job is done
+    SDL_cond* finished;
+    // the jobs with rows left to hand out, in the order they get them
+    JobQueue jobs;
+    bool quit;
+
+    // no meaningful assignment/copy
+    RenderPool( const RenderPool& );
+    RenderPool& operator=( const RenderPool& );
+};
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_RENDER_POOL_HPP_ */
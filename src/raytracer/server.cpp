@@ -0,0 +1,338 @@
+/**
+ * @file server.cpp
+ * @brief Serving render requests for a scene kept loaded.
+ *
+ * Protocol, every integer is sent in network byte order and every float
+ * as its bit pattern, see network.hpp:
+ *   client -> server: magic "RTSV", version
+ *   then any number of requests, each answered before the next is read:
+ *     client -> server: command
+ *     for RENDER:
+ *       client -> server: image width, height, crop x, y, width, height
+ *         (a crop width of 0 for the whole image), samples per pixel
+ *         along each axis, format, whether the scene's camera is
+ *         overridden, and if so the camera's position x, y, z, its
+ *         orientation as angle, axis x, y, z and its fov, both angles in
+ *         radians as in scene files
+ *       server -> client: status, byte count, then either a PNG file of
+ *         the crop or its pixels as 4 bytes of RGBA, bottom row first
+ *     for STOP:
+ *       server -> client: status, byte count of 0
+ *   Closing the connection ends the session.
+ */
+
+#include "raytracer/server.hpp"
+#include "raytracer/raytracer.hpp"
+#include "raytracer/render_pool.hpp"
+#include "application/network.hpp"
+#include "application/imageio.hpp"
+#include "scene/scene.hpp"
+
+#include <SDL/SDL_thread.h>
+#include <SDL/SDL_mutex.h>
+#include <iostream>
+#include <cstring>
+#include <vector>
+
+namespace _462 {
+
+static const char MAGIC[4] = { 'R', 'T', 'S', 'V' };
+static const int VERSION = 1;
+
+enum Command
+{
+    COMMAND_RENDER = 1,
+    COMMAND_STOP = 2
+};
+
+enum Format
+{
+    FORMAT_PNG = 0,
+    FORMAT_RGBA = 1
+};
+
+enum Status
+{
+    STATUS_OK = 0,
+    // the request asked for something out of range
+    STATUS_INVALID = 1,
+    // the image could not be made or encoded
+    STATUS_FAILED = 2
+};
+
+// how often idle clients and the listener check whether to stop
+static const int POLL_INTERVAL = 100;
+
+struct ServerState
+{
+    Scene* scene;
+    RenderPool* pool;
+
+    // guards everything below
+    SDL_mutex* mutex;
+    // whether a client asked the server to stop
+    bool stopping;
+};
+
+struct Connection
+{
+    ServerState* state;
+    int sock;
+    SDL_Thread* thread;
+    // set by the connection's thread when it has finished, guarded by
+    // the state's mutex
+    bool done;
+};
+
+typedef std::vector< Connection* > ConnectionList;
+
+static bool stop_requested( ServerState* state )
+{
+    SDL_mutexP( state->mutex );
+    bool stopping = state->stopping;
+    SDL_mutexV( state->mutex );
+    return stopping;
+}
+
+// waits until sock has data, returning false if it failed or the server is stopping
+static bool wait_readable( ServerState* state, int sock )
+{
+    bool ready = false;
+    while ( !ready ) {
+        if ( stop_requested( state ) || !net_wait( &sock, &ready, 1, POLL_INTERVAL ) )
+            return false;
+    }
+    return true;
+}
+
+static bool send_reply( int sock, int status, const unsigned char* data, size_t size )
+{
+    return net_send_int( sock, status ) && net_send_int( sock, int( size ) )
+        && ( size == 0 || net_send( sock, data, size ) );
+}
+
+/**
+ * Reads the rest of a render request into job. Returns false if the
+ * connection failed, otherwise sets valid to whether the request can
+ * be traced.
+ */
+static bool recv_request( int sock, const Scene& scene, RenderJob* job, int* format, bool* valid )
+{
+    int has_camera;
+    if ( !net_recv_int( sock, &job->width ) || !net_recv_int( sock, &job->height )
+         || !net_recv_int( sock, &job->crop_x ) || !net_recv_int( sock, &job->crop_y )
+         || !net_recv_int( sock, &job->crop_width ) || !net_recv_int( sock, &job->crop_height )
+         || !net_recv_int( sock, &job->samples ) || !net_recv_int( sock, format )
+         || !net_recv_int( sock, &has_camera ) ) {
+        return false;
+    }
+
+    job->camera = scene.camera;
+    bool camera_valid = true;
+    if ( has_camera ) {
+        float position[3], angle, axis[3], fov;
+        if ( !net_recv_float( sock, &position[0] ) || !net_recv_float( sock, &position[1] )
+             || !net_recv_float( sock, &position[2] ) || !net_recv_float( sock, &angle )
+             || !net_recv_float( sock, &axis[0] ) || !net_recv_float( sock, &axis[1] )
+             || !net_recv_float( sock, &axis[2] ) || !net_recv_float( sock, &fov ) ) {
+            return false;
+        }
+        Vector3 axis_vector( axis[0], axis[1], axis[2] );
+        camera_valid = length( axis_vector ) > 0 && fov > 0 && fov < PI;
+        if ( camera_valid ) {
+            job->camera.position = Vector3( position[0], position[1], position[2] );
+            job->camera.orientation = normalize( Quaternion( axis_vector, angle ) );
+            job->camera.fov = fov;
+        }
+    }
+
+    // a crop width of 0 asks for the whole image
+    if ( job->crop_width == 0 ) {
+        job->crop_x = 0;
+        job->crop_y = 0;
+        job->crop_width = job->width;
+        job->crop_height = job->height;
+    }
+
+    *valid = camera_valid
+        && job->width >= 1 && job->width <= RenderJob::MAX_SIZE
+        && job->height >= 1 && job->height <= RenderJob::MAX_SIZE
+        && job->crop_x >= 0 && job->crop_y >= 0 && job->crop_width >= 1 && job->crop_height >= 1
+        // subtracted, as the client's values could overflow a sum
+        && job->crop_x <= job->width - job->crop_width && job->crop_y <= job->height - job->crop_height
+        && job->samples >= 1 && job->samples <= RenderJob::MAX_SAMPLES
+        && ( *format == FORMAT_PNG || *format == FORMAT_RGBA );
+    return true;
+}
+
+// answers the requests of one client until it disconnects or the server stops
+static void serve_client( ServerState* state, int sock )
+{
+    char magic[sizeof MAGIC];
+    int version;
+    if ( !wait_readable( state, sock ) || !net_recv( sock, magic, sizeof magic )
+         || memcmp( magic, MAGIC, sizeof MAGIC ) != 0
+         || !net_recv_int( sock, &version ) || version != VERSION ) {
+        return;
+    }
+
+    while ( true ) {
+        int command;
+        if ( !wait_readable( state, sock ) || !net_recv_int( sock, &command ) )
+            return;
+
+        if ( command == COMMAND_STOP ) {
+            SDL_mutexP( state->mutex );
+            state->stopping = true;
+            SDL_mutexV( state->mutex );
+            send_reply( sock, STATUS_OK, 0, 0 );
+            return;
+        }
+        if ( command != COMMAND_RENDER ) {
+            return;
+        }
+
+        RenderJob job;
+        int format;
+        bool valid;
+        if ( !recv_request( sock, *state->scene, &job, &format, &valid ) )
+            return;
+        if ( !valid ) {
+            if ( !send_reply( sock, STATUS_INVALID, 0, 0 ) )
+                return;
+            continue;
+        }
+
+        job.scene = state->scene;
+        state->pool->submit( &job );
+        state->pool->wait( &job );
+
+        bool sent;
+        if ( format == FORMAT_PNG ) {
+            size_t size;
+            unsigned char* png = imageio_encode_png( &job.pixels[0], job.crop_width,
+                                                     job.crop_height, &size );
+            sent = png ? send_reply( sock, STATUS_OK, png, size )
+                       : send_reply( sock, STATUS_FAILED, 0, 0 );
+            free( png );
+        } else {
+            sent = send_reply( sock, STATUS_OK, &job.pixels[0], job.pixels.size() );
+        }
+        if ( !sent )
+            return;
+    }
+}
+
+static int connection_main( void* data )
+{
+    Connection* connection = static_cast< Connection* >( data );
+    serve_client( connection->state, connection->sock );
+    net_close( connection->sock );
+
+    SDL_mutexP( connection->state->mutex );
+    connection->done = true;
+    SDL_mutexV( connection->state->mutex );
+    return 0;
+}
+
+// waits for the threads of finished connections, or of all if block is set
+static void reap_connections( ServerState* state, ConnectionList* connections, bool block )
+{
+    for ( size_t i = 0; i < connections->size(); ) {
+        Connection* connection = ( *connections )[i];
+        SDL_mutexP( state->mutex );
+        bool done = connection->done;
+        SDL_mutexV( state->mutex );
+
+        if ( done || block ) {
+            SDL_WaitThread( connection->thread, 0 );
+            delete connection;
+            connections->erase( connections->begin() + i );
+        } else {
+            ++i;
+        }
+    }
+}
+
+bool render_serve( const ServerParams& params, Scene* scene, Raytracer* raytracer )
+{
+    // bring the scene up to date once, the threads only read it
+    if ( !raytracer->initialize( scene, 1, 1 ) ) {
+        std::cout << "Raytracer initialization failed.\n";
+        return false;
+    }
+
+    int listener = net_listen( params.address );
+    if ( listener == -1 )
+        return false;
+
+    char address[256];
+    if ( !net_local_address( listener, address, sizeof address ) ) {
+        std::cout << "Cannot determine the server address.\n";
+        net_close( listener );
+        return false;
+    }
+
+    RenderPool pool;
+    ServerState state;
+    state.scene = scene;
+    state.pool = &pool;
+    state.mutex = SDL_CreateMutex();
+    state.stopping = false;
+
+    size_t num_started = pool.start( params.num_threads, raytracer->is_wavefront() );
+
+    bool ok = num_started > 0;
+    if ( ok ) {
+        // flushed so scripts starting the server can read the address
+        std::cout << "Serving render requests on " << address << " with " << num_started
+                  << " threads." << std::endl;
+    } else {
+        std::cout << "Cannot start the server's threads.\n";
+    }
+
+    ConnectionList connections;
+    while ( ok && !stop_requested( &state ) ) {
+        bool ready;
+        if ( !net_wait( &listener, &ready, 1, POLL_INTERVAL ) ) {
+            ok = false;
+            break;
+        }
+
+        if ( ready ) {
+            int sock = net_accept( listener );
+            if ( sock != -1 ) {
+                Connection* connection = new Connection;
+                connection->state = &state;
+                connection->sock = sock;
+                connection->done = false;
+                connection->thread = SDL_CreateThread( connection_main, connection );
+                if ( connection->thread ) {
+                    connections.push_back( connection );
+                } else {
+                    net_close( sock );
+                    delete connection;
+                }
+            }
+        }
+
+        reap_connections( &state, &connections, false );
+    }
+    net_close( listener );
+
+    // clients finish their current requests once the server is stopping
+    SDL_mutexP( state.mutex );
+    state.stopping = true;
+    SDL_mutexV( state.mutex );
+    reap_connections( &state, &connections, true );
+
+    pool.stop();
+    SDL_DestroyMutex( state.mutex );
+
+    if ( ok ) {
+        std::cout << "Server stopped.\n";
+    }
+    return ok;
+}
+
+} /* _462 */
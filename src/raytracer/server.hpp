@@ -0,0 +1,41 @@
+/**
+ * @file server.hpp
+ * @brief Serving render requests for a scene kept loaded.
+ *
+ * The server loads a scene once and answers requests from any number of
+ * clients for images of it, each with its own camera, size, crop and
+ * samples. The requests in flight are split into bands of rows traced by
+ * one pool of threads, so concurrent clients share the cores.
+ */
+
+#ifndef _462_RAYTRACER_SERVER_HPP_
+#define _462_RAYTRACER_SERVER_HPP_
+
+#include <cstdlib>
+
+namespace _462 {
+
+class Scene;
+class Raytracer;
+
+struct ServerParams
+{
+    // address to accept clients on, see network.hpp
+    const char* address;
+    // the number of threads tracing requests, shared by every client
+    int num_threads;
+};
+
+/**
+ * Accepts clients at params.address and renders their requests until one
+ * asks the server to stop. The requests in flight when it does are
+ * finished first. The scene and its assets must already be loaded.
+ * @param raytracer Initialized for the scene here. The threads trace the
+ *  way it is set to, e.g. a bounce at a time.
+ * @return true if a client stopped the server, false on error.
+ */
+bool render_serve( const ServerParams& params, Scene* scene, Raytracer* raytracer );
+
+} /* _462 */
+
+#endif /* _462_RAYTRACER_SERVER_HPP_ */
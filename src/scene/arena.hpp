@@ -0,0 +1,90 @@
+/**
+ * @file arena.hpp
+ * @brief Block allocation of scene objects.
+ */
+
+#ifndef _462_SCENE_ARENA_HPP_
+#define _462_SCENE_ARENA_HPP_
+
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+
+namespace _462 {
+
+/**
+ * Makes objects of one type in blocks of many, so objects made one after
+ * another lie together in memory, and frees them all at once. Blocks
+ * double in size up to MAX_BLOCK objects, so an arena of n objects takes
+ * a handful of allocations rather than n. Objects are never freed one at
+ * a time: clear destroys every object in the order they were made and
+ * releases the blocks.
+ */
+template< typename T >
+class ObjectArena
+{
+public:
+
+    ObjectArena() : num_objects( 0 ) { }
+    ~ObjectArena() { clear(); }
+
+    // default constructs a new object, which lives until clear
+    T* create()
+    {
+        if ( blocks.empty() || blocks.back().used == blocks.back().capacity ) {
+            Block block;
+            block.capacity = blocks.empty() ? FIRST_BLOCK
+                : std::min( 2 * blocks.back().capacity, size_t( MAX_BLOCK ) );
+            block.used = 0;
+            blocks.reserve( blocks.size() + 1 );
+            block.objects = static_cast< T* >( ::operator new( block.capacity * sizeof( T ) ) );
+            blocks.push_back( block );
+        }
+
+        Block& block = blocks.back();
+        T* object = new ( block.objects + block.used ) T();
+        ++block.used;
+        ++num_objects;
+        return object;
+    }
+
+    // destroys every object and frees the blocks
+    void clear()
+    {
+        for ( size_t i = 0; i < blocks.size(); ++i ) {
+            for ( size_t j = 0; j < blocks[i].used; ++j ) {
+                blocks[i].objects[j].~T();
+            }
+            ::operator delete( blocks[i].objects );
+        }
+        blocks.clear();
+        num_objects = 0;
+    }
+
+    size_t size() const { return num_objects; }
+
+    static const size_t FIRST_BLOCK = 64;
+    static const size_t MAX_BLOCK = 65536;
+
+private:
+
+    struct Block
+    {
+        T* objects;
+        // objects made, and room for
+        size_t used;
+        size_t capacity;
+    };
+
+    std::vector< Block > blocks;
+    size_t num_objects;
+
+    // no meaningful assignment or copy
+    ObjectArena( const ObjectArena& );
+    ObjectArena& operator=( const ObjectArena& );
+};
+
+} /* _462 */
+
+#endif /* _462_SCENE_ARENA_HPP_ */
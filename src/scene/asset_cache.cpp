@@ -0,0 +1,90 @@
+/**
+ * @file asset_cache.cpp
+ * @brief Textures and meshes loaded once for many scenes.
+ */
+
+#include "scene/asset_cache.hpp"
+#include "scene/scene.hpp"
+#include "scene/model.hpp"
+
+namespace _462 {
+
+AssetCache::AssetCache()
+    : loaded( 0 ), shared( 0 ) { }
+
+bool AssetCache::load( Scene* scene )
+{
+    // a file that fails is kept too, so it is not tried again
+    bool ok = true;
+    Material* const* materials = scene->get_materials();
+    for ( size_t i = 0; i < scene->num_materials(); ++i ) {
+        const std::string& filename = materials[i]->texture_filename;
+        if ( filename.empty() )
+            continue;
+
+        TextureMap::iterator iter = textures.find( filename );
+        if ( iter == textures.end() ) {
+            Material* texture = texture_arena.create();
+            texture->texture_filename = filename;
+            if ( !texture->load() ) {
+                failed.insert( texture );
+            }
+            iter = textures.insert( TextureMap::value_type( filename, texture ) ).first;
+            ++loaded;
+        } else {
+            ++shared;
+        }
+        materials[i]->share_texture( *iter->second );
+        ok = ok && failed.count( iter->second ) == 0;
+    }
+
+    // the models using each mesh, as baking only moves a mesh one uses
+    std::map< const Mesh*, size_t > users;
+    Geometry* const* geometries = scene->get_geometries();
+    for ( size_t i = 0; i < scene->num_geometries(); ++i ) {
+        const Model* model = dynamic_cast< const Model* >( geometries[i] );
+        if ( model ) {
+            ++users[model->mesh];
+        }
+    }
+
+    // index, since sharing a mesh replaces it in the scene's list
+    for ( size_t i = 0; i < scene->num_meshes(); ++i ) {
+        Mesh* own = scene->get_meshes()[i];
+        MeshKey key( own->filename,
+                     std::make_pair( int( scene->bvh_build_mode ), int( scene->bvh_layout ) ) );
+
+        MeshMap::iterator iter = meshes.find( key );
+        if ( iter == meshes.end() ) {
+            Mesh* mesh = mesh_arena.create();
+            mesh->filename = key.first;
+            if ( !mesh->load( scene->bvh_build_mode, scene->bvh_layout ) ) {
+                failed.insert( mesh );
+            }
+            iter = meshes.insert( MeshMap::value_type( key, mesh ) ).first;
+            ++loaded;
+        } else {
+            ++shared;
+        }
+        bool loaded_ok = failed.count( iter->second ) == 0;
+        if ( scene->bake_transforms && loaded_ok && users[own] == 1 ) {
+            own->copy( *iter->second );
+        } else {
+            scene->share_mesh( i, iter->second );
+        }
+        ok = ok && loaded_ok;
+    }
+    return ok;
+}
+
+size_t AssetCache::num_loaded() const
+{
+    return loaded;
+}
+
+size_t AssetCache::num_shared() const
+{
+    return shared;
+}
+
+} /* _462 */
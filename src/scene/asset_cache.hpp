@@ -0,0 +1,75 @@
+/**
+ * @file asset_cache.hpp
+ * @brief Textures and meshes loaded once for many scenes.
+ */
+
+#ifndef _462_SCENE_ASSET_CACHE_HPP_
+#define _462_SCENE_ASSET_CACHE_HPP_
+
+#include "scene/arena.hpp"
+#include "scene/material.hpp"
+#include "scene/mesh.hpp"
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+namespace _462 {
+
+class Scene;
+
+/**
+ * Keeps the textures and meshes loaded for scenes, so a texture or mesh
+ * file used by several scenes rendered in one process is decoded or
+ * parsed, and its hierarchy built, only once. Every scene loaded through
+ * the cache points at the same copy, which lives until the cache is
+ * destroyed, so the cache must outlive the scenes.
+ */
+class AssetCache
+{
+public:
+
+    AssetCache();
+
+    /**
+     * Loads the textures and meshes of a scene just read from a scene
+     * file, as loading it for a raytrace would, but shares those already
+     * loaded for an earlier scene instead of loading them again. Meshes
+     * are built in the scene's bvh_build_mode and bvh_layout, and only
+     * shared with scenes that use the same. If the scene bakes transforms,
+     * a mesh only one of its models uses is copied into the scene
+     * instead, so baking can move it into world space.
+     * @return false if a texture or mesh could not be loaded, now or for
+     *  an earlier scene. The scene is still set up without it.
+     */
+    bool load( Scene* scene );
+
+    // the number of files loaded, and of times one was shared instead
+    size_t num_loaded() const;
+    size_t num_shared() const;
+
+private:
+
+    // a mesh file with the build mode and layout of its hierarchy
+    typedef std::pair< std::string, std::pair< int, int > > MeshKey;
+    typedef std::map< std::string, Material* > TextureMap;
+    typedef std::map< MeshKey, Mesh* > MeshMap;
+
+    // materials holding nothing but a texture, by file name
+    TextureMap textures;
+    MeshMap meshes;
+    // the textures and meshes whose files could not be loaded
+    std::set< const void* > failed;
+    ObjectArena< Material > texture_arena;
+    ObjectArena< Mesh > mesh_arena;
+    size_t loaded;
+    size_t shared;
+
+    // no meaningful assignment or copy
+    AssetCache( const AssetCache& );
+    AssetCache& operator=( const AssetCache& );
+};
+
+} /* _462 */
+
+#endif /* _462_SCENE_ASSET_CACHE_HPP_ */
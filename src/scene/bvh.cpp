@@ -0,0 +1,512 @@
+/**
+ * @file bvh.cpp
+ * @brief Bounding volume hierarchy over axis-aligned boxes.
+ */
+
+#include "scene/bvh.hpp"
+
+#include <SDL/SDL_thread.h>
+#include <SDL/SDL_timer.h>
+#include <algorithm>
+
+namespace _462 {
+
+const real_t Bvh::REBUILD_COST_RATIO = 1.5;
+
+// relative cost of visiting a node and of testing a primitive
+#define TRAVERSAL_COST 1.0
+#define INTERSECTION_COST 1.0
+
+bool BoundingBox::intersect_ray( const Vector3& origin, const Vector3& inv_dir, real_t tmax ) const
+{
+    real_t tenter;
+    return intersect_ray( origin, inv_dir, tmax, &tenter );
+}
+
+bool BoundingBox::intersect_ray( const Vector3& origin, const Vector3& inv_dir, real_t tmax, real_t* tenter_out ) const
+{
+    real_t tenter = 0.0;
+    real_t texit = tmax;
+
+    for ( size_t i = 0; i < 3; ++i ) {
+        real_t t0 = ( min[i] - origin[i] ) * inv_dir[i];
+        real_t t1 = ( max[i] - origin[i] ) * inv_dir[i];
+        if ( t0 > t1 )
+            std::swap( t0, t1 );
+        // written so that a NaN, from a ray lying in a slab plane, is ignored
+        tenter = t0 > tenter ? t0 : tenter;
+        texit = t1 < texit ? t1 : texit;
+        if ( tenter > texit )
+            return false;
+    }
+
+    *tenter_out = tenter;
+    return true;
+}
+
+BoundingBox transform_bounds( const BoundingBox& b, const Matrix4& mat )
+{
+    BoundingBox rv;
+    if ( b.is_empty() )
+        return rv;
+
+    for ( int i = 0; i < 8; ++i ) {
+        Vector3 corner( i & 1 ? b.max.x : b.min.x,
+                        i & 2 ? b.max.y : b.min.y,
+                        i & 4 ? b.max.z : b.min.z );
+        rv.include( mat.transform_point( corner ) );
+    }
+    return rv;
+}
+
+BoundingBox pad_bounds( const BoundingBox& b )
+{
+    static const real_t PAD = 1e-7;
+
+    if ( b.is_empty() )
+        return b;
+
+    Vector3 size = b.max - b.min;
+    real_t pad = PAD * ( 1.0 + std::max( size.x, std::max( size.y, size.z ) )
+                       + std::max( length( b.min ), length( b.max ) ) );
+    Vector3 offset( pad, pad, pad );
+    return BoundingBox( b.min - offset, b.max + offset );
+}
+
+Bvh::Bvh()
+    : cost_sum( 0.0 ), build_cost( 0.0 ), build_mode( BUILD_SAH ), build_time( 0 ) { }
+
+// the state shared by every node of one build
+struct BuildContext
+{
+    const BoundingBox* boxes;
+    const Vector3* centers;
+    // morton code of the primitive at each position of indices, lbvh only
+    const unsigned int* codes;
+    unsigned int* indices;
+    Bvh::BuildMode mode;
+};
+
+static unsigned int build_node( const BuildContext& ctx, std::vector< Bvh::Node >* nodes,
+                                unsigned int begin, unsigned int end, unsigned int depth );
+
+// a subtree built on its own thread into its own node list
+struct BuildTask
+{
+    const BuildContext* ctx;
+    std::vector< Bvh::Node > nodes;
+    unsigned int begin, end, depth;
+};
+
+static int build_task( void* data )
+{
+    BuildTask* task = static_cast< BuildTask* >( data );
+    build_node( *task->ctx, &task->nodes, task->begin, task->end, task->depth );
+    return 0;
+}
+
+// orders primitive indices by the bin of their center along one axis
+struct BinPredicate
+{
+    const Vector3* centers;
+    size_t axis;
+    real_t min;
+    real_t scale;
+    unsigned int split;
+
+    bool operator()( unsigned int prim ) const
+    {
+        return center_bin( centers[prim][axis], min, scale ) < split;
+    }
+
+    static unsigned int center_bin( real_t center, real_t min, real_t scale )
+    {
+        unsigned int bin = static_cast< unsigned int >( ( center - min ) * scale );
+        return bin < Bvh::SAH_BINS ? bin : Bvh::SAH_BINS - 1;
+    }
+};
+
+/**
+ * Picks the cheapest of the bin boundaries along each axis by the surface
+ * area heuristic, and partitions the range there.
+ * @return false if a leaf is cheaper, or the centers cannot be split.
+ */
+static bool split_sah( const BuildContext& ctx, unsigned int begin, unsigned int end,
+                       unsigned int* mid, unsigned int* axis )
+{
+    BoundingBox center_bounds;
+    for ( unsigned int i = begin; i < end; ++i ) {
+        center_bounds.include( ctx.centers[ctx.indices[i]] );
+    }
+
+    unsigned int count = end - begin;
+    real_t best_cost = std::numeric_limits< real_t >::max();
+    unsigned int best_axis = 0;
+    unsigned int best_split = 0;
+    real_t area = 0.0;
+
+    for ( unsigned int a = 0; a < 3; ++a ) {
+        real_t extent = center_bounds.max[a] - center_bounds.min[a];
+        if ( extent <= 0.0 )
+            continue;
+        real_t scale = Bvh::SAH_BINS / extent;
+
+        BoundingBox bin_bounds[Bvh::SAH_BINS];
+        unsigned int bin_counts[Bvh::SAH_BINS] = { 0 };
+        for ( unsigned int i = begin; i < end; ++i ) {
+            unsigned int prim = ctx.indices[i];
+            unsigned int bin = BinPredicate::center_bin( ctx.centers[prim][a], center_bounds.min[a], scale );
+            bin_bounds[bin].include( ctx.boxes[prim] );
+            bin_counts[bin]++;
+        }
+
+        // sweep from the right to get the cost of everything right of each split
+        real_t right_costs[Bvh::SAH_BINS];
+        BoundingBox right;
+        unsigned int right_count = 0;
+        for ( unsigned int b = Bvh::SAH_BINS - 1; b > 0; --b ) {
+            right.include( bin_bounds[b] );
+            right_count += bin_counts[b];
+            right_costs[b] = right.surface_area() * right_count;
+        }
+
+        BoundingBox left;
+        unsigned int left_count = 0;
+        for ( unsigned int b = 1; b < Bvh::SAH_BINS; ++b ) {
+            left.include( bin_bounds[b - 1] );
+            left_count += bin_counts[b - 1];
+            real_t cost = left.surface_area() * left_count + right_costs[b];
+            if ( cost < best_cost ) {
+                best_cost = cost;
+                best_axis = a;
+                best_split = b;
+            }
+        }
+        left.include( bin_bounds[Bvh::SAH_BINS - 1] );
+        area = left.surface_area();
+    }
+
+    if ( best_split == 0 )
+        return false;
+
+    // compare with making a leaf, in the same units as the tree's cost
+    if ( count <= Bvh::MAX_LEAF_SIZE && area > 0.0
+         && INTERSECTION_COST * count <= TRAVERSAL_COST + INTERSECTION_COST * best_cost / area ) {
+        return false;
+    }
+
+    BinPredicate pred;
+    pred.centers = ctx.centers;
+    pred.axis = best_axis;
+    pred.min = center_bounds.min[best_axis];
+    pred.scale = Bvh::SAH_BINS / ( center_bounds.max[best_axis] - center_bounds.min[best_axis] );
+    pred.split = best_split;
+    *mid = std::partition( ctx.indices + begin, ctx.indices + end, pred ) - ctx.indices;
+    *axis = best_axis;
+    // the first and last bins are never empty, so neither side is
+    assert( *mid > begin && *mid < end );
+    return true;
+}
+
+/**
+ * Splits the range, whose codes are sorted, where the highest bit that
+ * differs between its codes turns on. Ranges of equal codes are halved.
+ * @return false if the range is small enough for a leaf.
+ */
+static bool split_morton( const BuildContext& ctx, unsigned int begin, unsigned int end,
+                          unsigned int* mid, unsigned int* axis )
+{
+    if ( end - begin <= Bvh::MAX_LEAF_SIZE )
+        return false;
+
+    unsigned int first = ctx.codes[begin];
+    unsigned int last = ctx.codes[end - 1];
+    if ( first == last ) {
+        *mid = begin + ( end - begin ) / 2;
+        *axis = 0;
+        return true;
+    }
+
+    unsigned int bit = 31;
+    while ( !( ( first ^ last ) & ( 1u << bit ) ) ) {
+        --bit;
+    }
+    // the first code with the bit set, all higher bits being shared
+    unsigned int threshold = ( last >> bit ) << bit;
+    *mid = std::lower_bound( ctx.codes + begin, ctx.codes + end, threshold ) - ctx.codes;
+    // codes interleave the axes as xyzxyz...
+    *axis = 2 - bit % 3;
+    return true;
+}
+
+/**
+ * Builds the subtree over indices [begin, end) into nodes, splitting it
+ * as the build mode says. The top few levels of large trees build their
+ * second child on another thread.
+ * @return The index of the new node.
+ */
+static unsigned int build_node( const BuildContext& ctx, std::vector< Bvh::Node >* nodes,
+                                unsigned int begin, unsigned int end, unsigned int depth )
+{
+    unsigned int index = nodes->size();
+    nodes->push_back( Bvh::Node() );
+
+    unsigned int mid = 0;
+    unsigned int axis = 0;
+    bool split = depth + 1 < Bvh::MAX_DEPTH
+                 && ( ctx.mode == Bvh::BUILD_LBVH ? split_morton( ctx, begin, end, &mid, &axis )
+                                                  : split_sah( ctx, begin, end, &mid, &axis ) );
+
+    if ( !split ) {
+        Bvh::Node& node = ( *nodes )[index];
+        node.bounds = BoundingBox();
+        for ( unsigned int i = begin; i < end; ++i ) {
+            node.bounds.include( ctx.boxes[ctx.indices[i]] );
+        }
+        node.offset = begin;
+        node.count = end - begin;
+        node.axis = axis;
+        return index;
+    }
+
+    BuildTask task;
+    SDL_Thread* thread = 0;
+    if ( depth < Bvh::PARALLEL_DEPTH && end - begin >= Bvh::PARALLEL_MIN_PRIMITIVES ) {
+        task.ctx = &ctx;
+        task.begin = mid;
+        task.end = end;
+        task.depth = depth + 1;
+        // if no thread can be made, build it here instead
+        thread = SDL_CreateThread( build_task, &task );
+    }
+
+    build_node( ctx, nodes, begin, mid, depth + 1 );
+    unsigned int second;
+    if ( thread ) {
+        SDL_WaitThread( thread, 0 );
+        // move the subtree after the first child
+        second = nodes->size();
+        for ( size_t i = 0; i < task.nodes.size(); ++i ) {
+            if ( task.nodes[i].count == 0 )
+                task.nodes[i].offset += second;
+        }
+        nodes->insert( nodes->end(), task.nodes.begin(), task.nodes.end() );
+    } else {
+        second = build_node( ctx, nodes, mid, end, depth + 1 );
+    }
+
+    // push_back may have moved the nodes, so index again
+    Bvh::Node& node = ( *nodes )[index];
+    node.bounds = ( *nodes )[index + 1].bounds;
+    node.bounds.include( ( *nodes )[second].bounds );
+    node.offset = second;
+    node.count = 0;
+    node.axis = axis;
+    return index;
+}
+
+// orders primitives by morton code, then index so builds are repeatable
+typedef std::pair< unsigned int, unsigned int > CodedIndex;
+
+void Bvh::build( const BoundingBox* boxes, size_t num, BuildMode mode )
+{
+    Uint32 start_time = SDL_GetTicks();
+
+    clear();
+    build_mode = mode;
+    if ( num == 0 )
+        return;
+
+    std::vector< Vector3 > centers( num );
+    indices.resize( num );
+    for ( size_t i = 0; i < num; ++i ) {
+        centers[i] = boxes[i].center();
+        indices[i] = i;
+    }
+
+    BuildContext ctx;
+    ctx.boxes = boxes;
+    ctx.centers = &centers[0];
+    ctx.codes = NULL;
+    ctx.indices = &indices[0];
+    ctx.mode = mode;
+
+    std::vector< unsigned int > codes;
+    if ( mode == BUILD_LBVH ) {
+        // sort the centers along a morton curve through their bounds
+        BoundingBox center_bounds;
+        for ( size_t i = 0; i < num; ++i ) {
+            center_bounds.include( centers[i] );
+        }
+        Vector3 extent = center_bounds.max - center_bounds.min;
+
+        std::vector< CodedIndex > coded( num );
+        for ( size_t i = 0; i < num; ++i ) {
+            unsigned int code = 0;
+            for ( size_t a = 0; a < 3; ++a ) {
+                real_t x = extent[a] > 0.0 ? ( centers[i][a] - center_bounds.min[a] ) / extent[a] : 0.0;
+                unsigned int q = static_cast< unsigned int >( x * 1023.0 );
+                code |= expand_bits( q ) << ( 2 - a );
+            }
+            coded[i] = CodedIndex( code, i );
+        }
+        std::sort( coded.begin(), coded.end() );
+
+        codes.resize( num );
+        for ( size_t i = 0; i < num; ++i ) {
+            codes[i] = coded[i].first;
+            indices[i] = coded[i].second;
+        }
+        ctx.codes = &codes[0];
+    }
+
+    nodes.reserve( 2 * num );
+    build_node( ctx, &nodes, 0, num, 0 );
+    // leaves hold several primitives, so far fewer nodes are used
+    NodeList( nodes ).swap( nodes );
+
+    // link the parents and leaves, which refitting walks
+    leaf_of.resize( num );
+    nodes[0].parent = 0;
+    cost_sum = 0.0;
+    for ( size_t i = 0; i < nodes.size(); ++i ) {
+        const Node& node = nodes[i];
+        if ( node.count > 0 ) {
+            for ( unsigned int j = node.offset; j < node.offset + node.count; ++j ) {
+                leaf_of[indices[j]] = i;
+            }
+        } else {
+            nodes[i + 1].parent = i;
+            nodes[node.offset].parent = i;
+        }
+        cost_sum += node_cost( node );
+    }
+    build_cost = get_cost();
+    build_time = SDL_GetTicks() - start_time;
+}
+
+bool Bvh::update( const BoundingBox* boxes, const unsigned int* changed, size_t num_changed )
+{
+    assert( leaf_of.size() == indices.size() );
+
+    if ( num_changed == 0 )
+        return false;
+
+    // collect the nodes above the changed primitives, stopping at nodes
+    // already collected so each is visited once
+    std::vector< bool > dirty( nodes.size(), false );
+    IndexList dirty_nodes;
+    for ( size_t i = 0; i < num_changed; ++i ) {
+        unsigned int index = leaf_of[changed[i]];
+        while ( !dirty[index] ) {
+            dirty[index] = true;
+            dirty_nodes.push_back( index );
+            if ( index == 0 )
+                break;
+            index = nodes[index].parent;
+        }
+    }
+
+    // children come after their parents, so refit in decreasing index order
+    std::sort( dirty_nodes.begin(), dirty_nodes.end() );
+    for ( size_t i = dirty_nodes.size(); i-- > 0; ) {
+        Node& node = nodes[dirty_nodes[i]];
+        cost_sum -= node_cost( node );
+
+        node.bounds = BoundingBox();
+        if ( node.count > 0 ) {
+            for ( unsigned int j = node.offset; j < node.offset + node.count; ++j ) {
+                node.bounds.include( boxes[indices[j]] );
+            }
+        } else {
+            node.bounds.include( nodes[dirty_nodes[i] + 1].bounds );
+            node.bounds.include( nodes[node.offset].bounds );
+        }
+
+        cost_sum += node_cost( node );
+    }
+
+    if ( get_cost() > REBUILD_COST_RATIO * build_cost ) {
+        build( boxes, indices.size(), build_mode );
+        return true;
+    }
+    return false;
+}
+
+void Bvh::clear()
+{
+    // swap rather than clear to give back the memory
+    NodeList().swap( nodes );
+    IndexList().swap( indices );
+    IndexList().swap( leaf_of );
+    cost_sum = 0.0;
+    build_cost = 0.0;
+    build_time = 0;
+}
+
+bool Bvh::empty() const
+{
+    return nodes.empty();
+}
+
+size_t Bvh::num_nodes() const
+{
+    return nodes.size();
+}
+
+size_t Bvh::num_primitives() const
+{
+    return indices.size();
+}
+
+const Bvh::Node* Bvh::get_nodes() const
+{
+    return nodes.empty() ? NULL : &nodes[0];
+}
+
+const unsigned int* Bvh::get_indices() const
+{
+    return indices.empty() ? NULL : &indices[0];
+}
+
+BoundingBox Bvh::get_bounds() const
+{
+    return nodes.empty() ? BoundingBox() : nodes[0].bounds;
+}
+
+size_t Bvh::memory_size() const
+{
+    return nodes.capacity() * sizeof( Node )
+           + ( indices.capacity() + leaf_of.capacity() ) * sizeof( unsigned int );
+}
+
+real_t Bvh::node_cost( const Node& node ) const
+{
+    real_t cost = node.count > 0 ? INTERSECTION_COST * node.count : TRAVERSAL_COST;
+    return cost * node.bounds.surface_area();
+}
+
+real_t Bvh::get_cost() const
+{
+    if ( nodes.empty() )
+        return 0.0;
+    real_t area = nodes[0].bounds.surface_area();
+    return area > 0.0 ? cost_sum / area : 0.0;
+}
+
+real_t Bvh::get_build_cost() const
+{
+    return build_cost;
+}
+
+Bvh::BuildMode Bvh::get_build_mode() const
+{
+    return build_mode;
+}
+
+unsigned int Bvh::get_build_time() const
+{
+    return build_time;
+}
+
+} /* _462 */
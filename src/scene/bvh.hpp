@@ -0,0 +1,342 @@
+/**
+ * @file bvh.hpp
+ * @brief Bounding volume hierarchy over axis-aligned boxes.
+ */
+
+#ifndef _462_SCENE_BVH_HPP_
+#define _462_SCENE_BVH_HPP_
+
+#include "math/vector.hpp"
+#include "math/matrix.hpp"
+#include <vector>
+#include <limits>
+
+namespace _462 {
+
+/**
+ * An axis-aligned bounding box. A default constructed box is empty and
+ * grows to contain whatever is included into it.
+ */
+struct BoundingBox
+{
+    Vector3 min;
+    Vector3 max;
+
+    BoundingBox()
+        : min( std::numeric_limits< real_t >::max(),
+               std::numeric_limits< real_t >::max(),
+               std::numeric_limits< real_t >::max() ),
+          max( -std::numeric_limits< real_t >::max(),
+               -std::numeric_limits< real_t >::max(),
+               -std::numeric_limits< real_t >::max() ) { }
+
+    BoundingBox( const Vector3& min, const Vector3& max )
+        : min( min ), max( max ) { }
+
+    bool is_empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void include( const Vector3& p ) {
+        min = Vector3( std::min( min.x, p.x ), std::min( min.y, p.y ), std::min( min.z, p.z ) );
+        max = Vector3( std::max( max.x, p.x ), std::max( max.y, p.y ), std::max( max.z, p.z ) );
+    }
+
+    void include( const BoundingBox& b ) {
+        if ( !b.is_empty() ) {
+            include( b.min );
+            include( b.max );
+        }
+    }
+
+    bool contains( const Vector3& p ) const {
+        return p.x >= min.x && p.y >= min.y && p.z >= min.z
+            && p.x <= max.x && p.y <= max.y && p.z <= max.z;
+    }
+
+    Vector3 center() const {
+        return 0.5 * ( min + max );
+    }
+
+    real_t surface_area() const {
+        if ( is_empty() )
+            return 0.0;
+        Vector3 d = max - min;
+        return 2.0 * ( d.x * d.y + d.y * d.z + d.z * d.x );
+    }
+
+    bool operator==( const BoundingBox& rhs ) const {
+        return min == rhs.min && max == rhs.max;
+    }
+
+    bool operator!=( const BoundingBox& rhs ) const {
+        return !operator==( rhs );
+    }
+
+    /**
+     * Tests the segment [0, tmax] of the ray origin + t * dir against this
+     * box, where inv_dir holds the reciprocals of dir's components.
+     */
+    bool intersect_ray( const Vector3& origin, const Vector3& inv_dir, real_t tmax ) const;
+    // as above, also returning where the ray enters the box
+    bool intersect_ray( const Vector3& origin, const Vector3& inv_dir, real_t tmax, real_t* tenter ) const;
+};
+
+// returns the box containing b after transforming it by mat
+BoundingBox transform_bounds( const BoundingBox& b, const Matrix4& mat );
+
+// grows b by a small amount relative to its size, for robust ray tests
+BoundingBox pad_bounds( const BoundingBox& b );
+
+/**
+ * Counts of the work done by traversals, for benchmarking the layouts and
+ * ray orders. Node reads go through a simulated direct mapped cache, so
+ * how well the order of the rays reuses nodes shows up as fewer misses.
+ */
+struct TraversalStats
+{
+    // nodes whose children were tested against the ray
+    unsigned long nodes;
+    // primitives handed to visitors
+    unsigned long primitives;
+    // cache lines of node reads that missed the simulated cache
+    unsigned long cache_misses;
+
+    TraversalStats()
+        : nodes( 0 ), primitives( 0 ), cache_misses( 0 ), cache_lines( CACHE_LINES, ~(size_t) 0 ) { }
+
+    // records reading size bytes at address through the simulated cache
+    void fetch( const void* address, size_t size );
+
+    static const size_t LINE_SIZE = 64;
+    // 256 KB, about a core's share of the last level cache
+    static const size_t CACHE_LINES = 4096;
+
+private:
+
+    // the line held by each slot of the cache
+    std::vector< size_t > cache_lines;
+};
+
+inline void TraversalStats::fetch( const void* address, size_t size )
+{
+    size_t first = reinterpret_cast< size_t >( address ) / LINE_SIZE;
+    size_t last = ( reinterpret_cast< size_t >( address ) + size - 1 ) / LINE_SIZE;
+    for ( size_t line = first; line <= last; ++line ) {
+        size_t& slot = cache_lines[line % CACHE_LINES];
+        if ( slot != line ) {
+            slot = line;
+            ++cache_misses;
+        }
+    }
+}
+
+/**
+ * A binary bounding volume hierarchy. It only knows the primitives by
+ * index and box, so it can be used for anything that has bounds. Moving
+ * primitives are handled by refitting the boxes bottom-up, and the tree is
+ * rebuilt once refitting has degraded its surface area cost too much.
+ *
+ * Trees are built either by binned surface area heuristic splits, which
+ * trace fastest, or by sorting along a morton curve (an lbvh), which
+ * builds several times faster for a somewhat slower tree.
+ */
+class Bvh
+{
+public:
+
+    struct Node
+    {
+        BoundingBox bounds;
+        // for leaves, the index of the first primitive in the index list.
+        // for interior nodes, the index of the second child. the first
+        // child always directly follows its parent.
+        unsigned int offset;
+        // number of primitives, 0 for interior nodes
+        unsigned int count;
+        // index of the parent node, unused for the root
+        unsigned int parent;
+        // axis the children were split along, to visit the near one first
+        unsigned int axis;
+    };
+
+    enum BuildMode
+    {
+        // binned surface area heuristic, the top levels split in parallel
+        BUILD_SAH,
+        // splits at the bits of sorted morton codes, for fast builds
+        BUILD_LBVH
+    };
+
+    Bvh();
+
+    /**
+     * Builds the tree from scratch over the given primitive boxes. The
+     * primitive indices handed to visitors index into this array. Rebuilds
+     * done by update use the same mode.
+     */
+    void build( const BoundingBox* boxes, size_t num, BuildMode mode = BUILD_SAH );
+
+    /**
+     * Updates the tree after the boxes of some primitives changed. Only the
+     * nodes above the changed primitives are refit. If the tree's cost has
+     * grown past REBUILD_COST_RATIO times its cost when last built, it is
+     * rebuilt. The number of primitives must not have changed.
+     * @return true if the tree was rebuilt.
+     */
+    bool update( const BoundingBox* boxes, const unsigned int* changed, size_t num_changed );
+
+    // removes all nodes
+    void clear();
+
+    bool empty() const;
+    size_t num_nodes() const;
+    size_t num_primitives() const;
+    const Node* get_nodes() const;
+    // the primitive indices the leaves' ranges index into
+    const unsigned int* get_indices() const;
+    // the bounds of all primitives, empty if there are none
+    BoundingBox get_bounds() const;
+    // bytes used by the nodes and primitive lists
+    size_t memory_size() const;
+
+    // the surface area heuristic cost of the tree, relative to the root box
+    real_t get_cost() const;
+    // the cost of the tree right after it was last built
+    real_t get_build_cost() const;
+    BuildMode get_build_mode() const;
+    // milliseconds the last build took
+    unsigned int get_build_time() const;
+
+    /**
+     * Visits each primitive whose leaf box the ray enters within
+     * [0, *tmax], visiting nearer children first. The visitor is called as
+     * visitor( primitive, tmax ) and may shrink *tmax to prune the rest of
+     * the traversal. If it returns true the traversal stops. If stats is
+     * given, the work done is added to it.
+     * @return true if the visitor stopped the traversal.
+     */
+    template< typename Visitor >
+    bool traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                   TraversalStats* stats = 0 ) const;
+
+    /**
+     * Visits each primitive of every leaf whose box contains point. The
+     * visitor is called as visitor( primitive ), and if it returns true the
+     * query stops.
+     * @return true if the visitor stopped the query.
+     */
+    template< typename Visitor >
+    bool query( const Vector3& point, Visitor& visitor ) const;
+
+    // rebuild once the cost has grown by this factor since the last build
+    static const real_t REBUILD_COST_RATIO;
+    // most primitives put in a leaf
+    static const unsigned int MAX_LEAF_SIZE = 4;
+    // deepest a tree may get, which bounds the traversal stack
+    static const unsigned int MAX_DEPTH = 64;
+    // number of bins sah splits are chosen from, per axis
+    static const unsigned int SAH_BINS = 16;
+    // nodes above this depth build their second child on another thread,
+    // if they have at least PARALLEL_MIN_PRIMITIVES primitives
+    static const unsigned int PARALLEL_DEPTH = 3;
+    static const unsigned int PARALLEL_MIN_PRIMITIVES = 4096;
+
+private:
+
+    // saves and restores the tree as it is
+    friend class SceneSnapshot;
+
+    typedef std::vector< Node > NodeList;
+    typedef std::vector< unsigned int > IndexList;
+
+    // area weighted by the node's cost, summed over all nodes gives the cost
+    real_t node_cost( const Node& node ) const;
+
+    NodeList nodes;
+    // primitive indices, each leaf owns a contiguous range
+    IndexList indices;
+    // the leaf containing each primitive
+    IndexList leaf_of;
+    // sum of node_cost over all nodes, kept up to date by refits
+    real_t cost_sum;
+    real_t build_cost;
+    BuildMode build_mode;
+    unsigned int build_time;
+};
+
+template< typename Visitor >
+bool Bvh::traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                    TraversalStats* stats ) const
+{
+    if ( nodes.empty() )
+        return false;
+
+    Vector3 inv_dir( 1.0 / dir.x, 1.0 / dir.y, 1.0 / dir.z );
+    unsigned int stack[2 * MAX_DEPTH];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while ( top > 0 ) {
+        unsigned int index = stack[--top];
+        const Node& node = nodes[index];
+        if ( stats )
+            stats->fetch( &node, sizeof node );
+        if ( !node.bounds.intersect_ray( origin, inv_dir, *tmax ) )
+            continue;
+        if ( stats && node.count == 0 )
+            ++stats->nodes;
+
+        if ( node.count > 0 ) {
+            for ( unsigned int i = node.offset; i < node.offset + node.count; ++i ) {
+                if ( stats )
+                    ++stats->primitives;
+                if ( visitor( indices[i], tmax ) )
+                    return true;
+            }
+        } else if ( dir[node.axis] < 0.0 ) {
+            // second child is nearer, so push it last
+            stack[top++] = index + 1;
+            stack[top++] = node.offset;
+        } else {
+            stack[top++] = node.offset;
+            stack[top++] = index + 1;
+        }
+    }
+
+    return false;
+}
+
+template< typename Visitor >
+bool Bvh::query( const Vector3& point, Visitor& visitor ) const
+{
+    if ( nodes.empty() )
+        return false;
+
+    unsigned int stack[2 * MAX_DEPTH];
+    size_t top = 0;
+    stack[top++] = 0;
+
+    while ( top > 0 ) {
+        unsigned int index = stack[--top];
+        const Node& node = nodes[index];
+        if ( !node.bounds.contains( point ) )
+            continue;
+
+        if ( node.count > 0 ) {
+            for ( unsigned int i = node.offset; i < node.offset + node.count; ++i ) {
+                if ( visitor( indices[i] ) )
+                    return true;
+            }
+        } else {
+            stack[top++] = node.offset;
+            stack[top++] = index + 1;
+        }
+    }
+
+    return false;
+}
+
+} /* _462 */
+
+#endif /* _462_SCENE_BVH_HPP_ */
@@ -0,0 +1,180 @@
+/**
+ * @file compressed_bvh.cpp
+ * @brief Bounding volume hierarchy with quantized child bounds.
+ */
+
+#include "scene/compressed_bvh.hpp"
+
+#include <cmath>
+
+namespace _462 {
+
+// a subtree of the source tree, or part of one of its leaves
+struct SourceNode
+{
+    BoundingBox bounds;
+    // for leaves, the first index in the index list, else the node index
+    unsigned int offset;
+    // number of primitives, 0 for interior nodes
+    unsigned int count;
+    unsigned int axis;
+};
+
+static SourceNode source_node( const Bvh::Node* nodes, unsigned int index )
+{
+    const Bvh::Node& node = nodes[index];
+    SourceNode rv;
+    rv.bounds = node.bounds;
+    rv.offset = node.count > 0 ? node.offset : index;
+    rv.count = node.count;
+    rv.axis = node.axis;
+    return rv;
+}
+
+static void source_children( const Bvh::Node* nodes, const SourceNode& parent, SourceNode children[2] )
+{
+    if ( parent.count > 0 ) {
+        // split a leaf too big to store, both halves keep its box
+        unsigned int half = parent.count / 2;
+        children[0] = parent;
+        children[0].count = half;
+        children[1] = parent;
+        children[1].offset += half;
+        children[1].count -= half;
+    } else {
+        children[0] = source_node( nodes, parent.offset + 1 );
+        children[1] = source_node( nodes, nodes[parent.offset].offset );
+    }
+}
+
+// the grid of a node: the float origin at or below min, and the smallest
+// power of two step that reaches max within 255 steps
+static void make_grid( const BoundingBox& bounds, CompressedBvh::Node* node )
+{
+    for ( size_t a = 0; a < 3; ++a ) {
+        // float rounding is well under a millionth, so this rounds down
+        real_t min = bounds.min[a];
+        node->origin[a] = static_cast< float >( min - fabs( min ) * 1e-6 - 1e-30 );
+        real_t extent = bounds.max[a] - node->origin[a];
+
+        int exponent = 0;
+        if ( extent > 0.0 ) {
+            frexp( extent / 255.0, &exponent );
+        }
+        node->exponent[a] = static_cast< signed char >( std::max( -126, std::min( 127, exponent ) ) );
+    }
+}
+
+static void quantize( const BoundingBox& bounds, CompressedBvh::Node* node, size_t i )
+{
+    for ( size_t a = 0; a < 3; ++a ) {
+        real_t origin = node->origin[a];
+        real_t scale = ldexp( 1.0, node->exponent[a] );
+
+        // round outward, checking against what traversal will compute
+        real_t qmin = std::max( 0.0, std::min( 255.0, floor( ( bounds.min[a] - origin ) / scale ) ) );
+        while ( qmin > 0.0 && origin + qmin * scale > bounds.min[a] ) {
+            qmin -= 1.0;
+        }
+        real_t qmax = std::max( 0.0, std::min( 255.0, ceil( ( bounds.max[a] - origin ) / scale ) ) );
+        while ( qmax < 255.0 && origin + qmax * scale < bounds.max[a] ) {
+            qmax += 1.0;
+        }
+
+        node->qmin[i][a] = static_cast< unsigned char >( qmin );
+        node->qmax[i][a] = static_cast< unsigned char >( qmax );
+    }
+}
+
+/**
+ * Adds the node for source, which must not be a leaf small enough to
+ * store in its parent, and the nodes below it.
+ * @return The index of the new node.
+ */
+static unsigned int compress_node( const Bvh::Node* src_nodes, const SourceNode& source,
+                                   std::vector< CompressedBvh::Node >* nodes )
+{
+    unsigned int index = nodes->size();
+    nodes->push_back( CompressedBvh::Node() );
+
+    CompressedBvh::Node node;
+    make_grid( source.bounds, &node );
+    node.axis = source.axis;
+
+    SourceNode children[2];
+    source_children( src_nodes, source, children );
+    for ( size_t i = 0; i < 2; ++i ) {
+        quantize( children[i].bounds, &node, i );
+        if ( children[i].count > 0 && children[i].count <= CompressedBvh::MAX_LEAF_SIZE ) {
+            node.count[i] = children[i].count;
+            node.child[i] = children[i].offset;
+        } else {
+            node.count[i] = 0;
+            node.child[i] = compress_node( src_nodes, children[i], nodes );
+        }
+    }
+
+    ( *nodes )[index] = node;
+    return index;
+}
+
+CompressedBvh::CompressedBvh() { }
+
+void CompressedBvh::build( const Bvh& bvh )
+{
+    clear();
+    if ( bvh.empty() )
+        return;
+
+    const Bvh::Node* src_nodes = bvh.get_nodes();
+    indices.assign( bvh.get_indices(), bvh.get_indices() + bvh.num_primitives() );
+    bounds = bvh.get_bounds();
+    nodes.reserve( bvh.num_nodes() / 2 + 1 );
+
+    SourceNode root = source_node( src_nodes, 0 );
+    if ( root.count > 0 && root.count <= MAX_LEAF_SIZE ) {
+        // a single leaf still needs a node to hold it
+        Node node;
+        make_grid( root.bounds, &node );
+        node.axis = 0;
+        quantize( root.bounds, &node, 0 );
+        quantize( root.bounds, &node, 1 );
+        node.count[0] = root.count;
+        node.child[0] = root.offset;
+        node.count[1] = 0;
+        node.child[1] = 0;
+        nodes.push_back( node );
+    } else {
+        compress_node( src_nodes, root, &nodes );
+    }
+}
+
+void CompressedBvh::clear()
+{
+    // swap rather than clear to give back the memory
+    NodeList().swap( nodes );
+    IndexList().swap( indices );
+    bounds = BoundingBox();
+}
+
+bool CompressedBvh::empty() const
+{
+    return nodes.empty();
+}
+
+size_t CompressedBvh::num_nodes() const
+{
+    return nodes.size();
+}
+
+BoundingBox CompressedBvh::get_bounds() const
+{
+    return bounds;
+}
+
+size_t CompressedBvh::memory_size() const
+{
+    return nodes.capacity() * sizeof( Node ) + indices.capacity() * sizeof( unsigned int );
+}
+
+} /* _462 */
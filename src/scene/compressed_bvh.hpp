@@ -0,0 +1,172 @@
+/**
+ * @file compressed_bvh.hpp
+ * @brief Bounding volume hierarchy with quantized child bounds.
+ */
+
+#ifndef _462_SCENE_COMPRESSED_BVH_HPP_
+#define _462_SCENE_COMPRESSED_BVH_HPP_
+
+#include "scene/bvh.hpp"
+#include <cstring>
+#include <algorithm>
+
+namespace _462 {
+
+/**
+ * A read-only copy of a Bvh in a smaller layout. Each node holds the
+ * boxes of both its children as 8-bit offsets from a grid spanning the
+ * node's own box, rounded outward so they still contain the children.
+ * Leaves are folded into their parents, so there are about half as many
+ * nodes, and each is 40 bytes instead of 64. Rays visit the same
+ * primitives as in the source tree, give or take the extra few the looser
+ * boxes let through.
+ */
+class CompressedBvh
+{
+public:
+
+    struct Node
+    {
+        // the children are quantized on the grid origin + q * 2^exponent
+        float origin[3];
+        signed char exponent[3];
+        // axis the children were split along, to visit the near one first
+        unsigned char axis;
+        unsigned char qmin[2][3];
+        unsigned char qmax[2][3];
+        // number of primitives in a leaf child, 0 for a node or no child
+        unsigned char count[2];
+        // index of a node child, or the first primitive of a leaf child.
+        // 0 with a count of 0 means no child, which only the root may have.
+        unsigned int child[2];
+    };
+
+    CompressedBvh();
+
+    // replaces this tree with a copy of bvh
+    void build( const Bvh& bvh );
+
+    void clear();
+
+    bool empty() const;
+    size_t num_nodes() const;
+    BoundingBox get_bounds() const;
+    // bytes used by the nodes and primitive indices
+    size_t memory_size() const;
+
+    /**
+     * Visits each primitive whose leaf box the ray enters within
+     * [0, *tmax], exactly like Bvh::traverse.
+     * @return true if the visitor stopped the traversal.
+     */
+    template< typename Visitor >
+    bool traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                   TraversalStats* stats = 0 ) const;
+
+    // largest leaf stored as is, bigger ones are split into several
+    static const unsigned int MAX_LEAF_SIZE = 255;
+    // deepest a tree may get, which bounds the traversal stack. splitting
+    // big leaves can make it deeper than the source tree.
+    static const unsigned int MAX_DEPTH = 2 * Bvh::MAX_DEPTH;
+
+private:
+
+    typedef std::vector< Node > NodeList;
+    typedef std::vector< unsigned int > IndexList;
+
+    // the box of child i of node
+    static BoundingBox child_bounds( const Node& node, size_t i );
+    // 2^exponent, built directly from its bits
+    static float grid_scale( int exponent );
+
+    NodeList nodes;
+    IndexList indices;
+    // the root has no parent to hold its box, so keep it at full precision
+    BoundingBox bounds;
+};
+
+inline float CompressedBvh::grid_scale( int exponent )
+{
+    unsigned int bits = static_cast< unsigned int >( exponent + 127 ) << 23;
+    float scale;
+    memcpy( &scale, &bits, sizeof scale );
+    return scale;
+}
+
+inline BoundingBox CompressedBvh::child_bounds( const Node& node, size_t i )
+{
+    BoundingBox rv;
+    for ( size_t a = 0; a < 3; ++a ) {
+        real_t scale = grid_scale( node.exponent[a] );
+        rv.min[a] = node.origin[a] + node.qmin[i][a] * scale;
+        rv.max[a] = node.origin[a] + node.qmax[i][a] * scale;
+    }
+    return rv;
+}
+
+template< typename Visitor >
+bool CompressedBvh::traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                              TraversalStats* stats ) const
+{
+    if ( nodes.empty() )
+        return false;
+
+    Vector3 inv_dir( 1.0 / dir.x, 1.0 / dir.y, 1.0 / dir.z );
+    real_t tenter;
+    if ( !bounds.intersect_ray( origin, inv_dir, *tmax, &tenter ) )
+        return false;
+
+    // children are tested before they are pushed, so keep where the ray
+    // enters them to skip any *tmax has since moved in front of
+    unsigned int stack[MAX_DEPTH];
+    real_t stack_enter[MAX_DEPTH];
+    size_t top = 0;
+    stack[top] = 0;
+    stack_enter[top++] = tenter;
+
+    while ( top > 0 ) {
+        --top;
+        if ( stack_enter[top] > *tmax )
+            continue;
+        const Node& node = nodes[stack[top]];
+        if ( stats ) {
+            ++stats->nodes;
+            stats->fetch( &node, sizeof node );
+        }
+
+        size_t near = dir[node.axis] < 0.0 ? 1 : 0;
+        size_t num_pushed = 0;
+        for ( size_t j = 0; j < 2; ++j ) {
+            size_t i = j == 0 ? near : 1 - near;
+            if ( node.count[i] == 0 && node.child[i] == 0 )
+                continue;
+            if ( !child_bounds( node, i ).intersect_ray( origin, inv_dir, *tmax, &tenter ) )
+                continue;
+
+            if ( node.count[i] > 0 ) {
+                for ( unsigned int k = node.child[i]; k < node.child[i] + node.count[i]; ++k ) {
+                    if ( stats )
+                        ++stats->primitives;
+                    if ( visitor( indices[k], tmax ) )
+                        return true;
+                }
+            } else {
+                stack[top] = node.child[i];
+                stack_enter[top++] = tenter;
+                ++num_pushed;
+            }
+        }
+
+        // the near child was pushed first, so swap it on top
+        if ( num_pushed == 2 ) {
+            std::swap( stack[top - 1], stack[top - 2] );
+            std::swap( stack_enter[top - 1], stack_enter[top - 2] );
+        }
+    }
+
+    return false;
+}
+
+} /* _462 */
+
+#endif /* _462_SCENE_COMPRESSED_BVH_HPP_ */
@@ -18,7 +18,8 @@ Material::Material():
     refractive_index( 0.0 ),
     tex_width( 0 ),
     tex_height( 0 ),
-    tex_data( 0 )
+    tex_data( 0 ),
+    owns_texture( true )
 {
     tex_handle = 0;
 }
@@ -26,7 +27,9 @@ Material::Material():
 Material::~Material()
 {
     if ( tex_data ) {
-        free( tex_data );
+        if ( owns_texture ) {
+            free( tex_data );
+        }
         if ( tex_handle ) {
             glDeleteTextures( 1, &tex_handle );
         }
@@ -36,10 +39,11 @@ Material::~Material()
 bool Material::load()
 {
     // if data has already been loaded, clear old data
-    if ( tex_data ) {
+    if ( tex_data && owns_texture ) {
         free( tex_data );
-        tex_data = 0;
     }
+    tex_data = 0;
+    owns_texture = true;
 
     // if no texture, nothing to do
     if ( texture_filename.empty() )
@@ -58,6 +62,17 @@ bool Material::load()
     return true;
 }
 
+void Material::share_texture( const Material& owner )
+{
+    if ( tex_data && owns_texture ) {
+        free( tex_data );
+    }
+    tex_data = owner.tex_data;
+    tex_width = owner.tex_width;
+    tex_height = owner.tex_height;
+    owns_texture = false;
+}
+
 const unsigned char* Material::get_texture_data() const
 {
     return tex_data;
@@ -49,6 +49,13 @@ public:
      */
     bool load();
 
+    /**
+     * Uses the texture loaded by another material instead of loading it
+     * again, e.g. one kept for several scenes. The texture is not copied,
+     * so owner must outlive this material and keep its texture.
+     */
+    void share_texture( const Material& owner );
+
     /// returns the raw texture data
     const unsigned char* get_texture_data() const;
 
@@ -74,11 +81,16 @@ public:
 
 private:
 
+    // saves and restores the decoded texture
+    friend class SceneSnapshot;
+
     // dimensions of the texture
     int tex_width, tex_height;
 
     // raw texture data
     unsigned char* tex_data;
+    // false if tex_data belongs to another material
+    bool owns_texture;
 
     // opengl descriptor of the texture
     GLuint tex_handle;
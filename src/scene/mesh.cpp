@@ -53,11 +53,12 @@ Mesh::Mesh()
 {
     has_tcoords = false;
     has_normals = false;
+    bvh_layout = BVH_BINARY;
 }
 
 Mesh::~Mesh() { }
 
-bool Mesh::load()
+bool Mesh::load( Bvh::BuildMode bvh_mode, BvhLayout bvh_layout )
 {
     std::cout << "Loading mesh from '" << filename << "'..." << std::endl;
 
@@ -300,9 +301,78 @@ bool Mesh::load()
     }
 
     std::cout << "Successfully loaded mesh '" << filename << "'.\n";
+
+    // build the hierarchy once, every model using this mesh shares it
+    build_bvh( bvh_mode, bvh_layout );
     return true;
 }
 
+void Mesh::build_bvh( Bvh::BuildMode mode, BvhLayout layout )
+{
+    std::vector< BoundingBox > boxes( triangles.size() );
+    for ( size_t i = 0; i < triangles.size(); ++i ) {
+        for ( size_t j = 0; j < 3; ++j ) {
+            boxes[i].include( vertices[triangles[i].vertices[j]].position );
+        }
+        boxes[i] = pad_bounds( boxes[i] );
+    }
+    bvh.build( boxes.empty() ? NULL : &boxes[0], boxes.size(), mode );
+
+    std::cout << "Built " << ( mode == Bvh::BUILD_LBVH ? "lbvh" : "sah bvh" )
+              << " over " << triangles.size() << " triangles in " << bvh.get_build_time()
+              << " ms: " << bvh.num_nodes() << " nodes, cost " << bvh.get_cost()
+              << ", " << bvh.memory_size() / 1024 << " KB.\n";
+
+    bvh_layout = BVH_BINARY;
+    set_bvh_layout( layout );
+}
+
+void Mesh::set_bvh_layout( BvhLayout layout )
+{
+    assert( bvh_layout == BVH_BINARY );
+    bvh_layout = layout;
+    compressed_bvh.clear();
+    wide_bvh.clear();
+    if ( layout == BVH_COMPRESSED ) {
+        compressed_bvh.build( bvh );
+        // the models only need the copy
+        bvh.clear();
+        std::cout << "Compressed bvh to " << compressed_bvh.num_nodes() << " nodes, "
+                  << compressed_bvh.memory_size() / 1024 << " KB.\n";
+    } else if ( layout == BVH_WIDE ) {
+        wide_bvh.build( bvh );
+        bvh.clear();
+        std::cout << "Collapsed bvh to " << wide_bvh.num_nodes() << " four-wide nodes, "
+                  << wide_bvh.memory_size() / 1024 << " KB.\n";
+    }
+}
+
+void Mesh::copy( const Mesh& mesh )
+{
+    filename = mesh.filename;
+    triangles = mesh.triangles;
+    vertices = mesh.vertices;
+    has_tcoords = mesh.has_tcoords;
+    has_normals = mesh.has_normals;
+    bvh = mesh.bvh;
+    compressed_bvh = mesh.compressed_bvh;
+    wide_bvh = mesh.wide_bvh;
+    bvh_layout = mesh.bvh_layout;
+    vertex_data.clear();
+    index_data.clear();
+}
+
+void Mesh::transform( const Matrix4& trans, const Matrix3& normal_matrix )
+{
+    for ( size_t i = 0; i < vertices.size(); ++i ) {
+        vertices[i].position = trans.transform_point( vertices[i].position );
+        vertices[i].normal = normal_matrix * vertices[i].normal;
+    }
+    if ( !vertex_data.empty() ) {
+        create_gl_data();
+    }
+}
+
 const MeshTriangle* Mesh::get_triangles() const
 {
     return triangles.empty() ? NULL : &triangles[0];
@@ -333,6 +403,29 @@ bool Mesh::are_tex_coords_valid() const
     return has_tcoords;
 }
 
+BoundingBox Mesh::get_bounds() const
+{
+    if ( bvh_layout == BVH_COMPRESSED )
+        return compressed_bvh.get_bounds();
+    if ( bvh_layout == BVH_WIDE )
+        return wide_bvh.get_bounds();
+    return bvh.get_bounds();
+}
+
+Mesh::BvhLayout Mesh::get_bvh_layout() const
+{
+    return bvh_layout;
+}
+
+size_t Mesh::bvh_memory_size() const
+{
+    if ( bvh_layout == BVH_COMPRESSED )
+        return compressed_bvh.memory_size();
+    if ( bvh_layout == BVH_WIDE )
+        return wide_bvh.memory_size();
+    return bvh.memory_size();
+}
+
 // number of floats per vertex
 #define VERTEX_SIZE 8
 
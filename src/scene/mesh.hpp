@@ -10,6 +10,10 @@
 #define _462_SCENE_MESH_HPP_
 
 #include "math/vector.hpp"
+#include "math/matrix.hpp"
+#include "scene/bvh.hpp"
+#include "scene/compressed_bvh.hpp"
+#include "scene/wide_bvh.hpp"
 
 #include <vector>
 #include <cassert>
@@ -36,14 +40,41 @@ class Mesh
 {
 public:
 
+    // how the hierarchy over the triangles is stored
+    enum BvhLayout
+    {
+        // fastest to build, refittable
+        BVH_BINARY,
+        // quantized copy of the binary tree, using about a third the memory
+        BVH_COMPRESSED,
+        // four children per node, tested together with SIMD
+        BVH_WIDE
+    };
+
     Mesh();
     ~Mesh();
 
     /**
-     * Loads the model into a list of triangles and vertices.
+     * Loads the model into a list of triangles and vertices, and builds
+     * the hierarchy over them with the given mode and layout.
      * @return True on success.
      */
-    bool load();
+    bool load( Bvh::BuildMode bvh_mode = Bvh::BUILD_SAH, BvhLayout bvh_layout = BVH_BINARY );
+
+    /// Rebuilds the hierarchy over the loaded triangles.
+    void build_bvh( Bvh::BuildMode mode, BvhLayout layout );
+
+    /// Copies the binary hierarchy into layout, which then replaces it.
+    /// The hierarchy must be binary, as built or loaded from a snapshot.
+    void set_bvh_layout( BvhLayout layout );
+
+    /// Replaces this mesh with a copy of the triangles and hierarchy of
+    /// mesh, which is left as it is. The GL data is not copied.
+    void copy( const Mesh& mesh );
+
+    /// Moves the vertices by trans and their normals by normal_matrix,
+    /// remaking the GL data if it was made. The hierarchy must be rebuilt.
+    void transform( const Matrix4& trans, const Matrix3& normal_matrix );
 
     /// Get a pointer to the triangles.
     const MeshTriangle* get_triangles() const;
@@ -59,6 +90,28 @@ public:
     /// Returns true if the loaded model contained texture coordinate data.
     bool are_tex_coords_valid() const;
 
+    /// Bounds of the triangles in local space.
+    BoundingBox get_bounds() const;
+    BvhLayout get_bvh_layout() const;
+    /// Bytes used by the hierarchy.
+    size_t bvh_memory_size() const;
+
+    /**
+     * Traverses the hierarchy over the triangles in local space, built by
+     * load, with the triangle indices. Shared by every model instancing
+     * this mesh. See Bvh::traverse.
+     */
+    template< typename Visitor >
+    bool traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                   TraversalStats* stats = 0 ) const
+    {
+        if ( bvh_layout == BVH_COMPRESSED )
+            return compressed_bvh.traverse( origin, dir, tmax, visitor, stats );
+        if ( bvh_layout == BVH_WIDE )
+            return wide_bvh.traverse( origin, dir, tmax, visitor, stats );
+        return bvh.traverse( origin, dir, tmax, visitor, stats );
+    }
+
     // scene loader stores the filename of the mesh here
     std::string filename;
 
@@ -69,6 +122,11 @@ public:
 
 private:
 
+    // saves and restores the loaded triangles and hierarchy
+    friend class SceneSnapshot;
+    // fills in the triangles it merges
+    friend class TriangleGroup;
+
     typedef std::vector< MeshTriangle > MeshTriangleList;
     typedef std::vector< MeshVertex > MeshVertexList;
 
@@ -81,6 +139,13 @@ private:
     bool has_tcoords;
     bool has_normals;
 
+    // bounding volume hierarchy over triangles, in the layout in
+    // bvh_layout, the others are empty
+    Bvh bvh;
+    CompressedBvh compressed_bvh;
+    WideBvh wide_bvh;
+    BvhLayout bvh_layout;
+
     typedef std::vector< float > FloatList;
     typedef std::vector< unsigned int > IndexList;
 
@@ -14,6 +14,7 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <limits>
 
 //arbitrary slop factor
 #define EPSILON .000001
@@ -25,10 +26,10 @@ namespace _462 {
 Model::Model() : mesh( 0 ), material( 0 ) { }
 Model::~Model() { }
 
-MeshTriangle min_triangle;
-real_t ALPH; 
-real_t BET; 
-real_t GAM;
+_462_THREAD_LOCAL MeshTriangle min_triangle;
+_462_THREAD_LOCAL real_t ALPH; 
+_462_THREAD_LOCAL real_t BET; 
+_462_THREAD_LOCAL real_t GAM;
 
 void Model::render() const
 {
@@ -45,43 +46,20 @@ void Model::render() const
  *to world space. One for transforming vector, and one for 
  *transforming point*/
 Vector3 Model::transform_vector(const Vector3 &v) const{
-	//create a transformation matrix for instancing 
-	return inv_trans.transform_vector(v);
+	//create a transformation matrix for instancing, unless
+	//the mesh was baked into world space
+	return baked ? v : inv_trans.transform_vector(v);
 }
 
 Vector3 Model::transform_point(const Vector3 &v) const{
 	//create a transformation matrix for instancing 
-        return inv_trans.transform_point(v);  
+        return baked ? v : inv_trans.transform_point(v);  
 }
 
-/* helper function for computing diffuse
- */
-real_t Model:: max(const real_t a, const real_t b) const
-{
-        if(a > b)
-                return a;
-        else
-                return b;
-}
- 
-/* computes the attenuation factor of a light source 
- * based on its distance from the surface point
- *  formula is: color/(const + lin*d + qud*d^2))
- */
-Color3 Model::attenuation(real_t &dist, const PointLight light, const Vector3 &light_pos, const Vector3 &surface_pos) const
-{
-        real_t constant = light.attenuation.constant;
-        real_t lin = light.attenuation.linear;
-        real_t quad = light.attenuation.quadratic;
-        return light.color*(1.0/(constant + lin*dist + quad*pow(dist,2)));
-}
-
-/*identically implemented as that of triangle*/
-real_t Model::shadow_intersect_triangle(const MeshTriangle &triangle, const Vector3 &shadow_dir, const Vector3 &surface_pos) const{
+/*identically implemented as that of triangle, except the shadow ray
+ *is already in local space*/
+real_t Model::shadow_intersect_triangle(const MeshTriangle &triangle, const Vector3 &d, const Vector3 &e1) const{
 	 const MeshVertex* vertices = mesh->get_vertices();
-         Vector3 d  = transform_vector(shadow_dir);
-
-         Vector3 e1 = transform_point(surface_pos);
  
          Vector3 a = vertices[triangle.vertices[0]].position;
          Vector3 b = vertices[triangle.vertices[1]].position;
@@ -126,60 +104,43 @@ real_t Model::shadow_intersect_triangle(const MeshTriangle &triangle, const Vect
 	return -1.0;
 
 }
-/*similar to shadow intersection for triangles, with extended behavior 
- *in that it iterates through a mesh a triangles within this model*/
-real_t Model::shadow_intersection(const Vector3 &shadow_dir, const Vector3 &surface_pos) const{
-	real_t min_time = -1.0;
-	const MeshTriangle* triangles = mesh->get_triangles();
- 	for(unsigned int i=0; i<mesh->num_triangles(); i++){
-		real_t time = shadow_intersect_triangle(triangles[i],shadow_dir,surface_pos); 
+/*keeps the closest shadow hit of the triangles the mesh's bvh hands it*/
+struct ModelShadowVisitor
+{
+	const Model* model;
+	const MeshTriangle* triangles;
+	Vector3 d, e1;
+	real_t min_time;
+
+	bool operator()(unsigned int i, real_t* tmax){
+		real_t time = model->shadow_intersect_triangle(triangles[i],d,e1); 
 		if(time != -1.0){
 			if(time < min_time || min_time == -1.0){
 				min_time = time;
+				*tmax = time;
 			}
 		}
-	}		
-	return min_time;
-}
-
+		return false;
+	}
+};
 
-/*computes the diffuse component of the of the model, exactly like triangle*/
-Color3 Model:: compute_diffuse(const Scene* scene, const Vector3 &normal, const Vector3 &surface_pos) const{ 
-
-	Color3 total_diff = Color3::Black;//initialize the color to black, then we start adding to it 
-	int num_lights = scene->num_lights();
-	int num_shapes = scene->num_geometries();
-	Geometry* const* sceneObjects = scene->get_geometries();
-	const PointLight* lights = scene->get_lights();
-
-	// iterate through all lights to determine their contributions to the diffuse 
-	for(int i=0;i<num_lights;i++){
-		Vector3 light_pos = lights[i].position;
-		Vector3 light_vector = normalize(light_pos - surface_pos); 
-		real_t dist = distance(light_pos, surface_pos);	
-		Vector3 slope_pos = surface_pos + EPSILON*light_vector;	
-		real_t b_i = 1.0;
-		for(int j=0; j<num_shapes; j++){
-			//if geometry is a model, we consider the closest model by time
-			real_t t = sceneObjects[j]->shadow_intersection(light_vector, slope_pos);	
-			if(t != -1.0){
-                                 Vector3 geo_surface = slope_pos + light_vector*t;
-                                 real_t geo_dis = distance(geo_surface,surface_pos);
-	  			 if( geo_dis < dist){
-				        b_i = 0.0; //light contributes nothing
-                                        break;
-                                 }
-                         }
+/*similar to shadow intersection for triangles, with extended behavior 
+ *in that it searches the triangles of the mesh within this model. the
+ *ray is moved into local space once, where the mesh's bvh lives, which
+ *leaves the times unchanged*/
+real_t Model::shadow_intersection(const Vector3 &shadow_dir, const Vector3 &surface_pos) const{
+	ModelShadowVisitor visitor;
+	visitor.model = this;
+	visitor.triangles = mesh->get_triangles();
+	visitor.d = transform_vector(shadow_dir);
+	visitor.e1 = transform_point(surface_pos);
+	visitor.min_time = -1.0;
+	real_t tmax = std::numeric_limits<real_t>::max();
+	mesh->traverse(visitor.e1,visitor.d,&tmax,visitor);
+	return visitor.min_time;
+}
 
-		}
-		if(b_i == 1.0){
-			Color3 atten = attenuation(dist, lights[i], light_pos, surface_pos);
-			total_diff+= atten*max(dot(light_vector,normal),0.0); 
-		}
-	}	
 
-	return total_diff;
-}
 /* emulates the textures algorithm for the triangle 
  * note: the only discrepancy is we are only considering 
  * the texture of the "minial" (i.e closest) triangle
@@ -245,85 +206,119 @@ Vector3 Model::normal_of(const Vector3 &surface_pos) const{
         Vector3 normalB = vertices[min_triangle.vertices[1]].normal;
         Vector3 normalC = vertices[min_triangle.vertices[2]].normal;
 
-        Vector3 bary_normal = normalize(norm_matrix*(ALPH*normalA + BET*normalB + GAM*normalC));
+        Vector3 normal = ALPH*normalA + BET*normalB + GAM*normalC;
+        Vector3 bary_normal = normalize(baked ? normal : norm_matrix*normal);
         return bary_normal;
 }
 
-/*recursively computes the specular component of this triangle
- *identically implement as that of sphere. After ray hits the surface position 
- *it will spawn a reflected ray of the surface, and potentailly a refracted ray
- *we then recursively call the specular function on those new rays*/
-Color3 Model::compute_specular(const Scene* scene, const Vector3 &normal, const Vector3 &incoming_ray, const Vector3 &surface_pos, int depth) const{
-
-        Geometry* const* sceneObjects = scene->get_geometries();
-        Vector3 refl_ray = normalize(incoming_ray - 2*dot(incoming_ray,normal)*normal);
-        Vector3 slop_pos = surface_pos + EPSILON*refl_ray;
-        real_t minTime = UNINITIALIZED;
-        Geometry* geo = sceneObjects[0];
-        Color3 tex_color = compute_texture();
-        for(unsigned int i=0;i<scene->num_geometries(); i++){
-        Geometry* temp_geo = sceneObjects[i];
-                 if(temp_geo->is_intersecting(refl_ray,slop_pos,&minTime) != NOINTERSECTION){
-                         geo = temp_geo;
-                 }   
- 
-        }   
-        if(minTime != UNINITIALIZED){
-                Vector3 new_pos = surface_pos + refl_ray*minTime;
-                Color3 returnColor = geo->color_at_pixel(scene,new_pos);
-                if(depth == 1)  
-                        return returnColor;
-                else{
-                        int new_depth = depth-1;
-                        Color3 specular = geo->get_specular();
-                        Vector3 new_norm = geo->normal_of(new_pos);
-			// RECURSIVE CALL IS HERE!!!
-                        return tex_color*(returnColor + specular*geo->compute_specular(scene,new_norm,refl_ray,new_pos,new_depth));
-                     }        
-        }                
-        return tex_color*scene->background_color;
+/*gets the reflected ray for the specular component of this model
+ *identically implement as that of sphere, without refraction. compute_specular
+ *traces it recursively. what the last bounce sees is not scaled by the texture*/
+void Model::specular_rays(const Vector3 &normal, const Vector3 &incoming_ray, SpecularRays* rays) const{
+
+        rays->dir[0] = normalize(incoming_ray - 2*dot(incoming_ray,normal)*normal);
+        rays->num = 1;
+        rays->tex_color = compute_texture();
+        rays->reflectance = 1;
+        rays->tex_last_bounce = false;
+}
+
+/* bounds of the mesh's vertices in local space */
+bool Model::get_local_bounds(BoundingBox* bounds) const{
+	*bounds = mesh ? mesh->get_bounds() : BoundingBox();
+	return true;
+}
+
+/* the closest triangle of the last hit and where on it */
+void Model::get_hit(HitRecord* hit) const{
+	for(size_t i = 0; i < 3; ++i){
+		hit->vertices[i] = min_triangle.vertices[i];
+	}
+	hit->barycentric[0] = ALPH;
+	hit->barycentric[1] = BET;
+	hit->barycentric[2] = GAM;
+}
+
+void Model::set_hit(const HitRecord &hit) const{
+	for(size_t i = 0; i < 3; ++i){
+		min_triangle.vertices[i] = hit.vertices[i];
+	}
+	ALPH = hit.barycentric[0];
+	BET = hit.barycentric[1];
+	GAM = hit.barycentric[2];
 }
 
 /* outputs the color of the triangle we are currently intersecting 
  * much like that of triangle.cpp
  */
-Color3 Model::color_at_pixel(const Scene* scene,const Vector3 &surface_pos) const{
+Color3 Model::color_at_pixel(const Scene* scene,const Vector3 &surface_pos, ShadowCache* shadow_cache) const{
 
 	const Color3 &diffuse =  material->diffuse;
         const Color3 &ambient =  material->ambient;
       
 	Vector3 bary_norm = normal_of(surface_pos);
         Color3 tex_color = compute_texture();    
-        return tex_color*((scene->ambient_light)*ambient + diffuse*compute_diffuse(scene, bary_norm, surface_pos));
+        return tex_color*((scene->ambient_light)*ambient + diffuse*scene->compute_diffuse(bary_norm, surface_pos, shadow_cache));
 }
 
-/* iterates through every triangle in the model's mesh
+/*keeps the closest hit of the triangles the mesh's bvh hands it*/
+struct ModelIntersectVisitor
+{
+	const Model* model;
+	const MeshTriangle* triangles;
+	Vector3 d, e1;
+	real_t* T;
+	bool hit;
+	// index of the triangle hit
+	unsigned int hit_index;
+
+	bool operator()(unsigned int i, real_t* tmax){
+		real_t time;
+		if(hit && i < hit_index){
+			// testing in order, a tie went to the first triangle
+			real_t t = next_up(*T);
+			time = model->intersects_triangle(triangles[i],d,e1,&t);
+			if(time != -1)
+				*T = t;
+		}
+		else
+			time = model->intersects_triangle(triangles[i],d,e1,T);
+		if(time != -1){
+			hit = true;
+			hit_index = i;
+			*tmax = *T;
+		}
+		return false;
+	}
+};
+
+/* searches the triangles in the model's mesh with the mesh's bvh
  * and performs the triangle intersection test 
  * and returns a non-zero number if the intersection time 
  * is minimal. Otherwise, ignore this intersection 
+ * the ray is moved into local space once, instead of per triangle 
  */
-real_t Model::is_intersecting(Vector3 &s, Vector3 &e, real_t *T) const
+real_t Model::is_intersecting(Vector3 &s, Vector3 &e, real_t *T, TraversalStats* stats) const
 {
-	real_t has_intersection = 0.0; 
-	const MeshTriangle* triangles = mesh->get_triangles();
- 	for(unsigned int i=0; i<mesh->num_triangles(); i++){
-		real_t time = intersects_triangle(triangles[i],s,e,T); 
-		if(time != -1){
-			has_intersection = 1.0;
-		}
-	}		
-	return has_intersection;
+	ModelIntersectVisitor visitor;
+	visitor.model = this;
+	visitor.triangles = mesh->get_triangles();
+	visitor.d = transform_vector(s);
+	visitor.e1 = transform_point(e);
+	visitor.T = T;
+	visitor.hit = false;
+	visitor.hit_index = 0;
+	real_t tmax = *T == -1 ? std::numeric_limits<real_t>::max() : *T;
+	mesh->traverse(visitor.e1,visitor.d,&tmax,visitor,stats);
+	return visitor.hit ? 1.0 : 0.0;
 }
 
 /* standard triangle intersection as seen in triangle.cpp 
- * utilizes cramer's rule
+ * utilizes cramer's rule. d and e1 are the ray in local space
  */
-real_t Model::intersects_triangle(const MeshTriangle &triangle, const Vector3 &s, const Vector3 &e, real_t *T) const{
+real_t Model::intersects_triangle(const MeshTriangle &triangle, const Vector3 &d, const Vector3 &e1, real_t *T) const{
 
 	 const MeshVertex* vertices = mesh->get_vertices();
-         Vector3 d  = transform_vector(s);
-
-         Vector3 e1 = transform_point(e);
  
          Vector3 a = vertices[triangle.vertices[0]].position;
          Vector3 b = vertices[triangle.vertices[1]].position;
@@ -7,20 +7,106 @@
  */
 
 #include "scene/scene.hpp"
+#include "scene/sphere.hpp"
+#include "scene/triangle.hpp"
+#include "scene/model.hpp"
+#include "scene/triangle_group.hpp"
+#include "scene/visibility_cache.hpp"
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <iostream>
+
+// arbitrary slop factor
+#define EPSILON .000001
 
 namespace _462 {
 
 
+Color3 SpecularRays::combine( const Color3* colors ) const
+{
+    if ( num == 1 || reflectance == 1 )
+        return colors[0];
+    return reflectance * colors[0] + ( 1 - reflectance ) * colors[1];
+}
+
+
+const unsigned int ShadowCache::NO_OCCLUDER;
+
+bool ShadowLog::find( unsigned int light, bool* shadowed ) const
+{
+    if ( light >= moved->size() || ( *moved )[light] )
+        return false;
+
+    const unsigned int* end = previous + num_previous;
+    const unsigned int* i = std::lower_bound( previous, end, light << 1 );
+    if ( i == end || ( *i >> 1 ) != light )
+        return false;
+    *shadowed = ( *i & 1 ) != 0;
+    return true;
+}
+
+
 Geometry::Geometry():
     position( Vector3::Zero ),
     orientation( Quaternion::Identity ),
-    scale( Vector3::Ones )
+    scale( Vector3::Ones ),
+    baked( false )
 {
 
 }
 
 Geometry::~Geometry() { }
 
+bool Geometry::get_local_bounds( BoundingBox* bounds ) const
+{
+    return false;
+}
+
+void Geometry::get_hit( HitRecord* hit ) const
+{
+    // nothing to keep, but zero it so saved records are repeatable
+    memset( hit, 0, sizeof *hit );
+}
+
+void Geometry::set_hit( const HitRecord& hit ) const { }
+
+/* traces each spawned ray from just off the surface, shading what it hits
+ * before recursing, and combines what they see */
+Color3 Geometry::compute_specular( const Scene* scene, const Vector3& normal, const Vector3& incoming_ray,
+                                   const Vector3& surface_pos, int depth, TraversalStats* stats,
+                                   ShadowCache* shadow_cache ) const
+{
+    SpecularRays rays;
+    specular_rays( normal, incoming_ray, &rays );
+
+    Color3 colors[2];
+    for ( size_t i = 0; i < rays.num; ++i ) {
+        const Vector3& dir = rays.dir[i];
+        Vector3 slop_pos = surface_pos + EPSILON * dir;
+        real_t min_time = -1.0;
+        Geometry* geo = scene->intersect( dir, slop_pos, &min_time, stats );
+        if ( !geo ) {
+            colors[i] = rays.miss( scene->background_color );
+            continue;
+        }
+
+        // shade before tracing further, which overwrites the hit state
+        Vector3 new_pos = surface_pos + dir * min_time;
+        Color3 color = geo->color_at_pixel( scene, new_pos, shadow_cache );
+        if ( depth > 1 ) {
+            Color3 specular = geo->get_specular();
+            Vector3 new_norm = geo->normal_of( new_pos );
+            Color3 seen = geo->compute_specular( scene, new_norm, dir, new_pos, depth - 1, stats, shadow_cache );
+            colors[i] = rays.bounce( color, specular, seen );
+        } else {
+            colors[i] = rays.last_bounce( color );
+        }
+    }
+
+    return rays.combine( colors );
+}
+
 
 
 PointLight::PointLight():
@@ -30,10 +116,49 @@ PointLight::PointLight():
     attenuation.constant = 1;
     attenuation.linear = 0;
     attenuation.quadratic = 0;
+    radius = std::numeric_limits< real_t >::infinity();
 }
 
+/* formula is: color/(const + lin*d + qud*d^2)) */
+Color3 PointLight::attenuate( real_t dist ) const
+{
+    real_t constant = attenuation.constant;
+    real_t lin = attenuation.linear;
+    real_t quad = attenuation.quadratic;
+    return color*(1.0/(constant + lin*dist + quad*pow(dist,2)));
+}
+
+/* solves brightest/(const + lin*d + qud*d^2) = cutoff for d */
+void PointLight::update_radius( real_t cutoff )
+{
+    real_t brightest = std::max( color.r, std::max( color.g, color.b ) );
+    real_t constant = attenuation.constant;
+    real_t lin = attenuation.linear;
+    real_t quad = attenuation.quadratic;
+    if ( cutoff <= 0.0 ) {
+        radius = std::numeric_limits< real_t >::infinity();
+        return;
+    }
+    // the falloff that dims the light to the cutoff
+    real_t falloff = brightest / cutoff;
+
+    if ( constant >= falloff ) {
+        radius = 0.0;
+    } else if ( quad > 0.0 ) {
+        radius = ( -lin + sqrt( lin * lin + 4.0 * quad * ( falloff - constant ) ) ) / ( 2.0 * quad );
+    } else if ( lin > 0.0 ) {
+        radius = ( falloff - constant ) / lin;
+    } else {
+        radius = std::numeric_limits< real_t >::infinity();
+    }
+}
+
+
+const real_t Scene::DEFAULT_LIGHT_CUTOFF = 1.0 / 1024.0;
+const size_t Scene::MAX_LIGHT_SAMPLES;
 
 Scene::Scene()
+    : revisions()
 {
     reset();
 }
@@ -85,26 +210,84 @@ size_t Scene::num_meshes() const
 
 void Scene::reset()
 {
-    for ( GeometryList::iterator i = geometries.begin(); i != geometries.end(); ++i ) {
-        delete *i;
-    }
-    for ( MaterialList::iterator i = materials.begin(); i != materials.end(); ++i ) {
-        delete *i;
-    }
-    for ( MeshList::iterator i = meshes.begin(); i != meshes.end(); ++i ) {
-        delete *i;
-    }
-
     geometries.clear();
     materials.clear();
     meshes.clear();
+    shared_meshes.clear();
+    sphere_arena.clear();
+    triangle_arena.clear();
+    model_arena.clear();
+    triangle_group_arena.clear();
+    material_arena.clear();
+    mesh_arena.clear();
     point_lights.clear();
 
+    geometry_states.clear();
+    primitive_bounds.clear();
+    primitive_geometries.clear();
+    unbounded_geometries.clear();
+    bvh.clear();
+    compressed_bvh.clear();
+    wide_bvh.clear();
+    built_layout = Mesh::BVH_BINARY;
+    light_bvh.clear();
+    light_bounds.clear();
+    light_primitives.clear();
+    unbounded_lights.clear();
+
+    // everything may have changed, and the states are gone
+    ++revisions.geometry;
+    ++revisions.materials;
+    ++revisions.lights;
+    ++revisions.camera;
+    light_state.lights.clear();
+    material_states.clear();
+
     camera = Camera();
+    camera_path.clear();
 
     background_color = Color3::Black;
     ambient_light = Color3::Black;
     refractive_index = 1.0;
+    light_cutoff = DEFAULT_LIGHT_CUTOFF;
+    light_samples = 0;
+    bvh_build_mode = Bvh::BUILD_SAH;
+    bvh_layout = Mesh::BVH_BINARY;
+    bake_transforms = false;
+
+    background_state = background_color;
+    refractive_index_state = refractive_index;
+    camera_state = camera;
+}
+
+Sphere* Scene::make_sphere()
+{
+    return sphere_arena.create();
+}
+
+Triangle* Scene::make_triangle()
+{
+    return triangle_arena.create();
+}
+
+Model* Scene::make_model()
+{
+    return model_arena.create();
+}
+
+TriangleGroup* Scene::make_triangle_group()
+{
+    return triangle_group_arena.create();
+}
+
+Material* Scene::make_material()
+{
+    return material_arena.create();
+}
+
+Mesh* Scene::make_mesh()
+{
+    return mesh_arena.create();
 }
 
 void Scene::add_geometry( Geometry* g )
@@ -127,6 +310,739 @@ void Scene::add_light( const PointLight& l )
     point_lights.push_back( l );
 }
 
+void Scene::share_mesh( size_t index, Mesh* mesh )
+{
+    assert( index < meshes.size() );
+    const Mesh* replaced = meshes[index];
+    meshes[index] = mesh;
+    shared_meshes.push_back( mesh );
+    for ( size_t i = 0; i < geometries.size(); ++i ) {
+        Model* model = dynamic_cast< Model* >( geometries[i] );
+        if ( model && model->mesh == replaced ) {
+            model->mesh = mesh;
+        }
+    }
+}
+
+// orders geometries by position, orientation and scale, equal if all match
+struct TransformCompare
+{
+    bool operator()( const Geometry* a, const Geometry* b ) const
+    {
+        const real_t lhs[] = { a->position.x, a->position.y, a->position.z, a->orientation.w,
+                               a->orientation.x, a->orientation.y, a->orientation.z,
+                               a->scale.x, a->scale.y, a->scale.z };
+        const real_t rhs[] = { b->position.x, b->position.y, b->position.z, b->orientation.w,
+                               b->orientation.x, b->orientation.y, b->orientation.z,
+                               b->scale.x, b->scale.y, b->scale.z };
+        for ( size_t i = 0; i < sizeof lhs / sizeof lhs[0]; ++i ) {
+            if ( lhs[i] != rhs[i] )
+                return lhs[i] < rhs[i];
+        }
+        return false;
+    }
+};
+
+void Scene::merge_triangles()
+{
+    typedef std::map< const Geometry*, size_t, TransformCompare > TransformMap;
+
+    // number the transforms in order of their first triangle, and count
+    // the triangles of each
+    TransformMap transforms;
+    std::vector< size_t > transform_of( geometries.size() );
+    std::vector< size_t > num_triangles;
+    for ( size_t i = 0; i < geometries.size(); ++i ) {
+        if ( !dynamic_cast< const Triangle* >( geometries[i] ) )
+            continue;
+        std::pair< TransformMap::iterator, bool > added =
+            transforms.insert( std::make_pair( geometries[i], num_triangles.size() ) );
+        if ( added.second ) {
+            num_triangles.push_back( 0 );
+        }
+        transform_of[i] = added.first->second;
+        ++num_triangles[transform_of[i]];
+    }
+
+    // a group of each transform with more than one triangle, in the
+    // place of its first
+    GeometryList merged;
+    std::vector< TriangleGroup* > groups( num_triangles.size(), 0 );
+    size_t num_merged = 0;
+    size_t num_groups = 0;
+    for ( size_t i = 0; i < geometries.size(); ++i ) {
+        const Triangle* triangle = dynamic_cast< const Triangle* >( geometries[i] );
+        if ( !triangle || num_triangles[transform_of[i]] < 2 ) {
+            merged.push_back( geometries[i] );
+            continue;
+        }
+
+        TriangleGroup*& group = groups[transform_of[i]];
+        if ( !group ) {
+            group = make_triangle_group();
+            group->position = triangle->position;
+            group->orientation = triangle->orientation;
+            group->scale = triangle->scale;
+            group->mesh = make_mesh();
+            add_mesh( group->mesh );
+            merged.push_back( group );
+            ++num_groups;
+        }
+        group->add_triangle( *triangle );
+        ++num_merged;
+    }
+
+    if ( num_groups == 0 )
+        return;
+
+    for ( size_t i = 0; i < groups.size(); ++i ) {
+        if ( groups[i] ) {
+            groups[i]->build( bvh_build_mode, bvh_layout );
+        }
+    }
+    geometries.swap( merged );
+    std::cout << "Merged " << num_merged << " triangles into " << num_groups << " groups.\n";
+}
+
+void Scene::bake_static_transforms()
+{
+    typedef std::map< const Mesh*, size_t > MeshCountMap;
+    typedef std::map< const Mesh*, Mesh* > MeshMap;
+
+    // the geometries using each mesh, which is instanced if more than one
+    MeshCountMap users;
+    for ( size_t i = 0; i < geometries.size(); ++i ) {
+        const Model* model = dynamic_cast< const Model* >( geometries[i] );
+        const TriangleGroup* group = dynamic_cast< const TriangleGroup* >( geometries[i] );
+        if ( model || group ) {
+            ++users[model ? model->mesh : group->mesh];
+        }
+    }
+    // shared meshes are used by other scenes too
+    MeshMap owned;
+    for ( size_t i = 0; i < meshes.size(); ++i ) {
+        if ( std::find( shared_meshes.begin(), shared_meshes.end(), meshes[i] ) == shared_meshes.end() ) {
+            owned[meshes[i]] = meshes[i];
+        }
+    }
+
+    size_t num_baked = 0;
+    for ( size_t i = 0; i < geometries.size(); ++i ) {
+        Geometry* geom = geometries[i];
+        if ( geom->baked )
+            continue;
+
+        Triangle* triangle = dynamic_cast< Triangle* >( geom );
+        const Model* model = dynamic_cast< const Model* >( geom );
+        const TriangleGroup* group = dynamic_cast< const TriangleGroup* >( geom );
+        Mesh* mesh = 0;
+        if ( model || group ) {
+            const Mesh* used = model ? model->mesh : group->mesh;
+            MeshMap::iterator iter = owned.find( used );
+            if ( used && users[used] == 1 && iter != owned.end() ) {
+                mesh = iter->second;
+            }
+        }
+        if ( !triangle && !mesh )
+            continue;
+
+        Matrix4 trans;
+        Matrix3 normal_matrix;
+        make_transformation_matrix( &trans, geom->position, geom->orientation, geom->scale );
+        make_normal_matrix( &normal_matrix, trans );
+        if ( triangle ) {
+            for ( size_t j = 0; j < 3; ++j ) {
+                triangle->vertices[j].position = trans.transform_point( triangle->vertices[j].position );
+                triangle->vertices[j].normal = normal_matrix * triangle->vertices[j].normal;
+            }
+        } else {
+            mesh->transform( trans, normal_matrix );
+            mesh->build_bvh( bvh_build_mode, bvh_layout );
+        }
+
+        geom->position = Vector3::Zero;
+        geom->orientation = Quaternion::Identity;
+        geom->scale = Vector3::Ones;
+        geom->baked = true;
+        ++num_baked;
+    }
+
+    if ( num_baked > 0 ) {
+        std::cout << "Baked the transforms of " << num_baked << " geometries into world space.\n";
+    }
+}
+
+/**
+ * Recomputes the matrices of geom from its transform.
+ * @return false if geom is unbounded, else true with its world bounds.
+ */
+static bool update_transform( Geometry* geom, BoundingBox* bounds )
+{
+    make_inverse_transformation_matrix( &geom->inv_trans, geom->position, geom->orientation, geom->scale );
+    Matrix4 trans;
+    make_transformation_matrix( &trans, geom->position, geom->orientation, geom->scale );
+    make_normal_matrix( &geom->norm_matrix, trans );
+
+    BoundingBox local;
+    if ( !geom->get_local_bounds( &local ) )
+        return false;
+    *bounds = pad_bounds( transform_bounds( local, trans ) );
+    return true;
+}
+
+void Scene::update_geometries()
+{
+    update_lights();
+    update_materials();
+    update_camera();
+
+    bool rebuild = geometry_states.size() != geometries.size();
+    for ( size_t i = 0; !rebuild && i < geometries.size(); ++i ) {
+        rebuild = geometry_states[i].geometry != geometries[i];
+    }
+
+    if ( rebuild ) {
+        geometry_states.resize( geometries.size() );
+        primitive_bounds.clear();
+        primitive_geometries.clear();
+        unbounded_geometries.clear();
+
+        for ( size_t i = 0; i < geometries.size(); ++i ) {
+            Geometry* geom = geometries[i];
+            GeometryState& state = geometry_states[i];
+            state.geometry = geom;
+            state.position = geom->position;
+            state.orientation = geom->orientation;
+            state.scale = geom->scale;
+
+            BoundingBox bounds;
+            if ( update_transform( geom, &bounds ) ) {
+                state.primitive = primitive_bounds.size();
+                primitive_bounds.push_back( bounds );
+                primitive_geometries.push_back( i );
+            } else {
+                state.primitive = NO_PRIMITIVE;
+                unbounded_geometries.push_back( i );
+            }
+        }
+
+        bvh.build( primitive_bounds.empty() ? NULL : &primitive_bounds[0], primitive_bounds.size(),
+                   bvh_build_mode );
+        update_layout();
+        ++revisions.geometry;
+        return;
+    }
+
+    // only redo the geometries that moved
+    IndexList changed;
+    bool moved = false;
+    for ( size_t i = 0; i < geometries.size(); ++i ) {
+        Geometry* geom = geometries[i];
+        GeometryState& state = geometry_states[i];
+        if ( state.position == geom->position && state.orientation == geom->orientation
+             && state.scale == geom->scale ) {
+            continue;
+        }
+
+        state.position = geom->position;
+        state.orientation = geom->orientation;
+        state.scale = geom->scale;
+        moved = true;
+
+        BoundingBox bounds;
+        bool bounded = update_transform( geom, &bounds );
+        assert( bounded == ( state.primitive != NO_PRIMITIVE ) );
+        if ( bounded ) {
+            primitive_bounds[state.primitive] = bounds;
+            changed.push_back( state.primitive );
+        }
+    }
+
+    if ( !changed.empty() ) {
+        bvh.update( &primitive_bounds[0], &changed[0], changed.size() );
+        update_layout();
+    } else if ( built_layout != bvh_layout ) {
+        update_layout();
+    }
+    if ( moved ) {
+        ++revisions.geometry;
+    }
+}
+
+const Scene::Revisions& Scene::get_revisions() const
+{
+    return revisions;
+}
+
+void Scene::update_layout()
+{
+    // copying is linear in the tree's size, far cheaper than tracing it
+    compressed_bvh.clear();
+    wide_bvh.clear();
+    if ( bvh_layout == Mesh::BVH_COMPRESSED ) {
+        compressed_bvh.build( bvh );
+    } else if ( bvh_layout == Mesh::BVH_WIDE ) {
+        wide_bvh.build( bvh );
+    }
+    built_layout = bvh_layout;
+}
+
+static bool same_light( const PointLight& a, const PointLight& b )
+{
+    return a.position == b.position && a.color == b.color
+        && a.attenuation.constant == b.attenuation.constant
+        && a.attenuation.linear == b.attenuation.linear
+        && a.attenuation.quadratic == b.attenuation.quadratic;
+}
+
+void Scene::update_lights()
+{
+    bool same = light_state.lights.size() == point_lights.size()
+        && light_state.ambient_light == ambient_light
+        && light_state.light_cutoff == light_cutoff
+        && light_state.light_samples == light_samples;
+    for ( size_t i = 0; same && i < point_lights.size(); ++i ) {
+        same = same_light( light_state.lights[i], point_lights[i] );
+    }
+    if ( same )
+        return;
+    ++revisions.lights;
+    light_state.lights = point_lights;
+    light_state.ambient_light = ambient_light;
+    light_state.light_cutoff = light_cutoff;
+    light_state.light_samples = light_samples;
+
+    BoundingBoxList bounds;
+    IndexList primitives;
+    unbounded_lights.clear();
+    for ( size_t i = 0; i < point_lights.size(); ++i ) {
+        PointLight& light = point_lights[i];
+        light.update_radius( light_cutoff );
+        if ( light.radius == std::numeric_limits< real_t >::infinity() ) {
+            unbounded_lights.push_back( i );
+        } else {
+            Vector3 extent( light.radius, light.radius, light.radius );
+            bounds.push_back( BoundingBox( light.position - extent, light.position + extent ) );
+            primitives.push_back( i );
+        }
+    }
+
+    // lights are few next to geometry, so just rebuild when any changed
+    if ( bounds == light_bounds && primitives == light_primitives )
+        return;
+    light_bounds.swap( bounds );
+    light_primitives.swap( primitives );
+    light_bvh.build( light_bounds.empty() ? NULL : &light_bounds[0], light_bounds.size(), bvh_build_mode );
+}
+
+void Scene::update_materials()
+{
+    bool same = material_states.size() == materials.size()
+        && background_state == background_color && refractive_index_state == refractive_index;
+    for ( size_t i = 0; same && i < materials.size(); ++i ) {
+        const Material* material = materials[i];
+        const MaterialState& state = material_states[i];
+        same = state.ambient == material->ambient && state.diffuse == material->diffuse
+            && state.specular == material->specular && state.refractive_index == material->refractive_index
+            && state.texture == material->get_texture_data();
+    }
+    if ( same )
+        return;
+
+    ++revisions.materials;
+    material_states.resize( materials.size() );
+    for ( size_t i = 0; i < materials.size(); ++i ) {
+        const Material* material = materials[i];
+        MaterialState& state = material_states[i];
+        state.ambient = material->ambient;
+        state.diffuse = material->diffuse;
+        state.specular = material->specular;
+        state.refractive_index = material->refractive_index;
+        state.texture = material->get_texture_data();
+    }
+    background_state = background_color;
+    refractive_index_state = refractive_index;
+}
+
+void Scene::update_camera()
+{
+    if ( camera.position == camera_state.position && camera.orientation == camera_state.orientation
+         && camera.fov == camera_state.fov && camera.aspect == camera_state.aspect
+         && camera.near_clip == camera_state.near_clip && camera.far_clip == camera_state.far_clip ) {
+        return;
+    }
+    ++revisions.camera;
+    camera_state = camera;
+}
+
+template< typename Visitor >
+bool Scene::traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                      TraversalStats* stats ) const
+{
+    if ( built_layout == Mesh::BVH_COMPRESSED )
+        return compressed_bvh.traverse( origin, dir, tmax, visitor, stats );
+    if ( built_layout == Mesh::BVH_WIDE )
+        return wide_bvh.traverse( origin, dir, tmax, visitor, stats );
+    return bvh.traverse( origin, dir, tmax, visitor, stats );
+}
+
+// keeps the closest hit of the geometries the bvh hands it
+struct IntersectVisitor
+{
+    Geometry* const* geometries;
+    const unsigned int* primitive_geometries;
+    Vector3 ray;
+    Vector3 origin;
+    real_t* T;
+    Geometry* hit;
+    // index of the geometry hit
+    unsigned int hit_index;
+    TraversalStats* stats;
+
+    void test( unsigned int index )
+    {
+        Geometry* geom = geometries[index];
+        if ( hit && index < hit_index ) {
+            // is_intersecting only takes strictly closer hits. testing in
+            // order, a tie goes to the first geometry, so let it take ties.
+            real_t t = next_up( *T );
+            if ( geom->is_intersecting( ray, origin, &t, stats ) != 0.0 ) {
+                *T = t;
+                hit = geom;
+                hit_index = index;
+            }
+        } else if ( geom->is_intersecting( ray, origin, T, stats ) != 0.0 ) {
+            hit = geom;
+            hit_index = index;
+        }
+    }
+
+    bool operator()( unsigned int primitive, real_t* tmax )
+    {
+        test( primitive_geometries[primitive] );
+        if ( hit )
+            *tmax = *T;
+        return false;
+    }
+};
+
+Geometry* Scene::intersect( const Vector3& ray, const Vector3& origin, real_t* T,
+                            TraversalStats* stats ) const
+{
+    assert( geometry_states.size() == geometries.size() );
+
+    IntersectVisitor visitor;
+    visitor.geometries = get_geometries();
+    visitor.primitive_geometries = primitive_geometries.empty() ? NULL : &primitive_geometries[0];
+    visitor.ray = ray;
+    visitor.origin = origin;
+    visitor.T = T;
+    visitor.hit = 0;
+    visitor.hit_index = 0;
+    visitor.stats = stats;
+
+    for ( size_t i = 0; i < unbounded_geometries.size(); ++i ) {
+        visitor.test( unbounded_geometries[i] );
+    }
+
+    real_t tmax = *T < 0.0 ? std::numeric_limits< real_t >::max() : *T;
+    traverse( origin, ray, &tmax, visitor, stats );
+    return visitor.hit;
+}
+
+// stops at the first geometry blocking the light
+struct ShadowVisitor
+{
+    Geometry* const* geometries;
+    const unsigned int* primitive_geometries;
+    Vector3 shadow_dir;
+    Vector3 shadow_pos;
+    Vector3 surface_pos;
+    real_t dist;
+    // index of the geometry found blocking the light
+    unsigned int blocker;
+    // index of a geometry already found not to block, or NO_OCCLUDER
+    unsigned int tested;
+
+    bool is_blocked( unsigned int index )
+    {
+        if ( index == tested )
+            return false;
+        real_t t = geometries[index]->shadow_intersection( shadow_dir, shadow_pos );
+        // check if the intersection point is in front of the light
+        if ( t != -1.0 && distance( shadow_pos + shadow_dir * t, surface_pos ) < dist ) {
+            blocker = index;
+            return true;
+        }
+        return false;
+    }
+
+    bool operator()( unsigned int primitive, real_t* tmax )
+    {
+        return is_blocked( primitive_geometries[primitive] );
+    }
+};
+
+bool Scene::is_shadowed( const Vector3& shadow_dir, const Vector3& shadow_pos,
+                         const Vector3& surface_pos, real_t dist, unsigned int* occluder ) const
+{
+    assert( geometry_states.size() == geometries.size() );
+
+    ShadowVisitor visitor;
+    visitor.geometries = get_geometries();
+    visitor.primitive_geometries = primitive_geometries.empty() ? NULL : &primitive_geometries[0];
+    visitor.shadow_dir = shadow_dir;
+    visitor.shadow_pos = shadow_pos;
+    visitor.surface_pos = surface_pos;
+    visitor.dist = dist;
+    visitor.tested = ShadowCache::NO_OCCLUDER;
+
+    // any blocker will do, so try the likeliest one first
+    if ( occluder && *occluder < geometries.size() ) {
+        if ( visitor.is_blocked( *occluder ) )
+            return true;
+        visitor.tested = *occluder;
+    }
+
+    bool blocked = false;
+    for ( size_t i = 0; !blocked && i < unbounded_geometries.size(); ++i ) {
+        blocked = visitor.is_blocked( unbounded_geometries[i] );
+    }
+    if ( !blocked ) {
+        // blockers are closer to surface_pos than dist, so no farther along the ray
+        real_t tmax = dist;
+        blocked = traverse( shadow_pos, shadow_dir, &tmax, visitor );
+    }
+
+    if ( blocked && occluder )
+        *occluder = visitor.blocker;
+    return blocked;
+}
+
+// xorshift random numbers seeded from a position, so renders repeat and
+// each surface point draws its own
+struct SampleRandom
+{
+    unsigned int state;
+
+    explicit SampleRandom( const Vector3& seed )
+    {
+        unsigned int words[3 * sizeof( real_t ) / sizeof( unsigned int )];
+        for ( size_t i = 0; i < 3; ++i ) {
+            memcpy( words + i * sizeof( real_t ) / sizeof( unsigned int ), &seed[i], sizeof( real_t ) );
+        }
+        // fnv-1a over the words, which must not leave a zero state
+        state = 2166136261u;
+        for ( size_t i = 0; i < sizeof words / sizeof words[0]; ++i ) {
+            state = ( state ^ words[i] ) * 16777619u;
+        }
+        if ( state == 0 )
+            state = 1;
+    }
+
+    // uniform in [0, 1)
+    real_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return ( state & 0xFFFFFFFFu ) * ( 1.0 / 4294967296.0 );
+    }
+};
+
+// a light reaching a surface, before its shadow ray is traced
+struct LightSample
+{
+    unsigned int light;
+    Color3 contribution;
+    Vector3 light_vector;
+    real_t dist;
+    // the brightest channel of contribution, how likely it is to be picked
+    real_t weight;
+};
+
+/* sums the lights the light bvh hands it. with max_samples set, the first
+ * max_samples lights are kept, and once there are more each sample keeps
+ * one light picked in proportion to its weight, as a reservoir */
+struct DiffuseVisitor
+{
+    const Scene* scene;
+    const PointLight* lights;
+    const unsigned int* light_primitives;
+    Vector3 normal;
+    Vector3 surface_pos;
+    real_t cutoff;
+    size_t max_samples;
+    ShadowCache* shadow_cache;
+    // the unshadowed lights so far, without max_samples
+    Color3 total;
+    // the lights so far while there are at most max_samples of them, then
+    // the light each sample picked
+    LightSample samples[Scene::MAX_LIGHT_SAMPLES];
+    size_t num_lights;
+    real_t total_weight;
+    SampleRandom random;
+
+    DiffuseVisitor( const Scene* scene, const Vector3& normal, const Vector3& surface_pos )
+        : scene( scene ), normal( normal ), surface_pos( surface_pos ), total( Color3::Black ),
+          num_lights( 0 ), total_weight( 0.0 ), random( surface_pos ) { }
+
+    bool is_lit( const LightSample& sample )
+    {
+        if ( !shadow_cache ) {
+            // shoot the shadow ray from just off the surface
+            Vector3 slope_pos = surface_pos + EPSILON * sample.light_vector;
+            return !scene->is_shadowed( sample.light_vector, slope_pos, surface_pos, sample.dist );
+        }
+
+        ShadowLog* log = shadow_cache->log;
+        bool shadowed;
+        if ( log && log->find( sample.light, &shadowed ) ) {
+            ++shadow_cache->replayed;
+        } else {
+            shadowed = is_shadowed( sample );
+        }
+        if ( log )
+            log->outcomes->push_back( sample.light << 1 | ( shadowed ? 1 : 0 ) );
+        return !shadowed;
+    }
+
+    // traces the shadow ray through shadow_cache, unless its visibility
+    // cache knows the answer
+    bool is_shadowed( const LightSample& sample )
+    {
+        Vector3 slope_pos = surface_pos + EPSILON * sample.light_vector;
+        VisibilityCache* visibility = shadow_cache->visibility;
+        if ( visibility ) {
+            VisibilityCache::Visibility baked = visibility->lookup( surface_pos, normal, sample.light );
+            if ( baked != VisibilityCache::UNKNOWN ) {
+                ++shadow_cache->baked;
+                return baked == VisibilityCache::SHADOWED;
+            }
+        }
+
+        unsigned int& occluder = shadow_cache->occluders[sample.light];
+        unsigned int cached = occluder;
+        bool shadowed = scene->is_shadowed( sample.light_vector, slope_pos, surface_pos, sample.dist,
+                                            &occluder );
+        // if the cached occluder did not block, a traversal can't find it
+        // blocking either, so an unchanged one means it was a hit
+        ++shadow_cache->rays;
+        if ( shadowed ) {
+            ++shadow_cache->blocked;
+            if ( occluder == cached )
+                ++shadow_cache->hits;
+        }
+        if ( visibility )
+            visibility->record( surface_pos, normal, sample.light, shadowed );
+        return shadowed;
+    }
+
+    void add( unsigned int index )
+    {
+        const PointLight& light = lights[index];
+        LightSample sample;
+        sample.light = index;
+        sample.dist = distance( light.position, surface_pos );
+        if ( sample.dist > light.radius )
+            return;
+
+        sample.light_vector = normalize( light.position - surface_pos );
+        sample.contribution = light.attenuate( sample.dist )
+                            * std::max( dot( sample.light_vector, normal ), real_t( 0 ) );
+        // facing away or too dim to matter, so whether it is shadowed
+        // doesn't matter either
+        const Color3& c = sample.contribution;
+        sample.weight = std::max( c.r, std::max( c.g, c.b ) );
+        if ( sample.weight <= 0.0 || sample.weight < cutoff )
+            return;
+
+        if ( max_samples == 0 ) {
+            if ( is_lit( sample ) )
+                total = total + sample.contribution;
+            return;
+        }
+
+        ++num_lights;
+        total_weight += sample.weight;
+        if ( num_lights <= max_samples ) {
+            samples[num_lights - 1] = sample;
+            return;
+        }
+
+        if ( num_lights == max_samples + 1 ) {
+            // too many to trace them all, so let each sample pick one of
+            // the lights kept so far
+            LightSample kept[Scene::MAX_LIGHT_SAMPLES];
+            std::copy( samples, samples + max_samples, kept );
+            real_t kept_weight = total_weight - sample.weight;
+            for ( size_t i = 0; i < max_samples; ++i ) {
+                real_t pick = random.next() * kept_weight;
+                size_t k = 0;
+                for ( ; k + 1 < max_samples && pick >= kept[k].weight; ++k ) {
+                    pick -= kept[k].weight;
+                }
+                samples[i] = kept[k];
+            }
+        }
+
+        for ( size_t i = 0; i < max_samples; ++i ) {
+            if ( random.next() * total_weight < sample.weight )
+                samples[i] = sample;
+        }
+    }
+
+    bool operator()( unsigned int primitive )
+    {
+        add( light_primitives[primitive] );
+        return false;
+    }
+
+    Color3 result()
+    {
+        if ( max_samples == 0 )
+            return total;
+
+        Color3 sum = Color3::Black;
+        if ( num_lights <= max_samples ) {
+            for ( size_t i = 0; i < num_lights; ++i ) {
+                if ( is_lit( samples[i] ) )
+                    sum = sum + samples[i].contribution;
+            }
+            return sum;
+        }
+
+        // each sample stands in for all lights, scaled by how likely it was
+        for ( size_t i = 0; i < max_samples; ++i ) {
+            if ( is_lit( samples[i] ) )
+                sum = sum + samples[i].contribution * ( total_weight / ( samples[i].weight * max_samples ) );
+        }
+        return sum;
+    }
+};
+
+Color3 Scene::compute_diffuse( const Vector3& normal, const Vector3& surface_pos,
+                              ShadowCache* shadow_cache ) const
+{
+    if ( shadow_cache && shadow_cache->occluders.size() != point_lights.size() )
+        shadow_cache->occluders.assign( point_lights.size(), ShadowCache::NO_OCCLUDER );
+
+    DiffuseVisitor visitor( this, normal, surface_pos );
+    visitor.lights = get_lights();
+    visitor.light_primitives = light_primitives.empty() ? NULL : &light_primitives[0];
+    visitor.cutoff = light_cutoff;
+    visitor.max_samples = std::min( light_samples, MAX_LIGHT_SAMPLES );
+    visitor.shadow_cache = shadow_cache;
+
+    // the unbounded lights first, so scenes without attenuation sum their
+    // lights in order
+    for ( size_t i = 0; i < unbounded_lights.size(); ++i ) {
+        visitor.add( unbounded_lights[i] );
+    }
+    light_bvh.query( surface_pos, visitor );
+    return visitor.result();
+}
+
 
 } /* _462 */
 
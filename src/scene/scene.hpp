@@ -13,15 +13,120 @@
 #include "math/quaternion.hpp"
 #include "math/matrix.hpp"
 #include "math/camera.hpp"
+#include "math/camera_path.hpp"
 #include "scene/material.hpp"
 #include "scene/mesh.hpp"
+#include "scene/bvh.hpp"
+#include "scene/arena.hpp"
 #include <string>
 #include <vector>
 
+// geometries keep the hit of the last ray traced in globals, one copy per
+// thread so several threads can raytrace the same scene
+#ifdef _MSC_VER
+#define _462_THREAD_LOCAL __declspec( thread )
+#else
+#define _462_THREAD_LOCAL __thread
+#endif
+
 namespace _462 {
 
 class Scene;
+class Sphere;
+class Triangle;
+class Model;
+class TriangleGroup;
 struct PointLight;
+class VisibilityCache;
+struct ShadowLog;
+
+/* the rays a surface spawns for its specular color, and how the colors
+ * they see combine into it */
+struct SpecularRays
+{
+    // the reflected ray and, if num is 2, the refracted one
+    Vector3 dir[2];
+    size_t num;
+    // the surface's texture color, which scales what the rays see
+    Color3 tex_color;
+    // fresnel weight of the reflection, the refraction gets the rest
+    real_t reflectance;
+    // whether what the last bounce sees is also scaled by tex_color
+    bool tex_last_bounce;
+
+    /* what a ray contributes when it hits a surface of the given color,
+     * which reflects specular times the color seen in turn */
+    Color3 bounce(const Color3 &color, const Color3 &specular, const Color3 &seen) const {
+        return tex_color*(color + specular*seen);
+    }
+    // what a ray of the last bounce contributes when it hits
+    Color3 last_bounce(const Color3 &color) const {
+        return tex_last_bounce ? tex_color*color : color;
+    }
+    // what a ray contributes when it hits nothing
+    Color3 miss(const Color3 &background) const {
+        return tex_color*background;
+    }
+    // the specular color, given what each ray contributes
+    Color3 combine(const Color3 *colors) const;
+};
+
+/* remembers the geometry that last blocked the shadow rays to each light.
+ * neighbouring points are mostly shadowed by the same geometry, so testing
+ * it first answers most shadowed rays without a traversal. every thread
+ * tracing a scene needs its own. */
+struct ShadowCache
+{
+    // geometry index of each light's last occluder, or NO_OCCLUDER
+    std::vector< unsigned int > occluders;
+    // shadow rays traced with the cache
+    unsigned long rays;
+    // shadow rays that were blocked
+    unsigned long blocked;
+    // blocked shadow rays the cached occluder was found to block
+    unsigned long hits;
+    // if set, shadow rays it knows the answer to are not traced, and the
+    // rays that are traced are recorded into it. not owned.
+    VisibilityCache* visibility;
+    // shadow rays answered by visibility
+    unsigned long baked;
+    // if set, shadow rays are answered from and recorded into it. not owned.
+    ShadowLog* log;
+    // shadow rays answered by log
+    unsigned long replayed;
+
+    ShadowCache() : rays( 0 ), blocked( 0 ), hits( 0 ), visibility( 0 ), baked( 0 ), log( 0 ), replayed( 0 ) { }
+
+    static const unsigned int NO_OCCLUDER = ~0u;
+};
+
+/* the outcomes of the shadow rays traced from a point, each a light index
+ * shifted left once with the low bit set if the ray was blocked. shading
+ * the point again, after materials or lights changed, answers the rays to
+ * lights that did not move from the outcomes of the last time. */
+struct ShadowLog
+{
+    // outcomes of the last time the point was shaded, sorted
+    const unsigned int* previous;
+    size_t num_previous;
+    // whether each light moved since then, so its outcome is stale
+    const std::vector< bool >* moved;
+    // every outcome of this shading, answered or traced, is appended here
+    std::vector< unsigned int >* outcomes;
+
+    // finds whether the ray to light was blocked last time, if still valid
+    bool find( unsigned int light, bool* shadowed ) const;
+};
+
+/* the hit state a geometry keeps of the last ray that hit it, saved so the
+ * hit can be shaded after other rays were traced */
+struct HitRecord
+{
+    // barycentric coordinates on the triangle hit
+    real_t barycentric[3];
+    // for meshes, the vertices of the triangle hit
+    unsigned int vertices[3];
+};
 
 class Geometry
 {
@@ -48,6 +153,11 @@ public:
 
     Matrix4 inv_trans;
     Matrix3 norm_matrix;
+
+    // whether the transform was baked into the geometry's vertices, which
+    // are then in world space, so rays and normals skip the matrices. see
+    // Scene::bake_static_transforms. a baked geometry must not be moved.
+    bool baked;
     /**
      * Renders this geometry using OpenGL in the local coordinate space.
      */
@@ -57,15 +167,23 @@ public:
      *	a given geometry, rules for return values are as follows: 
      * 	-1 indicates intersection a sphere
      * 	 1 indicates intersection with a triangle
-     * 	 0 indicates no intersection */
-    virtual real_t is_intersecting(Vector3 &s, Vector3 &e, real_t *T) const = 0;
+     * 	 0 indicates no intersection
+     *  stats, if given, counts the work of any hierarchy inside the geometry */
+    virtual real_t is_intersecting(Vector3 &s, Vector3 &e, real_t *T, TraversalStats* stats = 0) const = 0;
 
     /*  virtual function for evaluating color at specified pixel
      *  utilizes several helper methods with in each class  
-     */
-    virtual Color3 color_at_pixel(const Scene* scene,const Vector3 &surface_pos) const = 0;
+     *  shadow_cache, if given, is used for the shadow rays */
+    virtual Color3 color_at_pixel(const Scene* scene,const Vector3 &surface_pos, ShadowCache* shadow_cache = 0) const = 0;
+
+    /*  computes the specular color at surface_pos by tracing the rays from
+     *  specular_rays, recursing depth bounces deep. stats, if given, counts
+     *  the work of tracing them, and shadow_cache is used where they hit */
+    Color3 compute_specular(const Scene* scene, const Vector3 &normal, const Vector3 &incoming_ray, const Vector3 &surface_pos, int depth, TraversalStats* stats = 0, ShadowCache* shadow_cache = 0) const;
 
-    virtual Color3 compute_specular(const Scene* scene, const Vector3 &normal, const Vector3 &incoming_ray, const Vector3 &surface_pos, int depth) const = 0;    
+    /*  gets the rays spawned where incoming_ray hit this geometry. must be
+     *  called before any other ray is traced, since it may use the hit state */
+    virtual void specular_rays(const Vector3 &normal, const Vector3 &incoming_ray, SpecularRays* rays) const = 0;
     /* transformation helper functions based on the inverse transform matrix*/
     virtual Vector3 transform_vector(const Vector3 &v) const = 0;
     virtual Vector3 transform_point(const Vector3 &v) const = 0;
@@ -74,9 +192,18 @@ public:
     virtual real_t compute_refraction(const real_t inner_refr, const real_t outer_refr, const Vector3 &incoming_ray,const Vector3 &normal) const = 0; 
     virtual Color3 get_specular() const = 0; 
     virtual Vector3 normal_of(const Vector3 &surface_pos) const = 0;     
+    /* gets the bounds of the geometry in local space, before the transform.
+     * returns false for unbounded geometry, which every ray is tested against */
+    virtual bool get_local_bounds(BoundingBox* bounds) const;
 
     /* determines whether a given position is in shadow*/	
     virtual real_t shadow_intersection(const Vector3 &shadow_dir, const Vector3 &surface_pos) const = 0;      
+
+    /* saves the hit state of the last ray to hit this geometry, and puts
+     * it back so that hit can be shaded again. the defaults are for
+     * geometries that keep none */
+    virtual void get_hit(HitRecord* hit) const;
+    virtual void set_hit(const HitRecord &hit) const;
 };
 
 
@@ -97,6 +224,15 @@ struct PointLight
     Color3 color;
     // attenuation
     Attenuation attenuation;
+    // the distance past which the light adds less than the scene's
+    // light_cutoff to any surface, infinite if it never fades that far.
+    // kept up to date by Scene::update_geometries.
+    real_t radius;
+
+    // the color of the light after falling off over dist
+    Color3 attenuate( real_t dist ) const;
+    // recomputes radius from the color, attenuation and cutoff
+    void update_radius( real_t cutoff );
 };
 
 /**
@@ -109,17 +245,59 @@ public:
 
     /// the camera
     Camera camera;
+    /// keyframes for rendering an animation, empty if the camera is still
+    CameraPath camera_path;
     /// the background color
     Color3 background_color;
     /// the amibient light of the scene
     Color3 ambient_light;
     /// the refraction index of air
     real_t refractive_index;
+    /// lights adding less than this to every channel of a surface are
+    /// skipped there. 0 only skips lights facing away.
+    real_t light_cutoff;
+    /// if more lights than this reach a surface, only this many of them
+    /// are picked at random there, weighted by how bright each is. 0 uses
+    /// every light. at most MAX_LIGHT_SAMPLES.
+    size_t light_samples;
+    /// how the scene's and meshes' hierarchies are built, not saved with
+    /// the scene
+    Bvh::BuildMode bvh_build_mode;
+    /// how the scene's and meshes' hierarchies are stored, not saved with
+    /// the scene
+    Mesh::BvhLayout bvh_layout;
+    /// whether Raytracer::initialize bakes the transforms of static
+    /// geometries, see bake_static_transforms. not saved with the scene
+    bool bake_transforms;
+
+    /// counts of the changes update_geometries has found to each part of
+    /// the scene, so that what was computed from a part can be kept until
+    /// its count moves on
+    struct Revisions
+    {
+        // geometries added, replaced, moved, rotated or scaled
+        unsigned int geometry;
+        // any material's colors, refractive index or texture, the
+        // background color or the refractive index of air
+        unsigned int materials;
+        // any light, the ambient light, the light cutoff or light samples
+        unsigned int lights;
+        // the camera's position, orientation, field of view or clip planes
+        unsigned int camera;
+
+        bool operator==( const Revisions& rhs ) const {
+            return geometry == rhs.geometry && materials == rhs.materials
+                && lights == rhs.lights && camera == rhs.camera;
+        }
+        bool operator!=( const Revisions& rhs ) const {
+            return !operator==( rhs );
+        }
+    };
 
     /// Creates a new empty scene.
     Scene();
 
-    /// Destroys this scene. Invokes delete on everything in geometries.
+    /// Destroys this scene, and everything made by it.
     ~Scene();
 
     // accessor functions
@@ -132,18 +310,107 @@ public:
     Mesh* const* get_meshes() const;
     size_t num_meshes() const;
 
-    /// Clears the scene, and invokes delete on everything in geometries.
+    /// Clears the scene, and destroys everything made by it at once.
     void reset();
 
+    // functions to make things in the scene's arenas, which keep each
+    // type together in memory. they live until the scene is reset or
+    // destroyed, and are only part of the scene once added.
+    Sphere* make_sphere();
+    Triangle* make_triangle();
+    Model* make_model();
+    TriangleGroup* make_triangle_group();
+    Material* make_material();
+    Mesh* make_mesh();
+
     // functions to add things to the scene
-    // all pointers are deleted by the scene upon scene deconstruction.
+    // all pointers must have been made by this scene's make functions.
     void add_geometry( Geometry* g );
     void add_material( Material* m );
     void add_mesh( Mesh* m );
     void add_light( const PointLight& l );
 
+    /**
+     * Puts mesh, loaded once outside the scene for several scenes to share,
+     * in the place of the index'th mesh, and points the models using that
+     * mesh at it. The scene does not own mesh, which must stay unchanged
+     * while the scene uses it, so it is never baked.
+     */
+    void share_mesh( size_t index, Mesh* mesh );
+
+    /**
+     * Replaces the triangles that share a position, orientation and scale
+     * with one TriangleGroup of them, in the place of the first, with a
+     * mesh added to the scene holding their vertices and the hierarchy
+     * over them, built in bvh_build_mode and bvh_layout. Triangles with a
+     * transform of their own are kept. The image rendered is the same.
+     */
+    void merge_triangles();
+
+    /**
+     * Moves the vertices and normals of every triangle, and of every model
+     * or group whose mesh no other geometry uses, into world space, and
+     * marks it baked with an identity transform, so tracing it no longer
+     * transforms rays and normals. The meshes' hierarchies are rebuilt in
+     * bvh_build_mode and bvh_layout. Models instancing a shared mesh, and
+     * spheres, keep their transforms. Geometries already baked are skipped.
+     */
+    void bake_static_transforms();
+
+    /**
+     * Brings inv_trans and norm_matrix of every geometry and the bounding
+     * volume hierarchy over them up to date. Only geometries whose position,
+     * orientation or scale changed since the last call are recomputed and
+     * refit; adding or replacing geometries rebuilds the hierarchy. The
+     * light radii and the hierarchy over the lights are only recomputed if
+     * a light changed. Whatever changed has its revision counted.
+     */
+    void update_geometries();
+
+    /// what changed as of the last update_geometries
+    const Revisions& get_revisions() const;
+
+    /**
+     * Finds the closest geometry along the ray, with the same results as
+     * calling is_intersecting on every geometry.
+     * @param T The closest time found so far, or -1. Updated on a hit.
+     * @param stats If given, counts the work of every hierarchy searched.
+     * @return The geometry hit closer than *T, or null if none.
+     */
+    Geometry* intersect( const Vector3& ray, const Vector3& origin, real_t* T,
+                         TraversalStats* stats = 0 ) const;
+
+    /**
+     * Returns true if the shadow ray from shadow_pos hits some geometry
+     * closer than dist to surface_pos, using shadow_intersection.
+     * @param occluder If given, the index of a geometry to test before any
+     *  other, which is replaced by the blocking geometry found if another.
+     */
+    bool is_shadowed( const Vector3& shadow_dir, const Vector3& shadow_pos,
+                      const Vector3& surface_pos, real_t dist,
+                      unsigned int* occluder = 0 ) const;
+
+    /**
+     * Sums the attenuated color of every light reaching surface_pos unshadowed,
+     * weighted by the cosine of its angle to normal. Lights out of range or
+     * too dim to see there are skipped without tracing a shadow ray, and
+     * only lights whose range contains surface_pos are looked at. With
+     * light_samples set, only that many shadow rays are traced, and the sum
+     * is estimated from them. shadow_cache, if given, is checked and updated
+     * for each shadow ray.
+     */
+    Color3 compute_diffuse( const Vector3& normal, const Vector3& surface_pos,
+                            ShadowCache* shadow_cache = 0 ) const;
+
+    // under half the smallest step of an 8-bit channel
+    static const real_t DEFAULT_LIGHT_CUTOFF;
+    static const size_t MAX_LIGHT_SAMPLES = 64;
+
 private:
 
+    // saves and restores everything loading and update_geometries computed
+    friend class SceneSnapshot;
+
     typedef std::vector< PointLight > PointLightList;
     typedef std::vector< Material* > MaterialList;
     typedef std::vector< Mesh* > MeshList;
@@ -155,9 +422,99 @@ private:
     MaterialList materials;
     // all meshes used by models
     MeshList meshes;
-    // list of all geometries. deleted in dctor, so should be allocated on heap.
+    // those of meshes the scene does not own, see share_mesh
+    MeshList shared_meshes;
+    // list of all geometries
     GeometryList geometries;
 
+    // what the make functions made, destroyed by reset
+    ObjectArena< Sphere > sphere_arena;
+    ObjectArena< Triangle > triangle_arena;
+    ObjectArena< Model > model_arena;
+    ObjectArena< TriangleGroup > triangle_group_arena;
+    ObjectArena< Material > material_arena;
+    ObjectArena< Mesh > mesh_arena;
+
+    // a geometry as of the last update_geometries
+    struct GeometryState
+    {
+        const Geometry* geometry;
+        Vector3 position;
+        Quaternion orientation;
+        Vector3 scale;
+        // index of its primitive in the bvh, or NO_PRIMITIVE if unbounded
+        unsigned int primitive;
+    };
+
+    typedef std::vector< GeometryState > GeometryStateList;
+    typedef std::vector< BoundingBox > BoundingBoxList;
+    typedef std::vector< unsigned int > IndexList;
+
+    static const unsigned int NO_PRIMITIVE = ~0u;
+
+    // one entry per geometry
+    GeometryStateList geometry_states;
+    // world bounds of each bvh primitive
+    BoundingBoxList primitive_bounds;
+    // geometry index of each bvh primitive
+    IndexList primitive_geometries;
+    // indices of the geometries without bounds
+    IndexList unbounded_geometries;
+    // hierarchy over the bounded geometries, kept binary for refitting
+    Bvh bvh;
+    // copy of bvh in built_layout, if that is not binary
+    CompressedBvh compressed_bvh;
+    WideBvh wide_bvh;
+    Mesh::BvhLayout built_layout;
+
+    // hierarchy over the ranges of the lights with a finite radius
+    Bvh light_bvh;
+    // the range of each light_bvh primitive
+    BoundingBoxList light_bounds;
+    // light index of each light_bvh primitive
+    IndexList light_primitives;
+    // indices of the lights with an infinite radius, which reach everywhere
+    IndexList unbounded_lights;
+
+    // what the lights, materials and camera were as of the last
+    // update_geometries, to find what changed
+    struct LightState
+    {
+        PointLightList lights;
+        Color3 ambient_light;
+        real_t light_cutoff;
+        size_t light_samples;
+    };
+    struct MaterialState
+    {
+        Color3 ambient;
+        Color3 diffuse;
+        Color3 specular;
+        real_t refractive_index;
+        const unsigned char* texture;
+    };
+    typedef std::vector< MaterialState > MaterialStateList;
+
+    Revisions revisions;
+    LightState light_state;
+    MaterialStateList material_states;
+    Color3 background_state;
+    real_t refractive_index_state;
+    Camera camera_state;
+
+    // remakes the copy of bvh in bvh_layout
+    void update_layout();
+    // recomputes the light radii and rebuilds light_bvh if the lights changed
+    void update_lights();
+    // counts a revision of the materials or camera if they changed
+    void update_materials();
+    void update_camera();
+
+    // traverses the copy of bvh in built_layout, see Bvh::traverse
+    template< typename Visitor >
+    bool traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                   TraversalStats* stats = 0 ) const;
+
 private:
 
     // no meaningful assignment or copy
@@ -0,0 +1,46 @@
+/**
+ * @file scene_hash.cpp
+ * @brief Hashes of scene state, for telling when a saved cache is stale.
+ */
+
+#include "scene/scene_hash.hpp"
+#include "scene/scene.hpp"
+
+namespace _462 {
+
+void SceneHash::add_lights( const Scene& scene )
+{
+    const PointLight* lights = scene.get_lights();
+    size_t num_lights = scene.num_lights();
+    add( &num_lights, sizeof num_lights );
+    for ( size_t i = 0; i < num_lights; ++i ) {
+        const PointLight& light = lights[i];
+        add( light.position );
+        add( light.color.r );
+        add( light.color.g );
+        add( light.color.b );
+        add( light.attenuation.constant );
+        add( light.attenuation.linear );
+        add( light.attenuation.quadratic );
+    }
+}
+
+void SceneHash::add_geometries( const Scene& scene )
+{
+    Geometry* const* geometries = scene.get_geometries();
+    size_t num_geometries = scene.num_geometries();
+    add( &num_geometries, sizeof num_geometries );
+    for ( size_t i = 0; i < num_geometries; ++i ) {
+        const Geometry* geom = geometries[i];
+        add( geom->position );
+        add( geom->orientation );
+        add( geom->scale );
+        BoundingBox bounds;
+        if ( geom->get_local_bounds( &bounds ) ) {
+            add( bounds.min );
+            add( bounds.max );
+        }
+    }
+}
+
+} /* _462 */
@@ -0,0 +1,60 @@
+/**
+ * @file scene_hash.hpp
+ * @brief Hashes of scene state, for telling when a saved cache is stale.
+ */
+
+#ifndef _462_SCENE_SCENE_HASH_HPP_
+#define _462_SCENE_SCENE_HASH_HPP_
+
+#include "math/vector.hpp"
+#include "math/quaternion.hpp"
+
+namespace _462 {
+
+class Scene;
+
+/**
+ * An fnv-1a hash over the bytes of each value added. Caches saved to disk
+ * keep the hash of the scene state they depend on, and are only reused
+ * if it still matches.
+ */
+struct SceneHash
+{
+    unsigned int hash;
+
+    SceneHash() : hash( 2166136261u ) { }
+
+    void add( const void* data, size_t size )
+    {
+        const unsigned char* bytes = static_cast< const unsigned char* >( data );
+        for ( size_t i = 0; i < size; ++i ) {
+            hash = ( hash ^ bytes[i] ) * 16777619u;
+        }
+    }
+
+    void add( real_t val ) { add( &val, sizeof val ); }
+
+    void add( const Vector3& v )
+    {
+        add( v.x );
+        add( v.y );
+        add( v.z );
+    }
+
+    void add( const Quaternion& q )
+    {
+        add( q.w );
+        add( q.x );
+        add( q.y );
+        add( q.z );
+    }
+
+    // the position, color and attenuation of every light
+    void add_lights( const Scene& scene );
+    // the transform and local bounds of every geometry
+    void add_geometries( const Scene& scene );
+};
+
+} /* _462 */
+
+#endif /* _462_SCENE_SCENE_HASH_HPP_ */
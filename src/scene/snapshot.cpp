@@ -0,0 +1,706 @@
+/**
+ * @file snapshot.cpp
+ * @brief Binary snapshots of loaded scenes, which open without parsing.
+ *
+ * File layout, all numbers are native endian, and every list is a count
+ * followed by its items padded to start on a multiple of ALIGNMENT:
+ *   magic "RTSN", version
+ *   camera, camera path keyframes, background color, ambient light,
+ *     refractive index, light cutoff, light samples, lights
+ *   number of materials, then each material and its texels
+ *   number of meshes, then each mesh's vertices, triangles and hierarchy
+ *   number of geometries, then each geometry's kind, transform and data
+ *   the state of each geometry, the primitive bounds and indices, and
+ *     the hierarchy over them
+ */
+
+#include "scene/snapshot.hpp"
+#include "scene/scene.hpp"
+#include "scene/sphere.hpp"
+#include "scene/triangle.hpp"
+#include "scene/model.hpp"
+#include "scene/triangle_group.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace _462 {
+
+static const char MAGIC[4] = { 'R', 'T', 'S', 'N' };
+static const int VERSION = 2;
+
+// lists start on a multiple of this, so they can be used where mapped
+static const size_t ALIGNMENT = 16;
+
+// the kind of each geometry
+enum GeometryKind
+{
+    GEOMETRY_SPHERE,
+    GEOMETRY_TRIANGLE,
+    GEOMETRY_MODEL,
+    GEOMETRY_TRIANGLE_GROUP
+};
+
+// index of a material or mesh that is not set
+static const unsigned int NO_INDEX = ~0u;
+
+typedef std::map< const void*, unsigned int > IndexMap;
+
+/**
+ * A file's contents, mapped into memory where supported and read into a
+ * buffer elsewhere.
+ */
+class MappedFile
+{
+public:
+
+    MappedFile() : data( 0 ), size( 0 ) { }
+    ~MappedFile();
+
+    // maps filename, returning false if it could not be
+    bool open( const char* filename );
+
+    const char* data;
+    size_t size;
+
+private:
+
+#ifdef _WIN32
+    std::vector< char > buffer;
+#endif
+
+    // no meaningful assignment or copy
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+};
+
+#ifdef _WIN32
+
+MappedFile::~MappedFile() { }
+
+bool MappedFile::open( const char* filename )
+{
+    FILE* fp = fopen( filename, "rb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    bool ok = fseek( fp, 0, SEEK_END ) == 0;
+    long end = ok ? ftell( fp ) : -1;
+    ok = end > 0 && fseek( fp, 0, SEEK_SET ) == 0;
+    if ( ok ) {
+        buffer.resize( end );
+        ok = fread( &buffer[0], 1, end, fp ) == (size_t) end;
+    }
+    fclose( fp );
+    if ( !ok )
+        return false;
+
+    data = &buffer[0];
+    size = buffer.size();
+    return true;
+}
+
+#else
+
+MappedFile::~MappedFile()
+{
+    if ( data ) {
+        munmap( const_cast< char* >( data ), size );
+    }
+}
+
+bool MappedFile::open( const char* filename )
+{
+    int fd = ::open( filename, O_RDONLY );
+    if ( fd < 0 ) {
+        return false;
+    }
+
+    struct stat st;
+    void* addr = MAP_FAILED;
+    if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+        addr = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+    // the mapping keeps the file open
+    close( fd );
+    if ( addr == MAP_FAILED )
+        return false;
+
+    data = static_cast< const char* >( addr );
+    size = st.st_size;
+    return true;
+}
+
+#endif /* _WIN32 */
+
+class SceneSnapshot::Writer
+{
+public:
+
+    Writer( FILE* fp ) : fp( fp ), offset( 0 ), ok( true ) { }
+
+    void write( const void* data, size_t size )
+    {
+        if ( ok && size > 0 ) {
+            ok = fwrite( data, 1, size, fp ) == size;
+        }
+        offset += size;
+    }
+
+    template< typename T >
+    void value( const T& val )
+    {
+        write( &val, sizeof val );
+    }
+
+    template< typename T >
+    void list( const T* items, size_t num )
+    {
+        value( num );
+        static const char zeros[ALIGNMENT] = { 0 };
+        write( zeros, ( ALIGNMENT - offset % ALIGNMENT ) % ALIGNMENT );
+        write( items, num * sizeof( T ) );
+    }
+
+    template< typename T >
+    void list( const std::vector< T >& items )
+    {
+        list( items.empty() ? 0 : &items[0], items.size() );
+    }
+
+    void string( const std::string& str )
+    {
+        list( str.data(), str.size() );
+    }
+
+    FILE* fp;
+    // bytes written so far
+    size_t offset;
+    // false once a write failed
+    bool ok;
+};
+
+class SceneSnapshot::Reader
+{
+public:
+
+    Reader( const char* data, size_t size ) : data( data ), size( size ), offset( 0 ), ok( true ) { }
+
+    // the next num bytes, or null if the file ends first
+    const char* read( size_t num )
+    {
+        if ( !ok || num > size - offset ) {
+            ok = false;
+            return 0;
+        }
+        const char* ptr = data + offset;
+        offset += num;
+        return ptr;
+    }
+
+    template< typename T >
+    void value( T* val )
+    {
+        const char* ptr = read( sizeof *val );
+        if ( ptr ) {
+            memcpy( val, ptr, sizeof *val );
+        }
+    }
+
+    // the items of the next list where they are in the file, or null if
+    // the file ends first
+    template< typename T >
+    const T* list( size_t* num )
+    {
+        *num = 0;
+        value( num );
+        read( ( ALIGNMENT - offset % ALIGNMENT ) % ALIGNMENT );
+        if ( !ok || *num > ( size - offset ) / sizeof( T ) ) {
+            ok = false;
+            return 0;
+        }
+        return reinterpret_cast< const T* >( read( *num * sizeof( T ) ) );
+    }
+
+    template< typename T >
+    void list( std::vector< T >* items )
+    {
+        size_t num;
+        const T* ptr = list< T >( &num );
+        if ( ptr ) {
+            items->assign( ptr, ptr + num );
+        }
+    }
+
+    void string( std::string* str )
+    {
+        size_t num;
+        const char* ptr = list< char >( &num );
+        if ( ptr ) {
+            str->assign( ptr, num );
+        }
+    }
+
+    const char* data;
+    size_t size;
+    // bytes read so far
+    size_t offset;
+    // false once the file ended early
+    bool ok;
+};
+
+bool SceneSnapshot::is_snapshot( const char* filename )
+{
+    FILE* fp = fopen( filename, "rb" );
+    if ( !fp ) {
+        return false;
+    }
+    char magic[sizeof MAGIC];
+    bool is = fread( magic, sizeof magic, 1, fp ) == 1 && memcmp( magic, MAGIC, sizeof MAGIC ) == 0;
+    fclose( fp );
+    return is;
+}
+
+bool SceneSnapshot::save( const Scene& scene, const char* filename )
+{
+    std::string tmpname = std::string( filename ) + ".tmp";
+    FILE* fp = fopen( tmpname.c_str(), "wb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    Writer out( fp );
+    out.write( MAGIC, sizeof MAGIC );
+    out.value( VERSION );
+    bool ok = write_scene( &out, scene ) && out.ok;
+
+    ok = fclose( fp ) == 0 && ok;
+    if ( !ok ) {
+        remove( tmpname.c_str() );
+        return false;
+    }
+
+#ifdef _WIN32
+    // windows will not rename over an existing file
+    remove( filename );
+#endif
+    return rename( tmpname.c_str(), filename ) == 0;
+}
+
+bool SceneSnapshot::load( Scene* scene, const char* filename )
+{
+    assert( scene );
+
+    MappedFile file;
+    if ( !file.open( filename ) ) {
+        std::cout << "Error opening snapshot '" << filename << "'.\n";
+        return false;
+    }
+
+    scene->reset();
+
+    bool ok = false;
+    try {
+        Reader in( file.data, file.size );
+        const char* magic = in.read( sizeof MAGIC );
+        int version = 0;
+        in.value( &version );
+        ok = magic && memcmp( magic, MAGIC, sizeof MAGIC ) == 0 && version == VERSION
+            && read_scene( &in, scene ) && in.ok;
+    } catch ( std::bad_alloc const& ) {
+        std::cout << "Out of memory error while loading snapshot\n.";
+        scene->reset();
+        return false;
+    }
+
+    if ( !ok ) {
+        std::cout << "'" << filename << "' is not a snapshot of this version, or is truncated.\n";
+        scene->reset();
+    }
+    return ok;
+}
+
+bool SceneSnapshot::write_scene( Writer* out, const Scene& scene )
+{
+    // the hierarchy over the geometries must be up to date
+    if ( scene.geometry_states.size() != scene.geometries.size() )
+        return false;
+
+    out->value( scene.camera );
+    out->list( scene.camera_path.get_keyframes(), scene.camera_path.num_keyframes() );
+    out->value( scene.background_color );
+    out->value( scene.ambient_light );
+    out->value( scene.refractive_index );
+    out->value( scene.light_cutoff );
+    out->value( scene.light_samples );
+    out->list( scene.point_lights );
+
+    IndexMap material_index;
+    out->value( scene.materials.size() );
+    for ( size_t i = 0; i < scene.materials.size(); ++i ) {
+        material_index[scene.materials[i]] = i;
+        write_material( out, *scene.materials[i] );
+    }
+
+    IndexMap mesh_index;
+    out->value( scene.meshes.size() );
+    for ( size_t i = 0; i < scene.meshes.size(); ++i ) {
+        // the other layouts are copied from the binary hierarchy when
+        // loaded, as the loading program's options ask
+        if ( scene.meshes[i]->bvh_layout != Mesh::BVH_BINARY )
+            return false;
+        mesh_index[scene.meshes[i]] = i;
+        write_mesh( out, *scene.meshes[i] );
+    }
+
+    // what isn't in the maps, a null pointer, is NO_INDEX
+    material_index[0] = NO_INDEX;
+    mesh_index[0] = NO_INDEX;
+
+    out->value( scene.geometries.size() );
+    for ( size_t i = 0; i < scene.geometries.size(); ++i ) {
+        const Geometry* geom = scene.geometries[i];
+        const Sphere* sphere = dynamic_cast< const Sphere* >( geom );
+        const Triangle* triangle = dynamic_cast< const Triangle* >( geom );
+        const Model* model = dynamic_cast< const Model* >( geom );
+        const TriangleGroup* group = dynamic_cast< const TriangleGroup* >( geom );
+
+        if ( sphere ) {
+            out->value( (unsigned int) GEOMETRY_SPHERE );
+        } else if ( triangle ) {
+            out->value( (unsigned int) GEOMETRY_TRIANGLE );
+        } else if ( model ) {
+            out->value( (unsigned int) GEOMETRY_MODEL );
+        } else if ( group ) {
+            out->value( (unsigned int) GEOMETRY_TRIANGLE_GROUP );
+        } else {
+            return false;
+        }
+
+        out->value( geom->position );
+        out->value( geom->orientation );
+        out->value( geom->scale );
+        out->value( geom->inv_trans );
+        out->value( geom->norm_matrix );
+
+        if ( sphere ) {
+            out->value( sphere->radius );
+            out->value( material_index[sphere->material] );
+        } else if ( triangle ) {
+            for ( size_t j = 0; j < 3; ++j ) {
+                const Triangle::Vertex& vertex = triangle->vertices[j];
+                out->value( vertex.position );
+                out->value( vertex.normal );
+                out->value( vertex.tex_coord );
+                out->value( material_index[vertex.material] );
+            }
+        } else if ( model ) {
+            out->value( mesh_index[model->mesh] );
+            out->value( material_index[model->material] );
+        } else {
+            out->value( mesh_index[group->mesh] );
+            std::vector< unsigned int > materials( group->materials.size() );
+            for ( size_t j = 0; j < materials.size(); ++j ) {
+                materials[j] = material_index[group->materials[j]];
+            }
+            out->list( materials );
+        }
+    }
+
+    // the geometry pointers are replaced when loaded
+    out->list( scene.geometry_states );
+    out->list( scene.primitive_bounds );
+    out->list( scene.primitive_geometries );
+    out->list( scene.unbounded_geometries );
+    write_bvh( out, scene.bvh );
+    return true;
+}
+
+void SceneSnapshot::write_material( Writer* out, const Material& material )
+{
+    out->value( material.ambient );
+    out->value( material.diffuse );
+    out->value( material.specular );
+    out->value( material.shininess );
+    out->value( material.refractive_index );
+    out->string( material.texture_filename );
+    out->value( material.tex_width );
+    out->value( material.tex_height );
+    size_t num_texels = material.tex_data ? 4 * material.tex_width * material.tex_height : 0;
+    out->list( material.tex_data, num_texels );
+}
+
+void SceneSnapshot::write_mesh( Writer* out, const Mesh& mesh )
+{
+    out->string( mesh.filename );
+    out->value( mesh.has_tcoords );
+    out->value( mesh.has_normals );
+    out->list( mesh.vertices );
+    out->list( mesh.triangles );
+    write_bvh( out, mesh.bvh );
+}
+
+void SceneSnapshot::write_bvh( Writer* out, const Bvh& bvh )
+{
+    out->list( bvh.nodes );
+    out->list( bvh.indices );
+    out->list( bvh.leaf_of );
+    out->value( bvh.cost_sum );
+    out->value( bvh.build_cost );
+    out->value( bvh.build_mode );
+    out->value( bvh.build_time );
+}
+
+// the material at index, which must be in range. geometries without
+// one can't be traced, as the scene loader never makes them.
+static bool lookup_material( const Scene& scene, unsigned int index, const Material** material )
+{
+    if ( index >= scene.num_materials() )
+        return false;
+    *material = scene.get_materials()[index];
+    return true;
+}
+
+// whether every index in list is below size
+static bool indices_below( const std::vector< unsigned int >& list, size_t size )
+{
+    for ( size_t i = 0; i < list.size(); ++i ) {
+        if ( list[i] >= size )
+            return false;
+    }
+    return true;
+}
+
+bool SceneSnapshot::read_scene( Reader* in, Scene* scene )
+{
+    in->value( &scene->camera );
+    size_t num_keyframes;
+    const CameraPath::Keyframe* keyframes = in->list< CameraPath::Keyframe >( &num_keyframes );
+    for ( size_t i = 0; keyframes && i < num_keyframes; ++i ) {
+        scene->camera_path.add_keyframe( keyframes[i] );
+    }
+    in->value( &scene->background_color );
+    in->value( &scene->ambient_light );
+    in->value( &scene->refractive_index );
+    in->value( &scene->light_cutoff );
+    in->value( &scene->light_samples );
+    in->list( &scene->point_lights );
+
+    size_t num_materials = 0;
+    in->value( &num_materials );
+    for ( size_t i = 0; in->ok && i < num_materials; ++i ) {
+        Material* material = scene->make_material();
+        scene->add_material( material );
+        if ( !read_material( in, material ) )
+            return false;
+    }
+
+    size_t num_meshes = 0;
+    in->value( &num_meshes );
+    for ( size_t i = 0; in->ok && i < num_meshes; ++i ) {
+        Mesh* mesh = scene->make_mesh();
+        scene->add_mesh( mesh );
+        if ( !read_mesh( in, mesh ) )
+            return false;
+    }
+
+    size_t num_geometries = 0;
+    in->value( &num_geometries );
+    for ( size_t i = 0; in->ok && i < num_geometries; ++i ) {
+        unsigned int kind = 0;
+        in->value( &kind );
+        Geometry* geom;
+        if ( kind == GEOMETRY_SPHERE ) {
+            geom = scene->make_sphere();
+        } else if ( kind == GEOMETRY_TRIANGLE ) {
+            geom = scene->make_triangle();
+        } else if ( kind == GEOMETRY_MODEL ) {
+            geom = scene->make_model();
+        } else if ( kind == GEOMETRY_TRIANGLE_GROUP ) {
+            geom = scene->make_triangle_group();
+        } else {
+            return false;
+        }
+        scene->add_geometry( geom );
+
+        in->value( &geom->position );
+        in->value( &geom->orientation );
+        in->value( &geom->scale );
+        in->value( &geom->inv_trans );
+        in->value( &geom->norm_matrix );
+
+        unsigned int material = NO_INDEX;
+        bool found = true;
+        if ( kind == GEOMETRY_SPHERE ) {
+            Sphere* sphere = static_cast< Sphere* >( geom );
+            in->value( &sphere->radius );
+            in->value( &material );
+            found = lookup_material( *scene, material, &sphere->material );
+        } else if ( kind == GEOMETRY_TRIANGLE ) {
+            Triangle* triangle = static_cast< Triangle* >( geom );
+            for ( size_t j = 0; j < 3; ++j ) {
+                Triangle::Vertex& vertex = triangle->vertices[j];
+                in->value( &vertex.position );
+                in->value( &vertex.normal );
+                in->value( &vertex.tex_coord );
+                in->value( &material );
+                found = found && lookup_material( *scene, material, &vertex.material );
+            }
+        } else if ( kind == GEOMETRY_MODEL ) {
+            Model* model = static_cast< Model* >( geom );
+            unsigned int mesh = NO_INDEX;
+            in->value( &mesh );
+            in->value( &material );
+            found = mesh < num_meshes && lookup_material( *scene, material, &model->material );
+            model->mesh = found ? scene->meshes[mesh] : 0;
+        } else {
+            TriangleGroup* group = static_cast< TriangleGroup* >( geom );
+            unsigned int mesh = NO_INDEX;
+            in->value( &mesh );
+            size_t num_materials;
+            const unsigned int* materials = in->list< unsigned int >( &num_materials );
+            // a material for each of the mesh's vertices
+            found = materials && mesh < num_meshes
+                && num_materials == scene->meshes[mesh]->num_vertices();
+            if ( found ) {
+                group->mesh = scene->meshes[mesh];
+                group->materials.resize( num_materials );
+            }
+            for ( size_t j = 0; found && j < num_materials; ++j ) {
+                found = lookup_material( *scene, materials[j], &group->materials[j] );
+            }
+        }
+        if ( !found )
+            return false;
+    }
+
+    in->list( &scene->geometry_states );
+    in->list( &scene->primitive_bounds );
+    in->list( &scene->primitive_geometries );
+    in->list( &scene->unbounded_geometries );
+    if ( !read_bvh( in, &scene->bvh ) || scene->geometry_states.size() != scene->geometries.size()
+         || scene->bvh.num_primitives() != scene->primitive_bounds.size()
+         || scene->primitive_geometries.size() != scene->primitive_bounds.size()
+         || !indices_below( scene->primitive_geometries, scene->geometries.size() )
+         || !indices_below( scene->unbounded_geometries, scene->geometries.size() ) )
+        return false;
+
+    // as of the update_geometries before saving, so the next one finds
+    // nothing changed and keeps the transforms and hierarchy
+    for ( size_t i = 0; i < scene->geometries.size(); ++i ) {
+        Scene::GeometryState& state = scene->geometry_states[i];
+        if ( state.primitive != Scene::NO_PRIMITIVE && state.primitive >= scene->primitive_bounds.size() )
+            return false;
+        state.geometry = scene->geometries[i];
+    }
+    return in->ok;
+}
+
+bool SceneSnapshot::read_material( Reader* in, Material* material )
+{
+    in->value( &material->ambient );
+    in->value( &material->diffuse );
+    in->value( &material->specular );
+    in->value( &material->shininess );
+    in->value( &material->refractive_index );
+    in->string( &material->texture_filename );
+    int width = 0;
+    int height = 0;
+    in->value( &width );
+    in->value( &height );
+    size_t num_texels;
+    const unsigned char* texels = in->list< unsigned char >( &num_texels );
+    if ( !texels || width < 0 || height < 0 || num_texels != 4 * (size_t) width * height )
+        return false;
+
+    if ( num_texels > 0 ) {
+        // freed by the material, as imageio allocates them
+        material->tex_data = static_cast< unsigned char* >( malloc( num_texels ) );
+        if ( !material->tex_data )
+            throw std::bad_alloc();
+        memcpy( material->tex_data, texels, num_texels );
+        material->tex_width = width;
+        material->tex_height = height;
+    }
+    return true;
+}
+
+bool SceneSnapshot::read_mesh( Reader* in, Mesh* mesh )
+{
+    in->string( &mesh->filename );
+    in->value( &mesh->has_tcoords );
+    in->value( &mesh->has_normals );
+    in->list( &mesh->vertices );
+    in->list( &mesh->triangles );
+    if ( !read_bvh( in, &mesh->bvh ) || mesh->bvh.num_primitives() != mesh->triangles.size() )
+        return false;
+
+    for ( size_t i = 0; i < mesh->triangles.size(); ++i ) {
+        for ( size_t j = 0; j < 3; ++j ) {
+            if ( mesh->triangles[i].vertices[j] >= mesh->vertices.size() )
+                return false;
+        }
+    }
+    mesh->bvh_layout = Mesh::BVH_BINARY;
+    return true;
+}
+
+bool SceneSnapshot::read_bvh( Reader* in, Bvh* bvh )
+{
+    in->list( &bvh->nodes );
+    in->list( &bvh->indices );
+    in->list( &bvh->leaf_of );
+    in->value( &bvh->cost_sum );
+    in->value( &bvh->build_cost );
+    in->value( &bvh->build_mode );
+    in->value( &bvh->build_time );
+
+    const Bvh::NodeList& nodes = bvh->nodes;
+    size_t num_indices = bvh->indices.size();
+    if ( !indices_below( bvh->indices, num_indices ) || bvh->leaf_of.size() != num_indices )
+        return false;
+
+    // leaves in the index list, and a tree no deeper than traversal's
+    // stack, each child after its parent and linked back to it, as
+    // traversal and refitting assume
+    std::vector< unsigned int > depths( nodes.size(), 0 );
+    for ( size_t i = 0; i < nodes.size(); ++i ) {
+        const Bvh::Node& node = nodes[i];
+        if ( depths[i] >= Bvh::MAX_DEPTH || ( i > 0 && node.parent >= i ) )
+            return false;
+        if ( node.count > 0 ) {
+            if ( node.offset > num_indices || node.count > num_indices - node.offset )
+                return false;
+            continue;
+        }
+        if ( node.offset <= i + 1 || node.offset >= nodes.size() || nodes[i + 1].parent != i
+             || nodes[node.offset].parent != i || node.axis >= 3 )
+            return false;
+        depths[i + 1] = depths[i] + 1;
+        depths[node.offset] = depths[i] + 1;
+    }
+
+    for ( size_t i = 0; i < num_indices; ++i ) {
+        if ( bvh->leaf_of[i] >= nodes.size() || nodes[bvh->leaf_of[i]].count == 0 )
+            return false;
+    }
+    return in->ok;
+}
+
+} /* _462 */
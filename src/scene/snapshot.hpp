@@ -0,0 +1,69 @@
+/**
+ * @file snapshot.hpp
+ * @brief Binary snapshots of loaded scenes, which open without parsing.
+ */
+
+#ifndef _462_SCENE_SNAPSHOT_HPP_
+#define _462_SCENE_SNAPSHOT_HPP_
+
+#include <cstdlib>
+
+namespace _462 {
+
+class Scene;
+class Bvh;
+class Material;
+class Mesh;
+
+/**
+ * Writes and reads a scene after its textures and meshes are loaded, as
+ * one file holding everything loading them computed: the decoded texels,
+ * the mesh triangles and their hierarchies, and the geometries' transforms
+ * and the hierarchy over them. Every list is stored as it is laid out in
+ * memory, aligned, so opening a snapshot maps the file and copies each
+ * list once, instead of parsing XML and OBJ files, decoding textures and
+ * building hierarchies.
+ */
+class SceneSnapshot
+{
+public:
+
+    // whether filename starts like a snapshot, rather than a .scene file
+    static bool is_snapshot( const char* filename );
+
+    /**
+     * Writes scene to filename, through a temporary file so an
+     * interrupted save leaves no truncated snapshot. The scene's textures
+     * and meshes must be loaded, with binary mesh hierarchies, and its
+     * geometries brought up to date by update_geometries.
+     * @return true on success, false on error.
+     */
+    static bool save( const Scene& scene, const char* filename );
+
+    /**
+     * Replaces scene with the snapshot in filename. Its textures and
+     * meshes are already loaded, each mesh with the binary hierarchy it
+     * was saved with, which Mesh::set_bvh_layout can copy into another
+     * layout. Prints a message to stdout if the file is not a snapshot.
+     * @return true on success, false on error, which clears the scene.
+     */
+    static bool load( Scene* scene, const char* filename );
+
+private:
+
+    class Writer;
+    class Reader;
+
+    static bool write_scene( Writer* out, const Scene& scene );
+    static void write_material( Writer* out, const Material& material );
+    static void write_mesh( Writer* out, const Mesh& mesh );
+    static void write_bvh( Writer* out, const Bvh& bvh );
+    static bool read_scene( Reader* in, Scene* scene );
+    static bool read_material( Reader* in, Material* material );
+    static bool read_mesh( Reader* in, Mesh* mesh );
+    static bool read_bvh( Reader* in, Bvh* bvh );
+};
+
+} /* _462 */
+
+#endif /* _462_SCENE_SNAPSHOT_HPP_ */
@@ -118,16 +118,6 @@ Vector3 Sphere::transform_point(const Vector3 &p) const {
 }
 
 
-/* static helper function for computing diffuse
- */
-real_t max_of(real_t a, real_t b)
-{
-	if(a > b)
-		return a; 
-	else
-		return b;
-}
-
 /* generates mapped 2D coordinates and mods by the the
  * width and height of the texture. then passes results
  * into the texture function for the sphere.
@@ -150,16 +140,6 @@ Color3 Sphere::compute_texture(const Vector3 &normal) const{
 	return texture_color;
 }
 
-/* computes the attenuation factor of a light source 
- * based on its distance from the surface point 
- * */
-Color3 Sphere::attenuation(real_t dist, const PointLight light, const Vector3 light_pos, const Vector3 surface_pos)const {
-	real_t constant = light.attenuation.constant;
-	real_t lin = light.attenuation.linear;
-	real_t quad = light.attenuation.quadratic;
-	return light.color*(1.0/(constant + lin*dist + quad*pow(dist,2)));
-}
-
 
 /* returns the time of intersection of a shadow ray if an intersection occurs
  * otherwise return -1, implying that the surface point is illuminated by light
@@ -192,46 +172,6 @@ real_t Sphere::shadow_intersection(const Vector3 &shadow_dir, const Vector3 &sur
 	return -1.0;		
 }
 
-/* utilizes the summation formula for computing the diffuse color
- * */ 
-Color3 Sphere::compute_diffuse(const Scene* scene, Vector3 normal, Vector3 surface_pos) const {
-
-	Color3 total_diff = Color3::Black;
-	int num_lights = scene->num_lights();
-	const PointLight* lights = scene->get_lights();
-	Geometry* const* sceneObjects = scene->get_geometries();
-	// iterate throught all lights in the scene
-	for(int i=0;i<num_lights;i++){
-		real_t b_i = 1.0;
-		Vector3 light_pos = lights[i].position;
-		Vector3 light_vector = normalize(light_pos - surface_pos);
-		real_t dist = distance(light_pos,surface_pos);
-
-		Vector3 slope_pos = surface_pos + EPSILON*light_vector;
-
-		for(unsigned int j=0;j<scene->num_geometries(); j++){	
-
-			real_t t = sceneObjects[j]->shadow_intersection(light_vector, slope_pos);
-			
-			if(t != -1.0){
-				// check if the intersection point is in front of the light
-				Vector3 geo_surface = slope_pos + light_vector*t; 
-				real_t geo_dis = distance(geo_surface,surface_pos);  
-				if(geo_dis < dist){
-					//if intersection with geometry is in front of light
-					b_i = 0.0; 
-					break; 	
-				}
-			}
-		}
-		if(b_i == 1.0){
-			Color3 atten = attenuation(dist,lights[i], light_pos,surface_pos);	
-			total_diff = total_diff + atten*max_of(dot(light_vector,normal),0); 		  	 
-		}
-	}
-	return total_diff;	
-}
-
 real_t Sphere::compute_refraction(const real_t n, const real_t nt, const Vector3 &ray, const Vector3 &normal) const{
 	//assumes vectors are normalized
 	real_t c = dot(ray,normal);
@@ -253,14 +193,12 @@ Vector3 Sphere::compute_refr_ray(const real_t n, const real_t nt,const Vector3 &
 	} 
 }
 
-/* recursively computes the specular component for spheres
+/* gets the rays for the specular component of spheres
  * After ray hits the surface position 
  * it will spawn a reflected ray of the surface, and potentailly a refracted ray
- * we then recursively call the specular function on those new rays*/
-Color3 Sphere::compute_specular(const Scene* scene, const Vector3 &normal, const Vector3 &incoming_ray,
-						    const Vector3 &surface_pos, int depth) const{	
+ * which compute_specular traces recursively*/
+void Sphere::specular_rays(const Vector3 &normal, const Vector3 &incoming_ray, SpecularRays* rays) const{	
 
-	Geometry* const* sceneObjects = scene->get_geometries();
 	real_t product = dot(incoming_ray,normal);
 	Vector3 refl_ray;
 	if(product < 0)
@@ -268,27 +206,16 @@ Color3 Sphere::compute_specular(const Scene* scene, const Vector3 &normal, const
 	else
 		refl_ray = normalize(incoming_ray + 2*dot(incoming_ray,-normal)*normal);
 
-	Vector3 slop_pos = surface_pos + EPSILON*refl_ray;
-	real_t minTime = UNINITIALIZED;
-	Geometry* geo1 = sceneObjects[0];
-	Geometry* geo2 = sceneObjects[0];
-
-	Color3 tex_color = compute_texture(normal);
-	for(unsigned int i=0;i<scene->num_geometries(); i++){
-	        Geometry* temp_geo = sceneObjects[i];
-	        if(temp_geo->is_intersecting(refl_ray,slop_pos,&minTime) != NOINTERSECTION){
-	                geo1 = temp_geo;
-	        }
-     	}
-	real_t R = 1; 
-	int new_depth = depth - 1;
-	Vector3 refr_ray;
-	
+	rays->dir[0] = refl_ray;
+	rays->num = 1;
+	rays->tex_color = compute_texture(normal);
+	rays->reflectance = 1;
+	rays->tex_last_bounce = true;
+
 	real_t curr_refr = get_refractive_index(); 
-	real_t min_ref_time = UNINITIALIZED;
-	Color3 refr_color;
-	Color3 refl_color;	
 	if(curr_refr != 0){
+		Vector3 refr_ray;
+		real_t R;
 		if(product < 0){
 			// computes the fresnel coefficient
 			refr_ray = compute_refr_ray(1,curr_refr,normal,incoming_ray);	
@@ -298,56 +225,13 @@ Color3 Sphere::compute_specular(const Scene* scene, const Vector3 &normal, const
 			refr_ray = compute_refr_ray(curr_refr,1,normal, incoming_ray);
 			R = compute_refraction(curr_refr,1,-incoming_ray,normal); 
 		}
-		/*check for total internal reflection*/
+		/*no refracted ray on total internal reflection*/
 		if(length(refr_ray) != 0){
-			Vector3 refr_slop_pos = surface_pos + EPSILON*refr_ray;
-			for(unsigned int i=0;i<scene->num_geometries(); i++){
-        			Geometry* temp_geo = sceneObjects[i];
-			       	if(temp_geo->is_intersecting(refr_ray,refr_slop_pos,&min_ref_time) != NOINTERSECTION){
-	               			geo2 = temp_geo;
-	       		 	}	
-			}
-			if(min_ref_time != UNINITIALIZED){	
-				Vector3 refr_surf_pos = surface_pos + refr_ray*min_ref_time;
-				Vector3 new_refr_norm = geo2->normal_of(refr_surf_pos);
-				Color3 temp_color = geo2->color_at_pixel(scene,refr_surf_pos);
-				if(depth > 1){	
-					Color3 refr_spec = geo2->get_specular();
-					// RECURSION HERE
-					refr_color = tex_color*(temp_color + refr_spec*geo2
-					->compute_specular(scene,new_refr_norm,refr_ray,refr_surf_pos,new_depth));
-				}
-				else
-					refl_color = Color3::Black;
-			}
-			else{
-				refr_color = tex_color*scene->background_color;
-			}	
-		}
-		else{
-			R = 1;
+			rays->dir[1] = refr_ray;
+			rays->num = 2;
+			rays->reflectance = R;
 		}
      	}
-									
-	if(minTime != UNINITIALIZED){
-        	Vector3 new_pos = surface_pos + refl_ray*minTime;
-		Vector3 new_norm = geo1->normal_of(new_pos);
-        	 Color3 temp_color = geo1->color_at_pixel(scene,new_pos);
-		if(depth > 1){ 	
-			Color3 specular = geo1->get_specular();	
-			// RECURSION HERE
-			refl_color = tex_color*(temp_color + specular*geo1->compute_specular(scene,new_norm,refl_ray,new_pos,new_depth));
-	  	}
-		else
-			refl_color = tex_color*temp_color;		
-     	}
-	else{	
-  		refl_color = tex_color*scene->background_color;
-	}
-	if(R == 1)
-		return refl_color;
-
-	return R*refl_color + (1 - R)*refr_color;
 }
 
 
@@ -373,10 +257,16 @@ Vector3 Sphere::normal_of(const Vector3 &surface_pos) const{
 	return normal;
 }
  
+/* the sphere is centered on the local origin */
+bool Sphere::get_local_bounds(BoundingBox* bounds) const{
+	*bounds = BoundingBox(Vector3(-radius,-radius,-radius), Vector3(radius,radius,radius));
+	return true;
+}
+ 
 /* Returns the color at the given pixel 
  * by computing the sum of all diffuse lights and ambient light 
  */
-Color3 Sphere::color_at_pixel(const Scene *scene, const Vector3 &surface_pos) const 
+Color3 Sphere::color_at_pixel(const Scene *scene, const Vector3 &surface_pos, ShadowCache* shadow_cache) const 
 {
 	const Color3 &diffuse =  material->diffuse;
 	const Color3 &ambient =  material->ambient;
@@ -387,7 +277,7 @@ Color3 Sphere::color_at_pixel(const Scene *scene, const Vector3 &surface_pos) co
 	// compute appropriate map for textures 
 	Color3 texture_color = compute_texture(normal);	
 	
-	return texture_color*((scene->ambient_light)*ambient + diffuse*compute_diffuse(scene,normal,surface_pos));
+	return texture_color*((scene->ambient_light)*ambient + diffuse*scene->compute_diffuse(normal,surface_pos,shadow_cache));
 }
 
 
@@ -401,7 +291,7 @@ Color3 Sphere::color_at_pixel(const Scene *scene, const Vector3 &surface_pos) co
  * dot product of vectors x and y 
  *  s is the directional vector, e is the camera eye starting point 
  *  */
-real_t Sphere::is_intersecting(Vector3 &s, Vector3 &e, real_t *T) const
+real_t Sphere::is_intersecting(Vector3 &s, Vector3 &e, real_t *T, TraversalStats* stats) const
 {
 	Vector3 D = s; // the viewing ray 
 
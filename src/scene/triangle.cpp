@@ -8,6 +8,7 @@
 #include "scene/triangle.hpp"
 #include "application/opengl.hpp"
 #include "stdio.h"
+#include <cstring>
 #include "scene/scene.hpp"
 
 // arbitrary slop factor
@@ -16,13 +17,9 @@
 #define UNINITIALIZED -1.0
 
 namespace _462 {
-real_t ALPHA;
-real_t BETA;
-real_t GAMMA; 
-
-Vector3 camera_eye;
-real_t  ray_time; 
-Vector3 ray_direction;
+_462_THREAD_LOCAL real_t ALPHA;
+_462_THREAD_LOCAL real_t BETA;
+_462_THREAD_LOCAL real_t GAMMA; 
 
 
 Triangle::Triangle()
@@ -65,38 +62,17 @@ void Triangle::render() const
 }
 
 /*transform vectors from object space to world space 
- *one method for point, one method for vectors*/
+ *one method for point, one method for vectors. baked
+ *vertices are already in world space*/
 Vector3 Triangle::transform_vector(const Vector3 &v) const {
-        return inv_trans.transform_vector(v);
+        return baked ? v : inv_trans.transform_vector(v);
 }
  
 Vector3 Triangle::transform_point(const Vector3 &p) const {
-        return inv_trans.transform_point(p);
+        return baked ? p : inv_trans.transform_point(p);
 }
 
  
-/* static helper function for computing diffuse
- */
-real_t max(real_t a, real_t b)
-{
-        if(a > b)
-                return a;
-        else
-                return b;
-}
- 
-/* computes the attenuation factor of a light source 
- * based on its distance from the surface point
- * formula is: color/(const + lin*d + qud*d^2)) 
- * */
-Color3 Triangle::attenuation(real_t &dist, const PointLight light, const Vector3 &light_pos, const Vector3 &surface_pos) const
-{
-        real_t constant = light.attenuation.constant;
-        real_t lin = light.attenuation.linear;
-        real_t quad = light.attenuation.quadratic;
-        return light.color*(1.0/(constant + lin*dist + quad*pow(dist,2)));
-}
-
 /* returns the time of intersection of a shadow ray if an intersection occurs
  * otherwise return -1, implying that the surface point is illuminated by light
  */
@@ -148,51 +124,6 @@ real_t Triangle::shadow_intersection(const Vector3 &shadow_dir, const Vector3 &s
 	return -1.0;
 }
 
-/* computes the diffuse component by iterating through all lights within the scene
- * much the like sphere. 
- * note: only difference is the barycentric coordinates are an
- * additional weighing factor in the final output
- * */
-Color3 Triangle:: compute_diffuse(const Scene* scene, const Vector3 &normal,const Vector3 &surface_pos)const{
- 	Color3 total_diff = Color3::Black;
-        int num_lights = scene->num_lights();
-	int num_shapes = scene->num_geometries(); 
-	Geometry* const* sceneObjects = scene->get_geometries();
-        const PointLight* lights = scene->get_lights();
-
-        // iterate throught all lights in the scene
-        for(int i=0;i<num_lights;i++){
-	
-		 real_t b_i = 1.0;
-                 Vector3 light_pos = lights[i].position;
-                 Vector3 light_vector = normalize(light_pos - surface_pos);
-                 real_t dist = distance(light_pos,surface_pos);
- 		 // apply slope factor of some arbitrarily small epsilon
- 		 // to the surface position, we will shoot out shadow ray from here
-                 Vector3 slope_pos = surface_pos + EPSILON*light_vector;
- 		   
-		 // check if a geometry casts a shadow, in which case 
- 	         // this light contributes nothing to the diffuse color
-                 for(int j=0; j<num_shapes; j++){ 
-                         real_t t = sceneObjects[j]->shadow_intersection(light_vector, slope_pos);
-			  // check if the intersection point is in front of the light 
-                         if(t != -1.0){
-                                 Vector3 geo_surface = slope_pos + light_vector*t;
-                                 real_t geo_dis = distance(geo_surface,surface_pos);
-                                 if(geo_dis < dist){
-                                         b_i = 0.0; //light contributes nothing
-                                         break;
-                                 }
-                         }
-                 }
-                 if(b_i == 1.0){
-                         Color3 atten = attenuation(dist,lights[i], light_pos,surface_pos);
-                         total_diff = total_diff + atten*max(dot(light_vector,normal),0);
-                 }
-        }     
-	return total_diff;
-}
-
 /* first generates textures by interpolating the texture coordinates
  * and calling the get_texture function on each vertex
  * then interpolates the resulting textures for each vertex
@@ -261,7 +192,8 @@ Vector3 Triangle::normal_of(const Vector3 &surface_pos) const{
 	Vector3 normalB = vertices[1].normal;
 	Vector3 normalC = vertices[2].normal;
 
-	Vector3 bary_normal = normalize(norm_matrix*(ALPHA*normalA + BETA*normalB + GAMMA*normalC));
+	Vector3 normal = ALPHA*normalA + BETA*normalB + GAMMA*normalC;
+	Vector3 bary_normal = normalize(baked ? normal : norm_matrix*normal);
         return bary_normal;
 }
 
@@ -269,50 +201,40 @@ real_t Triangle::compute_refraction(const real_t inner_refr, const real_t outer_
         return 0.0;
 }
 
-/*recursively computes the specular component of this triangle
- *identically implement as that of sphere. After ray hits the surface position 
- *it will spawn a reflected ray of the surface, and potentailly a refracted ray
- *we then recursively call the specular function on those new rays*/
-Color3 Triangle::compute_specular(const Scene* scene, const Vector3 &normal, 
-const Vector3 &incoming_ray, const Vector3 &surface_pos, int depth) const{
-
-	Geometry* const* sceneObjects = scene->get_geometries();
-        Vector3 refl_ray = normalize(incoming_ray - 2*dot(incoming_ray,normal)*normal);
-        Vector3 slop_pos = surface_pos + EPSILON*refl_ray;
-        real_t minTime = UNINITIALIZED;
-        Geometry* geo = sceneObjects[0];
-        Color3 tex_color = compute_texture();
-        for(unsigned int i=0;i<scene->num_geometries(); i++){
-        Geometry* temp_geo = sceneObjects[i];
-                 if(temp_geo->is_intersecting(refl_ray,slop_pos,&minTime) != NOINTERSECTION){
-                         geo = temp_geo;
-                 }
- 
-        }
-        if(minTime != UNINITIALIZED){
-                Vector3 new_pos = surface_pos + refl_ray*minTime;
-                Color3 returnColor = geo->color_at_pixel(scene,new_pos);
-                if(depth == 1)  
-                        return returnColor;
-                else{
-                        int new_depth = depth-1;
-                        Color3 specular = geo->get_specular();
-                        Vector3 new_norm = geo->normal_of(new_pos);
-                        // RECURSIVE CALL IS HERE!!!!
-                	return tex_color*(returnColor + specular*geo->compute_specular(scene,new_norm,refl_ray,new_pos,new_depth));
-         	     }    
-        }    
-	return tex_color*scene->background_color;
+/*gets the reflected ray for the specular component of this triangle
+ *identically implement as that of sphere, without refraction. compute_specular
+ *traces it recursively. what the last bounce sees is not scaled by the texture*/
+void Triangle::specular_rays(const Vector3 &normal, const Vector3 &incoming_ray, SpecularRays* rays) const{
+
+        rays->dir[0] = normalize(incoming_ray - 2*dot(incoming_ray,normal)*normal);
+        rays->num = 1;
+        rays->tex_color = compute_texture();
+        rays->reflectance = 1;
+        rays->tex_last_bounce = false;
 }
 
 
 
+/* the barycentric coordinates of the last hit */
+void Triangle::get_hit(HitRecord* hit) const{
+	memset(hit, 0, sizeof *hit);
+	hit->barycentric[0] = ALPHA;
+	hit->barycentric[1] = BETA;
+	hit->barycentric[2] = GAMMA;
+}
+
+void Triangle::set_hit(const HitRecord &hit) const{
+	ALPHA = hit.barycentric[0];
+	BETA = hit.barycentric[1];
+	GAMMA = hit.barycentric[2];
+}
+
 /* based on the ambient, and diffuse components of color 
  * and the barycentric coordinates of the point on the triangle
  * we compute the color at the given pixel coordinates
  * and then interpolate with alpha beta gamma
  * */
-Color3 Triangle::color_at_pixel(const Scene* scene, const Vector3 &surface_pos) const {
+Color3 Triangle::color_at_pixel(const Scene* scene, const Vector3 &surface_pos, ShadowCache* shadow_cache) const {
 
 	Color3 ambA = vertices[0].material->ambient;
 	Color3 ambB = vertices[1].material->ambient;
@@ -326,22 +248,30 @@ Color3 Triangle::color_at_pixel(const Scene* scene, const Vector3 &surface_pos)
 	Color3 bary_diff = ALPHA*diffA + BETA*diffB + GAMMA*diffC;
 	Vector3 bary_normal = normal_of(surface_pos);
 	Color3 tex_color = compute_texture();
-	return tex_color*(scene->ambient_light*bary_amb + bary_diff*compute_diffuse(scene,bary_normal, surface_pos));
+	return tex_color*(scene->ambient_light*bary_amb + bary_diff*scene->compute_diffuse(bary_normal, surface_pos, shadow_cache));
 }
  
+/* bounds of the three vertices in local space */
+bool Triangle::get_local_bounds(BoundingBox* bounds) const
+{
+	*bounds = BoundingBox();
+	for(int i=0; i<3; i++){
+		bounds->include(vertices[i].position);
+	}
+	return true;
+}
+
 // determines if our viewing ray intersects this given object
 // abstractly speaking we construct the following system: 
 // e + T(d) = a + BETA(b-a) + GAMMA(c-a)
 // And solve for T, BETA, and GAMMA using cramer's rule  
-real_t Triangle::is_intersecting(Vector3 &s, Vector3 &e, real_t* T) const
+real_t Triangle::is_intersecting(Vector3 &s, Vector3 &e, real_t* T, TraversalStats* stats) const
 {
 	Vector3 d  = transform_vector(s);
 	Vector3 e1 = transform_point(e);  
 	Vector3 a = vertices[0].position; 
 	Vector3 b = vertices[1].position;
 	Vector3 c = vertices[2].position;
-        camera_eye = e1; 
-	ray_direction = d; 	
 
 	// we construct each of the entries of the matrix
 	// of a linear system 
@@ -377,7 +307,6 @@ real_t Triangle::is_intersecting(Vector3 &s, Vector3 &e, real_t* T) const
 	real_t	 TIME =-(F*(AKJB) + E*(JCAL) + D*(BLKC))/M; 
  	// conditions for returning true, note that T must be within the interval [0, infinity) 
 	if((TIME >= 0.0) && (gamma >= 0.0) && (gamma <= 1.0) && (beta >= 0.0) && (beta <= 1.0 - gamma)){		
-		ray_time = TIME;
 		real_t alpha = 1.0 - beta - gamma;
 		// the intersection returns -1 if the time of intersection is 
 		// in fact a minimal time 
@@ -42,20 +42,21 @@ public:
     
     virtual Vector3 transform_vector(const Vector3 &v) const;
     virtual Vector3 transform_point(const Vector3 &p) const;
-    virtual Color3 color_at_pixel(const Scene* scene,const Vector3 &surface_pos) const ;
-    virtual real_t is_intersecting(Vector3 &s, Vector3 &e, real_t *T) const;
+    virtual Color3 color_at_pixel(const Scene* scene, const Vector3 &surface_pos, ShadowCache* shadow_cache = 0) const ;
+    virtual real_t is_intersecting(Vector3 &s, Vector3 &e, real_t *T, TraversalStats* stats = 0) const;
     virtual real_t shadow_intersection(const Vector3 &shadow_dir, const Vector3 &surface_pos) const;      
 
     virtual Color3 get_specular() const;
     virtual Vector3 normal_of(const Vector3 &surface_pos) const;
-    virtual Color3 compute_specular(const Scene* scene, const Vector3 &normal, const Vector3 &incoming_ray, const Vector3 &surface_pos, int depth) const ;
+    virtual void get_hit(HitRecord* hit) const;
+    virtual void set_hit(const HitRecord &hit) const;
+    virtual bool get_local_bounds(BoundingBox* bounds) const;
+    virtual void specular_rays(const Vector3 &normal, const Vector3 &incoming_ray, SpecularRays* rays) const;
     virtual real_t get_refractive_index() const;
     virtual real_t compute_refraction(const real_t inner_refr, const real_t outer_refr, const Vector3 &incoming_ray,const Vector3 &normal) const;
 
     Color3 compute_texture_at_vertex(real_t u, real_t v, const Material* material) const; 
     Color3 compute_texture () const;
-    Color3 compute_diffuse(const Scene* scene, const Vector3 &normal,const Vector3 &surface_pos) const;
-    Color3 attenuation(real_t &dist, const PointLight light, const Vector3 &light_pos, const Vector3 &surface_pos)const; 
 };
 
 
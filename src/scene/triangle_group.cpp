@@ -0,0 +1,393 @@
+/**
+ * @file triangle_group.cpp
+ * @brief Function definitions for the TriangleGroup class.
+ */
+
+#include "scene/triangle_group.hpp"
+#include "application/opengl.hpp"
+#include <cstring>
+#include <limits>
+
+namespace _462 {
+
+// the triangle of the last hit and where on it
+static _462_THREAD_LOCAL MeshTriangle hit_triangle;
+static _462_THREAD_LOCAL real_t hit_alpha;
+static _462_THREAD_LOCAL real_t hit_beta;
+static _462_THREAD_LOCAL real_t hit_gamma;
+
+TriangleGroup::TriangleGroup() : mesh( 0 ) { }
+
+TriangleGroup::~TriangleGroup() { }
+
+bool TriangleGroup::VertexCompare::operator()( const Triangle::Vertex& a, const Triangle::Vertex& b ) const
+{
+    const real_t lhs[] = { a.position.x, a.position.y, a.position.z, a.normal.x, a.normal.y,
+                           a.normal.z, a.tex_coord.x, a.tex_coord.y };
+    const real_t rhs[] = { b.position.x, b.position.y, b.position.z, b.normal.x, b.normal.y,
+                           b.normal.z, b.tex_coord.x, b.tex_coord.y };
+    for ( size_t i = 0; i < sizeof lhs / sizeof lhs[0]; ++i ) {
+        if ( lhs[i] != rhs[i] )
+            return lhs[i] < rhs[i];
+    }
+    return a.material < b.material;
+}
+
+void TriangleGroup::add_triangle( const Triangle& triangle )
+{
+    assert( mesh );
+    MeshTriangle indices;
+    for ( size_t i = 0; i < 3; ++i ) {
+        const Triangle::Vertex& vertex = triangle.vertices[i];
+        std::pair< VertexMap::iterator, bool > added =
+            vertex_index.insert( std::make_pair( vertex, (unsigned int) materials.size() ) );
+        if ( added.second ) {
+            MeshVertex mesh_vertex;
+            mesh_vertex.position = vertex.position;
+            mesh_vertex.normal = vertex.normal;
+            mesh_vertex.tex_coord = vertex.tex_coord;
+            mesh->vertices.push_back( mesh_vertex );
+            materials.push_back( vertex.material );
+        }
+        indices.vertices[i] = added.first->second;
+    }
+    mesh->triangles.push_back( indices );
+}
+
+void TriangleGroup::build( Bvh::BuildMode mode, Mesh::BvhLayout layout )
+{
+    vertex_index.clear();
+    // every vertex of a triangle has both
+    mesh->has_normals = true;
+    mesh->has_tcoords = true;
+    mesh->build_bvh( mode, layout );
+}
+
+void TriangleGroup::render() const
+{
+    const MeshVertex* vertices = mesh->get_vertices();
+    const MeshTriangle* triangles = mesh->get_triangles();
+
+    // as each triangle did, with the material of its first vertex
+    for ( size_t i = 0; i < mesh->num_triangles(); ++i ) {
+        const unsigned int* index = triangles[i].vertices;
+        const Material* material = materials[index[0]];
+        bool materials_nonnull = material && materials[index[1]] && materials[index[2]];
+        if ( materials_nonnull )
+            material->set_gl_state();
+
+        glBegin( GL_TRIANGLES );
+        for ( size_t j = 0; j < 3; ++j ) {
+            glNormal3dv( &vertices[index[j]].normal.x );
+            glTexCoord2dv( &vertices[index[j]].tex_coord.x );
+            glVertex3dv( &vertices[index[j]].position.x );
+        }
+        glEnd();
+
+        if ( materials_nonnull )
+            material->reset_gl_state();
+    }
+}
+
+/* baked vertices are already in world space */
+Vector3 TriangleGroup::transform_vector(const Vector3 &v) const {
+        return baked ? v : inv_trans.transform_vector(v);
+}
+
+Vector3 TriangleGroup::transform_point(const Vector3 &p) const {
+        return baked ? p : inv_trans.transform_point(p);
+}
+
+/* the cramer's rule test of Triangle::shadow_intersection, with the shadow
+ * ray already in local space */
+real_t TriangleGroup::shadow_intersect_triangle(const MeshTriangle &triangle, const Vector3 &d, const Vector3 &e1) const{
+	const MeshVertex* vertices = mesh->get_vertices();
+
+	Vector3 a = vertices[triangle.vertices[0]].position;
+	Vector3 b = vertices[triangle.vertices[1]].position;
+	Vector3 c = vertices[triangle.vertices[2]].position;
+
+	real_t A = a.x - b.x;
+	real_t B = a.y - b.y;
+	real_t C = a.z - b.z;
+
+	real_t D = a.x - c.x;
+	real_t E = a.y - c.y;
+	real_t F = a.z - c.z;
+
+	real_t G = d.x;
+	real_t H = d.y;
+	real_t I = d.z;
+
+	real_t J = a.x - e1.x;
+	real_t K = a.y - e1.y;
+	real_t L = a.z - e1.z;
+
+	real_t EIHF = E*I - H*F;
+	real_t GFDI = G*F - D*I;
+	real_t DHEG = D*H - E*G;
+
+	real_t AKJB = A*K - J*B;
+	real_t JCAL = J*C - A*L;
+	real_t BLKC = B*L - K*C;
+
+	real_t  M    =  A*(EIHF) + B*(GFDI) + C*(DHEG);
+	real_t beta  = (J*(EIHF) + K*(GFDI) + L*(DHEG))/M;
+	real_t gamma = (I*(AKJB) + H*(JCAL) + G*(BLKC))/M;
+	real_t  time =-(F*(AKJB) + E*(JCAL) + D*(BLKC))/M;
+	if((time >= 0.0) && (gamma >= 0.0) && (gamma <= 1.0) && (beta >= 0.0) && (beta <= 1.0 - gamma)){
+		return time;
+	}
+	return -1.0;
+}
+
+/*keeps the closest shadow hit of the triangles the mesh's bvh hands it*/
+struct TriangleGroupShadowVisitor
+{
+	const TriangleGroup* group;
+	const MeshTriangle* triangles;
+	Vector3 d, e1;
+	real_t min_time;
+
+	bool operator()(unsigned int i, real_t* tmax){
+		real_t time = group->shadow_intersect_triangle(triangles[i],d,e1);
+		if(time != -1.0){
+			if(time < min_time || min_time == -1.0){
+				min_time = time;
+				*tmax = time;
+			}
+		}
+		return false;
+	}
+};
+
+/*the closest of the triangles' shadow hits, which is within a distance
+ *whenever any of them is, as with the triangles apart*/
+real_t TriangleGroup::shadow_intersection(const Vector3 &shadow_dir, const Vector3 &surface_pos) const{
+	TriangleGroupShadowVisitor visitor;
+	visitor.group = this;
+	visitor.triangles = mesh->get_triangles();
+	visitor.d = transform_vector(shadow_dir);
+	visitor.e1 = transform_point(surface_pos);
+	visitor.min_time = -1.0;
+	real_t tmax = std::numeric_limits<real_t>::max();
+	mesh->traverse(visitor.e1,visitor.d,&tmax,visitor);
+	return visitor.min_time;
+}
+
+/* the texel of material at texture coordinates u and v, as
+ * Triangle::compute_texture_at_vertex */
+static Color3 texture_at(real_t u, real_t v, const Material* material){
+	int width,height;
+	material->get_texture_size(&width,&height);
+	if(width == 0 || height == 0){
+		return Color3::White;
+	}
+	real_t mod_U = ((int)(width*u)) % width;
+	real_t mod_V = ((int)(height*v)) % height;
+
+	return material->get_texture_pixel(mod_U,mod_V);
+}
+
+/* the texture of each vertex's material at the interpolated texture
+ * coordinates, interpolated, as Triangle::compute_texture */
+Color3 TriangleGroup::compute_texture() const{
+	const MeshVertex* vertices = mesh->get_vertices();
+
+	Vector2 tex_A = vertices[hit_triangle.vertices[0]].tex_coord;
+	Vector2 tex_B = vertices[hit_triangle.vertices[1]].tex_coord;
+	Vector2 tex_C = vertices[hit_triangle.vertices[2]].tex_coord;
+
+	real_t tex_U = hit_alpha*(tex_A.x) + hit_beta*(tex_B.x) + hit_gamma*(tex_C.x);
+	real_t tex_V = hit_alpha*(tex_A.y) + hit_beta*(tex_B.y) + hit_gamma*(tex_C.y);
+
+	Color3 color_A = texture_at(tex_U,tex_V,materials[hit_triangle.vertices[0]]);
+	Color3 color_B = texture_at(tex_U,tex_V,materials[hit_triangle.vertices[1]]);
+	Color3 color_C = texture_at(tex_U,tex_V,materials[hit_triangle.vertices[2]]);
+
+	return hit_alpha*color_A + hit_beta*color_B + hit_gamma*color_C;
+}
+
+/*the refractive indices of the hit triangle's vertices, interpolated*/
+real_t TriangleGroup::get_refractive_index() const{
+	real_t refA = materials[hit_triangle.vertices[0]]->refractive_index;
+	real_t refB = materials[hit_triangle.vertices[1]]->refractive_index;
+	real_t refC = materials[hit_triangle.vertices[2]]->refractive_index;
+
+	return hit_alpha*refA + hit_beta*refB + hit_gamma*refC;
+}
+
+/*the specular colors of the hit triangle's vertices, interpolated*/
+Color3 TriangleGroup::get_specular() const{
+	Color3 specA = materials[hit_triangle.vertices[0]]->specular;
+	Color3 specB = materials[hit_triangle.vertices[1]]->specular;
+	Color3 specC = materials[hit_triangle.vertices[2]]->specular;
+
+	return hit_alpha*specA + hit_beta*specB + hit_gamma*specC;
+}
+
+/*the normals of the hit triangle's vertices, interpolated*/
+Vector3 TriangleGroup::normal_of(const Vector3 &surface_pos) const{
+	const MeshVertex* vertices = mesh->get_vertices();
+
+	Vector3 normalA = vertices[hit_triangle.vertices[0]].normal;
+	Vector3 normalB = vertices[hit_triangle.vertices[1]].normal;
+	Vector3 normalC = vertices[hit_triangle.vertices[2]].normal;
+
+	Vector3 normal = hit_alpha*normalA + hit_beta*normalB + hit_gamma*normalC;
+	return normalize(baked ? normal : norm_matrix*normal);
+}
+
+real_t TriangleGroup::compute_refraction(const real_t inner_refr, const real_t outer_refr, const Vector3 &incoming_ray,const Vector3 &normal) const{
+        return 0.0;
+}
+
+/*the reflected ray, as for a triangle*/
+void TriangleGroup::specular_rays(const Vector3 &normal, const Vector3 &incoming_ray, SpecularRays* rays) const{
+
+        rays->dir[0] = normalize(incoming_ray - 2*dot(incoming_ray,normal)*normal);
+        rays->num = 1;
+        rays->tex_color = compute_texture();
+        rays->reflectance = 1;
+        rays->tex_last_bounce = false;
+}
+
+/* bounds of the mesh's vertices in local space */
+bool TriangleGroup::get_local_bounds(BoundingBox* bounds) const{
+	*bounds = mesh->get_bounds();
+	return true;
+}
+
+/* the vertices of the triangle of the last hit and where on it */
+void TriangleGroup::get_hit(HitRecord* hit) const{
+	for(size_t i = 0; i < 3; ++i){
+		hit->vertices[i] = hit_triangle.vertices[i];
+	}
+	hit->barycentric[0] = hit_alpha;
+	hit->barycentric[1] = hit_beta;
+	hit->barycentric[2] = hit_gamma;
+}
+
+void TriangleGroup::set_hit(const HitRecord &hit) const{
+	for(size_t i = 0; i < 3; ++i){
+		hit_triangle.vertices[i] = hit.vertices[i];
+	}
+	hit_alpha = hit.barycentric[0];
+	hit_beta = hit.barycentric[1];
+	hit_gamma = hit.barycentric[2];
+}
+
+/* the color of the hit triangle, its vertices' materials interpolated as
+ * Triangle::color_at_pixel does */
+Color3 TriangleGroup::color_at_pixel(const Scene* scene, const Vector3 &surface_pos, ShadowCache* shadow_cache) const {
+	const Material* matA = materials[hit_triangle.vertices[0]];
+	const Material* matB = materials[hit_triangle.vertices[1]];
+	const Material* matC = materials[hit_triangle.vertices[2]];
+
+	Color3 bary_amb  = hit_alpha*matA->ambient + hit_beta*matB->ambient + hit_gamma*matC->ambient;
+	Color3 bary_diff = hit_alpha*matA->diffuse + hit_beta*matB->diffuse + hit_gamma*matC->diffuse;
+	Vector3 bary_normal = normal_of(surface_pos);
+	Color3 tex_color = compute_texture();
+	return tex_color*(scene->ambient_light*bary_amb + bary_diff*scene->compute_diffuse(bary_normal, surface_pos, shadow_cache));
+}
+
+/*keeps the closest hit of the triangles the mesh's bvh hands it*/
+struct TriangleGroupIntersectVisitor
+{
+	const TriangleGroup* group;
+	const MeshTriangle* triangles;
+	Vector3 d, e1;
+	real_t* T;
+	bool hit;
+	// index of the triangle hit
+	unsigned int hit_index;
+
+	bool operator()(unsigned int i, real_t* tmax){
+		real_t time;
+		if(hit && i < hit_index){
+			// testing in order, a tie went to the first triangle
+			real_t t = next_up(*T);
+			time = group->intersects_triangle(triangles[i],d,e1,&t);
+			if(time != -1)
+				*T = t;
+		}
+		else
+			time = group->intersects_triangle(triangles[i],d,e1,T);
+		if(time != -1){
+			hit = true;
+			hit_index = i;
+			*tmax = *T;
+		}
+		return false;
+	}
+};
+
+/* searches the triangles with the mesh's bvh, with the ray moved into
+ * local space once. returns a non-zero number if one is hit closer than *T
+ */
+real_t TriangleGroup::is_intersecting(Vector3 &s, Vector3 &e, real_t *T, TraversalStats* stats) const
+{
+	TriangleGroupIntersectVisitor visitor;
+	visitor.group = this;
+	visitor.triangles = mesh->get_triangles();
+	visitor.d = transform_vector(s);
+	visitor.e1 = transform_point(e);
+	visitor.T = T;
+	visitor.hit = false;
+	visitor.hit_index = 0;
+	real_t tmax = *T == -1 ? std::numeric_limits<real_t>::max() : *T;
+	mesh->traverse(visitor.e1,visitor.d,&tmax,visitor,stats);
+	return visitor.hit ? 1.0 : 0.0;
+}
+
+/* the cramer's rule test of Triangle::is_intersecting, with the ray
+ * already in local space */
+real_t TriangleGroup::intersects_triangle(const MeshTriangle &triangle, const Vector3 &d, const Vector3 &e1, real_t *T) const{
+	const MeshVertex* vertices = mesh->get_vertices();
+
+	Vector3 a = vertices[triangle.vertices[0]].position;
+	Vector3 b = vertices[triangle.vertices[1]].position;
+	Vector3 c = vertices[triangle.vertices[2]].position;
+
+	real_t A = a.x - b.x;
+	real_t B = a.y - b.y;
+	real_t C = a.z - b.z;
+
+	real_t D = a.x - c.x;
+	real_t E = a.y - c.y;
+	real_t F = a.z - c.z;
+
+	real_t G = d.x;
+	real_t H = d.y;
+	real_t I = d.z;
+
+	real_t J = a.x - e1.x;
+	real_t K = a.y - e1.y;
+	real_t L = a.z - e1.z;
+
+	real_t EIHF = E*I - H*F;
+	real_t GFDI = G*F - D*I;
+	real_t DHEG = D*H - E*G;
+
+	real_t AKJB = A*K - J*B;
+	real_t JCAL = J*C - A*L;
+	real_t BLKC = B*L - K*C;
+
+	real_t  M    =  A*(EIHF) + B*(GFDI) + C*(DHEG);
+	real_t beta  = (J*(EIHF) + K*(GFDI) + L*(DHEG))/M;
+	real_t gamma = (I*(AKJB) + H*(JCAL) + G*(BLKC))/M;
+	real_t  time =-(F*(AKJB) + E*(JCAL) + D*(BLKC))/M;
+	if((time >= 0.0) && (gamma >= 0.0) && (gamma <= 1.0) && (beta >= 0.0) && (beta <= 1.0 - gamma)){
+		if(time < *T || *T == -1){
+			hit_triangle = triangle;
+			hit_alpha = 1.0 - beta - gamma;
+			hit_beta = beta;
+			hit_gamma = gamma;
+			*T = time;
+			return 1.0;
+		}
+	}
+	return -1.0;
+}
+
+} /* _462 */
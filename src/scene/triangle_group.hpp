@@ -0,0 +1,88 @@
+/**
+ * @file triangle_group.hpp
+ * @brief Class definition for TriangleGroup.
+ */
+
+#ifndef _462_SCENE_TRIANGLE_GROUP_HPP_
+#define _462_SCENE_TRIANGLE_GROUP_HPP_
+
+#include "scene/scene.hpp"
+#include "scene/mesh.hpp"
+#include "scene/triangle.hpp"
+#include <map>
+#include <vector>
+
+namespace _462 {
+
+/**
+ * Triangles of a scene file that share a transform, merged into one
+ * geometry. Their vertices are stored once in a mesh, with the hierarchy
+ * over the triangles, and each vertex keeps its own material. Shading is
+ * that of the triangles it replaces, which are searched in the order they
+ * were added, so it renders the same image with one primitive in the
+ * scene's hierarchy instead of one per triangle.
+ */
+class TriangleGroup : public Geometry
+{
+public:
+
+    // the vertices and triangles, made and added to the scene with the group
+    Mesh* mesh;
+    // the material of each of the mesh's vertices
+    std::vector< const Material* > materials;
+
+    TriangleGroup();
+    virtual ~TriangleGroup();
+
+    /**
+     * Adds a copy of triangle's vertices, sharing those identical to
+     * vertices already added. Its transform must be the group's.
+     */
+    void add_triangle( const Triangle& triangle );
+
+    /// Builds the mesh's hierarchy over the triangles added.
+    void build( Bvh::BuildMode mode, Mesh::BvhLayout layout );
+
+    virtual void render() const;
+
+    virtual Vector3 transform_vector(const Vector3 &v) const;
+    virtual Vector3 transform_point(const Vector3 &p) const;
+    virtual Color3 color_at_pixel(const Scene* scene, const Vector3 &surface_pos, ShadowCache* shadow_cache = 0) const;
+    virtual real_t is_intersecting(Vector3 &s, Vector3 &e, real_t *T, TraversalStats* stats = 0) const;
+    virtual real_t shadow_intersection(const Vector3 &shadow_dir, const Vector3 &surface_pos) const;
+
+    virtual Color3 get_specular() const;
+    virtual Vector3 normal_of(const Vector3 &surface_pos) const;
+    virtual void get_hit(HitRecord* hit) const;
+    virtual void set_hit(const HitRecord &hit) const;
+    virtual bool get_local_bounds(BoundingBox* bounds) const;
+    virtual void specular_rays(const Vector3 &normal, const Vector3 &incoming_ray, SpecularRays* rays) const;
+    virtual real_t get_refractive_index() const;
+    virtual real_t compute_refraction(const real_t inner_refr, const real_t outer_refr, const Vector3 &incoming_ray,const Vector3 &normal) const;
+
+    Color3 compute_texture() const;
+
+    // the triangle tests take the ray in local space
+    real_t intersects_triangle(const MeshTriangle &triangle, const Vector3 &d, const Vector3 &e1, real_t *T) const;
+    real_t shadow_intersect_triangle(const MeshTriangle &triangle, const Vector3 &d, const Vector3 &e1) const;
+
+private:
+
+    struct VertexCompare
+    {
+        bool operator()( const Triangle::Vertex& a, const Triangle::Vertex& b ) const;
+    };
+
+    typedef std::map< Triangle::Vertex, unsigned int, VertexCompare > VertexMap;
+
+    // index of each vertex added so far, emptied by build
+    VertexMap vertex_index;
+
+    // no meaningful assignment or copy
+    TriangleGroup( const TriangleGroup& );
+    TriangleGroup& operator=( const TriangleGroup& );
+};
+
+} /* _462 */
+
+#endif /* _462_SCENE_TRIANGLE_GROUP_HPP_ */
@@ -0,0 +1,284 @@
+/**
+ * @file visibility_cache.cpp
+ * @brief Baked shadow ray results for re-rendering static scenes.
+ *
+ * File layout, all numbers are native endian:
+ *   magic "RTVC", version
+ *   scene key, cell size as a real_t
+ *   number of entries, then each entry's cell, facing, light, lit and
+ *   shadowed counts
+ */
+
+#include "scene/visibility_cache.hpp"
+#include "scene/scene.hpp"
+#include "scene/scene_hash.hpp"
+#include "scene/triangle_group.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <string>
+#include <algorithm>
+#include <exception>
+
+namespace _462 {
+
+static const char MAGIC[4] = { 'R', 'T', 'V', 'C' };
+static const int VERSION = 1;
+
+VisibilityCache::VisibilityCache()
+    : key( 0 ), cell_size( 0.0 ), num_combined( 0 ) { }
+
+unsigned int VisibilityCache::scene_key( const Scene& scene )
+{
+    SceneHash hash;
+    hash.add_lights( scene );
+    hash.add_geometries( scene );
+    return hash.hash;
+}
+
+// appends the largest world extent of local bounds scaled by scale, if any
+static void add_size( std::vector< real_t >* sizes, const BoundingBox& bounds, const Vector3& scale )
+{
+    Vector3 extent = bounds.max - bounds.min;
+    real_t size = 0.0;
+    for ( size_t a = 0; a < 3; ++a ) {
+        size = std::max( size, extent[a] * fabs( scale[a] ) );
+    }
+    if ( size > 0.0 )
+        sizes->push_back( size );
+}
+
+void VisibilityCache::reset( const Scene& scene )
+{
+    key = scene_key( scene );
+    entries.clear();
+    recorded.clear();
+    num_combined = 0;
+
+    // size the cells by one of the smallest geometries, so one huge ground
+    // plane or a few tiny details don't decide it
+    std::vector< real_t > sizes;
+    Geometry* const* geometries = scene.get_geometries();
+    for ( size_t i = 0; i < scene.num_geometries(); ++i ) {
+        const Geometry* geom = geometries[i];
+        // merged triangles count one by one, as they did apart
+        const TriangleGroup* group = dynamic_cast< const TriangleGroup* >( geom );
+        if ( group ) {
+            const MeshVertex* vertices = group->mesh->get_vertices();
+            const MeshTriangle* triangles = group->mesh->get_triangles();
+            for ( size_t j = 0; j < group->mesh->num_triangles(); ++j ) {
+                BoundingBox bounds;
+                for ( size_t k = 0; k < 3; ++k ) {
+                    bounds.include( vertices[triangles[j].vertices[k]].position );
+                }
+                add_size( &sizes, bounds, geom->scale );
+            }
+            continue;
+        }
+
+        BoundingBox bounds;
+        if ( !geom->get_local_bounds( &bounds ) )
+            continue;
+        add_size( &sizes, bounds, geom->scale );
+    }
+
+    cell_size = 0.0;
+    if ( !sizes.empty() ) {
+        size_t small = sizes.size() / 10;
+        std::nth_element( sizes.begin(), sizes.begin() + small, sizes.end() );
+        cell_size = sizes[small] / CELLS_PER_GEOMETRY;
+    }
+}
+
+bool VisibilityCache::matches( const Scene& scene ) const
+{
+    return key == scene_key( scene );
+}
+
+bool VisibilityCache::find_cell( const Vector3& pos, const Vector3& normal, Entry* entry ) const
+{
+    if ( cell_size <= 0.0 )
+        return false;
+
+    for ( size_t a = 0; a < 3; ++a ) {
+        real_t c = floor( pos[a] / cell_size );
+        if ( !( c > INT_MIN && c < INT_MAX ) )
+            return false;
+        entry->cell[a] = static_cast< int >( c );
+    }
+
+    size_t axis = 0;
+    for ( size_t a = 1; a < 3; ++a ) {
+        if ( fabs( normal[a] ) > fabs( normal[axis] ) )
+            axis = a;
+    }
+    entry->facing = 2 * axis + ( normal[axis] < 0.0 ? 1 : 0 );
+    return true;
+}
+
+void VisibilityCache::record( const Vector3& pos, const Vector3& normal, unsigned int light, bool shadowed )
+{
+    Entry entry;
+    if ( !find_cell( pos, normal, &entry ) )
+        return;
+    entry.light = light;
+    entry.lit = shadowed ? 0 : 1;
+    entry.shadowed = shadowed ? 1 : 0;
+    recorded.push_back( entry );
+    // combine as it goes so a long bake doesn't hold every ray it traced,
+    // but leave them out of the entries until finish_bake
+    if ( recorded.size() - num_combined >= MAX_RECORDED )
+        combine_recorded();
+}
+
+void VisibilityCache::combine_recorded()
+{
+    // only the new rays need sorting, the combined ones are merged in
+    EntryList::iterator middle = recorded.begin() + num_combined;
+    std::sort( middle, recorded.end() );
+    std::inplace_merge( recorded.begin(), middle, recorded.end() );
+
+    EntryList::iterator last = recorded.begin();
+    for ( EntryList::const_iterator r = recorded.begin(); r != recorded.end(); ++r ) {
+        if ( r == recorded.begin() ) {
+            continue;
+        } else if ( !( *last < *r ) ) {
+            last->lit += r->lit;
+            last->shadowed += r->shadowed;
+        } else {
+            *++last = *r;
+        }
+    }
+    if ( !recorded.empty() )
+        recorded.erase( last + 1, recorded.end() );
+    num_combined = recorded.size();
+}
+
+void VisibilityCache::finish_bake()
+{
+    if ( recorded.empty() )
+        return;
+
+    // merge the combined recorded rays and entries, summing equal pairs
+    combine_recorded();
+    EntryList merged;
+    merged.reserve( entries.size() + recorded.size() );
+    EntryList::const_iterator e = entries.begin();
+    EntryList::const_iterator r = recorded.begin();
+    while ( e != entries.end() || r != recorded.end() ) {
+        Entry next;
+        if ( r == recorded.end() || ( e != entries.end() && !( *r < *e ) ) ) {
+            next = *e++;
+        } else {
+            next = *r++;
+        }
+
+        if ( !merged.empty() && !( merged.back() < next ) ) {
+            merged.back().lit += next.lit;
+            merged.back().shadowed += next.shadowed;
+        } else {
+            merged.push_back( next );
+        }
+    }
+
+    merged.swap( entries );
+    EntryList().swap( recorded );
+    num_combined = 0;
+}
+
+VisibilityCache::Visibility VisibilityCache::lookup( const Vector3& pos, const Vector3& normal,
+                                                    unsigned int light ) const
+{
+    Entry entry;
+    if ( !find_cell( pos, normal, &entry ) )
+        return UNKNOWN;
+    entry.light = light;
+
+    EntryList::const_iterator i = std::lower_bound( entries.begin(), entries.end(), entry );
+    if ( i == entries.end() || entry < *i )
+        return UNKNOWN;
+    if ( i->shadowed == 0 && i->lit >= MIN_RAYS )
+        return LIT;
+    if ( i->lit == 0 && i->shadowed >= MIN_RAYS )
+        return SHADOWED;
+    return UNKNOWN;
+}
+
+size_t VisibilityCache::num_entries() const
+{
+    return entries.size();
+}
+
+bool VisibilityCache::save( const char* filename ) const
+{
+    std::string tmpname = std::string( filename ) + ".tmp";
+    FILE* fp = fopen( tmpname.c_str(), "wb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    size_t num = entries.size();
+    bool ok = fwrite( MAGIC, sizeof MAGIC, 1, fp ) == 1
+        && fwrite( &VERSION, sizeof VERSION, 1, fp ) == 1
+        && fwrite( &key, sizeof key, 1, fp ) == 1
+        && fwrite( &cell_size, sizeof cell_size, 1, fp ) == 1
+        && fwrite( &num, sizeof num, 1, fp ) == 1
+        && ( num == 0 || fwrite( &entries[0], sizeof( Entry ), num, fp ) == num );
+
+    ok = fclose( fp ) == 0 && ok;
+    if ( !ok ) {
+        remove( tmpname.c_str() );
+        return false;
+    }
+
+#ifdef _WIN32
+    // windows will not rename over an existing file
+    remove( filename );
+#endif
+    return rename( tmpname.c_str(), filename ) == 0;
+}
+
+bool VisibilityCache::load( const char* filename )
+{
+    FILE* fp = fopen( filename, "rb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    char magic[sizeof MAGIC];
+    int version;
+    unsigned int new_key;
+    real_t new_cell_size;
+    size_t num;
+    bool ok = fread( magic, sizeof magic, 1, fp ) == 1
+        && memcmp( magic, MAGIC, sizeof MAGIC ) == 0
+        && fread( &version, sizeof version, 1, fp ) == 1 && version == VERSION
+        && fread( &new_key, sizeof new_key, 1, fp ) == 1
+        && fread( &new_cell_size, sizeof new_cell_size, 1, fp ) == 1
+        && fread( &num, sizeof num, 1, fp ) == 1;
+
+    // read into a scratch list so a truncated file leaves the cache alone
+    EntryList new_entries;
+    if ( ok ) {
+        try {
+            new_entries.resize( num );
+        } catch ( std::exception const& ) {
+            ok = false;
+        }
+    }
+    ok = ok && ( num == 0 || fread( &new_entries[0], sizeof( Entry ), num, fp ) == num );
+    fclose( fp );
+    if ( !ok )
+        return false;
+
+    key = new_key;
+    cell_size = new_cell_size;
+    entries.swap( new_entries );
+    recorded.clear();
+    num_combined = 0;
+    return true;
+}
+
+} /* _462 */
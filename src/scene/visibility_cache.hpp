@@ -0,0 +1,139 @@
+/**
+ * @file visibility_cache.hpp
+ * @brief Baked shadow ray results for re-rendering static scenes.
+ */
+
+#ifndef _462_SCENE_VISIBILITY_CACHE_HPP_
+#define _462_SCENE_VISIBILITY_CACHE_HPP_
+
+#include "scene/bvh.hpp"
+#include <vector>
+
+namespace _462 {
+
+class Scene;
+
+/**
+ * A sparse grid over space recording, for each light, whether the shadow
+ * rays from surfaces in each cell reached it. The cells are a fraction of
+ * the size of the scene's smaller geometries, and surfaces facing different
+ * ways in a cell, like the sides of a corner, are kept apart. It is baked from the
+ * shadow rays of a raytrace. Afterwards it answers shadow rays from cells
+ * where enough baked rays all agreed, so re-rendering the scene from other
+ * views only traces shadow rays near the edges of shadows and where the
+ * bake saw too little.
+ *
+ * A cache is only valid for the scene it was baked from. Its key covers
+ * every light and the transform and bounds of every geometry, so a cache
+ * for a scene where anything but the camera changed no longer matches.
+ */
+class VisibilityCache
+{
+public:
+
+    enum Visibility
+    {
+        // too few or disagreeing baked rays, so trace it
+        UNKNOWN,
+        LIT,
+        SHADOWED
+    };
+
+    VisibilityCache();
+
+    /**
+     * Empties the cache and sets it up to bake scene as it is now. The
+     * scene's geometries must be up to date.
+     */
+    void reset( const Scene& scene );
+
+    // whether the cache was reset or loaded for the scene as it is now
+    bool matches( const Scene& scene ) const;
+
+    // records a shadow ray traced from pos on a surface facing normal
+    // to the light while baking
+    void record( const Vector3& pos, const Vector3& normal, unsigned int light, bool shadowed );
+
+    // adds the rays recorded since the last call to what lookup answers
+    void finish_bake();
+
+    // what the baked rays from surfaces facing like normal in pos's cell to
+    // the light agreed on
+    Visibility lookup( const Vector3& pos, const Vector3& normal, unsigned int light ) const;
+
+    // the number of cell and light pairs lookup can answer
+    size_t num_entries() const;
+
+    /**
+     * Writes the baked entries to filename, through a temporary file so an
+     * interrupted save leaves no truncated cache behind.
+     * @return true on success, false on error.
+     */
+    bool save( const char* filename ) const;
+
+    /**
+     * Replaces the cache with the one in filename.
+     * @return true on success, false if it could not be read.
+     */
+    bool load( const char* filename );
+
+    // cells along the longest side of the tenth percentile geometry's bounds
+    static const unsigned int CELLS_PER_GEOMETRY = 8;
+    // baked rays that must agree before a cell answers for a light
+    static const unsigned int MIN_RAYS = 4;
+    // rays recorded before they are combined with the earlier ones
+    static const size_t MAX_RECORDED = 1 << 20;
+
+private:
+
+    // a cell and light, with what its baked rays found
+    struct Entry
+    {
+        int cell[3];
+        // the axis and sign the surface mostly faces, 0 to 5
+        unsigned int facing;
+        unsigned int light;
+        unsigned int lit;
+        unsigned int shadowed;
+
+        bool operator<( const Entry& rhs ) const {
+            for ( size_t a = 0; a < 3; ++a ) {
+                if ( cell[a] != rhs.cell[a] )
+                    return cell[a] < rhs.cell[a];
+            }
+            if ( facing != rhs.facing )
+                return facing < rhs.facing;
+            return light < rhs.light;
+        }
+    };
+
+    typedef std::vector< Entry > EntryList;
+
+    /**
+     * Fills in the cell containing pos and the facing of normal.
+     * @return false if the grid is empty or pos is too far out for it.
+     */
+    bool find_cell( const Vector3& pos, const Vector3& normal, Entry* entry ) const;
+
+    // sorts the rays recorded since the last call into the combined ones,
+    // summing those of the same cell and light
+    void combine_recorded();
+
+    // the key of the scene's lights and geometries
+    static unsigned int scene_key( const Scene& scene );
+
+    unsigned int key;
+    // the width of the cells, 0 for an empty grid
+    real_t cell_size;
+    // sorted, each answering for its cell and light
+    EntryList entries;
+    // the rays recorded since the last finish_bake, which lookup never
+    // reads. the first num_combined are sorted with equal pairs summed,
+    // and the rest one entry per ray.
+    EntryList recorded;
+    size_t num_combined;
+};
+
+} /* _462 */
+
+#endif /* _462_SCENE_VISIBILITY_CACHE_HPP_ */
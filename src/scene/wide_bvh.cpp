@@ -0,0 +1,151 @@
+/**
+ * @file wide_bvh.cpp
+ * @brief Four-wide bounding volume hierarchy with SIMD box tests.
+ */
+
+#include "scene/wide_bvh.hpp"
+
+#include <cmath>
+
+namespace _462 {
+
+// boxes are grown by this fraction of the root's largest coordinate,
+// which covers rounding the boxes and rays to floats
+#define FLOAT_PAD 4e-6
+
+/**
+ * Adds the node collapsing the interior node src_index of the source tree
+ * and its descendants, up to WIDTH children, then the nodes below them.
+ * @return The index of the new node.
+ */
+static unsigned int collapse_node( const Bvh::Node* src_nodes, unsigned int src_index, real_t pad,
+                                   std::vector< WideBvh::Node >* nodes )
+{
+    unsigned int index = nodes->size();
+    nodes->push_back( WideBvh::Node() );
+
+    unsigned int children[WideBvh::WIDTH];
+    size_t num_children = 2;
+    children[0] = src_index + 1;
+    children[1] = src_nodes[src_index].offset;
+
+    // open the largest interior child until the node is full
+    while ( num_children < WideBvh::WIDTH ) {
+        size_t largest = num_children;
+        real_t largest_area = -1.0;
+        for ( size_t i = 0; i < num_children; ++i ) {
+            const Bvh::Node& child = src_nodes[children[i]];
+            if ( child.count == 0 && child.bounds.surface_area() > largest_area ) {
+                largest = i;
+                largest_area = child.bounds.surface_area();
+            }
+        }
+        if ( largest == num_children )
+            break;
+
+        unsigned int opened = children[largest];
+        children[largest] = opened + 1;
+        children[num_children++] = src_nodes[opened].offset;
+    }
+
+    WideBvh::Node node;
+    for ( size_t i = 0; i < WideBvh::WIDTH; ++i ) {
+        if ( i >= num_children ) {
+            for ( size_t a = 0; a < 3; ++a ) {
+                node.min[a][i] = std::numeric_limits< float >::max();
+                node.max[a][i] = std::numeric_limits< float >::max();
+            }
+            node.child[i] = 0;
+            node.count[i] = 0;
+            continue;
+        }
+
+        const Bvh::Node& child = src_nodes[children[i]];
+        for ( size_t a = 0; a < 3; ++a ) {
+            // float rounding is well under the pad, so these round outward
+            node.min[a][i] = static_cast< float >( child.bounds.min[a] - pad );
+            node.max[a][i] = static_cast< float >( child.bounds.max[a] + pad );
+        }
+        if ( child.count > 0 ) {
+            node.child[i] = child.offset;
+            node.count[i] = child.count;
+        } else {
+            node.child[i] = collapse_node( src_nodes, children[i], pad, nodes );
+            node.count[i] = 0;
+        }
+    }
+
+    ( *nodes )[index] = node;
+    return index;
+}
+
+WideBvh::WideBvh() { }
+
+void WideBvh::build( const Bvh& bvh )
+{
+    clear();
+    if ( bvh.empty() )
+        return;
+
+    const Bvh::Node* src_nodes = bvh.get_nodes();
+    indices.assign( bvh.get_indices(), bvh.get_indices() + bvh.num_primitives() );
+    bounds = bvh.get_bounds();
+    nodes.reserve( bvh.num_nodes() / ( WIDTH - 1 ) + 1 );
+
+    real_t largest = 0.0;
+    for ( size_t a = 0; a < 3; ++a ) {
+        largest = std::max( largest, std::max( fabs( bounds.min[a] ), fabs( bounds.max[a] ) ) );
+    }
+    real_t pad = FLOAT_PAD * largest + 1e-30;
+
+    if ( src_nodes[0].count > 0 ) {
+        // a single leaf still needs a node to hold it
+        Node node;
+        for ( size_t i = 0; i < WIDTH; ++i ) {
+            for ( size_t a = 0; a < 3; ++a ) {
+                node.min[a][i] = static_cast< float >( bounds.min[a] - pad );
+                node.max[a][i] = static_cast< float >( bounds.max[a] + pad );
+            }
+            node.child[i] = 0;
+            node.count[i] = 0;
+        }
+        node.child[0] = src_nodes[0].offset;
+        node.count[0] = src_nodes[0].count;
+        nodes.push_back( node );
+    } else {
+        collapse_node( src_nodes, 0, pad, &nodes );
+    }
+
+    // give back what the reserve over-estimated
+    NodeList( nodes ).swap( nodes );
+}
+
+void WideBvh::clear()
+{
+    // swap rather than clear to give back the memory
+    NodeList().swap( nodes );
+    IndexList().swap( indices );
+    bounds = BoundingBox();
+}
+
+bool WideBvh::empty() const
+{
+    return nodes.empty();
+}
+
+size_t WideBvh::num_nodes() const
+{
+    return nodes.size();
+}
+
+BoundingBox WideBvh::get_bounds() const
+{
+    return bounds;
+}
+
+size_t WideBvh::memory_size() const
+{
+    return nodes.capacity() * sizeof( Node ) + indices.capacity() * sizeof( unsigned int );
+}
+
+} /* _462 */
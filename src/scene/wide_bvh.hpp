@@ -0,0 +1,233 @@
+/**
+ * @file wide_bvh.hpp
+ * @brief Four-wide bounding volume hierarchy with SIMD box tests.
+ */
+
+#ifndef _462_SCENE_WIDE_BVH_HPP_
+#define _462_SCENE_WIDE_BVH_HPP_
+
+#include "scene/bvh.hpp"
+
+// test all four child boxes at once where SSE is available
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#define _462_WIDE_BVH_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace _462 {
+
+/**
+ * A read-only copy of a Bvh collapsed to four children per node. The
+ * children's boxes are stored as floats, one axis of all four side by
+ * side, so a ray is tested against all of them in a few SSE operations.
+ * The boxes are grown slightly when rounded to floats, so rays still
+ * reach every primitive they reached in the source tree.
+ */
+class WideBvh
+{
+public:
+
+    static const unsigned int WIDTH = 4;
+
+    struct Node
+    {
+        // the children's boxes, one axis of every child per array
+        float min[3][WIDTH];
+        float max[3][WIDTH];
+        // index of a node child, or the first primitive of a leaf child.
+        // 0 with a count of 0 means no child.
+        unsigned int child[WIDTH];
+        // number of primitives in a leaf child, 0 for a node or no child
+        unsigned int count[WIDTH];
+    };
+
+    WideBvh();
+
+    // replaces this tree with a copy of bvh
+    void build( const Bvh& bvh );
+
+    void clear();
+
+    bool empty() const;
+    size_t num_nodes() const;
+    BoundingBox get_bounds() const;
+    // bytes used by the nodes and primitive indices
+    size_t memory_size() const;
+
+    /**
+     * Visits each primitive whose leaf box the ray enters within
+     * [0, *tmax], like Bvh::traverse. Children are visited near to far.
+     * @return true if the visitor stopped the traversal.
+     */
+    template< typename Visitor >
+    bool traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                   TraversalStats* stats = 0 ) const;
+
+    // each node on the stack pushes at most WIDTH more
+    static const unsigned int MAX_STACK = ( WIDTH - 1 ) * Bvh::MAX_DEPTH + 1;
+
+private:
+
+    // a ray moved to where it enters the root, in floats
+    struct Ray
+    {
+        float origin[3];
+        float inv_dir[3];
+#ifdef _462_WIDE_BVH_SSE
+        __m128 sse_origin[3];
+        __m128 sse_inv_dir[3];
+#endif
+    };
+
+    /**
+     * Tests the ray against the boxes of all children of node.
+     * @param tenter Set to where the ray enters each child hit.
+     * @return A mask with bit i set if child i was hit within [0, tmax].
+     */
+    static unsigned int intersect_children( const Node& node, const Ray& ray, float tmax, float* tenter );
+
+    // the ray segment [0, tmax] after moving the ray forward by tstart,
+    // rounded up to a float
+    static float shifted_tmax( real_t tmax, real_t tstart );
+
+    typedef std::vector< Node > NodeList;
+    typedef std::vector< unsigned int > IndexList;
+
+    NodeList nodes;
+    IndexList indices;
+    // the root has no parent to hold its box, so keep it at full precision
+    BoundingBox bounds;
+};
+
+inline unsigned int WideBvh::intersect_children( const Node& node, const Ray& ray, float tmax, float* tenter )
+{
+#ifdef _462_WIDE_BVH_SSE
+    __m128 tnear = _mm_setzero_ps();
+    __m128 tfar = _mm_set1_ps( tmax );
+    for ( size_t a = 0; a < 3; ++a ) {
+        __m128 t0 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( node.min[a] ), ray.sse_origin[a] ), ray.sse_inv_dir[a] );
+        __m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( node.max[a] ), ray.sse_origin[a] ), ray.sse_inv_dir[a] );
+        tnear = _mm_max_ps( tnear, _mm_min_ps( t0, t1 ) );
+        tfar = _mm_min_ps( tfar, _mm_max_ps( t0, t1 ) );
+    }
+    _mm_storeu_ps( tenter, tnear );
+    return _mm_movemask_ps( _mm_cmple_ps( tnear, tfar ) );
+#else
+    unsigned int mask = 0;
+    for ( size_t i = 0; i < WIDTH; ++i ) {
+        float tnear = 0.0f;
+        float tfar = tmax;
+        for ( size_t a = 0; a < 3; ++a ) {
+            float t0 = ( node.min[a][i] - ray.origin[a] ) * ray.inv_dir[a];
+            float t1 = ( node.max[a][i] - ray.origin[a] ) * ray.inv_dir[a];
+            tnear = std::max( tnear, std::min( t0, t1 ) );
+            tfar = std::min( tfar, std::max( t0, t1 ) );
+        }
+        tenter[i] = tnear;
+        if ( tnear <= tfar )
+            mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+inline float WideBvh::shifted_tmax( real_t tmax, real_t tstart )
+{
+    real_t t = tmax - tstart;
+    // stay finite, the segment only needs to reach past the root
+    if ( t > std::numeric_limits< float >::max() / 2 )
+        return std::numeric_limits< float >::max();
+    return static_cast< float >( t * ( 1.0 + 1e-6 ) );
+}
+
+template< typename Visitor >
+bool WideBvh::traverse( const Vector3& origin, const Vector3& dir, real_t* tmax, Visitor& visitor,
+                        TraversalStats* stats ) const
+{
+    if ( nodes.empty() )
+        return false;
+
+    Vector3 inv_dir( 1.0 / dir.x, 1.0 / dir.y, 1.0 / dir.z );
+    real_t tstart;
+    if ( !bounds.intersect_ray( origin, inv_dir, *tmax, &tstart ) )
+        return false;
+
+    // rounding a far away origin to floats would lose more than the boxes
+    // were grown by, so start the ray where it enters the root
+    Ray ray;
+    Vector3 start = origin + dir * tstart;
+    for ( size_t a = 0; a < 3; ++a ) {
+        static const real_t MAX_INV_DIR = 1e30;
+        ray.origin[a] = static_cast< float >( start[a] );
+        // a zero component gives an infinite inverse, which times zero
+        // would be a NaN. a huge finite one works the same otherwise.
+        ray.inv_dir[a] = static_cast< float >( std::max( -MAX_INV_DIR, std::min( MAX_INV_DIR, inv_dir[a] ) ) );
+#ifdef _462_WIDE_BVH_SSE
+        ray.sse_origin[a] = _mm_set1_ps( ray.origin[a] );
+        ray.sse_inv_dir[a] = _mm_set1_ps( ray.inv_dir[a] );
+#endif
+    }
+    float ftmax = shifted_tmax( *tmax, tstart );
+
+    // both nodes and leaves go on the stack, nearest on top. leaves have
+    // a count, and all keep where the ray enters them so any *tmax has
+    // since moved in front of can be skipped.
+    unsigned int stack[MAX_STACK];
+    unsigned int stack_count[MAX_STACK];
+    float stack_enter[MAX_STACK];
+    size_t top = 0;
+    stack[top] = 0;
+    stack_count[top] = 0;
+    stack_enter[top++] = 0.0f;
+
+    while ( top > 0 ) {
+        --top;
+        if ( stack_enter[top] > ftmax )
+            continue;
+
+        if ( stack_count[top] > 0 ) {
+            unsigned int first = stack[top];
+            for ( unsigned int i = first; i < first + stack_count[top]; ++i ) {
+                if ( stats )
+                    ++stats->primitives;
+                if ( visitor( indices[i], tmax ) )
+                    return true;
+            }
+            ftmax = shifted_tmax( *tmax, tstart );
+            continue;
+        }
+
+        const Node& node = nodes[stack[top]];
+        if ( stats ) {
+            ++stats->nodes;
+            stats->fetch( &node, sizeof node );
+        }
+        float tenter[WIDTH];
+        unsigned int mask = intersect_children( node, ray, ftmax, tenter );
+
+        // sort the children hit far to near, then push them in that order
+        unsigned int hits[WIDTH];
+        size_t num_hits = 0;
+        for ( unsigned int i = 0; i < WIDTH; ++i ) {
+            if ( !( mask & ( 1 << i ) ) || ( node.count[i] == 0 && node.child[i] == 0 ) )
+                continue;
+            size_t j = num_hits++;
+            for ( ; j > 0 && tenter[hits[j - 1]] < tenter[i]; --j ) {
+                hits[j] = hits[j - 1];
+            }
+            hits[j] = i;
+        }
+        for ( size_t j = 0; j < num_hits; ++j ) {
+            unsigned int i = hits[j];
+            stack[top] = node.child[i];
+            stack_count[top] = node.count[i];
+            stack_enter[top++] = tenter[i];
+        }
+    }
+
+    return false;
+}
+
+} /* _462 */
+
+#endif /* _462_SCENE_WIDE_BVH_HPP_ */